@@ -20,6 +20,7 @@ extern "C" {
 #endif
 
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <stdint.h>
 #include <openssl/ossl_typ.h>
 
@@ -51,6 +52,21 @@ struct s2n_config;
 
 extern int s2n_init(void);
 extern int s2n_cleanup(void);
+
+typedef int (*s2n_mem_init_callback)(void);
+typedef int (*s2n_mem_cleanup_callback)(void);
+typedef int (*s2n_mem_malloc_callback)(void **ptr, uint32_t requested, uint32_t *allocated);
+typedef int (*s2n_mem_free_callback)(void *ptr, uint32_t size);
+extern int s2n_mem_set_callbacks(s2n_mem_init_callback mem_init_callback, s2n_mem_cleanup_callback mem_cleanup_callback,
+                                 s2n_mem_malloc_callback mem_malloc_callback, s2n_mem_free_callback mem_free_callback);
+
+typedef enum {
+    S2N_MLOCK_ALL,
+    S2N_MLOCK_SECRETS_ONLY,
+    S2N_MLOCK_NONE
+} s2n_mlock_policy;
+extern int s2n_mem_set_mlock_policy(s2n_mlock_policy policy);
+
 extern struct s2n_config *s2n_config_new(void);
 extern int s2n_config_free(struct s2n_config *config);
 extern int s2n_config_free_dhparams(struct s2n_config *config);
@@ -112,6 +128,21 @@ extern void *s2n_connection_get_ctx(struct s2n_connection *conn);
 typedef int s2n_client_hello_fn(struct s2n_connection *conn, void *ctx);
 extern int s2n_config_set_client_hello_cb(struct s2n_config *config, s2n_client_hello_fn client_hello_callback, void *ctx);
 
+struct s2n_async_pkey_op;
+typedef enum { S2N_ASYNC_DECRYPT, S2N_ASYNC_SIGN } s2n_async_pkey_op_type;
+typedef int (*s2n_async_pkey_fn)(struct s2n_connection *conn, struct s2n_async_pkey_op *op);
+extern int s2n_config_set_async_pkey_callback(struct s2n_config *config, s2n_async_pkey_fn fn);
+extern int s2n_async_pkey_op_get_op_type(struct s2n_async_pkey_op *op, s2n_async_pkey_op_type *type);
+extern int s2n_async_pkey_op_perform(struct s2n_async_pkey_op *op);
+extern int s2n_async_pkey_op_apply(struct s2n_async_pkey_op *op, struct s2n_connection *conn);
+extern int s2n_async_pkey_op_free(struct s2n_async_pkey_op *op);
+
+extern int s2n_config_add_cert_chain_and_key_server(struct s2n_config *config, const char *cert_chain_pem, const char *key_server_path);
+extern int s2n_config_get_key_server_fd(struct s2n_config *config, int *fd);
+extern int s2n_config_key_server_service(struct s2n_config *config);
+
+extern int s2n_config_set_ephemeral_key_pool(struct s2n_config *config, uint32_t size, uint32_t threads);
+
 struct s2n_client_hello;
 extern struct s2n_client_hello *s2n_connection_get_client_hello(struct s2n_connection *conn);
 extern uint32_t s2n_client_hello_get_raw_message_length(struct s2n_client_hello *ch);
@@ -135,6 +166,10 @@ extern int s2n_connection_set_send_cb(struct s2n_connection *conn, s2n_send_fn s
 
 extern int s2n_connection_prefer_throughput(struct s2n_connection *conn);
 extern int s2n_connection_prefer_low_latency(struct s2n_connection *conn);
+extern int s2n_connection_set_dynamic_record_threshold(struct s2n_connection *conn, uint32_t resize_threshold, uint16_t timeout_threshold);
+extern int s2n_connection_set_send_buffer_size(struct s2n_connection *conn, uint32_t size);
+extern int s2n_connection_set_read_ahead(struct s2n_connection *conn, uint32_t size);
+extern int s2n_connection_release_buffers(struct s2n_connection *conn);
 
 /* If you don't want to use the configuration wide callback, you can set this per connection and it will be honored. */
 extern int s2n_connection_set_verify_host_callback(struct s2n_connection *config, s2n_verify_host_fn host_fn, void *data);
@@ -149,13 +184,32 @@ extern const char *s2n_get_application_protocol(struct s2n_connection *conn);
 extern const uint8_t *s2n_connection_get_ocsp_response(struct s2n_connection *conn, uint32_t *length);
 extern const uint8_t *s2n_connection_get_sct_list(struct s2n_connection *conn, uint32_t *length);
 
-typedef enum { S2N_NOT_BLOCKED = 0, S2N_BLOCKED_ON_READ, S2N_BLOCKED_ON_WRITE } s2n_blocked_status;
+typedef enum { S2N_NOT_BLOCKED = 0, S2N_BLOCKED_ON_READ, S2N_BLOCKED_ON_WRITE, S2N_BLOCKED_ON_APPLICATION } s2n_blocked_status;
 extern int s2n_negotiate(struct s2n_connection *conn, s2n_blocked_status *blocked);
 extern ssize_t s2n_send(struct s2n_connection *conn, const void *buf, ssize_t size, s2n_blocked_status *blocked);
+extern ssize_t s2n_sendv(struct s2n_connection *conn, const struct iovec *bufs, int count, s2n_blocked_status *blocked);
+extern ssize_t s2n_sendfile(struct s2n_connection *conn, int fd, off_t offset, size_t count, s2n_blocked_status *blocked);
 extern ssize_t s2n_recv(struct s2n_connection *conn,  void *buf, ssize_t size, s2n_blocked_status *blocked);
+extern uint32_t s2n_peek(struct s2n_connection *conn);
+extern int s2n_recv_borrow(struct s2n_connection *conn, const uint8_t **data, size_t *len, s2n_blocked_status *blocked);
+extern int s2n_recv_release(struct s2n_connection *conn, size_t consumed);
+
+extern int s2n_connection_enable_ktls(struct s2n_connection *conn);
+extern int s2n_connection_is_ktls_send_enabled(struct s2n_connection *conn);
+extern int s2n_connection_is_ktls_recv_enabled(struct s2n_connection *conn);
 
 extern int s2n_connection_wipe(struct s2n_connection *conn);
 extern int s2n_connection_free(struct s2n_connection *conn);
+
+struct s2n_connection_pool;
+extern struct s2n_connection_pool *s2n_connection_pool_new(s2n_mode mode, uint32_t capacity);
+extern int s2n_connection_pool_free(struct s2n_connection_pool *pool);
+extern struct s2n_connection *s2n_connection_pool_get(struct s2n_connection_pool *pool);
+extern int s2n_connection_pool_put(struct s2n_connection_pool *pool, struct s2n_connection *conn);
+extern uint32_t s2n_connection_pool_get_available(struct s2n_connection_pool *pool);
+extern uint64_t s2n_connection_pool_get_hits(struct s2n_connection_pool *pool);
+extern uint64_t s2n_connection_pool_get_misses(struct s2n_connection_pool *pool);
+
 extern int s2n_shutdown(struct s2n_connection *conn, s2n_blocked_status *blocked);
 
 typedef enum { S2N_CERT_AUTH_NONE, S2N_CERT_AUTH_REQUIRED, S2N_CERT_AUTH_OPTIONAL } s2n_cert_auth_type;
@@ -191,6 +245,7 @@ extern int s2n_cert_public_key_set_rsa_from_openssl(s2n_cert_public_key *cert_pu
 
 extern uint64_t s2n_connection_get_wire_bytes_in(struct s2n_connection *conn);
 extern uint64_t s2n_connection_get_wire_bytes_out(struct s2n_connection *conn);
+extern uint32_t s2n_connection_get_buffered_bytes_in(struct s2n_connection *conn);
 extern int s2n_connection_get_client_protocol_version(struct s2n_connection *conn);
 extern int s2n_connection_get_server_protocol_version(struct s2n_connection *conn);
 extern int s2n_connection_get_actual_protocol_version(struct s2n_connection *conn);
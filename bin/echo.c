@@ -42,6 +42,11 @@ int negotiate(struct s2n_connection *conn)
     s2n_blocked_status blocked;
     do {
         if (s2n_negotiate(conn, &blocked) < 0) {
+            /* In keyless mode s2n_negotiate picks up the key server's answer when called again */
+            if (blocked == S2N_BLOCKED_ON_APPLICATION && s2n_error_get_type(s2n_errno) == S2N_ERR_T_BLOCKED) {
+                poll(NULL, 0, 1);
+                continue;
+            }
             fprintf(stderr, "Failed to negotiate: '%s' %d\n", s2n_strerror(s2n_errno, "EN"), s2n_connection_get_alert(conn));
             return -1;
         }
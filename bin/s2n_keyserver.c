@@ -0,0 +1,358 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/* A reference key server for s2n's keyless mode. It holds an RSA private key
+ * and answers the sign and decrypt requests that s2n servers send it over a
+ * Unix socket. See tls/s2n_key_server.h for the wire format.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <getopt.h>
+
+#include <errno.h>
+
+#include <openssl/objects.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+
+#define OP_SIGN                     1
+#define OP_DECRYPT                  2
+
+#define STATUS_OK                   0
+#define STATUS_FAILED               1
+
+#define REQUEST_HEADER_LENGTH       8
+#define RESPONSE_HEADER_LENGTH      7
+
+#define MAX_CLIENTS                 32
+#define MAX_MESSAGE_LENGTH          (RESPONSE_HEADER_LENGTH + 0xffff)
+#define BUFFER_SIZE                 (2 * MAX_MESSAGE_LENGTH)
+
+struct client {
+    int fd;
+
+    /* Requests that have been read, and responses waiting to be written */
+    uint8_t in[BUFFER_SIZE];
+    uint32_t in_length;
+    uint8_t out[BUFFER_SIZE];
+    uint32_t out_length;
+};
+
+static struct client clients[MAX_CLIENTS];
+static RSA *rsa;
+
+void usage()
+{
+    fprintf(stderr, "usage: s2n_keyserver [options] socket_path\n");
+    fprintf(stderr, " socket_path: path of the Unix socket to listen on\n");
+    fprintf(stderr, "\n Options:\n\n");
+    fprintf(stderr, "  -k,--key [file path]\n");
+    fprintf(stderr, "    Path to the PEM encoded RSA private key to serve. Required.\n");
+    fprintf(stderr, "  -h,--help\n");
+    fprintf(stderr, "    Display this message and quit.\n");
+
+    exit(1);
+}
+
+static int hash_to_nid(uint8_t hash)
+{
+    switch (hash) {
+    case 0:
+        return NID_md5_sha1;
+    case 1:
+        return NID_md5;
+    case 2:
+        return NID_sha1;
+    case 3:
+        return NID_sha224;
+    case 4:
+        return NID_sha256;
+    case 5:
+        return NID_sha384;
+    case 6:
+        return NID_sha512;
+    default:
+        return NID_undef;
+    }
+}
+
+static uint32_t read_uint32(const uint8_t *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static uint16_t read_uint16(const uint8_t *p)
+{
+    return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+/* Do the operation, and queue its response behind any others for the same client */
+static void handle_request(struct client *client, uint32_t id, uint8_t op, uint8_t hash, const uint8_t *data, uint16_t length)
+{
+    uint8_t *response = client->out + client->out_length;
+    uint8_t *result = response + RESPONSE_HEADER_LENGTH;
+    int result_length = -1;
+
+    if (op == OP_SIGN && hash_to_nid(hash) != NID_undef) {
+        unsigned int signature_length = 0;
+        if (RSA_sign(hash_to_nid(hash), data, length, result, &signature_length, rsa) == 1) {
+            result_length = signature_length;
+        }
+    } else if (op == OP_DECRYPT) {
+        result_length = RSA_private_decrypt(length, data, result, rsa, RSA_PKCS1_PADDING);
+    }
+
+    uint8_t status = STATUS_OK;
+    if (result_length < 0) {
+        status = STATUS_FAILED;
+        result_length = 0;
+    }
+
+    response[0] = (id >> 24) & 0xff;
+    response[1] = (id >> 16) & 0xff;
+    response[2] = (id >> 8) & 0xff;
+    response[3] = id & 0xff;
+    response[4] = status;
+    response[5] = (result_length >> 8) & 0xff;
+    response[6] = result_length & 0xff;
+
+    client->out_length += RESPONSE_HEADER_LENGTH + result_length;
+}
+
+static void close_client(struct client *client)
+{
+    close(client->fd);
+    client->fd = -1;
+    client->in_length = 0;
+    client->out_length = 0;
+}
+
+/* Answer every complete request that has been read. The responses go back
+ * in as few writes as the socket allows.
+ */
+static int handle_requests(struct client *client)
+{
+    uint32_t consumed = 0;
+
+    while (client->in_length - consumed >= REQUEST_HEADER_LENGTH) {
+        const uint8_t *request = client->in + consumed;
+        uint16_t length = read_uint16(request + 6);
+        if (client->in_length - consumed < REQUEST_HEADER_LENGTH + length) {
+            break;
+        }
+
+        /* Leave the rest for when the client has taken some responses */
+        if (BUFFER_SIZE - client->out_length < MAX_MESSAGE_LENGTH) {
+            break;
+        }
+
+        handle_request(client, read_uint32(request), request[4], request[5], request + REQUEST_HEADER_LENGTH, length);
+        consumed += REQUEST_HEADER_LENGTH + length;
+    }
+
+    memmove(client->in, client->in + consumed, client->in_length - consumed);
+    client->in_length -= consumed;
+
+    while (client->out_length) {
+        ssize_t w = write(client->fd, client->out, client->out_length);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+
+        memmove(client->out, client->out + w, client->out_length - w);
+        client->out_length -= w;
+    }
+
+    return 0;
+}
+
+static void accept_client(int listener)
+{
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+        fprintf(stderr, "accept error: %s\n", strerror(errno));
+        return;
+    }
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].fd < 0) {
+            clients[i].fd = fd;
+            return;
+        }
+    }
+
+    fprintf(stderr, "Too many clients, dropping one\n");
+    close(fd);
+}
+
+int main(int argc, char *const *argv)
+{
+    const char *socket_path = NULL;
+    const char *private_key_file_path = NULL;
+
+    struct option long_options[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"key", required_argument, NULL, 'k'},
+        /* Per getopt(3) the last element of the array has to be filled with all zeros */
+        { 0 },
+    };
+    while (1) {
+        int option_index = 0;
+        int c = getopt_long(argc, argv, "hk:", long_options, &option_index);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+        case 'k':
+            private_key_file_path = optarg;
+            break;
+        case 'h':
+        case '?':
+        default:
+            usage();
+            break;
+        }
+    }
+
+    if (optind < argc) {
+        socket_path = argv[optind++];
+    }
+
+    if (!socket_path || !private_key_file_path) {
+        usage();
+    }
+
+    FILE *key_file = fopen(private_key_file_path, "r");
+    if (key_file == NULL) {
+        fprintf(stderr, "Error opening private key file: '%s'\n", strerror(errno));
+        exit(1);
+    }
+    rsa = PEM_read_RSAPrivateKey(key_file, NULL, NULL, NULL);
+    fclose(key_file);
+    if (rsa == NULL) {
+        fprintf(stderr, "Error reading RSA private key from '%s'\n", private_key_file_path);
+        exit(1);
+    }
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+        fprintf(stderr, "Error disabling SIGPIPE\n");
+        exit(1);
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path is too long: '%s'\n", socket_path);
+        exit(1);
+    }
+    memcpy(addr.sun_path, socket_path, strlen(socket_path) + 1);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        fprintf(stderr, "socket error: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    /* Only the owner gets to ask for signatures */
+    unlink(socket_path);
+    mode_t old_umask = umask(077);
+    if (bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "bind error: %s\n", strerror(errno));
+        exit(1);
+    }
+    umask(old_umask);
+
+    if (listen(listener, MAX_CLIENTS) < 0) {
+        fprintf(stderr, "listen error: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+
+    printf("Listening on %s\n", socket_path);
+
+    while (1) {
+        struct pollfd fds[MAX_CLIENTS + 1];
+        struct client *polled[MAX_CLIENTS + 1];
+        int nfds = 0;
+
+        fds[nfds].fd = listener;
+        fds[nfds].events = POLLIN;
+        polled[nfds++] = NULL;
+
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            if (clients[i].fd >= 0) {
+                fds[nfds].fd = clients[i].fd;
+                fds[nfds].events = clients[i].out_length ? POLLIN | POLLOUT : POLLIN;
+                polled[nfds++] = &clients[i];
+            }
+        }
+
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "poll error: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        if (fds[0].revents & POLLIN) {
+            accept_client(listener);
+        }
+
+        for (int i = 1; i < nfds; i++) {
+            struct client *client = polled[i];
+            if (fds[i].revents == 0) {
+                continue;
+            }
+
+            /* A full buffer is left alone until the client takes its responses */
+            if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && client->in_length < BUFFER_SIZE) {
+                ssize_t r = read(client->fd, client->in + client->in_length, BUFFER_SIZE - client->in_length);
+                if (r <= 0 && !(r < 0 && (errno == EINTR || errno == EAGAIN))) {
+                    close_client(client);
+                    continue;
+                }
+                if (r > 0) {
+                    client->in_length += r;
+                }
+            }
+
+            if (handle_requests(client) < 0) {
+                close_client(client);
+            }
+        }
+    }
+
+    return 0;
+}
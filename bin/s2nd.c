@@ -300,6 +300,8 @@ void usage()
     fprintf(stderr, "    Path to a PEM encoded certificate [chain]\n");
     fprintf(stderr, "  --key\n");
     fprintf(stderr, "    Path to a PEM encoded private key that matches cert.\n");
+    fprintf(stderr, "  --key-server [socket path]\n");
+    fprintf(stderr, "    Keyless mode: use the private key held by the s2n_keyserver listening on this Unix socket instead of --key.\n");
     fprintf(stderr, "  -m\n");
     fprintf(stderr, "  --mutualAuth\n");
     fprintf(stderr, "    Request a Client Certificate. Any RSA Certificate will be accepted.\n");
@@ -439,6 +441,7 @@ int main(int argc, char *const *argv)
 
     const char *certificate_chain_file_path = NULL;
     const char *private_key_file_path = NULL;
+    const char *key_server_path = NULL;
     const char *ocsp_response_file_path = NULL;
     const char *cipher_prefs = "default";
     struct conn_settings conn_settings = { 0 };
@@ -451,6 +454,7 @@ int main(int argc, char *const *argv)
         {"enter-fips-mode", no_argument, NULL, 'f'},
         {"help", no_argument, NULL, 'h'},
         {"key", required_argument, NULL, 'k'},
+        {"key-server", required_argument, NULL, 'K'},
         {"prefer-low-latency", no_argument, NULL, 'l'},
         {"mutualAuth", no_argument, NULL, 'm'},
         {"negotiate", no_argument, NULL, 'n'},
@@ -491,6 +495,9 @@ int main(int argc, char *const *argv)
         case 'k':
             private_key_file_path = optarg;
             break;
+        case 'K':
+            key_server_path = optarg;
+            break;
         case 'l':
             conn_settings.prefer_low_latency = 1;
             break;
@@ -644,7 +651,12 @@ int main(int argc, char *const *argv)
         private_key = default_private_key;
     }
 
-    if (s2n_config_add_cert_chain_and_key(config, certificate_chain, private_key) < 0) {
+    if (key_server_path) {
+        if (s2n_config_add_cert_chain_and_key_server(config, certificate_chain, key_server_path) < 0) {
+            print_s2n_error("Error getting certificate/key server");
+            exit(1);
+        }
+    } else if (s2n_config_add_cert_chain_and_key(config, certificate_chain, private_key) < 0) {
         print_s2n_error("Error getting certificate/key");
         exit(1);
     }
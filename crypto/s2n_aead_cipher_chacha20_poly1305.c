@@ -77,7 +77,8 @@ static int s2n_aead_chacha20_poly1305_decrypt(struct s2n_session_key *key, struc
 {
 #ifdef S2N_CHACHA20_POLY1305_AVAILABLE
     gte_check(in->size, S2N_TLS_CHACHA20_POLY1305_TAG_LEN);
-    gte_check(out->size, in->size);
+    /* Only the plaintext is written out, the tag stays where it is */
+    gte_check(out->size, in->size - S2N_TLS_CHACHA20_POLY1305_TAG_LEN);
     eq_check(iv->size, S2N_TLS_CHACHA20_POLY1305_IV_LEN);
 
     /* Initialize the IV */
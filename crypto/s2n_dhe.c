@@ -187,9 +187,6 @@ int s2n_dh_params_to_p_g_Ys(struct s2n_dh_params *server_dh_params, struct s2n_s
     uint8_t *g;
     uint8_t *Ys;
 
-    output->data = s2n_stuffer_raw_write(out, 0);
-    notnull_check(output->data);
-
     GUARD(s2n_stuffer_write_uint16(out, p_size));
     p = s2n_stuffer_raw_write(out, p_size);
     notnull_check(p);
@@ -205,7 +202,9 @@ int s2n_dh_params_to_p_g_Ys(struct s2n_dh_params *server_dh_params, struct s2n_s
     notnull_check(Ys);
     S2N_ERROR_IF(BN_bn2bin(bn_Ys, Ys) != Ys_size, S2N_ERR_DH_SERIALIZING);
 
+    /* out may have been grown, and moved, while we wrote to it */
     output->size = p_size + 2 + g_size + 2 + Ys_size + 2;
+    output->data = Ys + Ys_size - output->size;
 
     return 0;
 }
@@ -52,10 +52,6 @@ int s2n_ecc_write_ecc_params(struct s2n_ecc_params *server_ecc_params, struct s2
     uint8_t point_len;
     struct s2n_blob point;
 
-    /* Remember when the written data starts */
-    written->data = s2n_stuffer_raw_write(out, 0);
-    notnull_check(written->data);
-
     GUARD(s2n_stuffer_write_uint8(out, TLS_EC_CURVE_TYPE_NAMED));
     GUARD(s2n_stuffer_write_uint16(out, server_ecc_params->negotiated_curve->iana_id));
 
@@ -71,7 +67,11 @@ int s2n_ecc_write_ecc_params(struct s2n_ecc_params *server_ecc_params, struct s2
     notnull_check(point.data);
     GUARD(s2n_ecc_write_point_data_snug(EC_KEY_get0_public_key(server_ecc_params->ec_key), EC_KEY_get0_group(server_ecc_params->ec_key), &point));
 
+    /* Point at the written data only now that it's all there, as a growable
+     * stuffer may have moved it while it was being written
+     */
     written->size = 3 + (1 + point_len);
+    written->data = point.data + point_len - written->size;
 
     return 0;
 }
@@ -34,7 +34,9 @@ struct s2n_error_translation {
 struct s2n_error_translation EN[] = {
     {S2N_ERR_OK, "no error"},
     {S2N_ERR_IO, "underlying I/O operation failed, check system errno"},
+    {S2N_ERR_KEY_SERVER, "Connection to the key server failed, check system errno"},
     {S2N_ERR_BLOCKED, "underlying I/O operation would block"},
+    {S2N_ERR_ASYNC_BLOCKED, "waiting on the application to complete a private key operation"},
     {S2N_ERR_KEY_INIT, "error initializing encryption key"},
     {S2N_ERR_ENCRYPT, "error encrypting data"},
     {S2N_ERR_DECRYPT, "error decrypting data"},
@@ -133,11 +135,34 @@ struct s2n_error_translation EN[] = {
     {S2N_ERR_INVALID_OCSP_RESPONSE, "OCSP response is invalid" },
     {S2N_ERR_INVALID_NONCE_TYPE, "Invalid AEAD nonce type"},
     {S2N_ERR_UNIMPLEMENTED, "Unimplemented feature"},
+    {S2N_ERR_ASYNC_FAILED, "Asynchronous private key operation failed"},
+    {S2N_ERR_KEY_SERVER_RESPONSE, "Key server sent a response to an unknown request"},
+    {S2N_ERR_KEY_POOL_THREAD, "Failed to start the ephemeral key pool"},
     {S2N_ERR_CERT_UNTRUSTED, "Certificate is untrusted"},
     {S2N_ERR_CERT_TYPE_UNSUPPORTED, "Certificate Type is unsupported"},
     {S2N_ERR_CANCELLED, "handshake was cancelled"},
     {S2N_ERR_INVALID_MAX_FRAG_LEN, "invalid Maximum Fragmentation Length encountered"},
     {S2N_ERR_MAX_FRAG_LEN_MISMATCH, "Negotiated Maximum Fragmentation Length from server does not match the requested length by client"},
+    {S2N_ERR_INVALID_SEND_BUFFER_SIZE, "Send buffer size is invalid or the buffer still holds unsent data"},
+    {S2N_ERR_READ_AHEAD_PENDING, "Read-ahead buffer can't be resized while it holds unprocessed data"},
+    {S2N_ERR_KTLS_UNSUPPORTED, "Kernel TLS is not supported by this platform, socket, protocol version or cipher"},
+    {S2N_ERR_KTLS_STATE, "Kernel TLS can only be enabled after the handshake, with no records buffered"},
+    {S2N_ERR_SENDFILE_EOF, "File ended before the requested number of bytes could be sent"},
+    {S2N_ERR_INVALID_DYNAMIC_THRESHOLD, "Dynamic record resize threshold is too large"},
+    {S2N_ERR_RECV_BORROW_KTLS, "Plaintext can't be borrowed once kernel TLS receive is enabled"},
+    {S2N_ERR_RECV_RELEASE_SIZE, "Released more plaintext than was borrowed"},
+    {S2N_ERR_INVALID_CONNECTION_POOL_SIZE, "Connection pool must hold between 1 and 65536 connections"},
+    {S2N_ERR_CONNECTION_POOL_MODE, "Connection mode doesn't match the connection pool's mode"},
+    {S2N_ERR_INITIALIZED, "s2n is initialized"},
+    {S2N_ERR_UNALIGNED_ALLOCATION, "Allocator callback returned memory that is not page aligned"},
+    {S2N_ERR_CONNECTION_BUFFERS_IN_USE, "Connection buffers hold a record that hasn't been fully processed"},
+    {S2N_ERR_INVALID_STUFFER_GROWTH_LIMIT, "Stuffer growth limit is below the minimum growth"},
+    {S2N_ERR_INVALID_MLOCK_POLICY, "Invalid mlock policy"},
+    {S2N_ERR_ASYNC_CALLBACK_FAILED, "Asynchronous private key callback failed"},
+    {S2N_ERR_ASYNC_OP_STATE, "Private key operation was already performed or applied, or isn't the one the connection is waiting on"},
+    {S2N_ERR_KEY_SERVER_PATH, "Key server socket path is empty or too long"},
+    {S2N_ERR_NO_KEY_SERVER, "Config has no key server"},
+    {S2N_ERR_KEY_POOL_SIZE, "Ephemeral key pool size or thread count is out of range"},
 };
 
 const char *s2n_strerror(int error, const char *lang)
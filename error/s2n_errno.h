@@ -43,10 +43,12 @@ typedef enum {
     S2N_ERR_OK = S2N_ERR_T_OK_START,
     /* S2N_ERR_T_IO */
     S2N_ERR_IO = S2N_ERR_T_IO_START,
+    S2N_ERR_KEY_SERVER,
     /* S2N_ERR_T_CLOSED */
     S2N_ERR_CLOSED = S2N_ERR_T_CLOSED_START,
     /* S2N_ERR_T_BLOCKED */
     S2N_ERR_BLOCKED = S2N_ERR_T_BLOCKED_START,
+    S2N_ERR_ASYNC_BLOCKED,
     /* S2N_ERR_T_ALERT */
     S2N_ERR_ALERT = S2N_ERR_T_ALERT_START,
     /* S2N_ERR_T_PROTO */
@@ -131,6 +133,9 @@ typedef enum {
     S2N_ERR_INITIAL_HMAC,
     S2N_ERR_INVALID_NONCE_TYPE,
     S2N_ERR_UNIMPLEMENTED,
+    S2N_ERR_ASYNC_FAILED,
+    S2N_ERR_KEY_SERVER_RESPONSE,
+    S2N_ERR_KEY_POOL_THREAD,
     /* S2N_ERR_T_USAGE */
     S2N_ERR_NO_ALERT = S2N_ERR_T_USAGE_START,
     S2N_ERR_CLIENT_MODE,
@@ -153,6 +158,26 @@ typedef enum {
     S2N_ERR_INVALID_SCT_LIST,
     S2N_ERR_INVALID_OCSP_RESPONSE,
     S2N_ERR_CANCELLED,
+    S2N_ERR_INVALID_SEND_BUFFER_SIZE,
+    S2N_ERR_READ_AHEAD_PENDING,
+    S2N_ERR_KTLS_UNSUPPORTED,
+    S2N_ERR_KTLS_STATE,
+    S2N_ERR_SENDFILE_EOF,
+    S2N_ERR_INVALID_DYNAMIC_THRESHOLD,
+    S2N_ERR_RECV_BORROW_KTLS,
+    S2N_ERR_RECV_RELEASE_SIZE,
+    S2N_ERR_INVALID_CONNECTION_POOL_SIZE,
+    S2N_ERR_CONNECTION_POOL_MODE,
+    S2N_ERR_INITIALIZED,
+    S2N_ERR_UNALIGNED_ALLOCATION,
+    S2N_ERR_CONNECTION_BUFFERS_IN_USE,
+    S2N_ERR_INVALID_STUFFER_GROWTH_LIMIT,
+    S2N_ERR_INVALID_MLOCK_POLICY,
+    S2N_ERR_ASYNC_CALLBACK_FAILED,
+    S2N_ERR_ASYNC_OP_STATE,
+    S2N_ERR_KEY_SERVER_PATH,
+    S2N_ERR_NO_KEY_SERVER,
+    S2N_ERR_KEY_POOL_SIZE,
 } s2n_error;
 
 #define S2N_DEBUG_STR_LEN 128
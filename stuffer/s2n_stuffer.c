@@ -26,6 +26,17 @@
 #include "utils/s2n_blob.h"
 #include "utils/s2n_mem.h"
 
+/* Shared by every thread's stuffers, and may be changed while they grow */
+static uint32_t growth_limit = S2N_STUFFER_DEFAULT_GROWTH_LIMIT;
+
+int s2n_stuffer_set_growth_limit(uint32_t limit)
+{
+    S2N_ERROR_IF(limit < S2N_STUFFER_MIN_GROWTH, S2N_ERR_INVALID_STUFFER_GROWTH_LIMIT);
+
+    __atomic_store_n(&growth_limit, limit, __ATOMIC_RELAXED);
+    return 0;
+}
+
 int s2n_stuffer_init(struct s2n_stuffer *stuffer, struct s2n_blob *in)
 {
     stuffer->blob.data = in->data;
@@ -42,8 +53,13 @@ int s2n_stuffer_init(struct s2n_stuffer *stuffer, struct s2n_blob *in)
 
 int s2n_stuffer_alloc(struct s2n_stuffer *stuffer, const uint32_t size)
 {
+    return s2n_stuffer_alloc_class(stuffer, size, S2N_MEM_SECRET);
+}
 
-    GUARD(s2n_alloc(&stuffer->blob, size));
+int s2n_stuffer_alloc_class(struct s2n_stuffer *stuffer, const uint32_t size, s2n_mem_class mem_class)
+{
+
+    GUARD(s2n_alloc_class(&stuffer->blob, size, mem_class));
     GUARD(s2n_stuffer_init(stuffer, &stuffer->blob));
 
     stuffer->alloced = 1;
@@ -53,7 +69,12 @@ int s2n_stuffer_alloc(struct s2n_stuffer *stuffer, const uint32_t size)
 
 int s2n_stuffer_growable_alloc(struct s2n_stuffer *stuffer, const uint32_t size)
 {
-    GUARD(s2n_stuffer_alloc(stuffer, size));
+    return s2n_stuffer_growable_alloc_class(stuffer, size, S2N_MEM_SECRET);
+}
+
+int s2n_stuffer_growable_alloc_class(struct s2n_stuffer *stuffer, const uint32_t size, s2n_mem_class mem_class)
+{
+    GUARD(s2n_stuffer_alloc_class(stuffer, size, mem_class));
 
     stuffer->growable = 1;
 
@@ -207,9 +228,14 @@ int s2n_stuffer_skip_write(struct s2n_stuffer *stuffer, const uint32_t n)
 {
     if (s2n_stuffer_space_remaining(stuffer) < n) {
         if (stuffer->growable) {
-            /* Always grow a stuffer by at least 1k */
-            uint32_t growth = MAX(n, 1024);
-
+            /* Double the stuffer, so that building up a large message takes a
+             * logarithmic number of reallocations, but never grow by less
+             * than 1k or by more than the growth limit unless asked to.
+             */
+            uint32_t growth = MIN(MAX(stuffer->blob.size, S2N_STUFFER_MIN_GROWTH), __atomic_load_n(&growth_limit, __ATOMIC_RELAXED));
+            growth = MAX(growth, n - s2n_stuffer_space_remaining(stuffer));
+
+            S2N_ERROR_IF(stuffer->blob.size + growth < stuffer->blob.size, S2N_ERR_STUFFER_IS_FULL);
             GUARD(s2n_stuffer_resize(stuffer, stuffer->blob.size + growth));
         } else {
             S2N_ERROR(S2N_ERR_STUFFER_IS_FULL);
@@ -19,6 +19,7 @@
 #include <stdlib.h>
 
 #include "utils/s2n_blob.h"
+#include "utils/s2n_mem.h"
 
 struct s2n_stuffer {
     /* The data for the s2n_stuffer */
@@ -42,6 +43,12 @@ struct s2n_stuffer {
     unsigned int tainted:1;
 };
 
+/* Growable stuffers double in size when they run out of space, growing by
+ * at least S2N_STUFFER_MIN_GROWTH and at most the growth limit per step.
+ */
+#define S2N_STUFFER_MIN_GROWTH            1024
+#define S2N_STUFFER_DEFAULT_GROWTH_LIMIT  (256 * 1024)
+
 #define s2n_stuffer_data_available( s )   ((s)->write_cursor - (s)->read_cursor)
 #define s2n_stuffer_space_remaining( s )  ((s)->blob.size - (s)->write_cursor)
 
@@ -49,6 +56,8 @@ struct s2n_stuffer {
 extern int s2n_stuffer_init(struct s2n_stuffer *stuffer, struct s2n_blob *in);
 extern int s2n_stuffer_alloc(struct s2n_stuffer *stuffer, const uint32_t size);
 extern int s2n_stuffer_growable_alloc(struct s2n_stuffer *stuffer, const uint32_t size);
+extern int s2n_stuffer_alloc_class(struct s2n_stuffer *stuffer, const uint32_t size, s2n_mem_class mem_class);
+extern int s2n_stuffer_growable_alloc_class(struct s2n_stuffer *stuffer, const uint32_t size, s2n_mem_class mem_class);
 extern int s2n_stuffer_free(struct s2n_stuffer *stuffer);
 extern int s2n_stuffer_resize(struct s2n_stuffer *stuffer, const uint32_t size);
 extern int s2n_stuffer_rewind_read(struct s2n_stuffer *stuffer, const uint32_t size);
@@ -56,6 +65,7 @@ extern int s2n_stuffer_reread(struct s2n_stuffer *stuffer);
 extern int s2n_stuffer_rewrite(struct s2n_stuffer *stuffer);
 extern int s2n_stuffer_wipe(struct s2n_stuffer *stuffer);
 extern int s2n_stuffer_wipe_n(struct s2n_stuffer *stuffer, const uint32_t n);
+extern int s2n_stuffer_set_growth_limit(uint32_t limit);
 
 /* Basic read and write */
 extern int s2n_stuffer_read(struct s2n_stuffer *stuffer, struct s2n_blob *out);
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2014 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/* Single core throughput of sealing a large transfer into full sized
+ * records, the way s2n_send fills an enlarged send buffer.
+ *
+ * Usage: s2n_bulk_record_benchmark [megabytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include <s2n.h>
+
+#include "testlib/s2n_testlib.h"
+#include "tls/s2n_cipher_suites.h"
+#include "tls/s2n_connection.h"
+#include "tls/s2n_crypto.h"
+#include "tls/s2n_record.h"
+#include "stuffer/s2n_stuffer.h"
+#include "crypto/s2n_cipher.h"
+#include "utils/s2n_safety.h"
+
+#define ONE_S  INT64_C(1000000000)
+#define SEND_BUFFER_SIZE (256 * 1024)
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * ONE_S + ts.tv_nsec;
+}
+
+/* Fill the send buffer over and over, the way s2n_send does for a large write */
+static int seal(struct s2n_connection *conn, struct iovec *iov, uint64_t total)
+{
+    for (uint64_t sealed = 0; sealed < total;) {
+        uint32_t offs = 0;
+        GUARD(s2n_stuffer_rewrite(&conn->out));
+
+        while (offs < iov->iov_len && s2n_stuffer_space_remaining(&conn->out) >= s2n_record_max_write_size(conn)) {
+            int w;
+            GUARD((w = s2n_record_writev(conn, TLS_APPLICATION_DATA, iov, 1, offs, iov->iov_len - offs)));
+            offs += w;
+        }
+
+        sealed += offs;
+    }
+
+    return 0;
+}
+
+static int benchmark(struct s2n_connection *conn, const char *name, struct iovec *iov, uint64_t total)
+{
+    /* Warm up */
+    GUARD(seal(conn, iov, total / 10));
+
+    int64_t start = now_ns();
+    GUARD(seal(conn, iov, total));
+    int64_t elapsed = now_ns() - start;
+
+    printf("%-32s %8.3f GB/s\n", name, (double) total / elapsed);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct s2n_cipher_suite *suites[] = {
+        &s2n_ecdhe_rsa_with_aes_128_gcm_sha256,
+        &s2n_ecdhe_rsa_with_aes_256_gcm_sha384,
+        &s2n_ecdhe_rsa_with_chacha20_poly1305_sha256,
+    };
+    int megabytes = argc > 1 ? atoi(argv[1]) : 1024;
+
+    setenv("S2N_DONT_MLOCK", "1", 0);
+    if (megabytes <= 0 || s2n_init() < 0) {
+        fprintf(stderr, "Usage: %s [megabytes]\n", argv[0]);
+        return 1;
+    }
+
+    static uint8_t data[SEND_BUFFER_SIZE];
+    struct iovec iov = {.iov_base = data,.iov_len = sizeof(data) };
+    uint64_t total = (uint64_t) megabytes * 1024 * 1024;
+
+    struct s2n_connection *conn = s2n_connection_new(S2N_SERVER);
+    if (conn == NULL || s2n_connection_set_send_buffer_size(conn, SEND_BUFFER_SIZE) < 0 || s2n_connection_prefer_throughput(conn) < 0) {
+        fprintf(stderr, "Error creating connection: '%s'\n", s2n_strerror(s2n_errno, "EN"));
+        return 1;
+    }
+
+    for (int s = 0; s < sizeof(suites) / sizeof(suites[0]); s++) {
+        if (!suites[s]->available) {
+            continue;
+        }
+
+        if (s2n_test_setup_secure_keys(conn, suites[s], NULL) < 0
+            || benchmark(conn, suites[s]->name, &iov, total) < 0) {
+            fprintf(stderr, "Error benchmarking %s: '%s'\n", suites[s]->name, s2n_strerror(s2n_errno, "EN"));
+            return 1;
+        }
+    }
+
+    s2n_connection_free(conn);
+    s2n_cleanup();
+
+    return 0;
+}
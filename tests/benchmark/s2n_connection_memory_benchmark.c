@@ -0,0 +1,180 @@
+/*
+ * Copyright 2014 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/* Steady-state memory held by an established connection: the bytes still
+ * allocated by s2n and by libcrypto after a full handshake, once the test
+ * transport has been freed.
+ *
+ * Usage: s2n_connection_memory_benchmark [connections]
+ */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/crypto.h>
+
+#include <s2n.h>
+
+#include "testlib/s2n_testlib.h"
+#include "utils/s2n_safety.h"
+
+static int64_t s2n_bytes;
+static int64_t libcrypto_bytes;
+
+static int count_init(void)
+{
+    return 0;
+}
+
+static int count_cleanup(void)
+{
+    return 0;
+}
+
+static int count_malloc(void **ptr, uint32_t requested, uint32_t *allocated)
+{
+    *ptr = malloc(requested);
+    if (*ptr == NULL) {
+        return -1;
+    }
+
+    *allocated = requested;
+    s2n_bytes += malloc_usable_size(*ptr);
+    return 0;
+}
+
+static int count_free(void *ptr, uint32_t size)
+{
+    s2n_bytes -= malloc_usable_size(ptr);
+    free(ptr);
+    return 0;
+}
+
+static void *count_crypto_malloc(size_t size, const char *file, int line)
+{
+    void *ptr = malloc(size);
+    libcrypto_bytes += malloc_usable_size(ptr);
+    return ptr;
+}
+
+static void *count_crypto_realloc(void *ptr, size_t size, const char *file, int line)
+{
+    libcrypto_bytes -= malloc_usable_size(ptr);
+    ptr = realloc(ptr, size);
+    libcrypto_bytes += malloc_usable_size(ptr);
+    return ptr;
+}
+
+static void count_crypto_free(void *ptr, const char *file, int line)
+{
+    libcrypto_bytes -= malloc_usable_size(ptr);
+    free(ptr);
+}
+
+static void report(const char *name, int64_t s2n, int64_t libcrypto, int connections)
+{
+    printf("%-8s %10.0f bytes/connection (s2n %8.0f, libcrypto %8.0f)\n", name,
+           (double) (s2n + libcrypto) / connections, (double) s2n / connections, (double) libcrypto / connections);
+}
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *server_config;
+    struct s2n_config *client_config;
+    char *cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE);
+    char *private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE);
+    int connections = argc > 1 ? atoi(argv[1]) : 100;
+
+    /* libcrypto only takes allocator functions before its first allocation */
+    int count_libcrypto = CRYPTO_set_mem_functions(count_crypto_malloc, count_crypto_realloc, count_crypto_free);
+
+    setenv("S2N_DONT_MLOCK", "1", 0);
+    setenv("S2N_ENABLE_CLIENT_MODE", "1", 0);
+    if (connections <= 0 || s2n_mem_set_callbacks(count_init, count_cleanup, count_malloc, count_free) < 0 || s2n_init() < 0) {
+        fprintf(stderr, "Usage: %s [connections]\n", argv[0]);
+        return 1;
+    }
+
+    struct s2n_connection **server_conns = calloc(connections, sizeof(struct s2n_connection *));
+    struct s2n_connection **client_conns = calloc(connections, sizeof(struct s2n_connection *));
+    struct s2n_test_io_buffer *client_to_server = calloc(connections, sizeof(struct s2n_test_io_buffer));
+    struct s2n_test_io_buffer *server_to_client = calloc(connections, sizeof(struct s2n_test_io_buffer));
+
+    if ((server_config = s2n_config_new()) == NULL
+        || s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE) < 0
+        || s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE) < 0
+        || s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem) < 0
+        || (client_config = s2n_config_new()) == NULL
+        || s2n_config_disable_x509_verification(client_config) < 0) {
+        fprintf(stderr, "Error setting up configs: '%s'\n", s2n_strerror(s2n_errno, "EN"));
+        return 1;
+    }
+
+    int64_t s2n_baseline = s2n_bytes;
+    int64_t libcrypto_baseline = libcrypto_bytes;
+
+    for (int i = 0; i < connections; i++) {
+        if ((server_conns[i] = s2n_connection_new(S2N_SERVER)) == NULL
+            || (client_conns[i] = s2n_connection_new(S2N_CLIENT)) == NULL
+            || s2n_connection_set_config(server_conns[i], server_config) < 0
+            || s2n_connection_set_config(client_conns[i], client_config) < 0
+            || s2n_test_io_buffer_alloc(&client_to_server[i], 0) < 0
+            || s2n_test_io_buffer_alloc(&server_to_client[i], 0) < 0
+            || s2n_connections_set_io_buffers(client_conns[i], server_conns[i], &client_to_server[i], &server_to_client[i]) < 0
+            || s2n_negotiate_test_server_and_client(server_conns[i], client_conns[i]) < 0) {
+            fprintf(stderr, "Error negotiating connection %d: '%s'\n", i, s2n_strerror(s2n_errno, "EN"));
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < connections; i++) {
+        s2n_test_io_buffer_free(&client_to_server[i]);
+        s2n_test_io_buffer_free(&server_to_client[i]);
+    }
+
+    int64_t s2n_both = s2n_bytes - s2n_baseline;
+    int64_t libcrypto_both = libcrypto_bytes - libcrypto_baseline;
+
+    for (int i = 0; i < connections; i++) {
+        s2n_connection_free(client_conns[i]);
+    }
+
+    int64_t s2n_server = s2n_bytes - s2n_baseline;
+    int64_t libcrypto_server = libcrypto_bytes - libcrypto_baseline;
+
+    if (!count_libcrypto) {
+        printf("libcrypto allocations can't be counted with this build\n");
+    }
+    report("server", s2n_server, libcrypto_server, connections);
+    report("client", s2n_both - s2n_server, libcrypto_both - libcrypto_server, connections);
+
+    for (int i = 0; i < connections; i++) {
+        s2n_connection_free(server_conns[i]);
+    }
+    s2n_config_free(server_config);
+    s2n_config_free(client_config);
+    free(server_conns);
+    free(client_conns);
+    free(client_to_server);
+    free(server_to_client);
+    free(cert_chain_pem);
+    free(private_key_pem);
+
+    s2n_cleanup();
+
+    return 0;
+}
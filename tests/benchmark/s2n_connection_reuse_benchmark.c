@@ -0,0 +1,153 @@
+/*
+ * Copyright 2014 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/* Cost of getting a connection ready for the next handshake once the last
+ * one is done with it: s2n_connection_wipe on the same connection, against
+ * s2n_connection_free followed by s2n_connection_new. Each connection runs a
+ * full handshake first, and only the turnaround itself is timed.
+ *
+ * Usage: s2n_connection_reuse_benchmark [connections]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <s2n.h>
+
+#include "testlib/s2n_testlib.h"
+#include "stuffer/s2n_stuffer.h"
+#include "utils/s2n_safety.h"
+
+#define ONE_S  INT64_C(1000000000)
+
+static struct s2n_config *server_config;
+static struct s2n_config *client_config;
+static struct s2n_test_io_buffer client_to_server;
+static struct s2n_test_io_buffer server_to_client;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * ONE_S + ts.tv_nsec;
+}
+
+static int setup(struct s2n_connection *server_conn, struct s2n_connection *client_conn)
+{
+    GUARD(s2n_connection_set_config(server_conn, server_config));
+    GUARD(s2n_connection_set_config(client_conn, client_config));
+    GUARD(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+
+    return 0;
+}
+
+static int handshake(struct s2n_connection *server_conn, struct s2n_connection *client_conn)
+{
+    GUARD(s2n_stuffer_wipe(&client_to_server.data));
+    GUARD(s2n_stuffer_wipe(&server_to_client.data));
+    GUARD(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+
+    return 0;
+}
+
+static int reuse(struct s2n_connection **server_conn, struct s2n_connection **client_conn)
+{
+    GUARD(s2n_connection_wipe(*server_conn));
+    GUARD(s2n_connection_wipe(*client_conn));
+    GUARD(setup(*server_conn, *client_conn));
+
+    return 0;
+}
+
+static int renew(struct s2n_connection **server_conn, struct s2n_connection **client_conn)
+{
+    GUARD(s2n_connection_free(*server_conn));
+    GUARD(s2n_connection_free(*client_conn));
+    notnull_check(*server_conn = s2n_connection_new(S2N_SERVER));
+    notnull_check(*client_conn = s2n_connection_new(S2N_CLIENT));
+    GUARD(setup(*server_conn, *client_conn));
+
+    return 0;
+}
+
+static int run(const char *name, int (*turnaround)(struct s2n_connection **, struct s2n_connection **), int connections)
+{
+    struct s2n_connection *server_conn = s2n_connection_new(S2N_SERVER);
+    struct s2n_connection *client_conn = s2n_connection_new(S2N_CLIENT);
+    int64_t elapsed = 0;
+
+    notnull_check(server_conn);
+    notnull_check(client_conn);
+    GUARD(setup(server_conn, client_conn));
+
+    for (int i = 0; i < connections; i++) {
+        GUARD(handshake(server_conn, client_conn));
+
+        int64_t start = now_ns();
+        GUARD(turnaround(&server_conn, &client_conn));
+        elapsed += now_ns() - start;
+    }
+
+    printf("%-10s %8.2f us/connection pair\n", name, (double) elapsed / connections / 1000);
+
+    GUARD(s2n_connection_free(server_conn));
+    GUARD(s2n_connection_free(client_conn));
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    char *cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE);
+    char *private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE);
+    int connections = argc > 1 ? atoi(argv[1]) : 1000;
+
+    setenv("S2N_ENABLE_CLIENT_MODE", "1", 0);
+    if (connections <= 0 || s2n_init() < 0) {
+        fprintf(stderr, "Usage: %s [connections]\n", argv[0]);
+        return 1;
+    }
+
+    if ((server_config = s2n_config_new()) == NULL
+        || s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE) < 0
+        || s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE) < 0
+        || s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem) < 0
+        || (client_config = s2n_config_new()) == NULL
+        || s2n_config_disable_x509_verification(client_config) < 0
+        || s2n_test_io_buffer_alloc(&client_to_server, 0) < 0
+        || s2n_test_io_buffer_alloc(&server_to_client, 0) < 0) {
+        fprintf(stderr, "Error setting up: '%s'\n", s2n_strerror(s2n_errno, "EN"));
+        return 1;
+    }
+
+    if (run("wipe", reuse, connections) < 0 || run("free+new", renew, connections) < 0) {
+        fprintf(stderr, "Error: '%s'\n", s2n_strerror(s2n_errno, "EN"));
+        return 1;
+    }
+
+    s2n_test_io_buffer_free(&client_to_server);
+    s2n_test_io_buffer_free(&server_to_client);
+    s2n_config_free(server_config);
+    s2n_config_free(client_config);
+    free(cert_chain_pem);
+    free(private_key_pem);
+
+    s2n_cleanup();
+
+    return 0;
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/* Cost of a DHE-RSA handshake with the server duplicating the config's DH
+ * parameters and generating its ephemeral key inline, against taking one
+ * from an ephemeral key pool that background threads keep topped up. Only
+ * the server's calls to s2n_negotiate are timed, since the client's check of
+ * the DH parameters would otherwise dwarf them. The pool is given the time in
+ * between handshakes to refill, as it would between a server's connections.
+ *
+ * Usage: s2n_dhe_handshake_benchmark [handshakes] [pool threads]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <s2n.h>
+
+#include "testlib/s2n_testlib.h"
+#include "stuffer/s2n_stuffer.h"
+#include "tls/s2n_config.h"
+#include "tls/s2n_key_pool.h"
+#include "utils/s2n_safety.h"
+
+#define ONE_S      INT64_C(1000000000)
+#define POOL_SIZE  64
+
+static struct s2n_config *server_config;
+static struct s2n_config *client_config;
+static struct s2n_test_io_buffer client_to_server;
+static struct s2n_test_io_buffer server_to_client;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * ONE_S + ts.tv_nsec;
+}
+
+/* Let the background threads catch up, so that the pool is full to start with */
+static void wait_for_dh_keys(struct s2n_key_pool *pool)
+{
+    struct timespec tick = { .tv_sec = 0, .tv_nsec = 1000000 };
+    uint32_t count = 0;
+
+    while (count < pool->size) {
+        nanosleep(&tick, NULL);
+        pthread_mutex_lock(&pool->lock);
+        count = pool->count[S2N_KEY_POOL_DH];
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static int negotiate(struct s2n_connection *conn, s2n_blocked_status *blocked)
+{
+    s2n_errno = S2N_ERR_T_OK;
+    if (s2n_negotiate(conn, blocked) < 0) {
+        S2N_ERROR_IF(s2n_error_get_type(s2n_errno) != S2N_ERR_T_BLOCKED, s2n_errno);
+    }
+
+    return 0;
+}
+
+/* A full handshake, returning how long the server spent in it */
+static int64_t handshake(struct s2n_connection *server_conn, struct s2n_connection *client_conn)
+{
+    s2n_blocked_status server_blocked = S2N_BLOCKED_ON_READ;
+    s2n_blocked_status client_blocked = S2N_BLOCKED_ON_READ;
+    int64_t elapsed = 0;
+
+    GUARD(s2n_connection_wipe(server_conn));
+    GUARD(s2n_connection_wipe(client_conn));
+    GUARD(s2n_connection_set_config(server_conn, server_config));
+    GUARD(s2n_connection_set_config(client_conn, client_config));
+    GUARD(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+    GUARD(s2n_stuffer_wipe(&client_to_server.data));
+    GUARD(s2n_stuffer_wipe(&server_to_client.data));
+
+    do {
+        if (client_blocked != S2N_NOT_BLOCKED) {
+            GUARD(negotiate(client_conn, &client_blocked));
+        }
+        if (server_blocked != S2N_NOT_BLOCKED) {
+            int64_t start = now_ns();
+            GUARD(negotiate(server_conn, &server_blocked));
+            elapsed += now_ns() - start;
+        }
+    } while (server_blocked != S2N_NOT_BLOCKED || client_blocked != S2N_NOT_BLOCKED);
+
+    return elapsed;
+}
+
+static int run(const char *name, int handshakes)
+{
+    struct s2n_connection *server_conn = s2n_connection_new(S2N_SERVER);
+    struct s2n_connection *client_conn = s2n_connection_new(S2N_CLIENT);
+    int64_t elapsed = 0;
+
+    notnull_check(server_conn);
+    notnull_check(client_conn);
+
+    for (int i = 0; i < handshakes; i++) {
+        if (server_config->key_pool) {
+            wait_for_dh_keys(server_config->key_pool);
+        }
+
+        int64_t server_ns = handshake(server_conn, client_conn);
+        GUARD(server_ns);
+        elapsed += server_ns;
+
+        S2N_ERROR_IF(strcmp(s2n_connection_get_cipher(server_conn), "DHE-RSA-AES128-GCM-SHA256") != 0, S2N_ERR_CIPHER_NOT_SUPPORTED);
+    }
+
+    printf("%-10s %8.2f us/handshake on the server\n", name, (double) elapsed / handshakes / 1000);
+
+    GUARD(s2n_connection_free(server_conn));
+    GUARD(s2n_connection_free(client_conn));
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    char *cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE);
+    char *private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE);
+    char *dhparams_pem = malloc(S2N_MAX_TEST_PEM_SIZE);
+    int handshakes = argc > 1 ? atoi(argv[1]) : 20;
+    int threads = argc > 2 ? atoi(argv[2]) : 2;
+
+    setenv("S2N_ENABLE_CLIENT_MODE", "1", 0);
+    if (handshakes <= 0 || threads <= 0 || s2n_init() < 0) {
+        fprintf(stderr, "Usage: %s [handshakes] [pool threads]\n", argv[0]);
+        return 1;
+    }
+
+    if ((server_config = s2n_config_new()) == NULL
+        || s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE) < 0
+        || s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE) < 0
+        || s2n_read_test_pem(S2N_DEFAULT_TEST_DHPARAMS, dhparams_pem, S2N_MAX_TEST_PEM_SIZE) < 0
+        || s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem) < 0
+        || s2n_config_add_dhparams(server_config, dhparams_pem) < 0
+        || s2n_config_set_cipher_preferences(server_config, "20150214") < 0
+        || (client_config = s2n_config_new()) == NULL
+        || s2n_config_disable_x509_verification(client_config) < 0
+        || s2n_config_set_cipher_preferences(client_config, "20150214") < 0
+        || s2n_test_io_buffer_alloc(&client_to_server, 0) < 0
+        || s2n_test_io_buffer_alloc(&server_to_client, 0) < 0) {
+        fprintf(stderr, "Error setting up: '%s'\n", s2n_strerror(s2n_errno, "EN"));
+        return 1;
+    }
+
+    if (run("inline", handshakes) < 0
+        || s2n_config_set_ephemeral_key_pool(server_config, POOL_SIZE, threads) < 0
+        || run("pooled", handshakes) < 0) {
+        fprintf(stderr, "Error: '%s'\n", s2n_strerror(s2n_errno, "EN"));
+        return 1;
+    }
+
+    s2n_test_io_buffer_free(&client_to_server);
+    s2n_test_io_buffer_free(&server_to_client);
+    s2n_config_free(server_config);
+    s2n_config_free(client_config);
+    free(cert_chain_pem);
+    free(private_key_pem);
+    free(dhparams_pem);
+
+    s2n_cleanup();
+
+    return 0;
+}
@@ -0,0 +1,211 @@
+/*
+ * Copyright 2014 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/* Throughput of one connection used full-duplex: a reader thread calling
+ * s2n_recv and a writer thread calling s2n_send at the same time, compared
+ * with each of them running alone. The gap between the two shows how much
+ * the threads get in each other's way, e.g. through false sharing.
+ *
+ * Usage: s2n_duplex_benchmark [records]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <s2n.h>
+
+#include "testlib/s2n_testlib.h"
+#include "tls/s2n_cipher_suites.h"
+#include "tls/s2n_connection.h"
+#include "tls/s2n_crypto.h"
+#include "tls/s2n_record.h"
+#include "crypto/s2n_cipher.h"
+#include "utils/s2n_safety.h"
+
+#define ONE_S  INT64_C(1000000000)
+#define RECORD_SIZE 1024
+
+struct stream {
+    uint8_t *data;
+    uint64_t size;
+    uint64_t offset;
+};
+
+static struct s2n_connection *conn;
+static struct stream ciphertext;
+static uint64_t records;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * ONE_S + ts.tv_nsec;
+}
+
+static int capture_send(void *io_context, const uint8_t *buf, uint32_t len)
+{
+    struct stream *s = io_context;
+    if (s->offset + len > s->size) {
+        return -1;
+    }
+
+    memcpy(s->data + s->offset, buf, len);
+    s->offset += len;
+    return len;
+}
+
+static int discard_send(void *io_context, const uint8_t *buf, uint32_t len)
+{
+    return len;
+}
+
+static int replay_recv(void *io_context, uint8_t *buf, uint32_t len)
+{
+    struct stream *s = io_context;
+    if (s->offset == s->size) {
+        return 0;
+    }
+
+    if (len > s->size - s->offset) {
+        len = s->size - s->offset;
+    }
+
+    memcpy(buf, s->data + s->offset, len);
+    s->offset += len;
+    return len;
+}
+
+static void *writer(void *unused)
+{
+    static uint8_t data[RECORD_SIZE];
+    s2n_blocked_status blocked;
+
+    for (uint64_t i = 0; i < records; i++) {
+        if (s2n_send(conn, data, sizeof(data), &blocked) != sizeof(data)) {
+            return (void *) -1;
+        }
+    }
+
+    return NULL;
+}
+
+static void *reader(void *unused)
+{
+    static uint8_t data[RECORD_SIZE];
+    s2n_blocked_status blocked;
+
+    for (uint64_t i = 0; i < records; i++) {
+        if (s2n_recv(conn, data, sizeof(data), &blocked) != sizeof(data)) {
+            return (void *) -1;
+        }
+    }
+
+    return NULL;
+}
+
+/* The records the reader decrypts are the ones the writer encrypts, since
+ * both directions share a key. Record them once and replay them each run.
+ */
+static int record_ciphertext(void)
+{
+    ciphertext.size = records * (RECORD_SIZE + 64);
+    ciphertext.data = malloc(ciphertext.size);
+    notnull_check(ciphertext.data);
+
+    GUARD(s2n_connection_set_send_cb(conn, capture_send));
+    GUARD(s2n_connection_set_send_ctx(conn, &ciphertext));
+    S2N_ERROR_IF(writer(NULL) != NULL, S2N_ERR_IO);
+
+    ciphertext.size = ciphertext.offset;
+    return 0;
+}
+
+static int reset(void)
+{
+    memset(conn->secure.client_sequence_number, 0, S2N_TLS_SEQUENCE_NUM_LEN);
+    memset(conn->secure.server_sequence_number, 0, S2N_TLS_SEQUENCE_NUM_LEN);
+    ciphertext.offset = 0;
+
+    GUARD(s2n_connection_set_send_cb(conn, discard_send));
+    GUARD(s2n_connection_set_recv_cb(conn, replay_recv));
+    GUARD(s2n_connection_set_recv_ctx(conn, &ciphertext));
+
+    return 0;
+}
+
+static int run(const char *name, int with_reader, int with_writer)
+{
+    pthread_t reader_thread;
+    pthread_t writer_thread;
+    void *reader_result = NULL;
+    void *writer_result = NULL;
+
+    GUARD(reset());
+
+    int64_t start = now_ns();
+    if (with_reader) {
+        S2N_ERROR_IF(pthread_create(&reader_thread, NULL, reader, NULL), S2N_ERR_IO);
+    }
+    if (with_writer) {
+        S2N_ERROR_IF(pthread_create(&writer_thread, NULL, writer, NULL), S2N_ERR_IO);
+    }
+    if (with_reader) {
+        pthread_join(reader_thread, &reader_result);
+    }
+    if (with_writer) {
+        pthread_join(writer_thread, &writer_result);
+    }
+    int64_t elapsed = now_ns() - start;
+
+    S2N_ERROR_IF(reader_result || writer_result, S2N_ERR_IO);
+
+    uint64_t bytes = records * RECORD_SIZE * (with_reader + with_writer);
+    printf("%-16s %10.0f records/s %8.3f GB/s\n", name, (double) records * (with_reader + with_writer) * ONE_S / elapsed, (double) bytes / elapsed);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    records = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+
+    setenv("S2N_DONT_MLOCK", "1", 0);
+    if (records == 0 || s2n_init() < 0) {
+        fprintf(stderr, "Usage: %s [records]\n", argv[0]);
+        return 1;
+    }
+
+    conn = s2n_connection_new(S2N_SERVER);
+    if (conn == NULL || s2n_test_setup_secure_keys(conn, &s2n_ecdhe_rsa_with_aes_128_gcm_sha256, NULL) < 0 || record_ciphertext() < 0) {
+        fprintf(stderr, "Error setting up connection: '%s'\n", s2n_strerror(s2n_errno, "EN"));
+        return 1;
+    }
+
+    printf("%s, %d byte records\n", s2n_ecdhe_rsa_with_aes_128_gcm_sha256.name, RECORD_SIZE);
+    if (run("reader alone", 1, 0) < 0 || run("writer alone", 0, 1) < 0 || run("reader + writer", 1, 1) < 0) {
+        fprintf(stderr, "Error benchmarking: '%s'\n", s2n_strerror(s2n_errno, "EN"));
+        return 1;
+    }
+
+    s2n_connection_free(conn);
+    free(ciphertext.data);
+    s2n_cleanup();
+
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2014 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/* Small record throughput of the record layer, for each record protection
+ * routine available to the negotiated cipher.
+ *
+ * Usage: s2n_record_benchmark [records]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <s2n.h>
+
+#include "testlib/s2n_testlib.h"
+#include "tls/s2n_cipher_suites.h"
+#include "tls/s2n_connection.h"
+#include "tls/s2n_crypto.h"
+#include "tls/s2n_record.h"
+#include "stuffer/s2n_stuffer.h"
+#include "crypto/s2n_cipher.h"
+#include "utils/s2n_safety.h"
+
+#define ONE_S  INT64_C(1000000000)
+
+/* Write a record, then read it back, the way s2n_send and s2n_recv would */
+static int round_trip(struct s2n_connection *conn, struct s2n_blob *in)
+{
+    GUARD(s2n_record_write(conn, TLS_APPLICATION_DATA, in));
+
+    GUARD(s2n_stuffer_wipe(&conn->header_in));
+    GUARD(s2n_stuffer_wipe(&conn->in));
+    GUARD(s2n_stuffer_copy(&conn->out, &conn->header_in, S2N_TLS_RECORD_HEADER_LENGTH));
+    GUARD(s2n_stuffer_copy(&conn->out, &conn->in, s2n_stuffer_data_available(&conn->out)));
+    GUARD(s2n_stuffer_wipe(&conn->out));
+
+    conn->in_status = ENCRYPTED;
+    GUARD(s2n_record_parse(conn));
+
+    return 0;
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * ONE_S + ts.tv_nsec;
+}
+
+static int benchmark(struct s2n_connection *conn, const char *name, const char *path, uint16_t size, int records)
+{
+    uint8_t data[S2N_DEFAULT_FRAGMENT_LENGTH] = { 0 };
+    struct s2n_blob in = {.data = data,.size = size };
+
+    /* Warm up */
+    for (int i = 0; i < records / 10; i++) {
+        GUARD(round_trip(conn, &in));
+    }
+
+    int64_t start = now_ns();
+    for (int i = 0; i < records; i++) {
+        GUARD(round_trip(conn, &in));
+    }
+    int64_t elapsed = now_ns() - start;
+
+    printf("%-32s %-12s %6d bytes %10.1f ns/record %9.1f MB/s\n", name, path, size,
+           (double) elapsed / records, (double) size * records * 1000 / elapsed);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct s2n_cipher_suite *suites[] = {
+        &s2n_ecdhe_rsa_with_aes_128_gcm_sha256,
+        &s2n_ecdhe_rsa_with_chacha20_poly1305_sha256,
+        &s2n_ecdhe_rsa_with_aes_128_cbc_sha256,
+    };
+    uint16_t sizes[] = { 16, 64, 256, 1024 };
+    int records = argc > 1 ? atoi(argv[1]) : 200000;
+
+    setenv("S2N_DONT_MLOCK", "1", 0);
+    if (records <= 0 || s2n_init() < 0) {
+        fprintf(stderr, "Usage: %s [records]\n", argv[0]);
+        return 1;
+    }
+
+    struct s2n_connection *conn = s2n_connection_new(S2N_SERVER);
+    if (conn == NULL) {
+        fprintf(stderr, "Error creating connection: '%s'\n", s2n_strerror(s2n_errno, "EN"));
+        return 1;
+    }
+
+    for (int s = 0; s < sizeof(suites) / sizeof(suites[0]); s++) {
+        if (!suites[s]->available) {
+            continue;
+        }
+
+        if (s2n_test_setup_secure_keys(conn, suites[s], NULL) < 0) {
+            fprintf(stderr, "Error setting up %s: '%s'\n", suites[s]->name, s2n_strerror(s2n_errno, "EN"));
+            return 1;
+        }
+
+        const struct s2n_record_protection *protection = conn->secure.record_protection;
+        for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            conn->secure.record_protection = NULL;
+            if (benchmark(conn, suites[s]->name, "generic", sizes[i], records) < 0) {
+                fprintf(stderr, "Error benchmarking %s: '%s'\n", suites[s]->name, s2n_strerror(s2n_errno, "EN"));
+                return 1;
+            }
+
+            if (protection == NULL) {
+                continue;
+            }
+
+            conn->secure.record_protection = protection;
+            if (benchmark(conn, suites[s]->name, "specialized", sizes[i], records) < 0) {
+                fprintf(stderr, "Error benchmarking %s: '%s'\n", suites[s]->name, s2n_strerror(s2n_errno, "EN"));
+                return 1;
+            }
+        }
+
+        if (s2n_connection_wipe(conn) < 0) {
+            return 1;
+        }
+    }
+
+    s2n_connection_free(conn);
+    s2n_cleanup();
+
+    return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include <s2n.h>
+
+#include "error/s2n_errno.h"
+
+#include "crypto/s2n_cipher.h"
+#include "crypto/s2n_hmac.h"
+
+#include "stuffer/s2n_stuffer.h"
+
+#include "tls/s2n_cipher_suites.h"
+#include "tls/s2n_crypto.h"
+#include "tls/s2n_record.h"
+
+#include "utils/s2n_safety.h"
+
+#include "testlib/s2n_testlib.h"
+
+int s2n_test_io_buffer_alloc(struct s2n_test_io_buffer *buffer, uint32_t size)
+{
+    /* A zero size buffer grows to hold everything that is written to it */
+    if (size == 0) {
+        GUARD(s2n_stuffer_growable_alloc(&buffer->data, 0));
+    } else {
+        GUARD(s2n_stuffer_alloc(&buffer->data, size));
+    }
+    buffer->calls = 0;
+    buffer->max_io_size = 0;
+
+    return 0;
+}
+
+int s2n_test_io_buffer_free(struct s2n_test_io_buffer *buffer)
+{
+    GUARD(s2n_stuffer_free(&buffer->data));
+
+    return 0;
+}
+
+int s2n_test_io_buffer_read(void *io_context, uint8_t *buf, uint32_t len)
+{
+    struct s2n_test_io_buffer *buffer = (struct s2n_test_io_buffer *) io_context;
+    if (buffer == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    buffer->calls++;
+
+    uint32_t n_read = MIN(len, s2n_stuffer_data_available(&buffer->data));
+    if (buffer->max_io_size) {
+        n_read = MIN(n_read, buffer->max_io_size);
+    }
+
+    if (n_read == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    GUARD(s2n_stuffer_read_bytes(&buffer->data, buf, n_read));
+
+    /* Reuse the space once everything written so far has been read */
+    if (s2n_stuffer_data_available(&buffer->data) == 0) {
+        GUARD(s2n_stuffer_rewrite(&buffer->data));
+    }
+
+    return n_read;
+}
+
+int s2n_test_io_buffer_write(void *io_context, const uint8_t *buf, uint32_t len)
+{
+    struct s2n_test_io_buffer *buffer = (struct s2n_test_io_buffer *) io_context;
+    if (buffer == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    buffer->calls++;
+
+    uint32_t n_written = len;
+    if (buffer->max_io_size) {
+        n_written = MIN(n_written, buffer->max_io_size);
+    }
+
+    /* A fixed size buffer behaves like a full socket send buffer */
+    if (!buffer->data.growable) {
+        n_written = MIN(n_written, s2n_stuffer_space_remaining(&buffer->data));
+    }
+
+    if (n_written == 0 || s2n_stuffer_write_bytes(&buffer->data, buf, n_written) < 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return n_written;
+}
+
+int s2n_connections_set_io_buffers(struct s2n_connection *client_conn, struct s2n_connection *server_conn,
+                                   struct s2n_test_io_buffer *client_to_server, struct s2n_test_io_buffer *server_to_client)
+{
+    GUARD(s2n_connection_set_send_cb(client_conn, s2n_test_io_buffer_write));
+    GUARD(s2n_connection_set_send_ctx(client_conn, client_to_server));
+    GUARD(s2n_connection_set_recv_cb(client_conn, s2n_test_io_buffer_read));
+    GUARD(s2n_connection_set_recv_ctx(client_conn, server_to_client));
+
+    GUARD(s2n_connection_set_send_cb(server_conn, s2n_test_io_buffer_write));
+    GUARD(s2n_connection_set_send_ctx(server_conn, server_to_client));
+    GUARD(s2n_connection_set_recv_cb(server_conn, s2n_test_io_buffer_read));
+    GUARD(s2n_connection_set_recv_ctx(server_conn, client_to_server));
+
+    return 0;
+}
+
+int s2n_test_recv_all(struct s2n_connection *conn, uint8_t *data, uint32_t size)
+{
+    s2n_blocked_status blocked;
+    uint32_t received = 0;
+
+    while (received < size) {
+        int r = s2n_recv(conn, data + received, size - received, &blocked);
+        if (r <= 0) {
+            return -1;
+        }
+        received += r;
+    }
+
+    return 0;
+}
+
+int s2n_test_setup_secure_keys(struct s2n_connection *conn, struct s2n_cipher_suite *cipher_suite, struct s2n_blob *key)
+{
+    uint8_t key_data[] = "1234567890123456789012345678901";
+    struct s2n_blob default_key = {.data = key_data,.size = cipher_suite->record_alg->cipher->key_material_size };
+    if (key == NULL) {
+        key = &default_key;
+    }
+
+    conn->actual_protocol_version = S2N_TLS12;
+    conn->secure.cipher_suite = cipher_suite;
+    conn->server = &conn->secure;
+    conn->client = &conn->secure;
+
+    GUARD(cipher_suite->record_alg->cipher->init(&conn->secure.server_key));
+    GUARD(cipher_suite->record_alg->cipher->init(&conn->secure.client_key));
+    GUARD(cipher_suite->record_alg->cipher->set_encryption_key(&conn->secure.server_key, key));
+    GUARD(cipher_suite->record_alg->cipher->set_decryption_key(&conn->secure.client_key, key));
+    memset(conn->secure.server_implicit_iv, 0x2a, S2N_TLS_MAX_IV_LEN);
+    memset(conn->secure.client_implicit_iv, 0x2a, S2N_TLS_MAX_IV_LEN);
+
+    if (cipher_suite->record_alg->cipher->type == S2N_CBC) {
+        GUARD(s2n_hmac_init(&conn->secure.server_record_mac, cipher_suite->record_alg->hmac_alg, key_data, 32));
+        GUARD(s2n_hmac_init(&conn->secure.client_record_mac, cipher_suite->record_alg->hmac_alg, key_data, 32));
+    }
+
+    return s2n_record_bind_protection(conn);
+}
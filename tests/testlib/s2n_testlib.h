@@ -96,3 +96,30 @@ int s2n_read_test_pem(const char *pem_path, char *pem_out, long int max_size);
 
 int s2n_negotiate_test_server_and_client(struct s2n_connection *server_conn, struct s2n_connection *client_conn);
 int s2n_shutdown_test_server_and_client(struct s2n_connection *server_conn, struct s2n_connection *client_conn);
+
+/* In-memory I/O for driving a client and a server connection from a single process */
+struct s2n_test_io_buffer {
+    struct s2n_stuffer data;
+
+    /* How many times a connection called the I/O callback on this buffer */
+    uint32_t calls;
+
+    /* If non-zero, the most a single callback will read or write */
+    uint32_t max_io_size;
+};
+
+int s2n_test_io_buffer_alloc(struct s2n_test_io_buffer *buffer, uint32_t size);
+int s2n_test_io_buffer_free(struct s2n_test_io_buffer *buffer);
+int s2n_test_io_buffer_read(void *io_context, uint8_t *buf, uint32_t len);
+int s2n_test_io_buffer_write(void *io_context, const uint8_t *buf, uint32_t len);
+int s2n_connections_set_io_buffers(struct s2n_connection *client_conn, struct s2n_connection *server_conn,
+                                   struct s2n_test_io_buffer *client_to_server, struct s2n_test_io_buffer *server_to_client);
+
+/* Call s2n_recv until exactly size bytes have been received */
+int s2n_test_recv_all(struct s2n_connection *conn, uint8_t *data, uint32_t size);
+
+/* Give conn TLS1.2 keys for cipher_suite without a handshake, sealing as the
+ * server and opening as the client with the same key, so that records it
+ * writes can be read straight back. A NULL key uses a fixed test key.
+ */
+int s2n_test_setup_secure_keys(struct s2n_connection *conn, struct s2n_cipher_suite *cipher_suite, struct s2n_blob *key);
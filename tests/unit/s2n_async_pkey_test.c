@@ -0,0 +1,224 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include "testlib/s2n_testlib.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include <s2n.h>
+
+#include "tls/s2n_connection.h"
+
+#include "utils/s2n_safety.h"
+
+static struct s2n_async_pkey_op *pending_op;
+static int ops_invoked;
+static s2n_async_pkey_op_type last_op_type;
+
+/* Hold on to the operation, to be performed between calls to s2n_negotiate() */
+static int async_pkey_store(struct s2n_connection *conn, struct s2n_async_pkey_op *op)
+{
+    S2N_ERROR_IF(pending_op != NULL, S2N_ERR_SAFETY);
+
+    pending_op = op;
+    ops_invoked++;
+    GUARD(s2n_async_pkey_op_get_op_type(op, &last_op_type));
+
+    return 0;
+}
+
+/* Do the whole operation before returning */
+static int async_pkey_inline(struct s2n_connection *conn, struct s2n_async_pkey_op *op)
+{
+    ops_invoked++;
+    GUARD(s2n_async_pkey_op_get_op_type(op, &last_op_type));
+    GUARD(s2n_async_pkey_op_perform(op));
+    GUARD(s2n_async_pkey_op_apply(op, conn));
+    GUARD(s2n_async_pkey_op_free(op));
+
+    return 0;
+}
+
+static int async_pkey_fail(struct s2n_connection *conn, struct s2n_async_pkey_op *op)
+{
+    GUARD(s2n_async_pkey_op_free(op));
+
+    return -1;
+}
+
+static int s2n_test_async_handshake(struct s2n_connection *server_conn, struct s2n_connection *client_conn)
+{
+    s2n_blocked_status server_blocked = S2N_BLOCKED_ON_READ;
+    s2n_blocked_status client_blocked = S2N_BLOCKED_ON_READ;
+
+    do {
+        if (client_blocked != S2N_NOT_BLOCKED) {
+            s2n_errno = S2N_ERR_T_OK;
+            if (s2n_negotiate(client_conn, &client_blocked) < 0) {
+                S2N_ERROR_IF(s2n_error_get_type(s2n_errno) != S2N_ERR_T_BLOCKED, s2n_errno);
+            }
+        }
+        if (server_blocked != S2N_NOT_BLOCKED) {
+            s2n_errno = S2N_ERR_T_OK;
+            if (s2n_negotiate(server_conn, &server_blocked) < 0) {
+                S2N_ERROR_IF(s2n_error_get_type(s2n_errno) != S2N_ERR_T_BLOCKED, s2n_errno);
+            }
+        }
+
+        if (server_blocked == S2N_BLOCKED_ON_APPLICATION) {
+            S2N_ERROR_IF(pending_op == NULL, S2N_ERR_SAFETY);
+
+            /* Nothing moves until the operation is applied */
+            S2N_ERROR_IF(s2n_negotiate(server_conn, &server_blocked) == 0, S2N_ERR_SAFETY);
+            S2N_ERROR_IF(s2n_errno != S2N_ERR_ASYNC_BLOCKED || server_blocked != S2N_BLOCKED_ON_APPLICATION, S2N_ERR_SAFETY);
+            S2N_ERROR_IF(s2n_async_pkey_op_apply(pending_op, server_conn) == 0, S2N_ERR_SAFETY);
+
+            GUARD(s2n_async_pkey_op_perform(pending_op));
+            S2N_ERROR_IF(s2n_async_pkey_op_perform(pending_op) == 0, S2N_ERR_SAFETY);
+            GUARD(s2n_async_pkey_op_apply(pending_op, server_conn));
+            S2N_ERROR_IF(s2n_async_pkey_op_apply(pending_op, server_conn) == 0, S2N_ERR_SAFETY);
+            GUARD(s2n_async_pkey_op_free(pending_op));
+            pending_op = NULL;
+        }
+    } while (server_blocked != S2N_NOT_BLOCKED || client_blocked != S2N_NOT_BLOCKED);
+
+    return 0;
+}
+
+static int s2n_test_ping_pong(struct s2n_connection *server_conn, struct s2n_connection *client_conn)
+{
+    s2n_blocked_status blocked;
+    uint8_t buf[64];
+
+    S2N_ERROR_IF(s2n_send(client_conn, "ping", 4, &blocked) != 4, S2N_ERR_SAFETY);
+    S2N_ERROR_IF(s2n_recv(server_conn, buf, sizeof(buf), &blocked) != 4 || memcmp(buf, "ping", 4), S2N_ERR_SAFETY);
+    S2N_ERROR_IF(s2n_send(server_conn, "pong", 4, &blocked) != 4, S2N_ERR_SAFETY);
+    S2N_ERROR_IF(s2n_recv(client_conn, buf, sizeof(buf), &blocked) != 4 || memcmp(buf, "pong", 4), S2N_ERR_SAFETY);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *server_config;
+    struct s2n_config *client_config;
+    struct s2n_connection *server_conn;
+    struct s2n_connection *client_conn;
+    struct s2n_test_io_buffer client_to_server;
+    struct s2n_test_io_buffer server_to_client;
+    s2n_blocked_status blocked;
+    char *cert_chain_pem;
+    char *private_key_pem;
+    char *dhparams_pem;
+    /* ECDHE and DHE sign the ServerKeyExchange, RSA key exchange decrypts the ClientKeyExchange */
+    const char *cipher_prefs[] = { "default", "20150214", "20140601" };
+    const int use_dhparams[] = { 1, 1, 0 };
+    const s2n_async_pkey_op_type op_types[] = { S2N_ASYNC_SIGN, S2N_ASYNC_SIGN, S2N_ASYNC_DECRYPT };
+
+    BEGIN_TEST();
+
+    EXPECT_SUCCESS(setenv("S2N_ENABLE_CLIENT_MODE", "1", 0));
+
+    EXPECT_NOT_NULL(cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(dhparams_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_DHPARAMS, dhparams_pem, S2N_MAX_TEST_PEM_SIZE));
+
+    EXPECT_NOT_NULL(server_config = s2n_config_new());
+    EXPECT_FAILURE(s2n_config_set_async_pkey_callback(NULL, async_pkey_store));
+    EXPECT_SUCCESS(s2n_config_set_async_pkey_callback(server_config, async_pkey_store));
+    EXPECT_SUCCESS(s2n_config_set_async_pkey_callback(server_config, NULL));
+    EXPECT_SUCCESS(s2n_config_free(server_config));
+
+    for (int p = 0; p < sizeof(cipher_prefs) / sizeof(cipher_prefs[0]); p++) {
+        EXPECT_NOT_NULL(server_config = s2n_config_new());
+        EXPECT_SUCCESS(s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem));
+        if (use_dhparams[p]) {
+            EXPECT_SUCCESS(s2n_config_add_dhparams(server_config, dhparams_pem));
+        }
+        EXPECT_SUCCESS(s2n_config_set_cipher_preferences(server_config, cipher_prefs[p]));
+        EXPECT_NOT_NULL(client_config = s2n_config_new());
+        EXPECT_SUCCESS(s2n_config_disable_x509_verification(client_config));
+        EXPECT_SUCCESS(s2n_config_set_cipher_preferences(client_config, cipher_prefs[p]));
+
+        EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+        EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server, 0));
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 0));
+
+        /* The operation is performed and applied in between calls to s2n_negotiate() */
+        EXPECT_SUCCESS(s2n_config_set_async_pkey_callback(server_config, async_pkey_store));
+        EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+        EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+        EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+        ops_invoked = 0;
+        EXPECT_SUCCESS(s2n_test_async_handshake(server_conn, client_conn));
+        EXPECT_EQUAL(ops_invoked, 1);
+        EXPECT_EQUAL(last_op_type, op_types[p]);
+        EXPECT_NULL(pending_op);
+        EXPECT_SUCCESS(s2n_test_ping_pong(server_conn, client_conn));
+        EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+
+        /* The operation is done inside the callback, and the handshake never blocks on it */
+        EXPECT_SUCCESS(s2n_connection_wipe(server_conn));
+        EXPECT_SUCCESS(s2n_connection_wipe(client_conn));
+        EXPECT_SUCCESS(s2n_config_set_async_pkey_callback(server_config, async_pkey_inline));
+        EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+        EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+        EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+        ops_invoked = 0;
+        EXPECT_SUCCESS(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+        EXPECT_EQUAL(ops_invoked, 1);
+        EXPECT_EQUAL(last_op_type, op_types[p]);
+        EXPECT_SUCCESS(s2n_test_ping_pong(server_conn, client_conn));
+        EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+
+        /* A callback that fails fails the handshake */
+        EXPECT_SUCCESS(s2n_connection_wipe(server_conn));
+        EXPECT_SUCCESS(s2n_connection_wipe(client_conn));
+        EXPECT_SUCCESS(s2n_config_set_async_pkey_callback(server_config, async_pkey_fail));
+        EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+        EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+        EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+        EXPECT_FAILURE(s2n_negotiate(client_conn, &blocked));
+        EXPECT_EQUAL(blocked, S2N_BLOCKED_ON_READ);
+        if (op_types[p] == S2N_ASYNC_DECRYPT) {
+            /* RSA key exchange only decrypts once the client has sent its key */
+            EXPECT_EQUAL(s2n_negotiate(server_conn, &blocked), -1);
+            EXPECT_EQUAL(s2n_errno, S2N_ERR_BLOCKED);
+            EXPECT_FAILURE(s2n_negotiate(client_conn, &blocked));
+        }
+        EXPECT_EQUAL(s2n_negotiate(server_conn, &blocked), -1);
+        EXPECT_EQUAL(s2n_errno, S2N_ERR_ASYNC_CALLBACK_FAILED);
+
+        EXPECT_SUCCESS(s2n_connection_free(server_conn));
+        EXPECT_SUCCESS(s2n_connection_free(client_conn));
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server));
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+        EXPECT_SUCCESS(s2n_config_free(server_config));
+        EXPECT_SUCCESS(s2n_config_free(client_config));
+    }
+
+    free(cert_chain_pem);
+    free(private_key_pem);
+    free(dhparams_pem);
+
+    END_TEST();
+}
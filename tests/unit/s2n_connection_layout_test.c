@@ -0,0 +1,178 @@
+/*
+ * Copyright 2014 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <s2n.h>
+
+#include "tls/s2n_connection.h"
+#include "tls/s2n_crypto.h"
+
+#define CACHE_LINE 64
+
+/* The fields s2n_send and s2n_recv touch for every record fit in this many
+ * cache lines, including the gaps between the reader's and the writer's.
+ */
+#define RECORD_PATH_LINES 10
+
+/* Everything in the connection other than its two sets of crypto parameters,
+ * and the gaps between the reader's and the writer's state
+ */
+#define CONNECTION_OVERHEAD_MAX (1024 + 3 * CACHE_LINE)
+
+#define FIELD_END( type, field ) (offsetof(type, field) + sizeof(((type *) 0)->field))
+
+#define EXPECT_RECORD_PATH( field ) \
+    EXPECT_TRUE(FIELD_END(struct s2n_connection, field) <= RECORD_PATH_LINES * CACHE_LINE)
+
+/* Shared fields come before the reader's, and the reader's before the writer's, with a cache line in between */
+#define EXPECT_SHARED( field ) do { \
+    EXPECT_RECORD_PATH(field); \
+    EXPECT_TRUE(FIELD_END(struct s2n_connection, field) + CACHE_LINE <= offsetof(struct s2n_connection, recv)); \
+} while (0)
+
+#define EXPECT_READER( field ) do { \
+    EXPECT_RECORD_PATH(field); \
+    EXPECT_TRUE(offsetof(struct s2n_connection, field) >= FIELD_END(struct s2n_connection, reader_gap)); \
+    EXPECT_TRUE(FIELD_END(struct s2n_connection, field) <= offsetof(struct s2n_connection, writer_gap)); \
+} while (0)
+
+#define EXPECT_WRITER( field ) do { \
+    EXPECT_RECORD_PATH(field); \
+    EXPECT_TRUE(offsetof(struct s2n_connection, field) >= FIELD_END(struct s2n_connection, writer_gap)); \
+    EXPECT_TRUE(FIELD_END(struct s2n_connection, field) <= offsetof(struct s2n_connection, handshake_gap)); \
+} while (0)
+
+#define EXPECT_CRYPTO_RECORD_PATH( field ) \
+    EXPECT_TRUE(FIELD_END(struct s2n_crypto_parameters, field) <= 2 * CACHE_LINE)
+
+#define EXPECT_COLD( field ) \
+    EXPECT_TRUE(offsetof(struct s2n_connection, field) >= FIELD_END(struct s2n_connection, secure))
+
+int main(int argc, char **argv)
+{
+    struct s2n_connection *conn;
+
+    BEGIN_TEST();
+
+    EXPECT_SUCCESS(setenv("S2N_ENABLE_CLIENT_MODE", "1", 0));
+
+    /* The record path is packed at the start of the connection */
+    EXPECT_SHARED(config);
+    EXPECT_SHARED(client);
+    EXPECT_SHARED(server);
+    EXPECT_SHARED(mode);
+    EXPECT_SHARED(managed_io);
+    EXPECT_SHARED(corked_io);
+    EXPECT_SHARED(actual_protocol_version);
+    EXPECT_SHARED(buffers_released);
+    EXPECT_SHARED(closing);
+    EXPECT_SHARED(closed);
+
+    /* The reader's and the writer's state don't share cache lines with each other */
+    EXPECT_READER(recv);
+    EXPECT_READER(recv_io_context);
+    EXPECT_READER(ktls_recv_enabled);
+    EXPECT_READER(header_in);
+    EXPECT_READER(in);
+    EXPECT_READER(in_status);
+    EXPECT_READER(buffer_in);
+    EXPECT_READER(alert_in);
+    EXPECT_READER(reader_alert_out);
+    EXPECT_READER(wire_bytes_in);
+
+    EXPECT_WRITER(send);
+    EXPECT_WRITER(send_io_context);
+    EXPECT_WRITER(ktls_send_enabled);
+    EXPECT_WRITER(close_notify_queued);
+    EXPECT_WRITER(out);
+    EXPECT_WRITER(writer_alert_out);
+    EXPECT_WRITER(max_outgoing_fragment_length);
+    EXPECT_WRITER(current_user_data_consumed);
+    EXPECT_WRITER(dynamic_record_resize_threshold);
+    EXPECT_WRITER(dynamic_record_timeout_threshold);
+    EXPECT_WRITER(active_application_bytes_consumed);
+    EXPECT_WRITER(wire_bytes_out);
+    EXPECT_WRITER(write_timer);
+    EXPECT_WRITER(delay);
+
+    EXPECT_TRUE(sizeof(((struct s2n_connection *) 0)->reader_gap) >= CACHE_LINE);
+    EXPECT_TRUE(sizeof(((struct s2n_connection *) 0)->writer_gap) >= CACHE_LINE);
+    EXPECT_TRUE(sizeof(((struct s2n_connection *) 0)->handshake_gap) >= CACHE_LINE);
+
+    /* ... and so are the crypto parameters each record uses, apart from the MAC state */
+    EXPECT_CRYPTO_RECORD_PATH(cipher_suite);
+    EXPECT_CRYPTO_RECORD_PATH(record_protection);
+    EXPECT_CRYPTO_RECORD_PATH(client_key);
+    EXPECT_CRYPTO_RECORD_PATH(server_key);
+    EXPECT_CRYPTO_RECORD_PATH(client_sequence_number);
+    EXPECT_CRYPTO_RECORD_PATH(server_sequence_number);
+    EXPECT_CRYPTO_RECORD_PATH(client_implicit_iv);
+    EXPECT_CRYPTO_RECORD_PATH(server_implicit_iv);
+    EXPECT_TRUE(offsetof(struct s2n_crypto_parameters, client_record_mac) < offsetof(struct s2n_crypto_parameters, server_public_key));
+
+    /* The handshake comes after the record path, and data the record path never looks at comes last */
+    EXPECT_TRUE(offsetof(struct s2n_connection, handshake) >= FIELD_END(struct s2n_connection, handshake_gap));
+    EXPECT_TRUE(offsetof(struct s2n_connection, initial) > offsetof(struct s2n_connection, handshake));
+    EXPECT_COLD(context);
+    EXPECT_COLD(client_cert_auth_type);
+    EXPECT_COLD(released_in_size);
+    EXPECT_COLD(server_name);
+    EXPECT_COLD(application_protocol);
+    EXPECT_COLD(status_response);
+    EXPECT_COLD(ct_response);
+    EXPECT_COLD(client_hello);
+    EXPECT_COLD(x509_validator);
+    EXPECT_COLD(verify_host_fn);
+
+    /* Large data isn't kept inline */
+    EXPECT_TRUE(sizeof(struct s2n_connection) - 2 * sizeof(struct s2n_crypto_parameters) <= CONNECTION_OVERHEAD_MAX);
+
+    /* Names are only allocated once they are set, and released when the connection is wiped */
+    EXPECT_NOT_NULL(conn = s2n_connection_new(S2N_CLIENT));
+    EXPECT_NULL(conn->server_name.data);
+    EXPECT_NULL(conn->application_protocol.data);
+    EXPECT_NULL(s2n_get_server_name(conn));
+    EXPECT_NULL(s2n_get_application_protocol(conn));
+
+    EXPECT_SUCCESS(s2n_set_server_name(conn, "www.example.com"));
+    EXPECT_STRING_EQUAL(s2n_get_server_name(conn), "www.example.com");
+    EXPECT_EQUAL(conn->server_name.size, strlen("www.example.com") + 1);
+    EXPECT_SUCCESS(s2n_set_server_name(conn, "example.com"));
+    EXPECT_STRING_EQUAL(s2n_get_server_name(conn), "example.com");
+
+    char too_long[S2N_MAX_SERVER_NAME + 1];
+    memset(too_long, 'a', S2N_MAX_SERVER_NAME);
+    too_long[S2N_MAX_SERVER_NAME] = '\0';
+    EXPECT_FAILURE(s2n_set_server_name(conn, too_long));
+    EXPECT_STRING_EQUAL(s2n_get_server_name(conn), "example.com");
+
+    EXPECT_SUCCESS(s2n_connection_store_application_protocol(conn, (const uint8_t *) "h2", 2));
+    EXPECT_STRING_EQUAL(s2n_get_application_protocol(conn), "h2");
+
+    EXPECT_SUCCESS(s2n_connection_wipe(conn));
+    EXPECT_NULL(conn->server_name.data);
+    EXPECT_NULL(conn->application_protocol.data);
+    EXPECT_NULL(s2n_get_server_name(conn));
+
+    EXPECT_SUCCESS(s2n_set_server_name(conn, "example.com"));
+    EXPECT_SUCCESS(s2n_connection_free(conn));
+
+    END_TEST();
+}
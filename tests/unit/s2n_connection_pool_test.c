@@ -0,0 +1,146 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include "testlib/s2n_testlib.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include <s2n.h>
+
+#include "tls/s2n_config.h"
+#include "tls/s2n_connection.h"
+#include "tls/s2n_connection_pool.h"
+
+#define POOL_SIZE 4
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *server_config;
+    struct s2n_config *client_config;
+    struct s2n_connection_pool *server_pool;
+    struct s2n_connection_pool *client_pool;
+    struct s2n_connection *server_conn;
+    struct s2n_connection *client_conn;
+    struct s2n_connection *conns[POOL_SIZE + 1];
+    struct s2n_test_io_buffer client_to_server;
+    struct s2n_test_io_buffer server_to_client;
+    s2n_blocked_status blocked;
+    char *cert_chain_pem;
+    char *private_key_pem;
+    char *dhparams_pem;
+    uint8_t buf[64];
+
+    BEGIN_TEST();
+
+    EXPECT_SUCCESS(setenv("S2N_ENABLE_CLIENT_MODE", "1", 0));
+
+    EXPECT_NOT_NULL(cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(dhparams_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+
+    EXPECT_NOT_NULL(server_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_DHPARAMS, dhparams_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem));
+    EXPECT_SUCCESS(s2n_config_add_dhparams(server_config, dhparams_pem));
+
+    EXPECT_NOT_NULL(client_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_config_disable_x509_verification(client_config));
+
+    /* A pool has to hold something, and not so much that its array overflows */
+    EXPECT_NULL(s2n_connection_pool_new(S2N_SERVER, 0));
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_INVALID_CONNECTION_POOL_SIZE);
+    EXPECT_NULL(s2n_connection_pool_new(S2N_SERVER, S2N_CONNECTION_POOL_MAX_CAPACITY + 1));
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_INVALID_CONNECTION_POOL_SIZE);
+    EXPECT_NULL(s2n_connection_pool_new(S2N_SERVER, UINT32_MAX));
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_INVALID_CONNECTION_POOL_SIZE);
+
+    /* Pools start out full */
+    EXPECT_NOT_NULL(server_pool = s2n_connection_pool_new(S2N_SERVER, POOL_SIZE));
+    EXPECT_NOT_NULL(client_pool = s2n_connection_pool_new(S2N_CLIENT, 1));
+    EXPECT_EQUAL(s2n_connection_pool_get_available(server_pool), POOL_SIZE);
+    EXPECT_EQUAL(s2n_connection_pool_get_hits(server_pool), 0);
+    EXPECT_EQUAL(s2n_connection_pool_get_misses(server_pool), 0);
+
+    /* Connections come out of the pool until it runs dry, then they're made on demand */
+    for (int i = 0; i < POOL_SIZE + 1; i++) {
+        EXPECT_NOT_NULL(conns[i] = s2n_connection_pool_get(server_pool));
+        EXPECT_EQUAL(conns[i]->mode, S2N_SERVER);
+        for (int j = 0; j < i; j++) {
+            EXPECT_NOT_EQUAL(conns[i], conns[j]);
+        }
+    }
+    EXPECT_EQUAL(s2n_connection_pool_get_available(server_pool), 0);
+    EXPECT_EQUAL(s2n_connection_pool_get_hits(server_pool), POOL_SIZE);
+    EXPECT_EQUAL(s2n_connection_pool_get_misses(server_pool), 1);
+
+    /* Anything that doesn't fit back in the pool is freed */
+    for (int i = 0; i < POOL_SIZE + 1; i++) {
+        EXPECT_SUCCESS(s2n_connection_pool_put(server_pool, conns[i]));
+    }
+    EXPECT_EQUAL(s2n_connection_pool_get_available(server_pool), POOL_SIZE);
+
+    /* Connections can only go back to a pool of the same mode */
+    EXPECT_NOT_NULL(client_conn = s2n_connection_pool_get(client_pool));
+    EXPECT_EQUAL(s2n_connection_pool_put(server_pool, client_conn), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_CONNECTION_POOL_MODE);
+
+    /* A pooled connection is as good as a new one, and comes back wiped */
+    for (int round = 0; round < 3; round++) {
+        EXPECT_NOT_NULL(server_conn = s2n_connection_pool_get(server_pool));
+        EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+        EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server, 0));
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 0));
+        EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+
+        EXPECT_SUCCESS(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+        EXPECT_EQUAL(s2n_send(client_conn, "hello", 5, &blocked), 5);
+        EXPECT_EQUAL(s2n_recv(server_conn, buf, sizeof(buf), &blocked), 5);
+        EXPECT_EQUAL(memcmp(buf, "hello", 5), 0);
+        EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+
+        EXPECT_SUCCESS(s2n_connection_pool_put(server_pool, server_conn));
+        EXPECT_SUCCESS(s2n_connection_pool_put(client_pool, client_conn));
+        EXPECT_EQUAL(server_conn->handshake.message_number, 0);
+        EXPECT_EQUAL(server_conn->wire_bytes_in, 0);
+        EXPECT_EQUAL(server_conn->config, s2n_fetch_default_config());
+
+        /* The most recently returned connection is handed out next */
+        EXPECT_EQUAL(s2n_connection_pool_get(client_pool), client_conn);
+
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server));
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+    }
+    EXPECT_EQUAL(s2n_connection_pool_get_hits(server_pool), POOL_SIZE + 3);
+    EXPECT_EQUAL(s2n_connection_pool_get_misses(server_pool), 1);
+
+    EXPECT_SUCCESS(s2n_connection_free(client_conn));
+    EXPECT_SUCCESS(s2n_connection_pool_free(server_pool));
+    EXPECT_SUCCESS(s2n_connection_pool_free(client_pool));
+    EXPECT_SUCCESS(s2n_config_free(server_config));
+    EXPECT_SUCCESS(s2n_config_free(client_config));
+
+    free(cert_chain_pem);
+    free(private_key_pem);
+    free(dhparams_pem);
+
+    END_TEST();
+}
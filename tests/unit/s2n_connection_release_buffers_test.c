@@ -0,0 +1,142 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include "testlib/s2n_testlib.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include <s2n.h>
+
+#include "tls/s2n_connection.h"
+#include "tls/s2n_record.h"
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *server_config;
+    struct s2n_config *client_config;
+    struct s2n_connection *server_conn;
+    struct s2n_connection *client_conn;
+    struct s2n_test_io_buffer client_to_server;
+    struct s2n_test_io_buffer server_to_client;
+    s2n_blocked_status blocked;
+    char *cert_chain_pem;
+    char *private_key_pem;
+    char *dhparams_pem;
+    uint8_t buf[64];
+
+    BEGIN_TEST();
+
+    EXPECT_SUCCESS(setenv("S2N_ENABLE_CLIENT_MODE", "1", 0));
+
+    EXPECT_NOT_NULL(cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(dhparams_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+
+    EXPECT_NOT_NULL(server_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_DHPARAMS, dhparams_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem));
+    EXPECT_SUCCESS(s2n_config_add_dhparams(server_config, dhparams_pem));
+
+    EXPECT_NOT_NULL(client_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_config_disable_x509_verification(client_config));
+
+    EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+    EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+    EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+    EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+
+    EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server, 0));
+    EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 0));
+    EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+
+    /* A connection that hasn't started its handshake can let go of its buffers */
+    EXPECT_FAILURE(s2n_connection_release_buffers(NULL));
+    EXPECT_SUCCESS(s2n_connection_release_buffers(server_conn));
+    EXPECT_EQUAL(server_conn->in.blob.size, 0);
+    EXPECT_EQUAL(server_conn->out.blob.size, 0);
+    EXPECT_EQUAL(server_conn->handshake.io.blob.size, 0);
+    EXPECT_EQUAL(server_conn->client_hello.raw_message.blob.size, 0);
+
+    EXPECT_SUCCESS(s2n_connection_set_read_ahead(server_conn, 4096));
+    EXPECT_SUCCESS(s2n_connection_set_send_buffer_size(client_conn, 4 * S2N_LARGE_RECORD_LENGTH));
+
+    /* ... and s2n_negotiate takes them back */
+    EXPECT_SUCCESS(s2n_connection_release_buffers(server_conn));
+    EXPECT_SUCCESS(s2n_connection_release_buffers(client_conn));
+    EXPECT_EQUAL(client_conn->out.blob.size, 0);
+    EXPECT_EQUAL(s2n_negotiate(client_conn, &blocked), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_BLOCKED);
+    EXPECT_EQUAL(blocked, S2N_BLOCKED_ON_READ);
+    EXPECT_EQUAL(client_conn->out.blob.size, 4 * S2N_LARGE_RECORD_LENGTH);
+    EXPECT_SUCCESS(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+
+    /* Once the handshake is done, everything but the ClientHello goes */
+    uint32_t client_hello_length = s2n_client_hello_get_raw_message_length(s2n_connection_get_client_hello(server_conn));
+    EXPECT_TRUE(client_hello_length > 0);
+    EXPECT_SUCCESS(s2n_connection_release_buffers(server_conn));
+    EXPECT_SUCCESS(s2n_connection_release_buffers(client_conn));
+    EXPECT_EQUAL(server_conn->buffer_in.blob.size, 0);
+    EXPECT_EQUAL(client_conn->out.blob.size, 0);
+    EXPECT_EQUAL(s2n_client_hello_get_raw_message_length(s2n_connection_get_client_hello(server_conn)), client_hello_length);
+
+    /* Buffers come back at the size they were when they were released */
+    EXPECT_EQUAL(s2n_send(client_conn, "hello world", 11, &blocked), 11);
+    EXPECT_EQUAL(client_conn->out.blob.size, 4 * S2N_LARGE_RECORD_LENGTH);
+
+    /* Data that has arrived but hasn't been read doesn't hold on to the buffers */
+    EXPECT_SUCCESS(s2n_connection_release_buffers(client_conn));
+
+    /* ... but a record that's only been partly read does */
+    EXPECT_EQUAL(s2n_recv(server_conn, buf, 5, &blocked), 5);
+    EXPECT_EQUAL(server_conn->buffer_in.blob.size, 4096);
+    EXPECT_EQUAL(s2n_connection_release_buffers(server_conn), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_CONNECTION_BUFFERS_IN_USE);
+    EXPECT_EQUAL(s2n_recv(server_conn, buf + 5, 6, &blocked), 6);
+    EXPECT_EQUAL(memcmp(buf, "hello world", 11), 0);
+
+    /* Released buffers go to a pool, and are the first to be handed out again */
+    uint8_t *server_out = server_conn->out.blob.data;
+    EXPECT_SUCCESS(s2n_connection_release_buffers(server_conn));
+    EXPECT_EQUAL(s2n_send(server_conn, "hello back", 10, &blocked), 10);
+    EXPECT_EQUAL(server_conn->out.blob.data, server_out);
+    EXPECT_EQUAL(s2n_recv(client_conn, buf, sizeof(buf), &blocked), 10);
+    EXPECT_EQUAL(memcmp(buf, "hello back", 10), 0);
+
+    /* Connections with released buffers can still be shut down, wiped and freed */
+    EXPECT_SUCCESS(s2n_connection_release_buffers(server_conn));
+    EXPECT_SUCCESS(s2n_connection_release_buffers(client_conn));
+    EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+    EXPECT_SUCCESS(s2n_connection_wipe(server_conn));
+    EXPECT_EQUAL(server_conn->in.blob.size, S2N_LARGE_FRAGMENT_LENGTH);
+    EXPECT_SUCCESS(s2n_connection_release_buffers(server_conn));
+
+    EXPECT_SUCCESS(s2n_connection_free(server_conn));
+    EXPECT_SUCCESS(s2n_connection_free(client_conn));
+    EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server));
+    EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+    EXPECT_SUCCESS(s2n_config_free(server_config));
+    EXPECT_SUCCESS(s2n_config_free(client_config));
+
+    free(cert_chain_pem);
+    free(private_key_pem);
+    free(dhparams_pem);
+
+    END_TEST();
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include "testlib/s2n_testlib.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include <s2n.h>
+
+#include "tls/s2n_cipher_suites.h"
+#include "tls/s2n_connection.h"
+#include "tls/s2n_tls_parameters.h"
+
+#include "utils/s2n_safety.h"
+
+static int s2n_expect_wiped(struct s2n_connection *conn, s2n_mode mode)
+{
+    eq_check(conn->mode, mode);
+    eq_check(conn->context, NULL);
+    eq_check(conn->server_name.data, NULL);
+    eq_check(conn->session_id_len, 0);
+    eq_check(conn->handshake.message_number, 0);
+    eq_check(conn->handshake.handshake_type, INITIAL);
+    eq_check(conn->initial.cipher_suite, &s2n_null_cipher_suite);
+    eq_check(conn->secure.cipher_suite, &s2n_null_cipher_suite);
+    eq_check(conn->client, &conn->initial);
+    eq_check(conn->server, &conn->initial);
+    eq_check(conn->secure.client_record_mac.alg, S2N_HMAC_NONE);
+    eq_check(conn->secure.server_record_mac.alg, S2N_HMAC_NONE);
+    eq_check(conn->secure.signature_hash.alg, S2N_HASH_NONE);
+    eq_check(s2n_stuffer_data_available(&conn->in), 0);
+    eq_check(s2n_stuffer_data_available(&conn->out), 0);
+    eq_check(conn->handshake.io.blob.size, S2N_LARGE_RECORD_LENGTH);
+    eq_check(conn->client_hello.raw_message.blob.size, S2N_LARGE_RECORD_LENGTH);
+    notnull_check(conn->handshake.hashes);
+    notnull_check(conn->prf_space);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *server_config;
+    struct s2n_config *client_config;
+    struct s2n_connection *server_conn;
+    struct s2n_connection *client_conn;
+    struct s2n_test_io_buffer client_to_server;
+    struct s2n_test_io_buffer server_to_client;
+    s2n_blocked_status blocked;
+    char *cert_chain_pem;
+    char *private_key_pem;
+    uint8_t buf[64];
+    /* An AEAD suite, and a CBC one */
+    const char *cipher_prefs[] = { "default", "20140601" };
+
+    BEGIN_TEST();
+
+    EXPECT_SUCCESS(setenv("S2N_ENABLE_CLIENT_MODE", "1", 0));
+
+    EXPECT_NOT_NULL(cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE));
+
+    /* Wiping a connection that was never used, over and over, leaves it as it was */
+    EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+    EXPECT_SUCCESS(s2n_expect_wiped(server_conn, S2N_SERVER));
+    for (int i = 0; i < 3; i++) {
+        EXPECT_SUCCESS(s2n_connection_wipe(server_conn));
+        EXPECT_SUCCESS(s2n_expect_wiped(server_conn, S2N_SERVER));
+    }
+
+    /* Digests that were keyed or fed are put back to their initial state */
+    uint8_t mac_key[SHA256_DIGEST_LENGTH] = { 1 };
+    EXPECT_SUCCESS(s2n_hmac_init(&server_conn->secure.client_record_mac, S2N_HMAC_SHA256, mac_key, sizeof(mac_key)));
+    EXPECT_SUCCESS(s2n_hmac_update(&server_conn->secure.client_record_mac, "hello", 5));
+    EXPECT_SUCCESS(s2n_hash_init(&server_conn->secure.signature_hash, S2N_HASH_SHA256));
+    EXPECT_SUCCESS(s2n_hash_update(&server_conn->secure.signature_hash, "hello", 5));
+    EXPECT_SUCCESS(s2n_connection_wipe(server_conn));
+    EXPECT_SUCCESS(s2n_expect_wiped(server_conn, S2N_SERVER));
+    EXPECT_EQUAL(server_conn->secure.client_record_mac.currently_in_hash_block, 0);
+    EXPECT_EQUAL(server_conn->secure.signature_hash.currently_in_hash, 0);
+    EXPECT_TRUE(s2n_hash_is_ready_for_input(&server_conn->secure.signature_hash));
+    EXPECT_SUCCESS(s2n_connection_free(server_conn));
+
+    for (int p = 0; p < sizeof(cipher_prefs) / sizeof(cipher_prefs[0]); p++) {
+        EXPECT_NOT_NULL(server_config = s2n_config_new());
+        EXPECT_SUCCESS(s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem));
+        EXPECT_SUCCESS(s2n_config_set_cipher_preferences(server_config, cipher_prefs[p]));
+        EXPECT_NOT_NULL(client_config = s2n_config_new());
+        EXPECT_SUCCESS(s2n_config_disable_x509_verification(client_config));
+        EXPECT_SUCCESS(s2n_config_set_cipher_preferences(client_config, cipher_prefs[p]));
+
+        EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+        EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+
+        for (int i = 0; i < 3; i++) {
+            EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+            EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+            EXPECT_SUCCESS(s2n_connection_set_ctx(server_conn, buf));
+            EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server, 0));
+            EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 0));
+            EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+
+            EXPECT_SUCCESS(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+            EXPECT_EQUAL(s2n_send(client_conn, "hello world", 11, &blocked), 11);
+            EXPECT_EQUAL(s2n_recv(server_conn, buf, sizeof(buf), &blocked), 11);
+            EXPECT_EQUAL(memcmp(buf, "hello world", 11), 0);
+
+            EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+
+            /* Wiping resets the connection in place: the record buffers and
+             * cipher contexts are the ones the last connection used.
+             */
+            uint8_t *in = server_conn->in.blob.data;
+            uint8_t *out = server_conn->out.blob.data;
+            void *client_key = server_conn->secure.client_key.evp_cipher_ctx;
+            void *server_key = server_conn->secure.server_key.evp_cipher_ctx;
+
+            EXPECT_SUCCESS(s2n_connection_wipe(server_conn));
+            EXPECT_SUCCESS(s2n_connection_wipe(client_conn));
+            EXPECT_SUCCESS(s2n_expect_wiped(server_conn, S2N_SERVER));
+            EXPECT_SUCCESS(s2n_expect_wiped(client_conn, S2N_CLIENT));
+            EXPECT_EQUAL(server_conn->in.blob.data, in);
+            EXPECT_EQUAL(server_conn->out.blob.data, out);
+            EXPECT_EQUAL(server_conn->secure.client_key.evp_cipher_ctx, client_key);
+            EXPECT_EQUAL(server_conn->secure.server_key.evp_cipher_ctx, server_key);
+
+            EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server));
+            EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+        }
+
+        EXPECT_SUCCESS(s2n_connection_free(server_conn));
+        EXPECT_SUCCESS(s2n_connection_free(client_conn));
+        EXPECT_SUCCESS(s2n_config_free(server_config));
+        EXPECT_SUCCESS(s2n_config_free(client_config));
+    }
+
+    free(cert_chain_pem);
+    free(private_key_pem);
+
+    END_TEST();
+}
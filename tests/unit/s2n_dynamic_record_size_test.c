@@ -0,0 +1,173 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include "testlib/s2n_testlib.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include <s2n.h>
+
+#include "tls/s2n_connection.h"
+#include "tls/s2n_record.h"
+
+#define DATA_SIZE 100000
+#define RESIZE_THRESHOLD 20000
+
+/* Walk the records waiting in the buffer. Check that every record sent before
+ * the threshold fits in a TCP segment, and that full sized records follow.
+ * Returns the number of records, or -1 if one of them is the wrong size.
+ */
+static int check_record_sizes(struct s2n_stuffer *wire, uint32_t small_records_expected)
+{
+    uint8_t *data = wire->blob.data + wire->read_cursor;
+    uint32_t available = s2n_stuffer_data_available(wire);
+    uint32_t records = 0;
+
+    for (uint32_t offset = 0; offset < available; records++) {
+        uint16_t length = (data[offset + 3] << 8) | data[offset + 4];
+        uint32_t record_size = S2N_TLS_RECORD_HEADER_LENGTH + length;
+
+        if (records < small_records_expected) {
+            if (record_size > S2N_SMALL_RECORD_LENGTH) {
+                return -1;
+            }
+        } else if (offset + record_size < available && record_size <= S2N_DEFAULT_RECORD_LENGTH) {
+            /* Only the last record may be short */
+            return -1;
+        }
+
+        offset += record_size;
+    }
+
+    return records;
+}
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *server_config;
+    struct s2n_config *client_config;
+    struct s2n_connection *server_conn;
+    struct s2n_connection *client_conn;
+    struct s2n_test_io_buffer client_to_server;
+    struct s2n_test_io_buffer server_to_client;
+    s2n_blocked_status blocked;
+    char *cert_chain_pem;
+    char *private_key_pem;
+    char *dhparams_pem;
+    uint8_t *data;
+    uint8_t *received;
+
+    BEGIN_TEST();
+
+    EXPECT_SUCCESS(setenv("S2N_ENABLE_CLIENT_MODE", "1", 0));
+
+    EXPECT_NOT_NULL(cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(dhparams_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(data = malloc(DATA_SIZE));
+    EXPECT_NOT_NULL(received = malloc(DATA_SIZE));
+    memset(data, 'a', DATA_SIZE);
+
+    EXPECT_NOT_NULL(server_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_DHPARAMS, dhparams_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem));
+    EXPECT_SUCCESS(s2n_config_add_dhparams(server_config, dhparams_pem));
+
+    EXPECT_NOT_NULL(client_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_config_disable_x509_verification(client_config));
+
+    EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+    EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+    EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+    EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+
+    EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server, 0));
+    EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 0));
+    EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+
+    EXPECT_FAILURE(s2n_connection_set_dynamic_record_threshold(server_conn, S2N_TLS_MAX_RESIZE_THRESHOLD + 1, 1));
+    EXPECT_SUCCESS(s2n_connection_set_dynamic_record_threshold(server_conn, RESIZE_THRESHOLD, 1));
+    EXPECT_EQUAL(server_conn->max_outgoing_fragment_length, S2N_LARGE_FRAGMENT_LENGTH);
+
+    EXPECT_SUCCESS(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+
+    int min_payload_size = s2n_record_min_write_payload_size(server_conn);
+    int max_payload_size = s2n_record_max_write_payload_size(server_conn);
+    EXPECT_TRUE(min_payload_size < max_payload_size);
+    int small_records = (RESIZE_THRESHOLD + min_payload_size - 1) / min_payload_size;
+
+    /* A new connection starts with small records, then ramps up */
+    EXPECT_EQUAL(s2n_send(server_conn, data, DATA_SIZE, &blocked), DATA_SIZE);
+    int records = check_record_sizes(&server_to_client.data, small_records);
+    uint32_t large_bytes = DATA_SIZE - small_records * min_payload_size;
+    EXPECT_EQUAL(records, small_records + (large_bytes + max_payload_size - 1) / max_payload_size);
+    EXPECT_SUCCESS(s2n_test_recv_all(client_conn, received, DATA_SIZE));
+    EXPECT_EQUAL(memcmp(data, received, DATA_SIZE), 0);
+
+    /* Carrying on straight away keeps the large records */
+    EXPECT_EQUAL(s2n_send(server_conn, data, DATA_SIZE, &blocked), DATA_SIZE);
+    records = check_record_sizes(&server_to_client.data, 0);
+    EXPECT_EQUAL(records, (DATA_SIZE + max_payload_size - 1) / max_payload_size);
+    EXPECT_SUCCESS(s2n_test_recv_all(client_conn, received, DATA_SIZE));
+
+    /* After an idle period, it starts small again. Wind the timer back
+     * rather than sleeping.
+     */
+    server_conn->write_timer.time -= 2 * 1000000000ULL;
+    EXPECT_EQUAL(s2n_send(server_conn, data, DATA_SIZE, &blocked), DATA_SIZE);
+    records = check_record_sizes(&server_to_client.data, small_records);
+    EXPECT_EQUAL(records, small_records + (large_bytes + max_payload_size - 1) / max_payload_size);
+    EXPECT_SUCCESS(s2n_test_recv_all(client_conn, received, DATA_SIZE));
+    EXPECT_EQUAL(memcmp(data, received, DATA_SIZE), 0);
+
+    /* A zero threshold turns it off */
+    EXPECT_SUCCESS(s2n_connection_set_dynamic_record_threshold(server_conn, 0, 0));
+    EXPECT_EQUAL(s2n_send(server_conn, data, DATA_SIZE, &blocked), DATA_SIZE);
+    records = check_record_sizes(&server_to_client.data, 0);
+    EXPECT_EQUAL(records, (DATA_SIZE + max_payload_size - 1) / max_payload_size);
+    EXPECT_SUCCESS(s2n_test_recv_all(client_conn, received, DATA_SIZE));
+
+    /* Turning it off doesn't undo an earlier preference for small records */
+    EXPECT_SUCCESS(s2n_connection_prefer_low_latency(server_conn));
+    EXPECT_SUCCESS(s2n_connection_set_dynamic_record_threshold(server_conn, 0, 0));
+    EXPECT_EQUAL(server_conn->max_outgoing_fragment_length, S2N_SMALL_FRAGMENT_LENGTH);
+    EXPECT_EQUAL(s2n_send(server_conn, data, DATA_SIZE, &blocked), DATA_SIZE);
+    records = check_record_sizes(&server_to_client.data, UINT32_MAX);
+    EXPECT_TRUE(records >= DATA_SIZE / min_payload_size);
+    EXPECT_SUCCESS(s2n_test_recv_all(client_conn, received, DATA_SIZE));
+    EXPECT_EQUAL(memcmp(data, received, DATA_SIZE), 0);
+
+    EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+
+    EXPECT_SUCCESS(s2n_connection_free(server_conn));
+    EXPECT_SUCCESS(s2n_connection_free(client_conn));
+    EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server));
+    EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+    EXPECT_SUCCESS(s2n_config_free(server_config));
+    EXPECT_SUCCESS(s2n_config_free(client_config));
+
+    free(cert_chain_pem);
+    free(private_key_pem);
+    free(dhparams_pem);
+    free(data);
+    free(received);
+
+    END_TEST();
+}
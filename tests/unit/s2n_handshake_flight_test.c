@@ -0,0 +1,183 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include "testlib/s2n_testlib.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include <s2n.h>
+
+#include "tls/s2n_connection.h"
+#include "tls/s2n_tls_parameters.h"
+
+#include "utils/s2n_safety.h"
+
+/* Counts the writes a connection makes, and passes them on to an in-memory buffer */
+struct counting_io {
+    struct s2n_test_io_buffer *buffer;
+    uint32_t writes;
+
+    /* How many of those it took to get through the handshake */
+    uint32_t handshake_writes;
+};
+
+static int counting_write(void *io_context, const uint8_t *buf, uint32_t len)
+{
+    struct counting_io *io = (struct counting_io *) io_context;
+    io->writes++;
+
+    return s2n_test_io_buffer_write(io->buffer, buf, len);
+}
+
+static int s2n_test_handshake(struct s2n_connection *server_conn, struct s2n_connection *client_conn,
+                              struct counting_io *server_io, struct counting_io *client_io, uint32_t io_buffer_size)
+{
+    struct s2n_test_io_buffer client_to_server;
+    struct s2n_test_io_buffer server_to_client;
+    s2n_blocked_status blocked;
+    uint8_t buf[64];
+
+    GUARD(s2n_test_io_buffer_alloc(&client_to_server, io_buffer_size));
+    GUARD(s2n_test_io_buffer_alloc(&server_to_client, io_buffer_size));
+    GUARD(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+
+    server_io->buffer = &server_to_client;
+    server_io->writes = 0;
+    GUARD(s2n_connection_set_send_cb(server_conn, counting_write));
+    GUARD(s2n_connection_set_send_ctx(server_conn, server_io));
+    client_io->buffer = &client_to_server;
+    client_io->writes = 0;
+    GUARD(s2n_connection_set_send_cb(client_conn, counting_write));
+    GUARD(s2n_connection_set_send_ctx(client_conn, client_io));
+
+    GUARD(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+    server_io->handshake_writes = server_io->writes;
+    client_io->handshake_writes = client_io->writes;
+
+    /* Nothing is left behind once the handshake is done */
+    S2N_ERROR_IF(s2n_stuffer_data_available(&server_conn->out) || s2n_stuffer_data_available(&client_conn->out), S2N_ERR_SAFETY);
+    S2N_ERROR_IF(server_conn->handshake.cutting_records || client_conn->handshake.cutting_records, S2N_ERR_SAFETY);
+
+    /* Application data still flows both ways */
+    S2N_ERROR_IF(s2n_send(client_conn, "ping", 4, &blocked) != 4, S2N_ERR_SAFETY);
+    S2N_ERROR_IF(s2n_recv(server_conn, buf, sizeof(buf), &blocked) != 4 || memcmp(buf, "ping", 4), S2N_ERR_SAFETY);
+    S2N_ERROR_IF(s2n_send(server_conn, "pong", 4, &blocked) != 4, S2N_ERR_SAFETY);
+    S2N_ERROR_IF(s2n_recv(client_conn, buf, sizeof(buf), &blocked) != 4 || memcmp(buf, "pong", 4), S2N_ERR_SAFETY);
+
+    GUARD(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+
+    GUARD(s2n_test_io_buffer_free(&client_to_server));
+    GUARD(s2n_test_io_buffer_free(&server_to_client));
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *server_config;
+    struct s2n_config *client_config;
+    struct s2n_connection *server_conn;
+    struct s2n_connection *client_conn;
+    struct counting_io server_io;
+    struct counting_io client_io;
+    char *cert_chain_pem;
+    char *private_key_pem;
+    char *dhparams_pem;
+    /* ECDHE and DHE with AEAD suites, and DHE with a CBC one */
+    const char *cipher_prefs[] = { "default", "20150214", "20140601" };
+
+    BEGIN_TEST();
+
+    EXPECT_SUCCESS(setenv("S2N_ENABLE_CLIENT_MODE", "1", 0));
+
+    EXPECT_NOT_NULL(cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(dhparams_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_DHPARAMS, dhparams_pem, S2N_MAX_TEST_PEM_SIZE));
+
+    for (int p = 0; p < sizeof(cipher_prefs) / sizeof(cipher_prefs[0]); p++) {
+        EXPECT_NOT_NULL(server_config = s2n_config_new());
+        EXPECT_SUCCESS(s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem));
+        EXPECT_SUCCESS(s2n_config_add_dhparams(server_config, dhparams_pem));
+        EXPECT_SUCCESS(s2n_config_set_cipher_preferences(server_config, cipher_prefs[p]));
+        EXPECT_NOT_NULL(client_config = s2n_config_new());
+        EXPECT_SUCCESS(s2n_config_disable_x509_verification(client_config));
+        EXPECT_SUCCESS(s2n_config_set_cipher_preferences(client_config, cipher_prefs[p]));
+
+        EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+        EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+
+        /* A full handshake takes two flights each way, and each flight is a single write:
+         *   client: ClientHello
+         *   server: ServerHello, Certificate, [ServerKeyExchange,] ServerHelloDone
+         *   client: ClientKeyExchange, ChangeCipherSpec, Finished
+         *   server: ChangeCipherSpec, Finished
+         */
+        EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+        EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+        EXPECT_SUCCESS(s2n_test_handshake(server_conn, client_conn, &server_io, &client_io, 0));
+        EXPECT_EQUAL(server_io.handshake_writes, 2);
+        EXPECT_EQUAL(client_io.handshake_writes, 2);
+
+        /* The handshake messages of a flight share records */
+        EXPECT_SUCCESS(s2n_connection_wipe(server_conn));
+        EXPECT_SUCCESS(s2n_connection_wipe(client_conn));
+        EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+        EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+        EXPECT_SUCCESS(s2n_connection_prefer_throughput(server_conn));
+        EXPECT_SUCCESS(s2n_test_handshake(server_conn, client_conn, &server_io, &client_io, 0));
+        EXPECT_EQUAL(server_io.handshake_writes, 2);
+        EXPECT_EQUAL(client_io.handshake_writes, 2);
+
+        /* A peer that can only take a few bytes at a time blocks us mid flight, and
+         * we carry on from there without writing any message twice.
+         */
+        EXPECT_SUCCESS(s2n_connection_wipe(server_conn));
+        EXPECT_SUCCESS(s2n_connection_wipe(client_conn));
+        EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+        EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+        EXPECT_SUCCESS(s2n_test_handshake(server_conn, client_conn, &server_io, &client_io, 100));
+        EXPECT_TRUE(server_io.handshake_writes > 2);
+        EXPECT_TRUE(client_io.handshake_writes > 2);
+
+        /* A flight that doesn't fit in conn->out goes out as it fills up */
+        EXPECT_SUCCESS(s2n_connection_wipe(server_conn));
+        EXPECT_SUCCESS(s2n_connection_wipe(client_conn));
+        EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+        EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+        EXPECT_SUCCESS(s2n_stuffer_free(&server_conn->out));
+        EXPECT_SUCCESS(s2n_stuffer_alloc(&server_conn->out, 1024));
+        server_conn->max_outgoing_fragment_length = 256;
+        EXPECT_SUCCESS(s2n_test_handshake(server_conn, client_conn, &server_io, &client_io, 0));
+        EXPECT_TRUE(server_io.handshake_writes > 2);
+        EXPECT_EQUAL(client_io.handshake_writes, 2);
+
+        EXPECT_SUCCESS(s2n_connection_free(server_conn));
+        EXPECT_SUCCESS(s2n_connection_free(client_conn));
+        EXPECT_SUCCESS(s2n_config_free(server_config));
+        EXPECT_SUCCESS(s2n_config_free(client_config));
+    }
+
+    free(cert_chain_pem);
+    free(private_key_pem);
+    free(dhparams_pem);
+
+    END_TEST();
+}
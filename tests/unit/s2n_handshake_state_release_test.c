@@ -0,0 +1,141 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include "testlib/s2n_testlib.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include <s2n.h>
+
+#include "tls/s2n_connection.h"
+
+#include "tls/s2n_handshake.h"
+#include "tls/s2n_prf.h"
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *server_config;
+    struct s2n_config *client_config;
+    struct s2n_connection *server_conn;
+    struct s2n_connection *client_conn;
+    struct s2n_test_io_buffer client_to_server;
+    struct s2n_test_io_buffer server_to_client;
+    s2n_blocked_status blocked;
+    char *cert_chain_pem;
+    char *private_key_pem;
+    char *dhparams_pem;
+    uint8_t buf[64];
+
+    BEGIN_TEST();
+
+    EXPECT_SUCCESS(setenv("S2N_ENABLE_CLIENT_MODE", "1", 0));
+
+    EXPECT_NOT_NULL(cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(dhparams_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+
+    EXPECT_NOT_NULL(server_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_DHPARAMS, dhparams_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem));
+    EXPECT_SUCCESS(s2n_config_add_dhparams(server_config, dhparams_pem));
+
+    EXPECT_NOT_NULL(client_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_config_disable_x509_verification(client_config));
+
+    EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server, 0));
+    EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 0));
+
+    /* A connection that never finishes its handshake frees its handshake state along with everything else */
+    EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+    EXPECT_NOT_NULL(server_conn->handshake.hashes);
+    EXPECT_NOT_NULL(server_conn->prf_space);
+    EXPECT_EQUAL(server_conn->handshake.hashes_mem.data, (uint8_t *) server_conn->handshake.hashes);
+    EXPECT_EQUAL(server_conn->prf_space_mem.data, (uint8_t *) server_conn->prf_space);
+    EXPECT_SUCCESS(s2n_connection_free(server_conn));
+
+    EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+    EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+    EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+    EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+
+    for (int i = 0; i < 2; i++) {
+        EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+        EXPECT_SUCCESS(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+
+        /* The transcript hashes, PRF space and handshake buffer are gone once the handshake is done */
+        EXPECT_NULL(server_conn->handshake.hashes);
+        EXPECT_NULL(server_conn->prf_space);
+        EXPECT_NULL(client_conn->handshake.hashes);
+        EXPECT_NULL(client_conn->prf_space);
+        EXPECT_NULL(server_conn->handshake.hashes_mem.data);
+        EXPECT_NULL(server_conn->prf_space_mem.data);
+        EXPECT_EQUAL(server_conn->prf_space_mem.allocated, 0);
+
+        /* So are the ephemeral keys, though the negotiated curve is still reported */
+        EXPECT_NULL(server_conn->secure.server_ecc_params.ec_key);
+        EXPECT_NULL(client_conn->secure.server_ecc_params.ec_key);
+        EXPECT_NULL(server_conn->secure.server_dh_params.dh);
+        EXPECT_NOT_NULL(s2n_connection_get_curve(server_conn));
+        EXPECT_NOT_EQUAL(strcmp(s2n_connection_get_curve(server_conn), "NONE"), 0);
+        EXPECT_EQUAL(server_conn->handshake.io.blob.size, 0);
+        EXPECT_EQUAL(client_conn->handshake.io.blob.size, 0);
+        EXPECT_NULL(client_conn->x509_validator.cert_chain);
+
+        /* Negotiating an established connection is a no-op */
+        EXPECT_SUCCESS(s2n_negotiate(server_conn, &blocked));
+
+        /* Application data still flows in both directions */
+        EXPECT_EQUAL(s2n_send(client_conn, "hello world", 11, &blocked), 11);
+        EXPECT_EQUAL(s2n_recv(server_conn, buf, sizeof(buf), &blocked), 11);
+        EXPECT_EQUAL(memcmp(buf, "hello world", 11), 0);
+        EXPECT_EQUAL(s2n_send(server_conn, "hello back", 10, &blocked), 10);
+        EXPECT_EQUAL(s2n_recv(client_conn, buf, sizeof(buf), &blocked), 10);
+        EXPECT_EQUAL(memcmp(buf, "hello back", 10), 0);
+
+        EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+
+        /* Wiping brings the handshake state back for the next handshake */
+        EXPECT_SUCCESS(s2n_connection_wipe(server_conn));
+        EXPECT_SUCCESS(s2n_connection_wipe(client_conn));
+        EXPECT_NOT_NULL(server_conn->handshake.hashes);
+        EXPECT_NOT_NULL(server_conn->prf_space);
+        EXPECT_NOT_NULL(client_conn->handshake.hashes);
+        EXPECT_NOT_NULL(client_conn->prf_space);
+        EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+        EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server));
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server, 0));
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 0));
+    }
+
+    EXPECT_SUCCESS(s2n_connection_free(server_conn));
+    EXPECT_SUCCESS(s2n_connection_free(client_conn));
+    EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server));
+    EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+    EXPECT_SUCCESS(s2n_config_free(server_config));
+    EXPECT_SUCCESS(s2n_config_free(client_config));
+
+    free(cert_chain_pem);
+    free(private_key_pem);
+    free(dhparams_pem);
+
+    END_TEST();
+}
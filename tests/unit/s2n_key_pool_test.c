@@ -0,0 +1,376 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include "testlib/s2n_testlib.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <s2n.h>
+
+#include "crypto/s2n_openssl.h"
+
+#include "tls/s2n_connection.h"
+#include "tls/s2n_key_pool.h"
+
+#include "utils/s2n_safety.h"
+
+#define POOL_SIZE 4
+
+static struct s2n_async_pkey_op *pending_op;
+
+static int async_pkey_store(struct s2n_connection *conn, struct s2n_async_pkey_op *op)
+{
+    pending_op = op;
+
+    return 0;
+}
+
+/* The size of p and g, with their lengths, at the start of a serialized DH key */
+static uint32_t s2n_test_dh_p_g_size(struct s2n_blob *p_g_Ys)
+{
+    uint32_t p_size = (p_g_Ys->data[0] << 8) | p_g_Ys->data[1];
+    uint32_t g_size = (p_g_Ys->data[2 + p_size] << 8) | p_g_Ys->data[2 + p_size + 1];
+
+    return 2 + p_size + 2 + g_size;
+}
+
+static uint32_t s2n_test_pool_count(struct s2n_key_pool *pool, int kind)
+{
+    pthread_mutex_lock(&pool->lock);
+    uint32_t count = pool->count[kind];
+    pthread_mutex_unlock(&pool->lock);
+
+    return count;
+}
+
+/* Give the background threads up to ten seconds to fill every kind of key,
+ * DH keys only if the pool has parameters for them
+ */
+static int s2n_test_wait_for_full_pool(struct s2n_key_pool *pool)
+{
+    struct timespec tick = { .tv_sec = 0, .tv_nsec = 10000000 };
+
+    for (int i = 0; i < 1000; i++) {
+        int full = 1;
+        for (int kind = 0; kind < S2N_KEY_POOL_KINDS; kind++) {
+            if (kind == S2N_KEY_POOL_DH && pool->dhparams.dh == NULL) {
+                continue;
+            }
+            full &= s2n_test_pool_count(pool, kind) == pool->size;
+        }
+        if (full) {
+            return 0;
+        }
+        nanosleep(&tick, NULL);
+    }
+
+    S2N_ERROR(S2N_ERR_SAFETY);
+}
+
+static int s2n_test_key_is_pooled(struct s2n_key_pool *pool, int kind, void *key)
+{
+    int pooled = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (int i = 0; i < pool->count[kind]; i++) {
+        pooled |= pool->keys[kind][i] == key;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return pooled;
+}
+
+/* Run a handshake, stopping at the ServerKeyExchange signature to look at the
+ * ephemeral key the server picked.
+ */
+static int s2n_test_handshake(struct s2n_connection *server_conn, struct s2n_connection *client_conn, void **server_key)
+{
+    s2n_blocked_status server_blocked = S2N_BLOCKED_ON_READ;
+    s2n_blocked_status client_blocked = S2N_BLOCKED_ON_READ;
+
+    do {
+        if (client_blocked != S2N_NOT_BLOCKED) {
+            s2n_errno = S2N_ERR_T_OK;
+            if (s2n_negotiate(client_conn, &client_blocked) < 0) {
+                S2N_ERROR_IF(s2n_error_get_type(s2n_errno) != S2N_ERR_T_BLOCKED, s2n_errno);
+            }
+        }
+        if (server_blocked != S2N_NOT_BLOCKED) {
+            s2n_errno = S2N_ERR_T_OK;
+            if (s2n_negotiate(server_conn, &server_blocked) < 0) {
+                S2N_ERROR_IF(s2n_error_get_type(s2n_errno) != S2N_ERR_T_BLOCKED, s2n_errno);
+            }
+        }
+
+        if (server_blocked == S2N_BLOCKED_ON_APPLICATION) {
+            if (server_conn->secure.server_ecc_params.ec_key) {
+                *server_key = server_conn->secure.server_ecc_params.ec_key;
+            } else {
+                *server_key = server_conn->secure.server_dh_params.dh;
+            }
+            GUARD(s2n_async_pkey_op_perform(pending_op));
+            GUARD(s2n_async_pkey_op_apply(pending_op, server_conn));
+            GUARD(s2n_async_pkey_op_free(pending_op));
+            pending_op = NULL;
+        }
+    } while (server_blocked != S2N_NOT_BLOCKED || client_blocked != S2N_NOT_BLOCKED);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *server_config;
+    struct s2n_config *client_config;
+    struct s2n_connection *server_conn;
+    struct s2n_connection *client_conn;
+    struct s2n_test_io_buffer client_to_server;
+    struct s2n_test_io_buffer server_to_client;
+    struct s2n_key_pool *pool;
+    struct s2n_ecc_params ecc_params;
+    void *taken[POOL_SIZE];
+    struct s2n_dh_params dh_params;
+    uint8_t public_keys[POOL_SIZE][2048];
+    struct s2n_stuffer public_key_out;
+    struct s2n_blob public_keys_blob;
+    struct s2n_blob public_key[POOL_SIZE];
+    void *server_key;
+    char *cert_chain_pem;
+    char *private_key_pem;
+    char *dhparams_pem;
+
+    BEGIN_TEST();
+
+    EXPECT_SUCCESS(setenv("S2N_ENABLE_CLIENT_MODE", "1", 0));
+
+    EXPECT_NOT_NULL(cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(dhparams_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_DHPARAMS, dhparams_pem, S2N_MAX_TEST_PEM_SIZE));
+
+    EXPECT_NOT_NULL(server_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem));
+    EXPECT_SUCCESS(s2n_config_set_async_pkey_callback(server_config, async_pkey_store));
+    EXPECT_NOT_NULL(client_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_config_disable_x509_verification(client_config));
+
+    /* Sizes out of range */
+    EXPECT_FAILURE(s2n_config_set_ephemeral_key_pool(NULL, POOL_SIZE, 1));
+    EXPECT_EQUAL(s2n_config_set_ephemeral_key_pool(server_config, S2N_KEY_POOL_MAX_SIZE + 1, 1), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_KEY_POOL_SIZE);
+    EXPECT_EQUAL(s2n_config_set_ephemeral_key_pool(server_config, POOL_SIZE, 0), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_KEY_POOL_SIZE);
+    EXPECT_EQUAL(s2n_config_set_ephemeral_key_pool(server_config, POOL_SIZE, S2N_KEY_POOL_MAX_THREADS + 1), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_KEY_POOL_SIZE);
+    EXPECT_NULL(server_config->key_pool);
+
+    /* Replacing a pool, and turning it off, stops its threads and frees its keys */
+    EXPECT_SUCCESS(s2n_config_set_ephemeral_key_pool(server_config, POOL_SIZE, 2));
+    EXPECT_SUCCESS(s2n_config_set_ephemeral_key_pool(server_config, POOL_SIZE, 2));
+    EXPECT_NOT_NULL(pool = server_config->key_pool);
+    EXPECT_SUCCESS(s2n_test_wait_for_full_pool(pool));
+    EXPECT_SUCCESS(s2n_config_set_ephemeral_key_pool(server_config, 0, 0));
+    EXPECT_NULL(server_config->key_pool);
+
+    /* The pool fills every curve, hands each key out once, and refills */
+    EXPECT_SUCCESS(s2n_config_set_ephemeral_key_pool(server_config, POOL_SIZE, 2));
+    EXPECT_NOT_NULL(pool = server_config->key_pool);
+    EXPECT_SUCCESS(s2n_test_wait_for_full_pool(pool));
+    EXPECT_EQUAL(s2n_test_pool_count(pool, S2N_KEY_POOL_DH), 0);
+    for (int kind = 0; kind < S2N_KEY_POOL_DH; kind++) {
+        ecc_params.negotiated_curve = &s2n_ecc_supported_curves[kind];
+        for (int i = 0; i < POOL_SIZE; i++) {
+            ecc_params.ec_key = NULL;
+            EXPECT_SUCCESS(s2n_key_pool_take_ecc_key(pool, &ecc_params));
+            EXPECT_NOT_NULL(taken[i] = ecc_params.ec_key);
+            EXPECT_SUCCESS(s2n_blob_init(&public_keys_blob, public_keys[i], sizeof(public_keys[i])));
+            EXPECT_SUCCESS(s2n_stuffer_init(&public_key_out, &public_keys_blob));
+            EXPECT_SUCCESS(s2n_ecc_write_ecc_params(&ecc_params, &public_key_out, &public_key[i]));
+            /* The curve type, named curve and point length, then an uncompressed point on the curve */
+            EXPECT_EQUAL(public_key[i].size, 4 + 1 + 2 * (kind == 0 ? 32 : 48));
+            for (int j = 0; j < i; j++) {
+                EXPECT_NOT_EQUAL(taken[j], taken[i]);
+                EXPECT_NOT_EQUAL(memcmp(public_key[j].data, public_key[i].data, public_key[i].size), 0);
+            }
+        }
+        for (int i = 0; i < POOL_SIZE; i++) {
+            ecc_params.ec_key = taken[i];
+            EXPECT_SUCCESS(s2n_ecc_params_free(&ecc_params));
+        }
+    }
+    EXPECT_SUCCESS(s2n_test_wait_for_full_pool(pool));
+
+    /* An ECDHE handshake uses a pooled key */
+    EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+    EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+    EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server, 0));
+    EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 0));
+    EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+    EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+    EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+
+    /* The pool is full, so nothing changes in it until the handshake takes a key */
+    int pooled_keys_seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (int i = 0; i < POOL_SIZE; i++) {
+        taken[i] = pool->keys[0][i];
+    }
+    pthread_mutex_unlock(&pool->lock);
+    EXPECT_SUCCESS(s2n_test_handshake(server_conn, client_conn, &server_key));
+    EXPECT_EQUAL(server_conn->secure.server_ecc_params.negotiated_curve, &s2n_ecc_supported_curves[0]);
+    for (int i = 0; i < POOL_SIZE; i++) {
+        pooled_keys_seen += taken[i] == server_key;
+    }
+    EXPECT_EQUAL(pooled_keys_seen, 1);
+    EXPECT_FALSE(s2n_test_key_is_pooled(pool, 0, server_key));
+    EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+
+    /* A forked child doesn't use its parent's keys, and generates its own inline */
+    pool->pid = 0;
+    EXPECT_SUCCESS(s2n_test_wait_for_full_pool(pool));
+    EXPECT_SUCCESS(s2n_connection_wipe(server_conn));
+    EXPECT_SUCCESS(s2n_connection_wipe(client_conn));
+    EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+    EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+    EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+    EXPECT_SUCCESS(s2n_test_handshake(server_conn, client_conn, &server_key));
+    EXPECT_NOT_NULL(server_key);
+    EXPECT_FALSE(s2n_test_key_is_pooled(pool, 0, server_key));
+    EXPECT_EQUAL(s2n_test_pool_count(pool, 0), POOL_SIZE);
+    EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+    pool->pid = getpid();
+
+    /* Adding DH parameters to a config with a pool starts DH keys, each over
+     * the config's parameters and handed out once
+     */
+    EXPECT_SUCCESS(s2n_config_set_ephemeral_key_pool(server_config, POOL_SIZE, 2));
+    EXPECT_NOT_NULL(pool = server_config->key_pool);
+    EXPECT_SUCCESS(s2n_config_add_dhparams(server_config, dhparams_pem));
+    EXPECT_SUCCESS(s2n_test_wait_for_full_pool(pool));
+    EXPECT_EQUAL(s2n_test_pool_count(pool, S2N_KEY_POOL_DH), POOL_SIZE);
+    for (int i = 0; i < POOL_SIZE; i++) {
+        dh_params.dh = NULL;
+        EXPECT_SUCCESS(s2n_key_pool_take_dh_key(pool, &dh_params));
+        EXPECT_NOT_NULL(taken[i] = dh_params.dh);
+        EXPECT_SUCCESS(s2n_dh_params_check(&dh_params));
+        EXPECT_SUCCESS(s2n_blob_init(&public_keys_blob, public_keys[i], sizeof(public_keys[i])));
+        EXPECT_SUCCESS(s2n_stuffer_init(&public_key_out, &public_keys_blob));
+        EXPECT_SUCCESS(s2n_dh_params_to_p_g_Ys(&dh_params, &public_key_out, &public_key[i]));
+        for (int j = 0; j < i; j++) {
+            /* The same p and g, then a different Ys */
+            uint32_t p_g_size = s2n_test_dh_p_g_size(&public_key[j]);
+            EXPECT_NOT_EQUAL(taken[j], taken[i]);
+            EXPECT_EQUAL(s2n_test_dh_p_g_size(&public_key[i]), p_g_size);
+            EXPECT_EQUAL(memcmp(public_key[j].data, public_key[i].data, p_g_size), 0);
+            EXPECT_FALSE(public_key[j].size == public_key[i].size && memcmp(public_key[j].data, public_key[i].data, public_key[i].size) == 0);
+        }
+    }
+    for (int i = 0; i < POOL_SIZE; i++) {
+        dh_params.dh = taken[i];
+        EXPECT_SUCCESS(s2n_dh_params_free(&dh_params));
+    }
+
+    /* A pool made after the DH parameters were added fills DH keys too */
+    EXPECT_SUCCESS(s2n_config_set_ephemeral_key_pool(server_config, POOL_SIZE, 2));
+    EXPECT_NOT_NULL(pool = server_config->key_pool);
+    EXPECT_NOT_NULL(pool->dhparams.dh);
+    EXPECT_SUCCESS(s2n_test_wait_for_full_pool(pool));
+
+    /* A DHE handshake uses a pooled key, with no copy of the parameters of its own */
+    EXPECT_SUCCESS(s2n_config_set_cipher_preferences(server_config, "20150214"));
+    EXPECT_SUCCESS(s2n_config_set_cipher_preferences(client_config, "20150214"));
+    EXPECT_SUCCESS(s2n_connection_wipe(server_conn));
+    EXPECT_SUCCESS(s2n_connection_wipe(client_conn));
+    EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+    EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+    EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+    pooled_keys_seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (int i = 0; i < POOL_SIZE; i++) {
+        taken[i] = pool->keys[S2N_KEY_POOL_DH][i];
+    }
+    pthread_mutex_unlock(&pool->lock);
+    server_key = NULL;
+    EXPECT_SUCCESS(s2n_test_handshake(server_conn, client_conn, &server_key));
+    EXPECT_NULL(server_conn->secure.server_ecc_params.ec_key);
+    for (int i = 0; i < POOL_SIZE; i++) {
+        pooled_keys_seen += taken[i] == server_key;
+    }
+    EXPECT_EQUAL(pooled_keys_seen, 1);
+    EXPECT_FALSE(s2n_test_key_is_pooled(pool, S2N_KEY_POOL_DH, server_key));
+    EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+
+    /* Threads that fail to make a key wait and try again, rather than giving up */
+    {
+        struct timespec failing = { .tv_sec = 0, .tv_nsec = 100000000 };
+
+        /* A 5 bit prime fails the size check after the DH has been made */
+        uint8_t small_p = 23, small_g = 5, small_Ys = 8;
+        struct s2n_blob p = { .data = &small_p, .size = 1 };
+        struct s2n_blob g = { .data = &small_g, .size = 1 };
+        struct s2n_blob Ys = { .data = &small_Ys, .size = 1 };
+        struct s2n_dh_params small_dh_params = { .dh = NULL };
+        EXPECT_FAILURE(s2n_dh_p_g_Ys_to_dh_params(&small_dh_params, &p, &g, &Ys));
+        EXPECT_NOT_NULL(small_dh_params.dh);
+
+        EXPECT_SUCCESS(s2n_key_pool_set_dhparams(pool, NULL));
+        pthread_mutex_lock(&pool->lock);
+        pool->dhparams = small_dh_params;
+        pool->dh_generation++;
+        pthread_cond_broadcast(&pool->wanted);
+        pthread_mutex_unlock(&pool->lock);
+        nanosleep(&failing, NULL);
+        EXPECT_EQUAL(s2n_test_pool_count(pool, S2N_KEY_POOL_DH), 0);
+
+        EXPECT_SUCCESS(s2n_key_pool_set_dhparams(pool, server_config->dhparams));
+        EXPECT_SUCCESS(s2n_test_wait_for_full_pool(pool));
+    }
+
+    /* A forked child frees the pool without waiting on its parent's threads */
+    {
+        pid_t child = fork();
+        EXPECT_TRUE(child >= 0);
+        if (child == 0) {
+            _exit(s2n_key_pool_free(pool) == 0 ? 0 : 1);
+        }
+
+        int status;
+        EXPECT_EQUAL(waitpid(child, &status, 0), child);
+        EXPECT_TRUE(WIFEXITED(status));
+        EXPECT_EQUAL(WEXITSTATUS(status), 0);
+    }
+
+    EXPECT_SUCCESS(s2n_connection_free(server_conn));
+    EXPECT_SUCCESS(s2n_connection_free(client_conn));
+    EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server));
+    EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+    EXPECT_SUCCESS(s2n_config_free(server_config));
+    EXPECT_SUCCESS(s2n_config_free(client_config));
+    free(cert_chain_pem);
+    free(private_key_pem);
+    free(dhparams_pem);
+
+    END_TEST();
+}
@@ -0,0 +1,368 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include "testlib/s2n_testlib.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <openssl/objects.h>
+#include <openssl/rsa.h>
+
+#include <s2n.h>
+
+#include "tls/s2n_connection.h"
+#include "tls/s2n_key_server.h"
+
+#include "utils/s2n_safety.h"
+
+#define NUM_CONNECTIONS 3
+
+static RSA *rsa;
+
+static int s2n_test_hash_to_nid(uint8_t hash)
+{
+    switch (hash) {
+    case 0:
+        return NID_md5_sha1;
+    case 2:
+        return NID_sha1;
+    case 4:
+        return NID_sha256;
+    case 5:
+        return NID_sha384;
+    case 6:
+        return NID_sha512;
+    default:
+        return NID_undef;
+    }
+}
+
+/* Play the key server: take all of the requests that have been sent in one
+ * read, and answer them in reverse order with one write.
+ */
+static int s2n_test_key_server_answer(int fd, int expected_requests, uint8_t status)
+{
+    uint8_t requests[8192];
+    uint8_t responses[8192];
+    uint32_t offsets[NUM_CONNECTIONS];
+    int num_requests = 0;
+    uint32_t responses_length = 0;
+
+    ssize_t requests_length = read(fd, requests, sizeof(requests));
+    S2N_ERROR_IF(requests_length <= 0, S2N_ERR_SAFETY);
+
+    for (uint32_t offset = 0; offset < requests_length;) {
+        S2N_ERROR_IF(num_requests == NUM_CONNECTIONS, S2N_ERR_SAFETY);
+        S2N_ERROR_IF(requests_length - offset < S2N_KEY_SERVER_REQUEST_HEADER_LENGTH, S2N_ERR_SAFETY);
+        offsets[num_requests++] = offset;
+        offset += S2N_KEY_SERVER_REQUEST_HEADER_LENGTH + ((requests[offset + 6] << 8) | requests[offset + 7]);
+        S2N_ERROR_IF(offset > requests_length, S2N_ERR_SAFETY);
+    }
+    S2N_ERROR_IF(num_requests != expected_requests, S2N_ERR_SAFETY);
+
+    for (int i = num_requests - 1; i >= 0; i--) {
+        uint8_t *request = requests + offsets[i];
+        uint8_t *data = request + S2N_KEY_SERVER_REQUEST_HEADER_LENGTH;
+        uint16_t length = (request[6] << 8) | request[7];
+        uint8_t *response = responses + responses_length;
+        uint8_t *result = response + S2N_KEY_SERVER_RESPONSE_HEADER_LENGTH;
+        int result_length = 0;
+
+        S2N_ERROR_IF(responses_length + S2N_KEY_SERVER_RESPONSE_HEADER_LENGTH + RSA_size(rsa) > sizeof(responses), S2N_ERR_SAFETY);
+
+        if (status == S2N_KEY_SERVER_STATUS_OK && request[4] == S2N_KEY_SERVER_OP_SIGN) {
+            unsigned int signature_length;
+            S2N_ERROR_IF(RSA_sign(s2n_test_hash_to_nid(request[5]), data, length, result, &signature_length, rsa) != 1, S2N_ERR_SAFETY);
+            result_length = signature_length;
+        } else if (status == S2N_KEY_SERVER_STATUS_OK && request[4] == S2N_KEY_SERVER_OP_DECRYPT) {
+            S2N_ERROR_IF(request[5] != 0, S2N_ERR_SAFETY);
+            result_length = RSA_private_decrypt(length, data, result, rsa, RSA_PKCS1_PADDING);
+            S2N_ERROR_IF(result_length < 0, S2N_ERR_SAFETY);
+        }
+
+        memcpy_check(response, request, 4);
+        response[4] = status;
+        response[5] = (result_length >> 8) & 0xff;
+        response[6] = result_length & 0xff;
+        responses_length += S2N_KEY_SERVER_RESPONSE_HEADER_LENGTH + result_length;
+    }
+
+    S2N_ERROR_IF(write(fd, responses, responses_length) != responses_length, S2N_ERR_SAFETY);
+
+    return 0;
+}
+
+/* Negotiate both sides once each, stopping short only on a blocked error */
+static int s2n_test_handshake_step(struct s2n_connection *server_conn, struct s2n_connection *client_conn,
+                                   s2n_blocked_status *server_blocked, s2n_blocked_status *client_blocked)
+{
+    if (*client_blocked != S2N_NOT_BLOCKED) {
+        s2n_errno = S2N_ERR_T_OK;
+        if (s2n_negotiate(client_conn, client_blocked) < 0) {
+            S2N_ERROR_IF(s2n_error_get_type(s2n_errno) != S2N_ERR_T_BLOCKED, s2n_errno);
+        }
+    }
+    if (*server_blocked != S2N_NOT_BLOCKED) {
+        s2n_errno = S2N_ERR_T_OK;
+        if (s2n_negotiate(server_conn, server_blocked) < 0) {
+            S2N_ERROR_IF(s2n_error_get_type(s2n_errno) != S2N_ERR_T_BLOCKED, s2n_errno);
+        }
+    }
+
+    return 0;
+}
+
+/* Run the handshake until the server is waiting on the key server */
+static int s2n_test_handshake_until_keyless(struct s2n_connection *server_conn, struct s2n_connection *client_conn)
+{
+    s2n_blocked_status server_blocked = S2N_BLOCKED_ON_READ;
+    s2n_blocked_status client_blocked = S2N_BLOCKED_ON_READ;
+
+    for (int i = 0; i < 10 && server_blocked != S2N_BLOCKED_ON_APPLICATION; i++) {
+        GUARD(s2n_test_handshake_step(server_conn, client_conn, &server_blocked, &client_blocked));
+    }
+    S2N_ERROR_IF(server_blocked != S2N_BLOCKED_ON_APPLICATION, S2N_ERR_SAFETY);
+
+    return 0;
+}
+
+static int s2n_test_handshake_finish(struct s2n_connection *server_conn, struct s2n_connection *client_conn)
+{
+    s2n_blocked_status server_blocked = S2N_BLOCKED_ON_APPLICATION;
+    s2n_blocked_status client_blocked = S2N_BLOCKED_ON_READ;
+
+    for (int i = 0; i < 10 && (server_blocked != S2N_NOT_BLOCKED || client_blocked != S2N_NOT_BLOCKED); i++) {
+        GUARD(s2n_test_handshake_step(server_conn, client_conn, &server_blocked, &client_blocked));
+    }
+    S2N_ERROR_IF(server_blocked != S2N_NOT_BLOCKED || client_blocked != S2N_NOT_BLOCKED, S2N_ERR_SAFETY);
+
+    return 0;
+}
+
+static int s2n_test_ping_pong(struct s2n_connection *server_conn, struct s2n_connection *client_conn)
+{
+    s2n_blocked_status blocked;
+    uint8_t buf[64];
+
+    S2N_ERROR_IF(s2n_send(client_conn, "ping", 4, &blocked) != 4, S2N_ERR_SAFETY);
+    S2N_ERROR_IF(s2n_recv(server_conn, buf, sizeof(buf), &blocked) != 4 || memcmp(buf, "ping", 4), S2N_ERR_SAFETY);
+    S2N_ERROR_IF(s2n_send(server_conn, "pong", 4, &blocked) != 4, S2N_ERR_SAFETY);
+    S2N_ERROR_IF(s2n_recv(client_conn, buf, sizeof(buf), &blocked) != 4 || memcmp(buf, "pong", 4), S2N_ERR_SAFETY);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *key_config;
+    struct s2n_config *server_config;
+    struct s2n_config *client_config;
+    struct s2n_connection *server_conns[NUM_CONNECTIONS];
+    struct s2n_connection *client_conns[NUM_CONNECTIONS];
+    struct s2n_test_io_buffer client_to_server[NUM_CONNECTIONS];
+    struct s2n_test_io_buffer server_to_client[NUM_CONNECTIONS];
+    struct sockaddr_un addr;
+    char *cert_chain_pem;
+    char *private_key_pem;
+    char *dhparams_pem;
+    char long_path[S2N_KEY_SERVER_MAX_PATH_LENGTH + 2];
+    int listener;
+    int key_server_fd;
+    int fd;
+    /* ECDHE and DHE sign the ServerKeyExchange, RSA key exchange decrypts the ClientKeyExchange */
+    const char *cipher_prefs[] = { "default", "20150214", "20140601" };
+    const int use_dhparams[] = { 1, 1, 0 };
+
+    BEGIN_TEST();
+
+    EXPECT_SUCCESS(setenv("S2N_ENABLE_CLIENT_MODE", "1", 0));
+
+    EXPECT_NOT_NULL(cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(dhparams_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_DHPARAMS, dhparams_pem, S2N_MAX_TEST_PEM_SIZE));
+
+    /* The test's key server borrows its key from an ordinary config */
+    EXPECT_NOT_NULL(key_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_config_add_cert_chain_and_key(key_config, cert_chain_pem, private_key_pem));
+    EXPECT_NOT_NULL(rsa = key_config->cert_and_key_pairs->private_key.key.rsa_key.rsa);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/s2n_keyless_test.%d", (int) getpid());
+    unlink(addr.sun_path);
+    EXPECT_TRUE((listener = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0);
+    EXPECT_SUCCESS(bind(listener, (struct sockaddr *) &addr, sizeof(addr)));
+    EXPECT_SUCCESS(listen(listener, 4));
+
+    /* Bad key server paths, and configs without a key server */
+    memset(long_path, 'a', sizeof(long_path) - 1);
+    long_path[sizeof(long_path) - 1] = '\0';
+    EXPECT_NOT_NULL(server_config = s2n_config_new());
+    EXPECT_EQUAL(s2n_config_add_cert_chain_and_key_server(server_config, cert_chain_pem, long_path), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_KEY_SERVER_PATH);
+    EXPECT_EQUAL(s2n_config_add_cert_chain_and_key_server(server_config, cert_chain_pem, ""), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_KEY_SERVER_PATH);
+    EXPECT_EQUAL(s2n_config_add_cert_chain_and_key_server(server_config, cert_chain_pem, "/tmp/s2n_keyless_test.nonexistent"), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_KEY_SERVER);
+    EXPECT_EQUAL(s2n_config_get_key_server_fd(server_config, &fd), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_NO_KEY_SERVER);
+    EXPECT_EQUAL(s2n_config_key_server_service(server_config), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_NO_KEY_SERVER);
+    EXPECT_SUCCESS(s2n_config_free(server_config));
+
+    for (int p = 0; p < sizeof(cipher_prefs) / sizeof(cipher_prefs[0]); p++) {
+        EXPECT_NOT_NULL(server_config = s2n_config_new());
+        EXPECT_SUCCESS(s2n_config_add_cert_chain_and_key_server(server_config, cert_chain_pem, addr.sun_path));
+        if (use_dhparams[p]) {
+            EXPECT_SUCCESS(s2n_config_add_dhparams(server_config, dhparams_pem));
+        }
+        EXPECT_SUCCESS(s2n_config_set_cipher_preferences(server_config, cipher_prefs[p]));
+        EXPECT_SUCCESS(s2n_config_get_key_server_fd(server_config, &fd));
+        EXPECT_TRUE(fd >= 0);
+        EXPECT_TRUE((key_server_fd = accept(listener, NULL, NULL)) >= 0);
+
+        EXPECT_NOT_NULL(client_config = s2n_config_new());
+        EXPECT_SUCCESS(s2n_config_disable_x509_verification(client_config));
+        EXPECT_SUCCESS(s2n_config_set_cipher_preferences(client_config, cipher_prefs[p]));
+
+        for (int i = 0; i < NUM_CONNECTIONS; i++) {
+            EXPECT_NOT_NULL(server_conns[i] = s2n_connection_new(S2N_SERVER));
+            EXPECT_NOT_NULL(client_conns[i] = s2n_connection_new(S2N_CLIENT));
+            EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server[i], 0));
+            EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client[i], 0));
+            EXPECT_SUCCESS(s2n_connection_set_config(server_conns[i], server_config));
+            EXPECT_SUCCESS(s2n_connection_set_config(client_conns[i], client_config));
+            EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conns[i], server_conns[i], &client_to_server[i], &server_to_client[i]));
+        }
+
+        /* Every connection's request goes out together, and the answers
+         * come back in a different order from the requests.
+         */
+        for (int i = 0; i < NUM_CONNECTIONS; i++) {
+            EXPECT_SUCCESS(s2n_test_handshake_until_keyless(server_conns[i], client_conns[i]));
+        }
+        EXPECT_SUCCESS(s2n_config_key_server_service(server_config));
+        EXPECT_SUCCESS(s2n_test_key_server_answer(key_server_fd, NUM_CONNECTIONS, S2N_KEY_SERVER_STATUS_OK));
+        for (int i = 0; i < NUM_CONNECTIONS; i++) {
+            EXPECT_SUCCESS(s2n_test_handshake_finish(server_conns[i], client_conns[i]));
+            EXPECT_SUCCESS(s2n_test_ping_pong(server_conns[i], client_conns[i]));
+            EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conns[i], client_conns[i]));
+            EXPECT_SUCCESS(s2n_connection_wipe(server_conns[i]));
+            EXPECT_SUCCESS(s2n_connection_wipe(client_conns[i]));
+            EXPECT_SUCCESS(s2n_connection_set_config(server_conns[i], server_config));
+            EXPECT_SUCCESS(s2n_connection_set_config(client_conns[i], client_config));
+            EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conns[i], server_conns[i], &client_to_server[i], &server_to_client[i]));
+        }
+
+        /* A connection that goes away while its request is in flight doesn't
+         * disturb the others, and its response is dropped when it arrives.
+         */
+        for (int i = 0; i < NUM_CONNECTIONS; i++) {
+            EXPECT_SUCCESS(s2n_test_handshake_until_keyless(server_conns[i], client_conns[i]));
+        }
+        EXPECT_SUCCESS(s2n_config_key_server_service(server_config));
+        EXPECT_SUCCESS(s2n_connection_wipe(server_conns[0]));
+        EXPECT_SUCCESS(s2n_connection_wipe(client_conns[0]));
+        /* The handshake was cut short, so drop whatever it left unread */
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server[0]));
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client[0]));
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server[0], 0));
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client[0], 0));
+        EXPECT_SUCCESS(s2n_test_key_server_answer(key_server_fd, NUM_CONNECTIONS, S2N_KEY_SERVER_STATUS_OK));
+        EXPECT_SUCCESS(s2n_config_key_server_service(server_config));
+        for (int i = 1; i < NUM_CONNECTIONS; i++) {
+            EXPECT_SUCCESS(s2n_test_handshake_finish(server_conns[i], client_conns[i]));
+            EXPECT_SUCCESS(s2n_test_ping_pong(server_conns[i], client_conns[i]));
+            EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conns[i], client_conns[i]));
+            EXPECT_SUCCESS(s2n_connection_wipe(server_conns[i]));
+            EXPECT_SUCCESS(s2n_connection_wipe(client_conns[i]));
+        }
+        for (int i = 0; i < NUM_CONNECTIONS; i++) {
+            EXPECT_SUCCESS(s2n_connection_set_config(server_conns[i], server_config));
+            EXPECT_SUCCESS(s2n_connection_set_config(client_conns[i], client_config));
+            EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conns[i], server_conns[i], &client_to_server[i], &server_to_client[i]));
+        }
+
+        /* A key server that can't sign or decrypt fails the handshake. A
+         * failed decrypt carries on with a random pre-master secret and fails
+         * when the Finished messages don't match.
+         */
+        EXPECT_SUCCESS(s2n_test_handshake_until_keyless(server_conns[0], client_conns[0]));
+        EXPECT_SUCCESS(s2n_config_key_server_service(server_config));
+        EXPECT_SUCCESS(s2n_test_key_server_answer(key_server_fd, 1, S2N_KEY_SERVER_STATUS_FAILED));
+        EXPECT_FAILURE(s2n_test_handshake_finish(server_conns[0], client_conns[0]));
+
+        /* Losing the key server fails what's in flight, and the next request reconnects */
+        EXPECT_SUCCESS(s2n_test_handshake_until_keyless(server_conns[1], client_conns[1]));
+        EXPECT_SUCCESS(s2n_config_key_server_service(server_config));
+        EXPECT_SUCCESS(close(key_server_fd));
+        EXPECT_EQUAL(s2n_config_key_server_service(server_config), -1);
+        EXPECT_EQUAL(s2n_errno, S2N_ERR_KEY_SERVER);
+        EXPECT_SUCCESS(s2n_config_get_key_server_fd(server_config, &fd));
+        EXPECT_EQUAL(fd, -1);
+        EXPECT_FAILURE(s2n_test_handshake_finish(server_conns[1], client_conns[1]));
+
+        EXPECT_SUCCESS(s2n_test_handshake_until_keyless(server_conns[2], client_conns[2]));
+        EXPECT_SUCCESS(s2n_config_key_server_service(server_config));
+        EXPECT_TRUE((key_server_fd = accept(listener, NULL, NULL)) >= 0);
+        EXPECT_SUCCESS(s2n_test_key_server_answer(key_server_fd, 1, S2N_KEY_SERVER_STATUS_OK));
+        EXPECT_SUCCESS(s2n_test_handshake_finish(server_conns[2], client_conns[2]));
+        EXPECT_SUCCESS(s2n_test_ping_pong(server_conns[2], client_conns[2]));
+        EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conns[2], client_conns[2]));
+
+        /* A request still in flight when everything is freed is freed with the config */
+        EXPECT_SUCCESS(s2n_connection_wipe(server_conns[0]));
+        EXPECT_SUCCESS(s2n_connection_wipe(client_conns[0]));
+        /* The handshake was cut short, so drop whatever it left unread */
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server[0]));
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client[0]));
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server[0], 0));
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client[0], 0));
+        EXPECT_SUCCESS(s2n_connection_set_config(server_conns[0], server_config));
+        EXPECT_SUCCESS(s2n_connection_set_config(client_conns[0], client_config));
+        EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conns[0], server_conns[0], &client_to_server[0], &server_to_client[0]));
+        EXPECT_SUCCESS(s2n_test_handshake_until_keyless(server_conns[0], client_conns[0]));
+        EXPECT_SUCCESS(s2n_config_key_server_service(server_config));
+
+        for (int i = 0; i < NUM_CONNECTIONS; i++) {
+            EXPECT_SUCCESS(s2n_connection_free(server_conns[i]));
+            EXPECT_SUCCESS(s2n_connection_free(client_conns[i]));
+            EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server[i]));
+            EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client[i]));
+        }
+        EXPECT_SUCCESS(s2n_config_free(server_config));
+        EXPECT_SUCCESS(s2n_config_free(client_config));
+        EXPECT_SUCCESS(close(key_server_fd));
+    }
+
+    EXPECT_SUCCESS(close(listener));
+    EXPECT_SUCCESS(unlink(addr.sun_path));
+    EXPECT_SUCCESS(s2n_config_free(key_config));
+    free(cert_chain_pem);
+    free(private_key_pem);
+    free(dhparams_pem);
+
+    END_TEST();
+}
@@ -0,0 +1,425 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include "testlib/s2n_testlib.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <s2n.h>
+
+#include "tls/s2n_cipher_preferences.h"
+#include "tls/s2n_cipher_suites.h"
+#include "tls/s2n_config.h"
+#include "tls/s2n_connection.h"
+#include "tls/s2n_ktls.h"
+
+#include "utils/s2n_safety.h"
+
+static struct s2n_cipher_suite *aes128_gcm_suites[] = { &s2n_ecdhe_rsa_with_aes_128_gcm_sha256 };
+static struct s2n_cipher_suite *aes256_gcm_suites[] = { &s2n_ecdhe_rsa_with_aes_256_gcm_sha384 };
+static struct s2n_cipher_suite *aes128_cbc_suites[] = { &s2n_ecdhe_rsa_with_aes_128_cbc_sha256 };
+
+static const struct s2n_cipher_preferences aes128_gcm_preferences = {
+    .count = 1,
+    .suites = aes128_gcm_suites,
+    .minimum_protocol_version = S2N_TLS12
+};
+
+static const struct s2n_cipher_preferences aes256_gcm_preferences = {
+    .count = 1,
+    .suites = aes256_gcm_suites,
+    .minimum_protocol_version = S2N_TLS12
+};
+
+static const struct s2n_cipher_preferences aes128_cbc_preferences = {
+    .count = 1,
+    .suites = aes128_cbc_suites,
+    .minimum_protocol_version = S2N_TLS12
+};
+
+static int loopback_socket_pair(int *server_fd, int *client_fd)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int listener;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    GUARD(listener = socket(AF_INET, SOCK_STREAM, 0));
+    GUARD(bind(listener, (struct sockaddr *) &addr, sizeof(addr)));
+    GUARD(listen(listener, 1));
+    GUARD(getsockname(listener, (struct sockaddr *) &addr, &addr_len));
+
+    GUARD(*client_fd = socket(AF_INET, SOCK_STREAM, 0));
+    GUARD(connect(*client_fd, (struct sockaddr *) &addr, sizeof(addr)));
+    GUARD(*server_fd = accept(listener, NULL, NULL));
+    GUARD(close(listener));
+
+    GUARD(fcntl(*client_fd, F_SETFL, fcntl(*client_fd, F_GETFL) | O_NONBLOCK));
+    GUARD(fcntl(*server_fd, F_SETFL, fcntl(*server_fd, F_GETFL) | O_NONBLOCK));
+
+    return 0;
+}
+
+/* Unlike the in-memory test I/O, data on a socket may take a moment to show up */
+static int negotiate_over_sockets(struct s2n_connection *server_conn, struct s2n_connection *client_conn)
+{
+    s2n_blocked_status blocked;
+    int server_done = 0;
+    int client_done = 0;
+
+    while (!server_done || !client_done) {
+        if (!server_done) {
+            if (s2n_negotiate(server_conn, &blocked) == 0) {
+                server_done = 1;
+            } else if (s2n_error_get_type(s2n_errno) != S2N_ERR_T_BLOCKED) {
+                return -1;
+            }
+        }
+        if (!client_done) {
+            if (s2n_negotiate(client_conn, &blocked) == 0) {
+                client_done = 1;
+            } else if (s2n_error_get_type(s2n_errno) != S2N_ERR_T_BLOCKED) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *server_config;
+    struct s2n_config *client_config;
+    struct s2n_connection *server_conn;
+    struct s2n_connection *client_conn;
+    struct s2n_test_io_buffer client_to_server;
+    struct s2n_test_io_buffer server_to_client;
+    s2n_blocked_status blocked;
+    char *cert_chain_pem;
+    char *private_key_pem;
+    char *dhparams_pem;
+
+    BEGIN_TEST();
+
+    EXPECT_SUCCESS(setenv("S2N_ENABLE_CLIENT_MODE", "1", 0));
+
+    EXPECT_NOT_NULL(cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(dhparams_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+
+    EXPECT_NOT_NULL(server_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_DHPARAMS, dhparams_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem));
+    EXPECT_SUCCESS(s2n_config_add_dhparams(server_config, dhparams_pem));
+
+    EXPECT_NOT_NULL(client_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_config_disable_x509_verification(client_config));
+
+    /* Both sides derive the same kernel parameters for each direction */
+    {
+        const struct s2n_cipher_preferences *gcm_preferences[] = { &aes128_gcm_preferences, &aes256_gcm_preferences };
+
+        for (int i = 0; i < sizeof(gcm_preferences) / sizeof(gcm_preferences[0]); i++) {
+            struct s2n_ktls_crypto_info server_client_info, server_server_info;
+            struct s2n_ktls_crypto_info client_client_info, client_server_info;
+
+            server_config->cipher_preferences = gcm_preferences[i];
+            client_config->cipher_preferences = gcm_preferences[i];
+
+            EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+            EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+            EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+            EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+
+            EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server, 0));
+            EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 0));
+            EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+
+            /* Not before the handshake */
+            EXPECT_EQUAL(s2n_connection_enable_ktls(server_conn), -1);
+            EXPECT_EQUAL(s2n_errno, S2N_ERR_KTLS_STATE);
+
+            EXPECT_SUCCESS(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+            EXPECT_EQUAL(server_conn->secure.cipher_suite, gcm_preferences[i]->suites[0]);
+
+            memset(&server_client_info, 0, sizeof(struct s2n_ktls_crypto_info));
+            memset(&server_server_info, 0, sizeof(struct s2n_ktls_crypto_info));
+            memset(&client_client_info, 0, sizeof(struct s2n_ktls_crypto_info));
+            memset(&client_server_info, 0, sizeof(struct s2n_ktls_crypto_info));
+            EXPECT_SUCCESS(s2n_ktls_crypto_info(server_conn, &server_client_info, &server_server_info));
+            EXPECT_SUCCESS(s2n_ktls_crypto_info(client_conn, &client_client_info, &client_server_info));
+            EXPECT_EQUAL(server_client_info.key_size, i ? 32 : 16);
+            EXPECT_EQUAL(memcmp(&server_client_info, &client_client_info, sizeof(struct s2n_ktls_crypto_info)), 0);
+            EXPECT_EQUAL(memcmp(&server_server_info, &client_server_info, sizeof(struct s2n_ktls_crypto_info)), 0);
+            EXPECT_NOT_EQUAL(memcmp(server_client_info.key, server_server_info.key, server_client_info.key_size), 0);
+
+            /* The Finished messages used sequence number zero in each direction */
+            uint8_t one[S2N_TLS_SEQUENCE_NUM_LEN] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+            EXPECT_EQUAL(memcmp(server_server_info.rec_seq, one, sizeof(one)), 0);
+            EXPECT_EQUAL(memcmp(server_client_info.rec_seq, one, sizeof(one)), 0);
+
+            /* Offload needs s2n to own the socket */
+            EXPECT_EQUAL(s2n_connection_enable_ktls(server_conn), -1);
+            EXPECT_EQUAL(s2n_errno, S2N_ERR_KTLS_UNSUPPORTED);
+            EXPECT_EQUAL(s2n_connection_is_ktls_send_enabled(server_conn), 0);
+            EXPECT_EQUAL(s2n_connection_is_ktls_recv_enabled(server_conn), 0);
+
+            EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+            EXPECT_SUCCESS(s2n_connection_free(server_conn));
+            EXPECT_SUCCESS(s2n_connection_free(client_conn));
+            EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server));
+            EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+        }
+    }
+
+    /* Only AES-GCM suites can be offloaded */
+    {
+        struct s2n_ktls_crypto_info client_info, server_info;
+
+        server_config->cipher_preferences = &aes128_cbc_preferences;
+        client_config->cipher_preferences = &aes128_cbc_preferences;
+
+        EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+        EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+        EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+        EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server, 0));
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 0));
+        EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+
+        EXPECT_SUCCESS(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+        EXPECT_EQUAL(server_conn->secure.cipher_suite, &s2n_ecdhe_rsa_with_aes_128_cbc_sha256);
+
+        EXPECT_EQUAL(s2n_ktls_crypto_info(server_conn, &client_info, &server_info), -1);
+        EXPECT_EQUAL(s2n_errno, S2N_ERR_KTLS_UNSUPPORTED);
+
+        EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+        EXPECT_SUCCESS(s2n_connection_free(server_conn));
+        EXPECT_SUCCESS(s2n_connection_free(client_conn));
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server));
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+    }
+
+    /* Over a loopback TCP connection, when the kernel supports it */
+    {
+        int server_fd, client_fd;
+        uint8_t data[4096];
+        uint8_t received[4096];
+
+        for (int i = 0; i < sizeof(data); i++) {
+            data[i] = i;
+        }
+
+        server_config->cipher_preferences = &aes128_gcm_preferences;
+        client_config->cipher_preferences = &aes128_gcm_preferences;
+
+        EXPECT_SUCCESS(loopback_socket_pair(&server_fd, &client_fd));
+
+        EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+        EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+        EXPECT_SUCCESS(s2n_connection_set_fd(server_conn, server_fd));
+        EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+        EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+        EXPECT_SUCCESS(s2n_connection_set_fd(client_conn, client_fd));
+
+        EXPECT_SUCCESS(negotiate_over_sockets(server_conn, client_conn));
+
+        if (s2n_connection_enable_ktls(server_conn) == 0) {
+            EXPECT_SUCCESS(s2n_connection_enable_ktls(client_conn));
+            EXPECT_EQUAL(s2n_connection_is_ktls_send_enabled(server_conn), 1);
+            EXPECT_EQUAL(s2n_connection_is_ktls_recv_enabled(server_conn), 1);
+
+            /* Data goes both ways through the kernel */
+            EXPECT_EQUAL(s2n_send(server_conn, data, sizeof(data), &blocked), sizeof(data));
+            uint32_t received_len = 0;
+            while (received_len < sizeof(data)) {
+                ssize_t r = s2n_recv(client_conn, received + received_len, sizeof(received) - received_len, &blocked);
+                if (r < 0) {
+                    EXPECT_EQUAL(s2n_error_get_type(s2n_errno), S2N_ERR_T_BLOCKED);
+                    continue;
+                }
+                received_len += r;
+            }
+            EXPECT_EQUAL(memcmp(data, received, sizeof(data)), 0);
+
+            EXPECT_EQUAL(s2n_send(client_conn, data, 100, &blocked), 100);
+            ssize_t r;
+            do {
+                r = s2n_recv(server_conn, received, sizeof(received), &blocked);
+            } while (r < 0 && s2n_error_get_type(s2n_errno) == S2N_ERR_T_BLOCKED);
+            EXPECT_EQUAL(r, 100);
+            EXPECT_EQUAL(memcmp(data, received, 100), 0);
+
+            /* close_notify goes through as an alert record */
+            EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+        } else {
+            EXPECT_EQUAL(s2n_errno, S2N_ERR_KTLS_UNSUPPORTED);
+
+            /* Without kernel support, the connection carries on in user space */
+            EXPECT_EQUAL(s2n_connection_is_ktls_send_enabled(server_conn), 0);
+            EXPECT_EQUAL(s2n_send(server_conn, data, sizeof(data), &blocked), sizeof(data));
+            uint32_t received_len = 0;
+            while (received_len < sizeof(data)) {
+                ssize_t r = s2n_recv(client_conn, received + received_len, sizeof(received) - received_len, &blocked);
+                if (r < 0) {
+                    EXPECT_EQUAL(s2n_error_get_type(s2n_errno), S2N_ERR_T_BLOCKED);
+                    continue;
+                }
+                received_len += r;
+            }
+            EXPECT_EQUAL(memcmp(data, received, sizeof(data)), 0);
+            EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+        }
+
+        EXPECT_SUCCESS(s2n_connection_free(server_conn));
+        EXPECT_SUCCESS(s2n_connection_free(client_conn));
+        EXPECT_SUCCESS(close(server_fd));
+        EXPECT_SUCCESS(close(client_fd));
+    }
+
+    /* When only sending can be offloaded, it stays offloaded and the
+     * connection carries on receiving in user space
+     */
+    {
+        int server_fd, client_fd;
+        int unix_fds[2];
+        uint8_t data[4096];
+        uint8_t received[4096];
+
+        for (int i = 0; i < sizeof(data); i++) {
+            data[i] = i;
+        }
+
+        /* The server reads from a UNIX socket, which the kernel can't do TLS on */
+        EXPECT_SUCCESS(loopback_socket_pair(&server_fd, &client_fd));
+        EXPECT_SUCCESS(socketpair(AF_UNIX, SOCK_STREAM, 0, unix_fds));
+        EXPECT_SUCCESS(fcntl(unix_fds[0], F_SETFL, fcntl(unix_fds[0], F_GETFL) | O_NONBLOCK));
+        EXPECT_SUCCESS(fcntl(unix_fds[1], F_SETFL, fcntl(unix_fds[1], F_GETFL) | O_NONBLOCK));
+
+        EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+        EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+        EXPECT_SUCCESS(s2n_connection_set_read_fd(server_conn, unix_fds[0]));
+        EXPECT_SUCCESS(s2n_connection_set_write_fd(server_conn, server_fd));
+        EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+        EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+        EXPECT_SUCCESS(s2n_connection_set_read_fd(client_conn, client_fd));
+        EXPECT_SUCCESS(s2n_connection_set_write_fd(client_conn, unix_fds[1]));
+
+        EXPECT_SUCCESS(negotiate_over_sockets(server_conn, client_conn));
+
+        EXPECT_EQUAL(s2n_connection_enable_ktls(server_conn), -1);
+        EXPECT_EQUAL(s2n_errno, S2N_ERR_KTLS_UNSUPPORTED);
+        EXPECT_EQUAL(s2n_connection_is_ktls_recv_enabled(server_conn), 0);
+        int send_enabled = s2n_connection_is_ktls_send_enabled(server_conn);
+
+        /* Trying again only retries receiving, and fails the same way */
+        EXPECT_EQUAL(s2n_connection_enable_ktls(server_conn), -1);
+        EXPECT_EQUAL(s2n_errno, S2N_ERR_KTLS_UNSUPPORTED);
+        EXPECT_EQUAL(s2n_connection_is_ktls_send_enabled(server_conn), send_enabled);
+        EXPECT_EQUAL(s2n_connection_is_ktls_recv_enabled(server_conn), 0);
+
+        /* Either way, data still goes both ways */
+        EXPECT_EQUAL(s2n_send(server_conn, data, sizeof(data), &blocked), sizeof(data));
+        uint32_t received_len = 0;
+        while (received_len < sizeof(data)) {
+            ssize_t r = s2n_recv(client_conn, received + received_len, sizeof(received) - received_len, &blocked);
+            if (r < 0) {
+                EXPECT_EQUAL(s2n_error_get_type(s2n_errno), S2N_ERR_T_BLOCKED);
+                continue;
+            }
+            received_len += r;
+        }
+        EXPECT_EQUAL(memcmp(data, received, sizeof(data)), 0);
+
+        EXPECT_EQUAL(s2n_send(client_conn, data, 100, &blocked), 100);
+        ssize_t r;
+        do {
+            r = s2n_recv(server_conn, received, sizeof(received), &blocked);
+        } while (r < 0 && s2n_error_get_type(s2n_errno) == S2N_ERR_T_BLOCKED);
+        EXPECT_EQUAL(r, 100);
+        EXPECT_EQUAL(memcmp(data, received, 100), 0);
+
+        EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+
+        EXPECT_SUCCESS(s2n_connection_free(server_conn));
+        EXPECT_SUCCESS(s2n_connection_free(client_conn));
+        EXPECT_SUCCESS(close(server_fd));
+        EXPECT_SUCCESS(close(client_fd));
+        EXPECT_SUCCESS(close(unix_fds[0]));
+        EXPECT_SUCCESS(close(unix_fds[1]));
+    }
+
+    /* A full socket blocks a kernel send on writing... */
+    {
+        int fds[2];
+        uint8_t data[4096] = { 0 };
+
+        EXPECT_SUCCESS(socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        EXPECT_SUCCESS(fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK));
+        /* Fill the socket */
+        while (write(fds[0], data, sizeof(data)) > 0) {
+        }
+
+        EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+        EXPECT_SUCCESS(s2n_connection_set_fd(server_conn, fds[0]));
+        server_conn->ktls_send_enabled = 1;
+
+        blocked = S2N_NOT_BLOCKED;
+        EXPECT_EQUAL(s2n_send(server_conn, data, sizeof(data), &blocked), -1);
+        EXPECT_EQUAL(s2n_errno, S2N_ERR_BLOCKED);
+        EXPECT_EQUAL(blocked, S2N_BLOCKED_ON_WRITE);
+
+        /* ... and so does a kernel sendfile */
+        FILE *file;
+        EXPECT_NOT_NULL(file = tmpfile());
+        EXPECT_EQUAL(fwrite(data, 1, sizeof(data), file), sizeof(data));
+        EXPECT_SUCCESS(fflush(file));
+
+        blocked = S2N_NOT_BLOCKED;
+        EXPECT_EQUAL(s2n_sendfile(server_conn, fileno(file), 0, sizeof(data), &blocked), -1);
+        EXPECT_EQUAL(s2n_errno, S2N_ERR_BLOCKED);
+        EXPECT_EQUAL(blocked, S2N_BLOCKED_ON_WRITE);
+        EXPECT_SUCCESS(fclose(file));
+
+        EXPECT_SUCCESS(s2n_connection_free(server_conn));
+        EXPECT_SUCCESS(close(fds[0]));
+        EXPECT_SUCCESS(close(fds[1]));
+    }
+
+    EXPECT_SUCCESS(s2n_config_free(server_config));
+    EXPECT_SUCCESS(s2n_config_free(client_config));
+
+    free(cert_chain_pem);
+    free(private_key_pem);
+    free(dhparams_pem);
+
+    END_TEST();
+}
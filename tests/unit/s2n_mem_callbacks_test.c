@@ -0,0 +1,195 @@
+/*
+ * Copyright 2014 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <s2n.h>
+
+#include "tls/s2n_config.h"
+
+#include "utils/s2n_blob.h"
+#include "utils/s2n_mem.h"
+#include "utils/s2n_slab.h"
+
+static int init_calls;
+static int cleanup_calls;
+static int malloc_calls;
+static int free_calls;
+static int64_t outstanding;
+
+static int counting_init(void)
+{
+    init_calls++;
+    return 0;
+}
+
+static int counting_cleanup(void)
+{
+    cleanup_calls++;
+    return 0;
+}
+
+static int counting_malloc(void **ptr, uint32_t requested, uint32_t *allocated)
+{
+    if (posix_memalign(ptr, sysconf(_SC_PAGESIZE), requested)) {
+        return -1;
+    }
+
+    malloc_calls++;
+    outstanding++;
+    *allocated = requested;
+    return 0;
+}
+
+static int counting_free(void *ptr, uint32_t size)
+{
+    free_calls++;
+    outstanding--;
+    free(ptr);
+    return 0;
+}
+
+/* Hands out memory that is deliberately one byte off a page boundary */
+static int unaligned_malloc(void **ptr, uint32_t requested, uint32_t *allocated)
+{
+    uint8_t *data;
+    if (posix_memalign((void **) &data, sysconf(_SC_PAGESIZE), requested + 1)) {
+        return -1;
+    }
+
+    *ptr = data + 1;
+    *allocated = requested;
+    return 0;
+}
+
+static int unaligned_free(void *ptr, uint32_t size)
+{
+    free((uint8_t *) ptr - 1);
+    return 0;
+}
+
+static int thread_cleanup_rc = -1;
+
+static void *cleanup_from_thread(void *arg)
+{
+    thread_cleanup_rc = s2n_mem_cleanup();
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *config;
+    struct s2n_connection *conn;
+    struct s2n_blob small = {0};
+    struct s2n_blob large = {0};
+    int use_mlock = getenv("S2N_DONT_MLOCK") == NULL;
+
+    BEGIN_TEST();
+
+    /* Callbacks can't be swapped underneath live allocations */
+    EXPECT_EQUAL(s2n_mem_set_callbacks(counting_init, counting_cleanup, counting_malloc, counting_free), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_INITIALIZED);
+
+    /* libcrypto can't have s2n's random engine re-added after s2n_cleanup, so only
+     * the memory subsystem is restarted here.
+     */
+    EXPECT_SUCCESS(s2n_mem_cleanup());
+
+    EXPECT_FAILURE(s2n_mem_set_callbacks(NULL, counting_cleanup, counting_malloc, counting_free));
+    EXPECT_FAILURE(s2n_mem_set_callbacks(counting_init, NULL, counting_malloc, counting_free));
+    EXPECT_FAILURE(s2n_mem_set_callbacks(counting_init, counting_cleanup, NULL, counting_free));
+    EXPECT_FAILURE(s2n_mem_set_callbacks(counting_init, counting_cleanup, counting_malloc, NULL));
+
+    EXPECT_SUCCESS(s2n_mem_set_callbacks(counting_init, counting_cleanup, counting_malloc, counting_free));
+    EXPECT_SUCCESS(s2n_mem_init());
+    EXPECT_EQUAL(init_calls, 1);
+    EXPECT_EQUAL(cleanup_calls, 0);
+
+    /* Blobs too big for a slab come straight from the callbacks */
+    EXPECT_SUCCESS(s2n_alloc(&large, 3 * S2N_SLAB_MAX_SIZE));
+    EXPECT_EQUAL(malloc_calls, 1);
+    if (use_mlock) {
+        EXPECT_EQUAL(large.allocated % sysconf(_SC_PAGESIZE), 0);
+        EXPECT_EQUAL(large.mlocked, 1);
+    }
+
+    /* Small locked blobs come from a slab arena, which also comes from the
+     * callbacks, as does the index of arenas
+     */
+    EXPECT_SUCCESS(s2n_alloc(&small, 16));
+    EXPECT_EQUAL(malloc_calls, use_mlock ? 3 : 2);
+
+    EXPECT_SUCCESS(s2n_free(&large));
+    EXPECT_EQUAL(free_calls, 1);
+    EXPECT_SUCCESS(s2n_free(&small));
+
+    /* Everything s2n allocates goes through the callbacks */
+    EXPECT_NOT_NULL(config = s2n_config_new());
+    EXPECT_NOT_NULL(conn = s2n_connection_new(S2N_SERVER));
+    EXPECT_SUCCESS(s2n_connection_set_config(conn, config));
+    EXPECT_TRUE(malloc_calls > 3);
+    EXPECT_SUCCESS(s2n_connection_free(conn));
+    EXPECT_SUCCESS(s2n_config_free(config));
+
+    /* Another thread cleaning up doesn't tear down the allocator under this one */
+    pthread_t thread;
+    EXPECT_EQUAL(pthread_create(&thread, NULL, cleanup_from_thread, NULL), 0);
+    EXPECT_EQUAL(pthread_join(thread, NULL), 0);
+    EXPECT_SUCCESS(thread_cleanup_rc);
+    EXPECT_EQUAL(cleanup_calls, 0);
+    EXPECT_EQUAL(s2n_mem_set_callbacks(counting_init, counting_cleanup, counting_malloc, counting_free), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_INITIALIZED);
+
+    /* ... and all of it has been handed back once s2n is cleaned up */
+    s2n_wipe_static_configs();
+    EXPECT_SUCCESS(s2n_mem_cleanup());
+    EXPECT_EQUAL(cleanup_calls, 1);
+    EXPECT_EQUAL(outstanding, 0);
+    EXPECT_EQUAL(malloc_calls, free_calls);
+
+    /* Locked memory has to be page aligned */
+    EXPECT_SUCCESS(s2n_mem_set_callbacks(counting_init, counting_cleanup, unaligned_malloc, unaligned_free));
+    EXPECT_SUCCESS(s2n_mem_init());
+    if (use_mlock) {
+        EXPECT_EQUAL(s2n_alloc(&large, 3 * S2N_SLAB_MAX_SIZE), -1);
+        EXPECT_EQUAL(s2n_errno, S2N_ERR_UNALIGNED_ALLOCATION);
+        EXPECT_NULL(large.data);
+        EXPECT_EQUAL(s2n_alloc(&small, 16), -1);
+        EXPECT_EQUAL(s2n_errno, S2N_ERR_UNALIGNED_ALLOCATION);
+    } else {
+        EXPECT_SUCCESS(s2n_alloc(&large, 3 * S2N_SLAB_MAX_SIZE));
+        EXPECT_SUCCESS(s2n_free(&large));
+    }
+    EXPECT_SUCCESS(s2n_mem_cleanup());
+
+    /* ... but memory that isn't locked doesn't, even if it's a whole number of pages */
+    EXPECT_SUCCESS(s2n_mem_set_mlock_policy(S2N_MLOCK_SECRETS_ONLY));
+    EXPECT_SUCCESS(s2n_mem_init());
+    EXPECT_SUCCESS(s2n_alloc_class(&large, 2 * sysconf(_SC_PAGESIZE), S2N_MEM_PUBLIC));
+    EXPECT_EQUAL(large.mlocked, 0);
+    EXPECT_SUCCESS(s2n_free(&large));
+    EXPECT_SUCCESS(s2n_mem_cleanup());
+    EXPECT_SUCCESS(s2n_mem_set_mlock_policy(S2N_MLOCK_ALL));
+
+    EXPECT_SUCCESS(s2n_mem_set_callbacks(counting_init, counting_cleanup, counting_malloc, counting_free));
+    EXPECT_SUCCESS(s2n_mem_init());
+
+    END_TEST();
+}
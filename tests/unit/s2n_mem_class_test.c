@@ -0,0 +1,161 @@
+/*
+ * Copyright 2014 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <s2n.h>
+
+#include "stuffer/s2n_stuffer.h"
+
+#include "tls/s2n_config.h"
+#include "tls/s2n_connection.h"
+#include "tls/s2n_connection_buffers.h"
+
+#include "utils/s2n_blob.h"
+#include "utils/s2n_mem.h"
+#include "utils/s2n_slab.h"
+
+#define LARGE_SIZE (3 * S2N_SLAB_MAX_SIZE)
+
+int main(int argc, char **argv)
+{
+    struct s2n_connection *conn;
+    struct s2n_blob secret = {0};
+    struct s2n_blob small_secret = {0};
+    struct s2n_blob plaintext = {0};
+    struct s2n_blob public = {0};
+    struct s2n_stuffer stuffer;
+    int use_mlock = getenv("S2N_DONT_MLOCK") == NULL;
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    BEGIN_TEST();
+
+    /* The policy can't change underneath live allocations */
+    EXPECT_EQUAL(s2n_mem_set_mlock_policy(S2N_MLOCK_SECRETS_ONLY), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_INITIALIZED);
+
+    /* Only the memory subsystem is restarted, as in the callbacks test */
+    EXPECT_SUCCESS(s2n_mem_cleanup());
+    EXPECT_FAILURE(s2n_mem_set_mlock_policy(S2N_MLOCK_NONE + 1));
+
+    /* By default every class is locked */
+    EXPECT_SUCCESS(s2n_mem_set_mlock_policy(S2N_MLOCK_ALL));
+    EXPECT_SUCCESS(s2n_mem_init());
+    EXPECT_SUCCESS(s2n_alloc_class(&plaintext, LARGE_SIZE, S2N_MEM_PLAINTEXT));
+    EXPECT_SUCCESS(s2n_alloc_class(&public, LARGE_SIZE, S2N_MEM_PUBLIC));
+    EXPECT_EQUAL(plaintext.mlocked, use_mlock);
+    EXPECT_EQUAL(public.mlocked, use_mlock);
+    EXPECT_SUCCESS(s2n_free(&plaintext));
+    EXPECT_SUCCESS(s2n_free(&public));
+    EXPECT_SUCCESS(s2n_mem_cleanup());
+
+    /* Only secrets are locked under S2N_MLOCK_SECRETS_ONLY */
+    EXPECT_SUCCESS(s2n_mem_set_mlock_policy(S2N_MLOCK_SECRETS_ONLY));
+    EXPECT_SUCCESS(s2n_mem_init());
+
+    EXPECT_SUCCESS(s2n_alloc(&secret, LARGE_SIZE));
+    EXPECT_SUCCESS(s2n_alloc(&small_secret, 32));
+    EXPECT_EQUAL(secret.mem_class, S2N_MEM_SECRET);
+    EXPECT_EQUAL(secret.mlocked, use_mlock);
+    EXPECT_EQUAL(small_secret.mlocked, use_mlock);
+    EXPECT_EQUAL(s2n_slab_owns(small_secret.data), use_mlock);
+
+    /* Plaintext isn't locked, but is still page aligned so it can be kept out of core dumps */
+    EXPECT_SUCCESS(s2n_alloc_class(&plaintext, LARGE_SIZE, S2N_MEM_PLAINTEXT));
+    EXPECT_EQUAL(plaintext.mlocked, 0);
+    if (use_mlock) {
+        EXPECT_EQUAL((uintptr_t) plaintext.data % page_size, 0);
+        EXPECT_EQUAL(plaintext.allocated % page_size, 0);
+    }
+
+    /* Public data is ordinary memory, however small */
+    EXPECT_SUCCESS(s2n_alloc_class(&public, 32, S2N_MEM_PUBLIC));
+    EXPECT_EQUAL(public.mlocked, 0);
+    EXPECT_FALSE(s2n_slab_owns(public.data));
+    EXPECT_EQUAL(public.allocated, 32);
+
+    /* The class survives reallocation */
+    EXPECT_SUCCESS(s2n_realloc(&public, LARGE_SIZE));
+    EXPECT_EQUAL(public.mem_class, S2N_MEM_PUBLIC);
+    EXPECT_EQUAL(public.mlocked, 0);
+    EXPECT_SUCCESS(s2n_realloc(&small_secret, LARGE_SIZE));
+    EXPECT_EQUAL(small_secret.mem_class, S2N_MEM_SECRET);
+    EXPECT_EQUAL(small_secret.mlocked, use_mlock);
+
+    EXPECT_SUCCESS(s2n_stuffer_growable_alloc_class(&stuffer, 0, S2N_MEM_PUBLIC));
+    EXPECT_SUCCESS(s2n_stuffer_skip_write(&stuffer, LARGE_SIZE));
+    EXPECT_EQUAL(stuffer.blob.mem_class, S2N_MEM_PUBLIC);
+    EXPECT_EQUAL(stuffer.blob.mlocked, 0);
+    EXPECT_SUCCESS(s2n_stuffer_free(&stuffer));
+
+    EXPECT_SUCCESS(s2n_free(&secret));
+    EXPECT_SUCCESS(s2n_free(&small_secret));
+    EXPECT_SUCCESS(s2n_free(&plaintext));
+    EXPECT_SUCCESS(s2n_free(&public));
+
+    /* A connection's record and handshake buffers aren't locked, and stay unlocked when they grow or are released */
+    EXPECT_NOT_NULL(conn = s2n_connection_new(S2N_SERVER));
+    EXPECT_EQUAL(conn->out.blob.mem_class, S2N_MEM_PLAINTEXT);
+    EXPECT_EQUAL(conn->out.blob.mlocked, 0);
+    EXPECT_EQUAL(conn->in.blob.mem_class, S2N_MEM_PLAINTEXT);
+    EXPECT_EQUAL(conn->in.blob.mlocked, 0);
+    EXPECT_EQUAL(conn->handshake.io.blob.mlocked, 0);
+    EXPECT_EQUAL(conn->client_hello.raw_message.blob.mem_class, S2N_MEM_PUBLIC);
+    EXPECT_SUCCESS(s2n_connection_set_read_ahead(conn, LARGE_SIZE));
+    EXPECT_EQUAL(conn->buffer_in.blob.mem_class, S2N_MEM_PUBLIC);
+    EXPECT_SUCCESS(s2n_connection_release_buffers(conn));
+    EXPECT_SUCCESS(s2n_connection_acquire_buffers(conn));
+    EXPECT_EQUAL(conn->out.blob.mem_class, S2N_MEM_PLAINTEXT);
+    EXPECT_EQUAL(conn->buffer_in.blob.mem_class, S2N_MEM_PUBLIC);
+    EXPECT_EQUAL(conn->out.blob.mlocked, 0);
+    EXPECT_SUCCESS(s2n_connection_free(conn));
+
+    s2n_wipe_static_configs();
+    EXPECT_SUCCESS(s2n_mem_cleanup());
+
+    /* Nothing is locked under S2N_MLOCK_NONE */
+    EXPECT_SUCCESS(s2n_mem_set_mlock_policy(S2N_MLOCK_NONE));
+    EXPECT_SUCCESS(s2n_mem_init());
+    EXPECT_SUCCESS(s2n_alloc(&secret, LARGE_SIZE));
+    EXPECT_EQUAL(secret.mlocked, 0);
+    EXPECT_SUCCESS(s2n_free(&secret));
+
+    /* ... and blobs grow with realloc(), rather than being copied and freed */
+    struct s2n_mem_stats before;
+    struct s2n_mem_stats after;
+    EXPECT_SUCCESS(s2n_alloc(&secret, 32));
+    memset(secret.data, 0x5a, secret.size);
+    EXPECT_SUCCESS(s2n_mem_get_stats(&before));
+    EXPECT_SUCCESS(s2n_realloc(&secret, LARGE_SIZE));
+    EXPECT_SUCCESS(s2n_mem_get_stats(&after));
+    EXPECT_EQUAL(after.reallocs - before.reallocs, 1);
+    EXPECT_EQUAL(after.frees, before.frees);
+    EXPECT_EQUAL(secret.allocated, LARGE_SIZE);
+    for (int i = 0; i < 32; i++) {
+        EXPECT_EQUAL(secret.data[i], 0x5a);
+    }
+    EXPECT_SUCCESS(s2n_free(&secret));
+    EXPECT_SUCCESS(s2n_mem_cleanup());
+
+    EXPECT_SUCCESS(s2n_mem_set_mlock_policy(S2N_MLOCK_ALL));
+    EXPECT_SUCCESS(s2n_mem_init());
+
+    END_TEST();
+}
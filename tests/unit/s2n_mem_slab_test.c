@@ -0,0 +1,185 @@
+/*
+ * Copyright 2014 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <s2n.h>
+
+#include "utils/s2n_blob.h"
+#include "utils/s2n_mem.h"
+#include "utils/s2n_slab.h"
+
+#define SMALL_BLOBS 100
+#define THREADS 8
+#define THREAD_ROUNDS 2000
+
+/* Allocate and free blobs of every size class over and over, checking that
+ * no other thread writes into them in between
+ */
+static void *s2n_slab_test_thread(void *arg)
+{
+    uint8_t fill = (uint8_t) (uintptr_t) arg;
+    struct s2n_blob blobs[8] = {{0}};
+
+    for (int round = 0; round < THREAD_ROUNDS; round++) {
+        for (int i = 0; i < 8; i++) {
+            uint32_t size = 1 + ((round + i * 257 + fill * 31) % S2N_SLAB_MAX_SIZE);
+            if (s2n_alloc(&blobs[i], size) < 0) {
+                return (void *) 1;
+            }
+            memset(blobs[i].data, fill, size);
+        }
+        for (int i = 0; i < 8; i++) {
+            for (int j = 0; j < blobs[i].size; j++) {
+                if (blobs[i].data[j] != fill) {
+                    return (void *) 1;
+                }
+            }
+            if (s2n_free(&blobs[i]) < 0) {
+                return (void *) 1;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct s2n_blob small[SMALL_BLOBS] = {{0}};
+    struct s2n_blob large = {0};
+    struct s2n_blob blob = {0};
+    struct s2n_slab_stats before;
+    struct s2n_slab_stats stats;
+
+    BEGIN_TEST();
+
+    if (getenv("S2N_DONT_MLOCK")) {
+        /* Nothing is locked, so nothing is carved out of arenas */
+        EXPECT_SUCCESS(s2n_alloc(&blob, 32));
+        EXPECT_FALSE(s2n_slab_owns(blob.data));
+        EXPECT_SUCCESS(s2n_free(&blob));
+
+        END_TEST();
+    }
+
+    EXPECT_FAILURE(s2n_slab_get_stats(NULL));
+    EXPECT_SUCCESS(s2n_slab_get_stats(&before));
+
+    /* Small blobs are rounded up to their size class and share arenas */
+    for (int i = 0; i < SMALL_BLOBS; i++) {
+        EXPECT_SUCCESS(s2n_alloc(&small[i], 20 + i));
+        EXPECT_EQUAL(small[i].size, 20 + i);
+        EXPECT_TRUE(s2n_slab_owns(small[i].data));
+        EXPECT_EQUAL(small[i].slab, 1);
+        EXPECT_EQUAL(small[i].mlocked, 1);
+        EXPECT_TRUE(small[i].allocated >= small[i].size);
+        EXPECT_TRUE(small[i].allocated <= 2 * small[i].size);
+        memset(small[i].data, 0xff, small[i].size);
+    }
+    EXPECT_SUCCESS(s2n_slab_get_stats(&stats));
+    EXPECT_EQUAL(stats.slabs_in_use, before.slabs_in_use + SMALL_BLOBS);
+    EXPECT_EQUAL(stats.slab_allocs, before.slab_allocs + SMALL_BLOBS);
+    /* 20..119 bytes fall into three size classes */
+    EXPECT_TRUE(stats.arenas <= before.arenas + 3);
+    EXPECT_EQUAL(stats.arena_bytes, (uint64_t) stats.arenas * S2N_SLAB_ARENA_SIZE);
+
+    /* Blobs never overlap */
+    for (int i = 1; i < SMALL_BLOBS; i++) {
+        for (int j = 0; j < i; j++) {
+            EXPECT_TRUE(small[i].data >= small[j].data + small[j].allocated || small[j].data >= small[i].data + small[i].allocated);
+        }
+    }
+
+    /* Large blobs still get pages of their own */
+    EXPECT_SUCCESS(s2n_alloc(&large, S2N_SLAB_MAX_SIZE + 1));
+    EXPECT_FALSE(s2n_slab_owns(large.data));
+    EXPECT_EQUAL(large.slab, 0);
+    EXPECT_EQUAL(large.mlocked, 1);
+
+    /* Growing within the size class keeps the slab, growing past it moves the data */
+    EXPECT_SUCCESS(s2n_alloc(&blob, 40));
+    memset(blob.data, 0xaa, blob.size);
+    uint8_t *first = blob.data;
+    EXPECT_SUCCESS(s2n_realloc(&blob, 60));
+    EXPECT_EQUAL(blob.data, first);
+    EXPECT_SUCCESS(s2n_realloc(&blob, 1000));
+    EXPECT_NOT_EQUAL(blob.data, first);
+    EXPECT_TRUE(s2n_slab_owns(blob.data));
+    for (int i = 0; i < 40; i++) {
+        EXPECT_EQUAL(blob.data[i], 0xaa);
+    }
+    /* The old slab was wiped when it was released, past the free list pointer */
+    for (int i = sizeof(void *); i < 60; i++) {
+        EXPECT_EQUAL(first[i], 0);
+    }
+    EXPECT_SUCCESS(s2n_realloc(&blob, 4 * S2N_SLAB_MAX_SIZE));
+    EXPECT_FALSE(s2n_slab_owns(blob.data));
+    EXPECT_EQUAL(blob.slab, 0);
+    for (int i = 0; i < 40; i++) {
+        EXPECT_EQUAL(blob.data[i], 0xaa);
+    }
+    EXPECT_SUCCESS(s2n_free(&blob));
+
+    /* Slabs can be freed through a blob rebuilt from the bare pointer, and are wiped and reused */
+    uint8_t *reused = small[0].data;
+    struct s2n_blob rebuilt = {.data = small[0].data,.size = small[0].size };
+    EXPECT_SUCCESS(s2n_free(&rebuilt));
+    EXPECT_NULL(rebuilt.data);
+    for (int i = sizeof(void *); i < 20; i++) {
+        EXPECT_EQUAL(reused[i], 0);
+    }
+    EXPECT_SUCCESS(s2n_alloc(&small[0], 20));
+    EXPECT_EQUAL(small[0].data, reused);
+    for (int i = 0; i < 20; i++) {
+        EXPECT_EQUAL(small[0].data[i], 0);
+    }
+
+    for (int i = 0; i < SMALL_BLOBS; i++) {
+        EXPECT_SUCCESS(s2n_free(&small[i]));
+    }
+    EXPECT_SUCCESS(s2n_free(&large));
+    EXPECT_SUCCESS(s2n_slab_get_stats(&stats));
+    EXPECT_EQUAL(stats.slabs_in_use, before.slabs_in_use);
+    EXPECT_EQUAL(stats.slab_frees, before.slab_frees + SMALL_BLOBS + 3);
+
+    /* Threads allocating and freeing at once, in the same and different size classes */
+    pthread_t threads[THREADS];
+    EXPECT_SUCCESS(s2n_slab_get_stats(&before));
+    for (int i = 0; i < THREADS; i++) {
+        EXPECT_SUCCESS(pthread_create(&threads[i], NULL, s2n_slab_test_thread, (void *) (uintptr_t) (i + 1)));
+    }
+    for (int i = 0; i < THREADS; i++) {
+        void *result;
+        EXPECT_SUCCESS(pthread_join(threads[i], &result));
+        EXPECT_NULL(result);
+    }
+    EXPECT_SUCCESS(s2n_slab_get_stats(&stats));
+    EXPECT_EQUAL(stats.slabs_in_use, before.slabs_in_use);
+    EXPECT_EQUAL(stats.slab_allocs, before.slab_allocs + THREADS * THREAD_ROUNDS * 8);
+    EXPECT_EQUAL(stats.slab_frees, before.slab_frees + THREADS * THREAD_ROUNDS * 8);
+
+    /* Cleanup releases the arenas that are no longer used */
+    EXPECT_SUCCESS(s2n_slab_cleanup());
+    EXPECT_SUCCESS(s2n_slab_get_stats(&stats));
+    EXPECT_TRUE(stats.arenas <= before.arenas);
+
+    END_TEST();
+}
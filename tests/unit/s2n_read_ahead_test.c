@@ -0,0 +1,186 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include "testlib/s2n_testlib.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include <s2n.h>
+
+#include "stuffer/s2n_stuffer.h"
+
+#include "tls/s2n_connection.h"
+
+#include "utils/s2n_random.h"
+
+#define RECORD_COUNT 50
+#define RECORD_SIZE 100
+#define READ_AHEAD_SIZE (64 * 1024)
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *server_config;
+    struct s2n_config *client_config;
+    struct s2n_connection *server_conn;
+    struct s2n_connection *client_conn;
+    struct s2n_test_io_buffer client_to_server;
+    struct s2n_test_io_buffer server_to_client;
+    s2n_blocked_status blocked;
+    char *cert_chain_pem;
+    char *private_key_pem;
+    char *dhparams_pem;
+    uint8_t data[RECORD_COUNT * RECORD_SIZE];
+    uint8_t received[RECORD_COUNT * RECORD_SIZE];
+    struct s2n_blob blob = {.data = data, .size = sizeof(data) };
+
+    BEGIN_TEST();
+
+    EXPECT_SUCCESS(setenv("S2N_ENABLE_CLIENT_MODE", "1", 0));
+    EXPECT_SUCCESS(s2n_get_urandom_data(&blob));
+
+    EXPECT_NOT_NULL(cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(dhparams_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+
+    EXPECT_NOT_NULL(server_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_DHPARAMS, dhparams_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem));
+    EXPECT_SUCCESS(s2n_config_add_dhparams(server_config, dhparams_pem));
+
+    EXPECT_NOT_NULL(client_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_config_disable_x509_verification(client_config));
+
+    EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+    EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+    EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+    EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+
+    EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server, 0));
+    EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 0));
+    EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+
+    /* Read-ahead works through the handshake too */
+    EXPECT_EQUAL(s2n_connection_get_buffered_bytes_in(server_conn), 0);
+    EXPECT_SUCCESS(s2n_connection_set_read_ahead(server_conn, READ_AHEAD_SIZE));
+    EXPECT_EQUAL(server_conn->buffer_in.blob.size, READ_AHEAD_SIZE);
+    EXPECT_SUCCESS(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+    EXPECT_EQUAL(s2n_connection_get_buffered_bytes_in(server_conn), 0);
+
+    /* Send lots of small records back to back */
+    for (int i = 0; i < RECORD_COUNT; i++) {
+        EXPECT_EQUAL(s2n_send(client_conn, data + i * RECORD_SIZE, RECORD_SIZE, &blocked), RECORD_SIZE);
+    }
+
+    /* A single read from the socket is enough to return all of them */
+    client_to_server.calls = 0;
+    EXPECT_EQUAL(s2n_recv(server_conn, received, sizeof(received), &blocked), sizeof(received));
+    EXPECT_EQUAL(client_to_server.calls, 1);
+    EXPECT_EQUAL(memcmp(data, received, sizeof(received)), 0);
+    EXPECT_EQUAL(s2n_connection_get_buffered_bytes_in(server_conn), 0);
+    EXPECT_EQUAL(s2n_peek(server_conn), 0);
+
+    /* Reading a little at a time leaves plaintext and ciphertext buffered in s2n */
+    for (int i = 0; i < RECORD_COUNT; i++) {
+        EXPECT_EQUAL(s2n_send(client_conn, data + i * RECORD_SIZE, RECORD_SIZE, &blocked), RECORD_SIZE);
+    }
+    client_to_server.calls = 0;
+    EXPECT_EQUAL(s2n_recv(server_conn, received, 10, &blocked), 10);
+    EXPECT_EQUAL(s2n_peek(server_conn), RECORD_SIZE - 10);
+    EXPECT_TRUE(s2n_connection_get_buffered_bytes_in(server_conn) > 0);
+
+    /* The read-ahead buffer can't be resized while it holds data */
+    EXPECT_FAILURE(s2n_connection_set_read_ahead(server_conn, 0));
+
+    uint32_t received_len = 10;
+    while (received_len < sizeof(received)) {
+        int r = s2n_recv(server_conn, received + received_len, sizeof(received) - received_len, &blocked);
+        EXPECT_TRUE(r > 0);
+        received_len += r;
+    }
+    EXPECT_EQUAL(client_to_server.calls, 1);
+    EXPECT_EQUAL(memcmp(data, received, sizeof(received)), 0);
+    EXPECT_EQUAL(s2n_connection_get_buffered_bytes_in(server_conn), 0);
+
+    /* Without read-ahead every record costs at least two reads */
+    EXPECT_SUCCESS(s2n_connection_set_read_ahead(server_conn, 0));
+    EXPECT_EQUAL(server_conn->buffer_in.blob.size, 0);
+    for (int i = 0; i < RECORD_COUNT; i++) {
+        EXPECT_EQUAL(s2n_send(client_conn, data + i * RECORD_SIZE, RECORD_SIZE, &blocked), RECORD_SIZE);
+    }
+    client_to_server.calls = 0;
+    received_len = 0;
+    while (received_len < sizeof(received)) {
+        int r = s2n_recv(server_conn, received + received_len, sizeof(received) - received_len, &blocked);
+        EXPECT_TRUE(r > 0);
+        received_len += r;
+    }
+    EXPECT_EQUAL(client_to_server.calls, 2 * RECORD_COUNT);
+    EXPECT_EQUAL(memcmp(data, received, sizeof(received)), 0);
+
+    /* A read-ahead buffer smaller than a record still works */
+    EXPECT_SUCCESS(s2n_connection_set_read_ahead(server_conn, 7));
+    for (int i = 0; i < RECORD_COUNT; i++) {
+        EXPECT_EQUAL(s2n_send(client_conn, data + i * RECORD_SIZE, RECORD_SIZE, &blocked), RECORD_SIZE);
+    }
+    received_len = 0;
+    while (received_len < sizeof(received)) {
+        int r = s2n_recv(server_conn, received + received_len, sizeof(received) - received_len, &blocked);
+        EXPECT_TRUE(r > 0);
+        received_len += r;
+    }
+    EXPECT_EQUAL(memcmp(data, received, sizeof(received)), 0);
+
+    EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+
+    /* A good record read along with a corrupted one after it still has its
+     * data returned, and the error waits for the next call
+     */
+    EXPECT_SUCCESS(s2n_connection_wipe(server_conn));
+    EXPECT_SUCCESS(s2n_connection_wipe(client_conn));
+    EXPECT_SUCCESS(s2n_stuffer_wipe(&client_to_server.data));
+    EXPECT_SUCCESS(s2n_stuffer_wipe(&server_to_client.data));
+    EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+    EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+    EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+    EXPECT_SUCCESS(s2n_connection_set_blinding(server_conn, S2N_SELF_SERVICE_BLINDING));
+    EXPECT_SUCCESS(s2n_connection_set_read_ahead(server_conn, READ_AHEAD_SIZE));
+    EXPECT_SUCCESS(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+    EXPECT_EQUAL(s2n_send(client_conn, data, RECORD_SIZE, &blocked), RECORD_SIZE);
+    EXPECT_EQUAL(s2n_send(client_conn, data + RECORD_SIZE, RECORD_SIZE, &blocked), RECORD_SIZE);
+    client_to_server.data.blob.data[client_to_server.data.write_cursor - 1] ^= 0x01;
+    EXPECT_EQUAL(s2n_recv(server_conn, received, sizeof(received), &blocked), RECORD_SIZE);
+    EXPECT_EQUAL(memcmp(data, received, RECORD_SIZE), 0);
+    EXPECT_EQUAL(s2n_recv(server_conn, received, sizeof(received), &blocked), -1);
+    EXPECT_EQUAL(s2n_error_get_type(s2n_errno), S2N_ERR_T_PROTO);
+    EXPECT_EQUAL(s2n_recv(server_conn, received, sizeof(received), &blocked), -1);
+
+    EXPECT_SUCCESS(s2n_connection_free(server_conn));
+    EXPECT_SUCCESS(s2n_connection_free(client_conn));
+    EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server));
+    EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+    EXPECT_SUCCESS(s2n_config_free(server_config));
+    EXPECT_SUCCESS(s2n_config_free(client_config));
+
+    free(cert_chain_pem);
+    free(private_key_pem);
+    free(dhparams_pem);
+
+    END_TEST();
+}
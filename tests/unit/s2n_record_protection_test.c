@@ -0,0 +1,237 @@
+/*
+ * Copyright 2014 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include <string.h>
+#include <sys/uio.h>
+
+#include <s2n.h>
+
+#include "testlib/s2n_testlib.h"
+
+#include "tls/s2n_cipher_suites.h"
+#include "tls/s2n_connection.h"
+#include "tls/s2n_crypto.h"
+#include "tls/s2n_record.h"
+#include "stuffer/s2n_stuffer.h"
+#include "crypto/s2n_cipher.h"
+#include "utils/s2n_random.h"
+#include "utils/s2n_safety.h"
+
+/* Move the record just written into the read side of the connection */
+static int loop_record(struct s2n_connection *conn)
+{
+    GUARD(s2n_stuffer_wipe(&conn->header_in));
+    GUARD(s2n_stuffer_wipe(&conn->in));
+    GUARD(s2n_stuffer_copy(&conn->out, &conn->header_in, S2N_TLS_RECORD_HEADER_LENGTH));
+    GUARD(s2n_stuffer_copy(&conn->out, &conn->in, s2n_stuffer_data_available(&conn->out)));
+    GUARD(s2n_stuffer_wipe(&conn->out));
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct s2n_connection *conn;
+    uint8_t random_data[S2N_DEFAULT_FRAGMENT_LENGTH];
+    uint8_t generic_record[S2N_TLS_MAXIMUM_RECORD_LENGTH];
+    uint8_t key_data[] = "1234567890123456789012345678901";
+    struct s2n_blob r = {.data = random_data,.size = sizeof(random_data) };
+
+    struct {
+        struct s2n_cipher_suite *cipher_suite;
+        const struct s2n_record_protection *protection;
+        uint8_t key_size;
+    } aead_suites[] = {
+        { &s2n_ecdhe_rsa_with_aes_128_gcm_sha256, &s2n_record_aes_gcm_protection, 16 },
+        { &s2n_ecdhe_rsa_with_aes_256_gcm_sha384, &s2n_record_aes_gcm_protection, 32 },
+        { &s2n_ecdhe_rsa_with_chacha20_poly1305_sha256, &s2n_record_chacha20_poly1305_protection, 32 },
+    };
+
+    BEGIN_TEST();
+
+    EXPECT_NOT_NULL(conn = s2n_connection_new(S2N_SERVER));
+    EXPECT_SUCCESS(s2n_get_urandom_data(&r));
+
+    /* Ciphers without a specialized routine stay on the generic path */
+    {
+        struct s2n_blob key = {.data = key_data,.size = 16 };
+        EXPECT_SUCCESS(s2n_test_setup_secure_keys(conn, &s2n_ecdhe_rsa_with_aes_128_cbc_sha256, &key));
+        EXPECT_NULL(conn->secure.record_protection);
+        EXPECT_SUCCESS(s2n_connection_wipe(conn));
+    }
+
+    for (int s = 0; s < sizeof(aead_suites) / sizeof(aead_suites[0]); s++) {
+        struct s2n_cipher_suite *cipher_suite = aead_suites[s].cipher_suite;
+        struct s2n_blob key = {.data = key_data,.size = aead_suites[s].key_size };
+
+        if (!cipher_suite->available) {
+            continue;
+        }
+
+        EXPECT_SUCCESS(s2n_test_setup_secure_keys(conn, cipher_suite, &key));
+        EXPECT_EQUAL(conn->secure.record_protection, aead_suites[s].protection);
+
+        /* Records from the specialized path are byte for byte the same as
+         * the generic ones, and each path can read the other's records.
+         */
+        uint16_t sizes[] = { 0, 1, 15, 16, 17, 100, 1398, 4096, S2N_DEFAULT_FRAGMENT_LENGTH - 1 };
+        for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            struct s2n_blob in = {.data = random_data,.size = sizes[i] };
+            const struct s2n_record_protection *protection = conn->secure.record_protection;
+
+            EXPECT_SUCCESS(s2n_connection_prefer_throughput(conn));
+            memset(conn->secure.server_sequence_number, 0, S2N_TLS_SEQUENCE_NUM_LEN);
+            memset(conn->secure.client_sequence_number, 0, S2N_TLS_SEQUENCE_NUM_LEN);
+            conn->secure.server_sequence_number[7] = i;
+            conn->secure.client_sequence_number[7] = i;
+
+            /* Generic */
+            conn->secure.record_protection = NULL;
+            int generic_written = s2n_record_write(conn, TLS_APPLICATION_DATA, &in);
+            EXPECT_SUCCESS(generic_written);
+            uint32_t generic_length = s2n_stuffer_data_available(&conn->out);
+            EXPECT_SUCCESS(s2n_stuffer_read_bytes(&conn->out, generic_record, generic_length));
+            EXPECT_SUCCESS(s2n_stuffer_reread(&conn->out));
+
+            /* ... parsed by the specialized routine */
+            conn->secure.record_protection = protection;
+            EXPECT_SUCCESS(loop_record(conn));
+            EXPECT_SUCCESS(s2n_record_parse(conn));
+            EXPECT_EQUAL(conn->in_status, PLAINTEXT);
+            EXPECT_EQUAL(s2n_stuffer_data_available(&conn->in), generic_written);
+            EXPECT_EQUAL(memcmp(s2n_stuffer_raw_read(&conn->in, generic_written), random_data, generic_written), 0);
+            EXPECT_EQUAL(conn->secure.client_sequence_number[7], i + 1);
+
+            /* Specialized, with the same sequence number */
+            conn->secure.server_sequence_number[7] = i;
+            conn->secure.client_sequence_number[7] = i;
+            EXPECT_EQUAL(s2n_record_write(conn, TLS_APPLICATION_DATA, &in), generic_written);
+            EXPECT_EQUAL(s2n_stuffer_data_available(&conn->out), generic_length);
+            EXPECT_EQUAL(memcmp(conn->out.blob.data, generic_record, generic_length), 0);
+            EXPECT_EQUAL(conn->secure.server_sequence_number[7], i + 1);
+
+            /* ... parsed by the generic routine */
+            conn->secure.record_protection = NULL;
+            EXPECT_SUCCESS(loop_record(conn));
+            EXPECT_SUCCESS(s2n_record_parse(conn));
+            EXPECT_EQUAL(s2n_stuffer_data_available(&conn->in), generic_written);
+            EXPECT_EQUAL(memcmp(s2n_stuffer_raw_read(&conn->in, generic_written), random_data, generic_written), 0);
+
+            conn->secure.record_protection = protection;
+        }
+
+        /* Scattered input, starting part way through the first buffer */
+        {
+            struct iovec iov[3];
+            iov[0].iov_base = random_data;
+            iov[0].iov_len = 10;
+            iov[1].iov_base = random_data + 10;
+            iov[1].iov_len = 1;
+            iov[2].iov_base = random_data + 11;
+            iov[2].iov_len = 500;
+
+            memset(conn->secure.server_sequence_number, 0, S2N_TLS_SEQUENCE_NUM_LEN);
+            conn->secure.record_protection = NULL;
+            EXPECT_EQUAL(s2n_record_writev(conn, TLS_APPLICATION_DATA, iov, 3, 3, 200), 200);
+            uint32_t generic_length = s2n_stuffer_data_available(&conn->out);
+            EXPECT_SUCCESS(s2n_stuffer_read_bytes(&conn->out, generic_record, generic_length));
+            EXPECT_SUCCESS(s2n_stuffer_wipe(&conn->out));
+
+            memset(conn->secure.server_sequence_number, 0, S2N_TLS_SEQUENCE_NUM_LEN);
+            conn->secure.record_protection = aead_suites[s].protection;
+            EXPECT_EQUAL(s2n_record_writev(conn, TLS_APPLICATION_DATA, iov, 3, 3, 200), 200);
+            EXPECT_EQUAL(s2n_stuffer_data_available(&conn->out), generic_length);
+            EXPECT_EQUAL(memcmp(conn->out.blob.data, generic_record, generic_length), 0);
+            EXPECT_SUCCESS(s2n_stuffer_wipe(&conn->out));
+        }
+
+        /* Records can be decrypted straight into a buffer big enough for the payload */
+        {
+            uint8_t plaintext[1000];
+            struct s2n_blob in = {.data = random_data,.size = sizeof(plaintext) };
+
+            memset(conn->secure.server_sequence_number, 0, S2N_TLS_SEQUENCE_NUM_LEN);
+            memset(conn->secure.client_sequence_number, 0, S2N_TLS_SEQUENCE_NUM_LEN);
+            EXPECT_EQUAL(s2n_record_write(conn, TLS_APPLICATION_DATA, &in), sizeof(plaintext));
+            EXPECT_SUCCESS(loop_record(conn));
+            conn->in_status = ENCRYPTED;
+
+            EXPECT_FALSE(s2n_record_can_parse_into(conn, sizeof(plaintext) - 1));
+            EXPECT_TRUE(s2n_record_can_parse_into(conn, sizeof(plaintext)));
+            EXPECT_EQUAL(s2n_record_parse_into(conn, plaintext, sizeof(plaintext) - 1), -1);
+            EXPECT_EQUAL(s2n_errno, S2N_ERR_SIZE_MISMATCH);
+            EXPECT_EQUAL(s2n_record_parse_into(conn, plaintext, sizeof(plaintext)), sizeof(plaintext));
+            EXPECT_EQUAL(memcmp(plaintext, random_data, sizeof(plaintext)), 0);
+            EXPECT_EQUAL(conn->secure.client_sequence_number[7], 1);
+
+            /* conn->in is ready for the next record */
+            EXPECT_EQUAL(conn->in_status, ENCRYPTED);
+            EXPECT_EQUAL(s2n_stuffer_data_available(&conn->in), 0);
+            EXPECT_EQUAL(s2n_stuffer_data_available(&conn->header_in), 0);
+
+            /* Unauthenticated plaintext doesn't stay in the buffer */
+            EXPECT_EQUAL(s2n_record_write(conn, TLS_APPLICATION_DATA, &in), sizeof(plaintext));
+            conn->out.blob.data[s2n_stuffer_data_available(&conn->out) - 1]++;
+            EXPECT_SUCCESS(loop_record(conn));
+            memset(plaintext, 0xaa, sizeof(plaintext));
+            EXPECT_FAILURE(s2n_record_parse_into(conn, plaintext, sizeof(plaintext)));
+            for (int j = 0; j < sizeof(plaintext); j++) {
+                EXPECT_EQUAL(plaintext[j], 0);
+            }
+        }
+
+        /* Tampered records are rejected */
+        for (int j = S2N_TLS_RECORD_HEADER_LENGTH; j < S2N_TLS_RECORD_HEADER_LENGTH + 100 + aead_suites[s].protection->overhead; j += 7) {
+            struct s2n_blob in = {.data = random_data,.size = 100 };
+
+            memset(conn->secure.server_sequence_number, 0, S2N_TLS_SEQUENCE_NUM_LEN);
+            memset(conn->secure.client_sequence_number, 0, S2N_TLS_SEQUENCE_NUM_LEN);
+            EXPECT_EQUAL(s2n_record_write(conn, TLS_APPLICATION_DATA, &in), 100);
+            conn->out.blob.data[j]++;
+            EXPECT_SUCCESS(loop_record(conn));
+            conn->in_status = ENCRYPTED;
+            EXPECT_FAILURE(s2n_record_parse(conn));
+            EXPECT_NOT_EQUAL(conn->in_status, PLAINTEXT);
+        }
+
+        /* Records too short to hold the tag are rejected */
+        {
+            uint8_t short_record[] = { TLS_APPLICATION_DATA, 3, 3, 0, 4, 0, 0, 0, 0 };
+            EXPECT_SUCCESS(s2n_stuffer_wipe(&conn->header_in));
+            EXPECT_SUCCESS(s2n_stuffer_wipe(&conn->in));
+            EXPECT_SUCCESS(s2n_stuffer_write_bytes(&conn->header_in, short_record, S2N_TLS_RECORD_HEADER_LENGTH));
+            EXPECT_SUCCESS(s2n_stuffer_write_bytes(&conn->in, short_record + S2N_TLS_RECORD_HEADER_LENGTH, 4));
+            EXPECT_EQUAL(s2n_record_parse(conn), -1);
+            EXPECT_EQUAL(s2n_errno, S2N_ERR_BAD_MESSAGE);
+        }
+
+        /* Sequence numbers never wrap */
+        {
+            struct s2n_blob in = {.data = random_data,.size = 1 };
+            memset(conn->secure.server_sequence_number, 0xff, S2N_TLS_SEQUENCE_NUM_LEN);
+            EXPECT_EQUAL(s2n_record_write(conn, TLS_APPLICATION_DATA, &in), -1);
+            EXPECT_EQUAL(s2n_errno, S2N_ERR_RECORD_LIMIT);
+        }
+
+        EXPECT_SUCCESS(s2n_connection_wipe(conn));
+        EXPECT_NULL(conn->secure.record_protection);
+    }
+
+    EXPECT_SUCCESS(s2n_connection_free(conn));
+
+    END_TEST();
+}
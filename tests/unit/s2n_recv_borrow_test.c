@@ -0,0 +1,161 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include "testlib/s2n_testlib.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include <s2n.h>
+
+#include "tls/s2n_connection.h"
+
+#include "utils/s2n_random.h"
+
+#define RECORD_COUNT 50
+#define RECORD_SIZE 100
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *server_config;
+    struct s2n_config *client_config;
+    struct s2n_connection *server_conn;
+    struct s2n_connection *client_conn;
+    struct s2n_test_io_buffer client_to_server;
+    struct s2n_test_io_buffer server_to_client;
+    s2n_blocked_status blocked;
+    char *cert_chain_pem;
+    char *private_key_pem;
+    char *dhparams_pem;
+    uint8_t data[RECORD_COUNT * RECORD_SIZE];
+    uint8_t received[RECORD_SIZE];
+    struct s2n_blob blob = {.data = data, .size = sizeof(data) };
+    const uint8_t *borrowed;
+    size_t len;
+
+    BEGIN_TEST();
+
+    EXPECT_SUCCESS(setenv("S2N_ENABLE_CLIENT_MODE", "1", 0));
+    EXPECT_SUCCESS(s2n_get_urandom_data(&blob));
+
+    EXPECT_NOT_NULL(cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(dhparams_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+
+    EXPECT_NOT_NULL(server_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_DHPARAMS, dhparams_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem));
+    EXPECT_SUCCESS(s2n_config_add_dhparams(server_config, dhparams_pem));
+
+    EXPECT_NOT_NULL(client_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_config_disable_x509_verification(client_config));
+
+    EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+    EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+    EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+    EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+
+    EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server, 0));
+    EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 0));
+    EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+
+    EXPECT_SUCCESS(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+
+    /* Nothing to borrow yet */
+    EXPECT_EQUAL(s2n_recv_borrow(server_conn, &borrowed, &len, &blocked), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_BLOCKED);
+    EXPECT_EQUAL(blocked, S2N_BLOCKED_ON_READ);
+    EXPECT_NULL(borrowed);
+    EXPECT_EQUAL(len, 0);
+    EXPECT_SUCCESS(s2n_recv_release(server_conn, 0));
+    EXPECT_EQUAL(s2n_recv_release(server_conn, 1), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_RECV_RELEASE_SIZE);
+
+    for (int i = 0; i < RECORD_COUNT; i++) {
+        EXPECT_EQUAL(s2n_send(client_conn, data + i * RECORD_SIZE, RECORD_SIZE, &blocked), RECORD_SIZE);
+    }
+
+    /* Plaintext is lent out a record at a time, straight from conn->in */
+    EXPECT_SUCCESS(s2n_recv_borrow(server_conn, &borrowed, &len, &blocked));
+    EXPECT_EQUAL(blocked, S2N_NOT_BLOCKED);
+    EXPECT_EQUAL(len, RECORD_SIZE);
+    EXPECT_EQUAL(borrowed, server_conn->in.blob.data + server_conn->in.read_cursor);
+    EXPECT_EQUAL(memcmp(borrowed, data, RECORD_SIZE), 0);
+
+    /* Borrowing again without releasing anything gives the same bytes */
+    const uint8_t *borrowed_again;
+    EXPECT_SUCCESS(s2n_recv_borrow(server_conn, &borrowed_again, &len, &blocked));
+    EXPECT_EQUAL(borrowed_again, borrowed);
+    EXPECT_EQUAL(len, RECORD_SIZE);
+
+    /* Release part of it */
+    EXPECT_EQUAL(s2n_recv_release(server_conn, RECORD_SIZE + 1), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_RECV_RELEASE_SIZE);
+    EXPECT_SUCCESS(s2n_recv_release(server_conn, 10));
+    EXPECT_EQUAL(s2n_peek(server_conn), RECORD_SIZE - 10);
+    EXPECT_SUCCESS(s2n_recv_borrow(server_conn, &borrowed, &len, &blocked));
+    EXPECT_EQUAL(len, RECORD_SIZE - 10);
+    EXPECT_EQUAL(memcmp(borrowed, data + 10, RECORD_SIZE - 10), 0);
+
+    /* s2n_recv picks up where the borrower left off */
+    EXPECT_SUCCESS(s2n_recv_release(server_conn, 20));
+    EXPECT_EQUAL(s2n_recv(server_conn, received, sizeof(received), &blocked), RECORD_SIZE - 30);
+    EXPECT_EQUAL(memcmp(received, data + 30, RECORD_SIZE - 30), 0);
+    EXPECT_EQUAL(s2n_peek(server_conn), 0);
+
+    /* ... and the other way around */
+    EXPECT_EQUAL(s2n_recv(server_conn, received, 40, &blocked), 40);
+    EXPECT_EQUAL(memcmp(received, data + RECORD_SIZE, 40), 0);
+    EXPECT_SUCCESS(s2n_recv_borrow(server_conn, &borrowed, &len, &blocked));
+    EXPECT_EQUAL(len, RECORD_SIZE - 40);
+    EXPECT_EQUAL(memcmp(borrowed, data + RECORD_SIZE + 40, RECORD_SIZE - 40), 0);
+    EXPECT_SUCCESS(s2n_recv_release(server_conn, len));
+
+    /* Releasing a whole record wipes it */
+    for (int i = 2; i < RECORD_COUNT; i++) {
+        EXPECT_SUCCESS(s2n_recv_borrow(server_conn, &borrowed, &len, &blocked));
+        EXPECT_EQUAL(len, RECORD_SIZE);
+        EXPECT_EQUAL(memcmp(borrowed, data + i * RECORD_SIZE, RECORD_SIZE), 0);
+        EXPECT_SUCCESS(s2n_recv_release(server_conn, len));
+        EXPECT_EQUAL(server_conn->in_status, ENCRYPTED);
+        EXPECT_EQUAL(s2n_stuffer_data_available(&server_conn->in), 0);
+    }
+    EXPECT_EQUAL(s2n_peek(server_conn), 0);
+
+    /* A close_notify from the peer ends the stream */
+    EXPECT_FAILURE(s2n_shutdown(client_conn, &blocked));
+    EXPECT_EQUAL(blocked, S2N_BLOCKED_ON_READ);
+    EXPECT_SUCCESS(s2n_recv_borrow(server_conn, &borrowed, &len, &blocked));
+    EXPECT_EQUAL(blocked, S2N_NOT_BLOCKED);
+    EXPECT_NULL(borrowed);
+    EXPECT_EQUAL(len, 0);
+
+    EXPECT_SUCCESS(s2n_connection_free(server_conn));
+    EXPECT_SUCCESS(s2n_connection_free(client_conn));
+    EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server));
+    EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+    EXPECT_SUCCESS(s2n_config_free(server_config));
+    EXPECT_SUCCESS(s2n_config_free(client_config));
+
+    free(cert_chain_pem);
+    free(private_key_pem);
+    free(dhparams_pem);
+
+    END_TEST();
+}
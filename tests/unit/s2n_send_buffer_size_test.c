@@ -0,0 +1,178 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include "testlib/s2n_testlib.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include <s2n.h>
+
+#include "tls/s2n_cipher_suites.h"
+#include "tls/s2n_connection.h"
+#include "tls/s2n_record.h"
+
+#include "utils/s2n_random.h"
+
+#define DATA_SIZE (1024 * 1024)
+#define SEND_BUFFER_SIZE (256 * 1024)
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *server_config;
+    struct s2n_config *client_config;
+    struct s2n_connection *server_conn;
+    struct s2n_connection *client_conn;
+    struct s2n_test_io_buffer client_to_server;
+    struct s2n_test_io_buffer server_to_client;
+    s2n_blocked_status blocked;
+    char *cert_chain_pem;
+    char *private_key_pem;
+    char *dhparams_pem;
+    uint8_t *data;
+    uint8_t *received;
+
+    BEGIN_TEST();
+
+    EXPECT_SUCCESS(setenv("S2N_ENABLE_CLIENT_MODE", "1", 0));
+
+    EXPECT_NOT_NULL(cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(dhparams_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(data = malloc(DATA_SIZE));
+    EXPECT_NOT_NULL(received = malloc(DATA_SIZE));
+
+    struct s2n_blob blob = {.data = data, .size = DATA_SIZE };
+    EXPECT_SUCCESS(s2n_get_urandom_data(&blob));
+
+    EXPECT_NOT_NULL(server_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_DHPARAMS, dhparams_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem));
+    EXPECT_SUCCESS(s2n_config_add_dhparams(server_config, dhparams_pem));
+
+    EXPECT_NOT_NULL(client_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_config_disable_x509_verification(client_config));
+
+    /* CBC records are written one at a time; AES-GCM ones are sealed several
+     * at a time once the send buffer is large enough.
+     */
+    const char *cipher_prefs[] = { "20140601", "default" };
+    for (int p = 0; p < sizeof(cipher_prefs) / sizeof(cipher_prefs[0]); p++) {
+        EXPECT_SUCCESS(s2n_config_set_cipher_preferences(server_config, cipher_prefs[p]));
+
+        EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+        EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+        EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+        EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+
+        /* The send buffer must hold at least one full record */
+        EXPECT_FAILURE(s2n_connection_set_send_buffer_size(server_conn, 0));
+        EXPECT_FAILURE(s2n_connection_set_send_buffer_size(server_conn, S2N_LARGE_RECORD_LENGTH - 1));
+        EXPECT_SUCCESS(s2n_connection_set_send_buffer_size(server_conn, S2N_LARGE_RECORD_LENGTH));
+
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server, 0));
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 0));
+        EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+
+        EXPECT_SUCCESS(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+        EXPECT_EQUAL(server_conn->secure.cipher_suite->record_alg->cipher->type == S2N_AEAD, p == 1);
+
+        /* By default every record is flushed with its own write */
+        uint32_t records = DATA_SIZE / s2n_record_max_write_payload_size(server_conn);
+        server_to_client.calls = 0;
+        EXPECT_EQUAL(s2n_send(server_conn, data, DATA_SIZE, &blocked), DATA_SIZE);
+        EXPECT_TRUE(server_to_client.calls >= records);
+        EXPECT_SUCCESS(s2n_test_recv_all(client_conn, received, DATA_SIZE));
+        EXPECT_EQUAL(memcmp(data, received, DATA_SIZE), 0);
+
+        /* With a larger send buffer, several records go out in each write */
+        EXPECT_SUCCESS(s2n_connection_set_send_buffer_size(server_conn, SEND_BUFFER_SIZE));
+        EXPECT_EQUAL(server_conn->out.blob.size, SEND_BUFFER_SIZE);
+        uint32_t records_per_write = SEND_BUFFER_SIZE / s2n_record_max_write_size(server_conn);
+        server_to_client.calls = 0;
+        EXPECT_EQUAL(s2n_send(server_conn, data, DATA_SIZE, &blocked), DATA_SIZE);
+        EXPECT_EQUAL(blocked, S2N_NOT_BLOCKED);
+        EXPECT_TRUE(server_to_client.calls <= (records / records_per_write) + 1);
+        EXPECT_SUCCESS(s2n_test_recv_all(client_conn, received, DATA_SIZE));
+        EXPECT_EQUAL(memcmp(data, received, DATA_SIZE), 0);
+
+        /* Large records batch too */
+        EXPECT_SUCCESS(s2n_connection_prefer_throughput(server_conn));
+        server_to_client.calls = 0;
+        EXPECT_EQUAL(s2n_send(server_conn, data, DATA_SIZE, &blocked), DATA_SIZE);
+        EXPECT_TRUE(server_to_client.calls < DATA_SIZE / S2N_LARGE_FRAGMENT_LENGTH);
+        EXPECT_SUCCESS(s2n_test_recv_all(client_conn, received, DATA_SIZE));
+        EXPECT_EQUAL(memcmp(data, received, DATA_SIZE), 0);
+
+        /* Partial writes: the peer can only take a little at a time, so s2n_send reports
+         * partial progress and the caller retries with the remainder.
+         */
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 3 * SEND_BUFFER_SIZE / 2));
+
+        uint32_t sent = 0;
+        uint32_t received_len = 0;
+        int partial_writes = 0;
+        while (sent < DATA_SIZE) {
+            ssize_t w = s2n_send(server_conn, data + sent, DATA_SIZE - sent, &blocked);
+            if (w < 0) {
+                EXPECT_EQUAL(s2n_error_get_type(s2n_errno), S2N_ERR_T_BLOCKED);
+                w = 0;
+            }
+            if (blocked != S2N_NOT_BLOCKED) {
+                partial_writes++;
+            }
+            sent += w;
+
+            /* Drain what the server managed to write */
+            while (s2n_stuffer_data_available(&server_to_client.data) || s2n_stuffer_data_available(&client_conn->in)) {
+                int r = s2n_recv(client_conn, received + received_len, DATA_SIZE - received_len, &blocked);
+                if (r <= 0) {
+                    break;
+                }
+                received_len += r;
+            }
+        }
+        EXPECT_TRUE(partial_writes > 0);
+        EXPECT_EQUAL(received_len, DATA_SIZE);
+        EXPECT_EQUAL(memcmp(data, received, DATA_SIZE), 0);
+
+        /* Once everything has been flushed the buffer can shrink back */
+        EXPECT_SUCCESS(s2n_connection_set_send_buffer_size(server_conn, S2N_LARGE_RECORD_LENGTH));
+        EXPECT_EQUAL(server_conn->out.blob.size, S2N_LARGE_RECORD_LENGTH);
+
+        EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+
+        EXPECT_SUCCESS(s2n_connection_free(server_conn));
+        EXPECT_SUCCESS(s2n_connection_free(client_conn));
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server));
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+    }
+
+    EXPECT_SUCCESS(s2n_config_free(server_config));
+    EXPECT_SUCCESS(s2n_config_free(client_config));
+
+    free(cert_chain_pem);
+    free(private_key_pem);
+    free(dhparams_pem);
+    free(data);
+    free(received);
+
+    END_TEST();
+}
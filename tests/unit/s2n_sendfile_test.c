@@ -0,0 +1,186 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include "testlib/s2n_testlib.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <s2n.h>
+
+#include "tls/s2n_connection.h"
+#include "tls/s2n_record.h"
+
+#include "utils/s2n_random.h"
+
+#define FILE_SIZE 100000
+#define FILE_OFFSET 1234
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *server_config;
+    struct s2n_config *client_config;
+    struct s2n_connection *server_conn;
+    struct s2n_connection *client_conn;
+    struct s2n_test_io_buffer client_to_server;
+    struct s2n_test_io_buffer server_to_client;
+    s2n_blocked_status blocked;
+    char *cert_chain_pem;
+    char *private_key_pem;
+    char *dhparams_pem;
+    uint8_t *data;
+    uint8_t *received;
+    FILE *file;
+    int fd;
+
+    BEGIN_TEST();
+
+    EXPECT_SUCCESS(setenv("S2N_ENABLE_CLIENT_MODE", "1", 0));
+
+    EXPECT_NOT_NULL(cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(dhparams_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(data = malloc(FILE_SIZE));
+    EXPECT_NOT_NULL(received = malloc(FILE_SIZE));
+
+    struct s2n_blob blob = {.data = data, .size = FILE_SIZE };
+    EXPECT_SUCCESS(s2n_get_urandom_data(&blob));
+
+    EXPECT_NOT_NULL(file = tmpfile());
+    EXPECT_EQUAL(fwrite(data, 1, FILE_SIZE, file), FILE_SIZE);
+    EXPECT_SUCCESS(fflush(file));
+    EXPECT_SUCCESS(fd = fileno(file));
+
+    EXPECT_NOT_NULL(server_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_DHPARAMS, dhparams_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem));
+    EXPECT_SUCCESS(s2n_config_add_dhparams(server_config, dhparams_pem));
+
+    EXPECT_NOT_NULL(client_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_config_disable_x509_verification(client_config));
+
+    /* Every cipher type has its own explicit IV layout in front of the plaintext */
+    const char *preferences[] = { "default", "20170405", "test_all" };
+    for (int i = 0; i < sizeof(preferences) / sizeof(preferences[0]); i++) {
+        EXPECT_SUCCESS(s2n_config_set_cipher_preferences(server_config, preferences[i]));
+
+        EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+        EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+        EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+        EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server, 0));
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 0));
+        EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+
+        EXPECT_SUCCESS(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+
+        /* A range of the file comes out the other end */
+        uint32_t count = FILE_SIZE - FILE_OFFSET;
+        EXPECT_EQUAL(s2n_sendfile(server_conn, fd, FILE_OFFSET, count, &blocked), count);
+        EXPECT_EQUAL(blocked, S2N_NOT_BLOCKED);
+        EXPECT_SUCCESS(s2n_test_recv_all(client_conn, received, count));
+        EXPECT_EQUAL(memcmp(data + FILE_OFFSET, received, count), 0);
+
+        /* And the other way */
+        EXPECT_EQUAL(s2n_sendfile(client_conn, fd, 0, 1000, &blocked), 1000);
+        EXPECT_SUCCESS(s2n_test_recv_all(server_conn, received, 1000));
+        EXPECT_EQUAL(memcmp(data, received, 1000), 0);
+
+        /* Asking for more than the file holds fails, and doesn't leave a
+         * partial record behind.
+         */
+        EXPECT_FAILURE(s2n_sendfile(server_conn, fd, FILE_SIZE - 10, 20, &blocked));
+        EXPECT_EQUAL(s2n_stuffer_data_available(&server_conn->out), 0);
+        EXPECT_FAILURE(s2n_sendfile(server_conn, -1, 0, 20, &blocked));
+
+        /* The connection is still good afterwards */
+        EXPECT_EQUAL(s2n_sendfile(server_conn, fd, FILE_SIZE - 10, 10, &blocked), 10);
+        EXPECT_SUCCESS(s2n_test_recv_all(client_conn, received, 10));
+        EXPECT_EQUAL(memcmp(data + FILE_SIZE - 10, received, 10), 0);
+
+        EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+        EXPECT_SUCCESS(s2n_connection_free(server_conn));
+        EXPECT_SUCCESS(s2n_connection_free(client_conn));
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server));
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+    }
+
+    /* Partial writes: the caller moves the offset along by what was written */
+    {
+        EXPECT_SUCCESS(s2n_config_set_cipher_preferences(server_config, "default"));
+
+        EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+        EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+        EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+        EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server, 0));
+        EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 3 * S2N_LARGE_RECORD_LENGTH));
+        EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+
+        EXPECT_SUCCESS(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+
+        uint32_t sent = 0;
+        uint32_t received_len = 0;
+        int partial_writes = 0;
+        while (sent < FILE_SIZE) {
+            ssize_t w = s2n_sendfile(server_conn, fd, sent, FILE_SIZE - sent, &blocked);
+            if (w < 0) {
+                EXPECT_EQUAL(s2n_error_get_type(s2n_errno), S2N_ERR_T_BLOCKED);
+                w = 0;
+            }
+            if (blocked != S2N_NOT_BLOCKED) {
+                partial_writes++;
+            }
+            sent += w;
+
+            while (s2n_stuffer_data_available(&server_to_client.data) || s2n_stuffer_data_available(&client_conn->in)) {
+                int r = s2n_recv(client_conn, received + received_len, FILE_SIZE - received_len, &blocked);
+                if (r <= 0) {
+                    break;
+                }
+                received_len += r;
+            }
+        }
+        EXPECT_TRUE(partial_writes > 0);
+        EXPECT_EQUAL(received_len, FILE_SIZE);
+        EXPECT_EQUAL(memcmp(data, received, FILE_SIZE), 0);
+
+        EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+        EXPECT_SUCCESS(s2n_connection_free(server_conn));
+        EXPECT_SUCCESS(s2n_connection_free(client_conn));
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server));
+        EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+    }
+
+    EXPECT_SUCCESS(s2n_config_free(server_config));
+    EXPECT_SUCCESS(s2n_config_free(client_config));
+    EXPECT_SUCCESS(fclose(file));
+
+    free(cert_chain_pem);
+    free(private_key_pem);
+    free(dhparams_pem);
+    free(data);
+    free(received);
+
+    END_TEST();
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include "testlib/s2n_testlib.h"
+
+#include <sys/uio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <s2n.h>
+
+#include "tls/s2n_connection.h"
+#include "tls/s2n_record.h"
+
+#include "utils/s2n_random.h"
+
+#define HEADER_SIZE 300
+#define BODY_SIZE 100000
+
+int main(int argc, char **argv)
+{
+    struct s2n_config *server_config;
+    struct s2n_config *client_config;
+    struct s2n_connection *server_conn;
+    struct s2n_connection *client_conn;
+    struct s2n_test_io_buffer client_to_server;
+    struct s2n_test_io_buffer server_to_client;
+    s2n_blocked_status blocked;
+    char *cert_chain_pem;
+    char *private_key_pem;
+    char *dhparams_pem;
+    uint8_t *data;
+    uint8_t *received;
+
+    BEGIN_TEST();
+
+    EXPECT_SUCCESS(setenv("S2N_ENABLE_CLIENT_MODE", "1", 0));
+
+    EXPECT_NOT_NULL(cert_chain_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(private_key_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(dhparams_pem = malloc(S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_NOT_NULL(data = malloc(HEADER_SIZE + BODY_SIZE));
+    EXPECT_NOT_NULL(received = malloc(HEADER_SIZE + BODY_SIZE));
+
+    struct s2n_blob blob = {.data = data, .size = HEADER_SIZE + BODY_SIZE };
+    EXPECT_SUCCESS(s2n_get_urandom_data(&blob));
+
+    EXPECT_NOT_NULL(server_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_CERT_CHAIN, cert_chain_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_PRIVATE_KEY, private_key_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_read_test_pem(S2N_DEFAULT_TEST_DHPARAMS, dhparams_pem, S2N_MAX_TEST_PEM_SIZE));
+    EXPECT_SUCCESS(s2n_config_add_cert_chain_and_key(server_config, cert_chain_pem, private_key_pem));
+    EXPECT_SUCCESS(s2n_config_add_dhparams(server_config, dhparams_pem));
+
+    EXPECT_NOT_NULL(client_config = s2n_config_new());
+    EXPECT_SUCCESS(s2n_config_disable_x509_verification(client_config));
+
+    EXPECT_NOT_NULL(server_conn = s2n_connection_new(S2N_SERVER));
+    EXPECT_SUCCESS(s2n_connection_set_config(server_conn, server_config));
+    EXPECT_NOT_NULL(client_conn = s2n_connection_new(S2N_CLIENT));
+    EXPECT_SUCCESS(s2n_connection_set_config(client_conn, client_config));
+
+    EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&client_to_server, 0));
+    EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 0));
+    EXPECT_SUCCESS(s2n_connections_set_io_buffers(client_conn, server_conn, &client_to_server, &server_to_client));
+
+    EXPECT_SUCCESS(s2n_negotiate_test_server_and_client(server_conn, client_conn));
+
+    int max_payload_size = s2n_record_max_write_payload_size(server_conn);
+    EXPECT_TRUE(max_payload_size > HEADER_SIZE);
+
+    /* A header and a body in separate buffers are sent as full sized records */
+    struct iovec iov[2];
+    iov[0].iov_base = data;
+    iov[0].iov_len = HEADER_SIZE;
+    iov[1].iov_base = data + HEADER_SIZE;
+    iov[1].iov_len = BODY_SIZE;
+
+    server_to_client.calls = 0;
+    EXPECT_EQUAL(s2n_sendv(server_conn, iov, 2, &blocked), HEADER_SIZE + BODY_SIZE);
+    EXPECT_EQUAL(blocked, S2N_NOT_BLOCKED);
+    EXPECT_EQUAL(server_to_client.calls, (HEADER_SIZE + BODY_SIZE + max_payload_size - 1) / max_payload_size);
+    EXPECT_SUCCESS(s2n_test_recv_all(client_conn, received, HEADER_SIZE + BODY_SIZE));
+    EXPECT_EQUAL(memcmp(data, received, HEADER_SIZE + BODY_SIZE), 0);
+
+    /* Lots of tiny buffers, some of them empty */
+    struct iovec tiny[64];
+    uint32_t tiny_size = 0;
+    for (int i = 0; i < 64; i++) {
+        tiny[i].iov_base = data + tiny_size;
+        tiny[i].iov_len = i % 3;
+        tiny_size += i % 3;
+    }
+    server_to_client.calls = 0;
+    EXPECT_EQUAL(s2n_sendv(server_conn, tiny, 64, &blocked), tiny_size);
+    EXPECT_EQUAL(server_to_client.calls, 1);
+    EXPECT_SUCCESS(s2n_test_recv_all(client_conn, received, tiny_size));
+    EXPECT_EQUAL(memcmp(data, received, tiny_size), 0);
+
+    /* One byte buffers spread over several records, each record picking up
+     * where the last one left off
+     */
+    struct iovec *bytes;
+    EXPECT_NOT_NULL(bytes = malloc(BODY_SIZE * sizeof(struct iovec)));
+    for (int i = 0; i < BODY_SIZE; i++) {
+        bytes[i].iov_base = data + i;
+        bytes[i].iov_len = 1;
+    }
+    server_to_client.calls = 0;
+    EXPECT_EQUAL(s2n_sendv(server_conn, bytes, BODY_SIZE, &blocked), BODY_SIZE);
+    EXPECT_EQUAL(server_to_client.calls, (BODY_SIZE + max_payload_size - 1) / max_payload_size);
+    EXPECT_SUCCESS(s2n_test_recv_all(client_conn, received, BODY_SIZE));
+    EXPECT_EQUAL(memcmp(data, received, BODY_SIZE), 0);
+    free(bytes);
+
+    /* Nothing to send */
+    server_to_client.calls = 0;
+    EXPECT_EQUAL(s2n_sendv(server_conn, iov, 0, &blocked), 0);
+    EXPECT_EQUAL(s2n_sendv(server_conn, NULL, 0, &blocked), 0);
+    EXPECT_EQUAL(server_to_client.calls, 0);
+    EXPECT_FAILURE(s2n_sendv(server_conn, iov, -1, &blocked));
+    EXPECT_FAILURE(s2n_sendv(server_conn, NULL, 1, &blocked));
+
+    /* Buffers that add up to more than a ssize_t can hold */
+    struct iovec huge[2];
+    huge[0].iov_base = data;
+    huge[0].iov_len = SIZE_MAX / 2;
+    huge[1].iov_base = data;
+    huge[1].iov_len = 2;
+    EXPECT_EQUAL(s2n_sendv(server_conn, huge, 2, &blocked), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_SEND_SIZE);
+    EXPECT_EQUAL(server_to_client.calls, 0);
+
+    /* Partial writes follow the same retry contract as s2n_send: the caller
+     * moves past whatever was reported as written and calls again.
+     */
+    EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+    EXPECT_SUCCESS(s2n_test_io_buffer_alloc(&server_to_client, 3 * S2N_LARGE_RECORD_LENGTH));
+
+    struct iovec *pending = iov;
+    int pending_count = 2;
+    uint32_t received_len = 0;
+    int partial_writes = 0;
+    iov[0].iov_base = data;
+    iov[0].iov_len = HEADER_SIZE;
+    iov[1].iov_base = data + HEADER_SIZE;
+    iov[1].iov_len = BODY_SIZE;
+    while (pending_count) {
+        ssize_t w = s2n_sendv(server_conn, pending, pending_count, &blocked);
+        if (w < 0) {
+            EXPECT_EQUAL(s2n_error_get_type(s2n_errno), S2N_ERR_T_BLOCKED);
+            w = 0;
+        }
+        if (blocked != S2N_NOT_BLOCKED) {
+            partial_writes++;
+        }
+
+        /* Advance past the data that was written */
+        while (pending_count && w >= pending->iov_len) {
+            w -= pending->iov_len;
+            pending++;
+            pending_count--;
+        }
+        if (pending_count) {
+            pending->iov_base = (uint8_t *) pending->iov_base + w;
+            pending->iov_len -= w;
+        }
+
+        while (s2n_stuffer_data_available(&server_to_client.data) || s2n_stuffer_data_available(&client_conn->in)) {
+            int r = s2n_recv(client_conn, received + received_len, HEADER_SIZE + BODY_SIZE - received_len, &blocked);
+            if (r <= 0) {
+                break;
+            }
+            received_len += r;
+        }
+    }
+    EXPECT_TRUE(partial_writes > 0);
+    EXPECT_EQUAL(received_len, HEADER_SIZE + BODY_SIZE);
+    EXPECT_EQUAL(memcmp(data, received, HEADER_SIZE + BODY_SIZE), 0);
+
+    EXPECT_SUCCESS(s2n_shutdown_test_server_and_client(server_conn, client_conn));
+
+    /* Even with nothing to send, a closed connection can't be written to */
+    EXPECT_EQUAL(s2n_sendv(server_conn, NULL, 0, &blocked), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_CLOSED);
+    EXPECT_EQUAL(s2n_send(server_conn, data, 0, &blocked), -1);
+    EXPECT_EQUAL(s2n_errno, S2N_ERR_CLOSED);
+
+    EXPECT_SUCCESS(s2n_connection_free(server_conn));
+    EXPECT_SUCCESS(s2n_connection_free(client_conn));
+    EXPECT_SUCCESS(s2n_test_io_buffer_free(&client_to_server));
+    EXPECT_SUCCESS(s2n_test_io_buffer_free(&server_to_client));
+    EXPECT_SUCCESS(s2n_config_free(server_config));
+    EXPECT_SUCCESS(s2n_config_free(client_config));
+
+    free(cert_chain_pem);
+    free(private_key_pem);
+    free(dhparams_pem);
+    free(data);
+    free(received);
+
+    END_TEST();
+}
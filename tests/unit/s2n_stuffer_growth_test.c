@@ -0,0 +1,120 @@
+/*
+ * Copyright 2014 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "s2n_test.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include <s2n.h>
+
+#include "stuffer/s2n_stuffer.h"
+#include "utils/s2n_mem.h"
+
+/* About the size of a certificate flight with a long chain */
+#define FLIGHT_SIZE (12 * 1024)
+#define CHUNK_SIZE  100
+
+static int stop_toggling;
+
+static void *s2n_test_toggle_growth_limit(void *arg)
+{
+    while (!__atomic_load_n(&stop_toggling, __ATOMIC_RELAXED)) {
+        s2n_stuffer_set_growth_limit(S2N_STUFFER_MIN_GROWTH);
+        s2n_stuffer_set_growth_limit(S2N_STUFFER_DEFAULT_GROWTH_LIMIT);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct s2n_stuffer stuffer;
+    struct s2n_mem_stats before;
+    struct s2n_mem_stats after;
+    uint8_t chunk[CHUNK_SIZE];
+
+    BEGIN_TEST();
+
+    EXPECT_FAILURE(s2n_mem_get_stats(NULL));
+
+    /* Writing a flight in small pieces doubles the stuffer a logarithmic number of times */
+    EXPECT_SUCCESS(s2n_stuffer_growable_alloc(&stuffer, 0));
+    EXPECT_SUCCESS(s2n_mem_get_stats(&before));
+    for (int i = 0; i < FLIGHT_SIZE / CHUNK_SIZE; i++) {
+        memset(chunk, i, sizeof(chunk));
+        EXPECT_SUCCESS(s2n_stuffer_write_bytes(&stuffer, chunk, sizeof(chunk)));
+    }
+    EXPECT_SUCCESS(s2n_mem_get_stats(&after));
+
+    /* 1k, 2k, 4k, 8k, 16k: one allocation and four moves, copying 15k in total */
+    EXPECT_EQUAL(after.allocs - before.allocs, 1);
+    EXPECT_TRUE(after.reallocs - before.reallocs <= 4);
+    EXPECT_TRUE(after.realloc_bytes_copied - before.realloc_bytes_copied < 2 * FLIGHT_SIZE);
+    EXPECT_TRUE(stuffer.blob.size < 2 * FLIGHT_SIZE);
+
+    for (int i = 0; i < FLIGHT_SIZE / CHUNK_SIZE; i++) {
+        EXPECT_SUCCESS(s2n_stuffer_read_bytes(&stuffer, chunk, sizeof(chunk)));
+        for (int j = 0; j < CHUNK_SIZE; j++) {
+            EXPECT_EQUAL(chunk[j], (uint8_t) i);
+        }
+    }
+    EXPECT_SUCCESS(s2n_stuffer_free(&stuffer));
+
+    /* A write bigger than the doubling grows the stuffer in one step */
+    EXPECT_SUCCESS(s2n_stuffer_growable_alloc(&stuffer, 1024));
+    EXPECT_SUCCESS(s2n_mem_get_stats(&before));
+    EXPECT_NOT_NULL(s2n_stuffer_raw_write(&stuffer, 10 * 1024));
+    EXPECT_SUCCESS(s2n_mem_get_stats(&after));
+    EXPECT_EQUAL(after.reallocs - before.reallocs, 1);
+    EXPECT_EQUAL(stuffer.blob.size, 10 * 1024);
+    EXPECT_SUCCESS(s2n_stuffer_free(&stuffer));
+
+    /* The growth limit caps each step */
+    EXPECT_FAILURE(s2n_stuffer_set_growth_limit(S2N_STUFFER_MIN_GROWTH - 1));
+    EXPECT_SUCCESS(s2n_stuffer_set_growth_limit(S2N_STUFFER_MIN_GROWTH));
+    EXPECT_SUCCESS(s2n_stuffer_growable_alloc(&stuffer, 0));
+    for (int i = 0; i < 8; i++) {
+        EXPECT_SUCCESS(s2n_stuffer_write_bytes(&stuffer, chunk, sizeof(chunk)));
+        EXPECT_SUCCESS(s2n_stuffer_skip_write(&stuffer, 1024 - sizeof(chunk)));
+        EXPECT_EQUAL(stuffer.blob.size, (i + 1) * 1024);
+    }
+    EXPECT_SUCCESS(s2n_stuffer_free(&stuffer));
+    EXPECT_SUCCESS(s2n_stuffer_set_growth_limit(S2N_STUFFER_DEFAULT_GROWTH_LIMIT));
+
+    /* The limit can change while another thread's stuffers are growing */
+    pthread_t thread;
+    EXPECT_SUCCESS(pthread_create(&thread, NULL, s2n_test_toggle_growth_limit, NULL));
+    for (int round = 0; round < 100; round++) {
+        EXPECT_SUCCESS(s2n_stuffer_growable_alloc(&stuffer, 0));
+        for (int i = 0; i < 12; i++) {
+            uint32_t size = stuffer.blob.size;
+            EXPECT_SUCCESS(s2n_stuffer_skip_write(&stuffer, s2n_stuffer_space_remaining(&stuffer) + 1));
+            EXPECT_TRUE(stuffer.blob.size - size >= S2N_STUFFER_MIN_GROWTH);
+            EXPECT_TRUE(stuffer.blob.size - size <= S2N_STUFFER_DEFAULT_GROWTH_LIMIT);
+        }
+        EXPECT_SUCCESS(s2n_stuffer_free(&stuffer));
+    }
+    __atomic_store_n(&stop_toggling, 1, __ATOMIC_RELAXED);
+    EXPECT_SUCCESS(pthread_join(thread, NULL));
+    EXPECT_SUCCESS(s2n_stuffer_set_growth_limit(S2N_STUFFER_DEFAULT_GROWTH_LIMIT));
+
+    /* Static stuffers still refuse to grow */
+    struct s2n_blob fixed = {.data = chunk,.size = sizeof(chunk) };
+    EXPECT_SUCCESS(s2n_stuffer_init(&stuffer, &fixed));
+    EXPECT_FAILURE(s2n_stuffer_skip_write(&stuffer, sizeof(chunk) + 1));
+
+    END_TEST();
+}
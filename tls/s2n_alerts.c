@@ -73,7 +73,7 @@ int s2n_process_alert_fragment(struct s2n_connection *conn)
         GUARD(s2n_stuffer_copy(&conn->in, &conn->alert_in, bytes_to_read));
 
         if (s2n_stuffer_data_available(&conn->alert_in) == 2) {
-            conn->closed = 1;
+            s2n_connection_set_closed(conn);
 
             /* Close notifications are handled as shutdowns */
             if (conn->alert_in_data[1] == S2N_TLS_ALERT_CLOSE_NOTIFY) {
@@ -0,0 +1,302 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <string.h>
+
+#include <s2n.h>
+
+#include "error/s2n_errno.h"
+
+#include "crypto/s2n_hash.h"
+#include "crypto/s2n_pkey.h"
+#include "crypto/s2n_rsa.h"
+
+#include "tls/s2n_async_pkey.h"
+#include "tls/s2n_config.h"
+#include "tls/s2n_connection.h"
+#include "tls/s2n_key_server.h"
+
+#include "utils/s2n_blob.h"
+#include "utils/s2n_mem.h"
+#include "utils/s2n_safety.h"
+
+static int s2n_async_pkey_op_new(struct s2n_connection *conn, s2n_async_pkey_op_type type, struct s2n_async_pkey_op **op)
+{
+    struct s2n_blob mem = {0};
+    GUARD(s2n_alloc_class(&mem, sizeof(struct s2n_async_pkey_op), S2N_MEM_PUBLIC));
+    GUARD(s2n_blob_zero(&mem));
+
+    *op = (struct s2n_async_pkey_op *)(void *)mem.data;
+    (*op)->mem = mem;
+    (*op)->type = type;
+    (*op)->conn = conn;
+    (*op)->key = &conn->config->cert_and_key_pairs->private_key;
+    (*op)->next = NULL;
+
+    return 0;
+}
+
+/* Hand the operation to the application. It may perform and apply it before
+ * the callback returns, in which case the handshake carries straight on.
+ */
+static int s2n_async_pkey_invoke(struct s2n_connection *conn, struct s2n_async_pkey_op *op)
+{
+    conn->handshake.async_state = S2N_ASYNC_INVOKED;
+    conn->handshake.async_op = op;
+
+    if (conn->config->async_pkey_cb(conn, op) < 0) {
+        conn->handshake.async_state = S2N_ASYNC_NOT_INVOKED;
+        conn->handshake.async_op = NULL;
+        S2N_ERROR(S2N_ERR_ASYNC_CALLBACK_FAILED);
+    }
+
+    switch (conn->handshake.async_state) {
+    case S2N_ASYNC_COMPLETE:
+        conn->handshake.async_state = S2N_ASYNC_NOT_INVOKED;
+        return 0;
+    case S2N_ASYNC_FAILED:
+        S2N_ERROR(S2N_ERR_ASYNC_FAILED);
+    default:
+        S2N_ERROR(S2N_ERR_ASYNC_BLOCKED);
+    }
+}
+
+/* Send the operation to the config's key server. The handshake waits until
+ * s2n_async_pkey_poll() finds the response.
+ */
+static int s2n_async_pkey_send(struct s2n_connection *conn, struct s2n_async_pkey_op *op)
+{
+    op->keyless = 1;
+
+    if (s2n_key_server_submit(conn->config->key_server, op) < 0) {
+        GUARD(s2n_async_pkey_op_free(op));
+        S2N_ERROR(S2N_ERR_KEY_SERVER);
+    }
+
+    conn->handshake.async_state = S2N_ASYNC_INVOKED;
+    conn->handshake.async_op = op;
+
+    S2N_ERROR(S2N_ERR_ASYNC_BLOCKED);
+}
+
+static int s2n_async_pkey_sign_keyless(struct s2n_connection *conn, struct s2n_hash_state *digest, s2n_async_pkey_sign_complete on_complete)
+{
+    uint8_t digest_length;
+    GUARD(s2n_hash_digest_size(digest->alg, &digest_length));
+
+    struct s2n_async_pkey_op *op;
+    GUARD(s2n_async_pkey_op_new(conn, S2N_ASYNC_SIGN, &op));
+    op->on_complete.sign = on_complete;
+
+    /* The key server gets the finished digest, the signature comes back with the response */
+    if (s2n_hash_new(&op->digest) < 0 || s2n_hash_copy(&op->digest, digest) < 0
+        || s2n_alloc_class(&op->input, digest_length, S2N_MEM_PUBLIC) < 0
+        || s2n_hash_digest(&op->digest, op->input.data, op->input.size) < 0) {
+        GUARD(s2n_async_pkey_op_free(op));
+        return -1;
+    }
+
+    return s2n_async_pkey_send(conn, op);
+}
+
+int s2n_async_pkey_sign(struct s2n_connection *conn, struct s2n_hash_state *digest, s2n_async_pkey_sign_complete on_complete)
+{
+    if (conn->config->key_server) {
+        return s2n_async_pkey_sign_keyless(conn, digest, on_complete);
+    }
+
+    const struct s2n_pkey *key = &conn->config->cert_and_key_pairs->private_key;
+    uint32_t signature_size = s2n_rsa_private_encrypted_size(&key->key.rsa_key);
+
+    if (conn->config->async_pkey_cb == NULL) {
+        struct s2n_blob signature = {0};
+        GUARD(s2n_alloc_class(&signature, signature_size, S2N_MEM_PUBLIC));
+
+        if (s2n_pkey_sign(key, digest, &signature) < 0) {
+            GUARD(s2n_free(&signature));
+            S2N_ERROR(S2N_ERR_DH_FAILED_SIGNING);
+        }
+
+        int rc = on_complete(conn, &signature);
+        GUARD(s2n_free(&signature));
+        return rc;
+    }
+
+    struct s2n_async_pkey_op *op;
+    GUARD(s2n_async_pkey_op_new(conn, S2N_ASYNC_SIGN, &op));
+    op->on_complete.sign = on_complete;
+
+    if (s2n_hash_new(&op->digest) < 0 || s2n_hash_copy(&op->digest, digest) < 0
+        || s2n_alloc_class(&op->output, signature_size, S2N_MEM_PUBLIC) < 0) {
+        GUARD(s2n_async_pkey_op_free(op));
+        return -1;
+    }
+
+    return s2n_async_pkey_invoke(conn, op);
+}
+
+int s2n_async_pkey_decrypt(struct s2n_connection *conn, struct s2n_blob *encrypted, struct s2n_blob *decrypted,
+                           s2n_async_pkey_decrypt_complete on_complete)
+{
+    if (conn->config->async_pkey_cb == NULL && conn->config->key_server == NULL) {
+        /* Decryption only writes to decrypted if it succeeds */
+        uint8_t rsa_failed = !!s2n_pkey_decrypt(&conn->config->cert_and_key_pairs->private_key, encrypted, decrypted);
+
+        return on_complete(conn, rsa_failed, decrypted);
+    }
+
+    struct s2n_async_pkey_op *op;
+    GUARD(s2n_async_pkey_op_new(conn, S2N_ASYNC_DECRYPT, &op));
+    op->on_complete.decrypt = on_complete;
+
+    if (s2n_alloc_class(&op->input, encrypted->size, S2N_MEM_PUBLIC) < 0
+        || s2n_alloc_class(&op->output, decrypted->size, S2N_MEM_SECRET) < 0) {
+        GUARD(s2n_async_pkey_op_free(op));
+        return -1;
+    }
+    memcpy_check(op->input.data, encrypted->data, encrypted->size);
+    memcpy_check(op->output.data, decrypted->data, decrypted->size);
+
+    if (conn->config->key_server) {
+        return s2n_async_pkey_send(conn, op);
+    }
+
+    return s2n_async_pkey_invoke(conn, op);
+}
+
+/* Check on an operation that was sent to the key server, and apply it if it
+ * has been answered. The application drives the channel, but servicing it
+ * here too means a connection that is retried picks up its own response.
+ */
+int s2n_async_pkey_poll(struct s2n_connection *conn)
+{
+    struct s2n_async_pkey_op *op = conn->handshake.async_op;
+    if (conn->handshake.async_state != S2N_ASYNC_INVOKED || op == NULL || !op->keyless) {
+        return 0;
+    }
+
+    /* A broken channel fails everything in flight, which is picked up below */
+    struct s2n_key_server *key_server = conn->config->key_server;
+    if (s2n_key_server_service(key_server) < 0) {
+        s2n_errno = S2N_ERR_OK;
+    }
+
+    uint8_t done;
+    GUARD(s2n_key_server_op_done(key_server, op, &done));
+    if (!done) {
+        return 0;
+    }
+
+    int rc = s2n_async_pkey_op_apply(op, conn);
+    GUARD(s2n_async_pkey_op_free(op));
+
+    return rc;
+}
+
+/* The connection is going away. The application frees operations it was
+ * handed, but a response from the key server may still be on its way.
+ */
+int s2n_async_pkey_abandon(struct s2n_connection *conn)
+{
+    struct s2n_async_pkey_op *op = conn->handshake.async_op;
+    if (op == NULL) {
+        return 0;
+    }
+
+    conn->handshake.async_op = NULL;
+    if (op->keyless) {
+        GUARD(s2n_key_server_abandon(conn->config->key_server, op));
+    }
+
+    return 0;
+}
+
+int s2n_async_pkey_op_get_op_type(struct s2n_async_pkey_op *op, s2n_async_pkey_op_type *type)
+{
+    notnull_check(op);
+    notnull_check(type);
+
+    *type = op->type;
+
+    return 0;
+}
+
+int s2n_async_pkey_op_perform(struct s2n_async_pkey_op *op)
+{
+    notnull_check(op);
+    S2N_ERROR_IF(op->performed, S2N_ERR_ASYNC_OP_STATE);
+
+    switch (op->type) {
+    case S2N_ASYNC_SIGN:
+        op->result = s2n_pkey_sign(op->key, &op->digest, &op->output);
+        break;
+    case S2N_ASYNC_DECRYPT:
+        op->result = s2n_pkey_decrypt(op->key, &op->input, &op->output);
+        break;
+    default:
+        S2N_ERROR(S2N_ERR_ASYNC_OP_STATE);
+    }
+
+    op->performed = 1;
+
+    return 0;
+}
+
+int s2n_async_pkey_op_apply(struct s2n_async_pkey_op *op, struct s2n_connection *conn)
+{
+    notnull_check(op);
+    notnull_check(conn);
+    S2N_ERROR_IF(!op->performed || op->applied, S2N_ERR_ASYNC_OP_STATE);
+    S2N_ERROR_IF(op->conn != conn || conn->handshake.async_op != op || conn->handshake.async_state != S2N_ASYNC_INVOKED,
+                 S2N_ERR_ASYNC_OP_STATE);
+
+    op->applied = 1;
+    conn->handshake.async_op = NULL;
+
+    /* The handshake can't go on without this message, so a failure here fails it */
+    if (op->type == S2N_ASYNC_SIGN && op->result < 0) {
+        conn->handshake.async_state = S2N_ASYNC_FAILED;
+        S2N_ERROR(S2N_ERR_DH_FAILED_SIGNING);
+    }
+
+    int rc;
+    if (op->type == S2N_ASYNC_SIGN) {
+        rc = op->on_complete.sign(conn, &op->output);
+    } else {
+        rc = op->on_complete.decrypt(conn, op->result != 0, &op->output);
+    }
+
+    conn->handshake.async_state = rc < 0 ? S2N_ASYNC_FAILED : S2N_ASYNC_COMPLETE;
+
+    return rc;
+}
+
+int s2n_async_pkey_op_free(struct s2n_async_pkey_op *op)
+{
+    notnull_check(op);
+
+    /* The connection may be gone by now, so it's left alone */
+    GUARD(s2n_hash_free(&op->digest));
+    GUARD(s2n_free(&op->input));
+    if (op->output.data) {
+        GUARD(s2n_blob_zero(&op->output));
+    }
+    GUARD(s2n_free(&op->output));
+
+    struct s2n_blob mem = op->mem;
+    GUARD(s2n_free(&mem));
+
+    return 0;
+}
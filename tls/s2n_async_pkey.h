@@ -0,0 +1,96 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <s2n.h>
+
+#include "crypto/s2n_hash.h"
+
+#include "utils/s2n_blob.h"
+
+struct s2n_connection;
+
+/* Where a handshake is with a private key operation it handed to the application */
+typedef enum {
+    S2N_ASYNC_NOT_INVOKED = 0,
+    S2N_ASYNC_INVOKED,
+    S2N_ASYNC_COMPLETE,
+    S2N_ASYNC_FAILED,
+} s2n_async_state;
+
+/* Finish the handshake message with the result of the operation. Called on the connection's
+ * thread: straight away when there's no async callback, or from s2n_async_pkey_op_apply().
+ */
+typedef int (*s2n_async_pkey_sign_complete)(struct s2n_connection *conn, struct s2n_blob *signature);
+typedef int (*s2n_async_pkey_decrypt_complete)(struct s2n_connection *conn, uint8_t rsa_failed, struct s2n_blob *decrypted);
+
+/* Everything an operation needs is copied in when it is started, so that
+ * it can be performed on any thread without touching the connection.
+ */
+struct s2n_async_pkey_op {
+    s2n_async_pkey_op_type type;
+    struct s2n_connection *conn;
+    const struct s2n_pkey *key;
+
+    /* The transcript to sign, or the ciphertext to decrypt. A keyless
+     * sign sends the finished digest of the transcript as its input.
+     */
+    struct s2n_hash_state digest;
+    struct s2n_blob input;
+
+    /* The signature, or the plaintext. A decrypt starts out with the
+     * random pre-master secret, which is kept if decryption fails.
+     */
+    struct s2n_blob output;
+    int result;
+
+    union {
+        s2n_async_pkey_sign_complete sign;
+        s2n_async_pkey_decrypt_complete decrypt;
+    } on_complete;
+
+    unsigned performed:1;
+    unsigned applied:1;
+
+    /* Set for operations sent to the config's key server, which s2n owns
+     * rather than the application.
+     */
+    unsigned keyless:1;
+    uint32_t id;
+    struct s2n_async_pkey_op *next;
+
+    /* The memory the operation itself lives in */
+    struct s2n_blob mem;
+};
+
+/* A handler that waited on the application is called again once the result has been applied.
+ * The completion callback has finished its message by then, so there's nothing left to do.
+ */
+#define S2N_ASYNC_PKEY_GUARD( conn )                                   \
+    do {                                                               \
+        if ((conn)->handshake.async_state == S2N_ASYNC_COMPLETE) {     \
+            (conn)->handshake.async_state = S2N_ASYNC_NOT_INVOKED;     \
+            return 0;                                                  \
+        }                                                              \
+    } while (0)
+
+extern int s2n_async_pkey_sign(struct s2n_connection *conn, struct s2n_hash_state *digest, s2n_async_pkey_sign_complete on_complete);
+extern int s2n_async_pkey_decrypt(struct s2n_connection *conn, struct s2n_blob *encrypted, struct s2n_blob *decrypted,
+                                  s2n_async_pkey_decrypt_complete on_complete);
+extern int s2n_async_pkey_poll(struct s2n_connection *conn);
+extern int s2n_async_pkey_abandon(struct s2n_connection *conn);
@@ -633,7 +633,7 @@ static int s2n_set_cipher_as_server(struct s2n_connection *conn, uint8_t * wire,
     if (conn->client_protocol_version < s2n_highest_protocol_version) {
         uint8_t fallback_scsv[S2N_TLS_CIPHER_SUITE_LEN] = { TLS_FALLBACK_SCSV };
         if (s2n_wire_ciphers_contain(fallback_scsv, wire, count, cipher_suite_len)) {
-            conn->closed = 1;
+            s2n_connection_set_closed(conn);
             S2N_ERROR(S2N_ERR_FALLBACK_DETECTED);
         }
     }
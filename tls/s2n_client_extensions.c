@@ -66,7 +66,8 @@ int s2n_client_extensions_send(struct s2n_connection *conn, struct s2n_stuffer *
     }
 
     uint16_t application_protocols_len = conn->config->application_protocols.size;
-    uint16_t server_name_len = strlen(conn->server_name);
+    const char *server_name = s2n_get_server_name(conn);
+    uint16_t server_name_len = server_name ? strlen(server_name) : 0;
     uint16_t mfl_code_len = sizeof(conn->config->mfl_code);
 
     if (server_name_len) {
@@ -106,11 +107,8 @@ int s2n_client_extensions_send(struct s2n_connection *conn, struct s2n_stuffer *
         /* Name type - host name, RFC3546 */
         GUARD(s2n_stuffer_write_uint8(out, 0));
 
-        struct s2n_blob server_name;
-        server_name.data = (uint8_t *) conn->server_name;
-        server_name.size = server_name_len;
         GUARD(s2n_stuffer_write_uint16(out, server_name_len));
-        GUARD(s2n_stuffer_write(out, &server_name));
+        GUARD(s2n_stuffer_write_bytes(out, (const uint8_t *) server_name, server_name_len));
     }
 
     /* Write ALPN extension */
@@ -251,7 +249,7 @@ static int s2n_recv_client_server_name(struct s2n_connection *conn, struct s2n_s
         return 0;
     }
 
-    if (server_name_len > sizeof(conn->server_name) - 1) {
+    if (server_name_len > S2N_MAX_SERVER_NAME - 1) {
         /* the server name is too long, ignore the extension */
         return 0;
     }
@@ -259,7 +257,7 @@ static int s2n_recv_client_server_name(struct s2n_connection *conn, struct s2n_s
     notnull_check(server_name = s2n_stuffer_raw_read(extension, server_name_len));
 
     /* copy the first server name */
-    memcpy_check(conn->server_name, server_name, server_name_len);
+    GUARD(s2n_connection_store_server_name(conn, server_name, server_name_len));
     return 0;
 }
 
@@ -364,8 +362,7 @@ static int s2n_recv_client_alpn(struct s2n_connection *conn, struct s2n_stuffer
                 uint8_t client_protocol[255];
                 GUARD(s2n_stuffer_read_bytes(&client_protos, client_protocol, client_length));
                 if (memcmp(client_protocol, protocol, client_length) == 0) {
-                    memcpy_check(conn->application_protocol, client_protocol, client_length);
-                    conn->application_protocol[client_length] = '\0';
+                    GUARD(s2n_connection_store_application_protocol(conn, client_protocol, client_length));
                     return 0;
                 }
             }
@@ -26,6 +26,7 @@
 #include "tls/s2n_cipher_preferences.h"
 #include "tls/s2n_cipher_suites.h"
 #include "tls/s2n_connection.h"
+#include "tls/s2n_connection_buffers.h"
 #include "tls/s2n_client_hello.h"
 #include "tls/s2n_alerts.h"
 #include "tls/s2n_tls.h"
@@ -118,6 +119,38 @@ int s2n_client_hello_free(struct s2n_client_hello *client_hello) {
     return 0;
 }
 
+int s2n_client_hello_shrink(struct s2n_client_hello *ch)
+{
+    notnull_check(ch);
+
+    struct s2n_stuffer *raw_message = &ch->raw_message;
+    if (raw_message->blob.allocated <= raw_message->blob.size) {
+        return 0;
+    }
+
+    /* The message was copied into a buffer sized for the largest record;
+     * move it into one that fits, and repoint the parsed blobs at the copy.
+     */
+    struct s2n_stuffer shrunk;
+    GUARD(s2n_stuffer_growable_alloc_class(&shrunk, raw_message->blob.size, S2N_MEM_PUBLIC));
+    memcpy_check(shrunk.blob.data, raw_message->blob.data, raw_message->blob.size);
+    shrunk.read_cursor = raw_message->read_cursor;
+    shrunk.write_cursor = raw_message->write_cursor;
+    shrunk.tainted = raw_message->tainted;
+
+    if (ch->cipher_suites.data) {
+        ch->cipher_suites.data = shrunk.blob.data + (ch->cipher_suites.data - raw_message->blob.data);
+    }
+    if (ch->extensions.data) {
+        ch->extensions.data = shrunk.blob.data + (ch->extensions.data - raw_message->blob.data);
+    }
+
+    GUARD(s2n_connection_buffer_release(raw_message));
+    *raw_message = shrunk;
+
+    return 0;
+}
+
 int s2n_collect_client_hello(struct s2n_connection *conn, struct s2n_stuffer *source)
 {
     notnull_check(conn);
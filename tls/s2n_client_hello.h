@@ -34,6 +34,7 @@ struct s2n_client_hello {
 };
 
 int s2n_client_hello_free(struct s2n_client_hello *client_hello);
+int s2n_client_hello_shrink(struct s2n_client_hello *ch);
 
 extern struct s2n_client_hello *s2n_connection_get_client_hello(struct s2n_connection *conn);
 
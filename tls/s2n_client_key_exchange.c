@@ -13,10 +13,13 @@
  * permissions and limitations under the License.
  */
 
+#include <string.h>
+
 #include <s2n.h>
 
 #include "error/s2n_errno.h"
 
+#include "tls/s2n_async_pkey.h"
 #include "tls/s2n_cipher_suites.h"
 #include "tls/s2n_connection.h"
 #include "tls/s2n_resume.h"
@@ -30,6 +33,46 @@
 #include "utils/s2n_safety.h"
 #include "utils/s2n_random.h"
 
+static int s2n_rsa_client_key_recv_complete(struct s2n_connection *conn, uint8_t rsa_failed, struct s2n_blob *decrypted)
+{
+    uint8_t client_protocol_version[S2N_TLS_PROTOCOL_VERSION_LEN];
+    struct s2n_blob pms;
+    pms.data = conn->secure.rsa_premaster_secret;
+    pms.size = S2N_TLS_SECRET_LEN;
+
+    /* An asynchronous decrypt hands back its own copy of the pre-master secret */
+    eq_check(decrypted->size, S2N_TLS_SECRET_LEN);
+    if (decrypted->data != pms.data) {
+        memcpy_check(pms.data, decrypted->data, S2N_TLS_SECRET_LEN);
+    }
+
+    /* Keep a copy of the client protocol version in wire format */
+    client_protocol_version[0] = conn->client_protocol_version / 10;
+    client_protocol_version[1] = conn->client_protocol_version % 10;
+
+    /* Set rsa_failed to 1 if the decrypt failed */
+    conn->handshake.rsa_failed = rsa_failed;
+
+    /* Set rsa_failed to 1, if it isn't already, if the protocol version isn't what we expect */
+    conn->handshake.rsa_failed |= !s2n_constant_time_equals(client_protocol_version, pms.data, S2N_TLS_PROTOCOL_VERSION_LEN);
+
+    /* Turn the pre-master secret into a master secret */
+    GUARD(s2n_prf_master_secret(conn, &pms));
+
+    /* Erase the pre-master secret */
+    GUARD(s2n_blob_zero(&pms));
+
+    /* Expand the keys */
+    GUARD(s2n_prf_key_expansion(conn));
+
+    /* Save the master secret in the cache */
+    if (s2n_allowed_to_cache_connection(conn)) {
+        GUARD(s2n_store_to_cache(conn));
+    }
+
+    return 0;
+}
+
 static int s2n_rsa_client_key_recv(struct s2n_connection *conn)
 {
     struct s2n_stuffer *in = &conn->handshake.io;
@@ -63,27 +106,7 @@ static int s2n_rsa_client_key_recv(struct s2n_connection *conn)
     conn->secure.rsa_premaster_secret[0] = client_protocol_version[0];
     conn->secure.rsa_premaster_secret[1] = client_protocol_version[1];
 
-    /* Set rsa_failed to 1 if s2n_pkey_decrypt returns anything other than zero */
-    conn->handshake.rsa_failed = !!s2n_pkey_decrypt(&conn->config->cert_and_key_pairs->private_key, &encrypted, &pms);
-
-    /* Set rsa_failed to 1, if it isn't already, if the protocol version isn't what we expect */
-    conn->handshake.rsa_failed |= !s2n_constant_time_equals(client_protocol_version, pms.data, S2N_TLS_PROTOCOL_VERSION_LEN);
-
-    /* Turn the pre-master secret into a master secret */
-    GUARD(s2n_prf_master_secret(conn, &pms));
-
-    /* Erase the pre-master secret */
-    GUARD(s2n_blob_zero(&pms));
-
-    /* Expand the keys */
-    GUARD(s2n_prf_key_expansion(conn));
-
-    /* Save the master secret in the cache */
-    if (s2n_allowed_to_cache_connection(conn)) {
-        GUARD(s2n_store_to_cache(conn));
-    }
-
-    return 0;
+    return s2n_async_pkey_decrypt(conn, &encrypted, &pms, s2n_rsa_client_key_recv_complete);
 }
 
 static int s2n_dhe_client_key_recv(struct s2n_connection *conn)
@@ -125,6 +148,8 @@ static int s2n_dhe_client_key_recv(struct s2n_connection *conn)
 
 int s2n_client_key_recv(struct s2n_connection *conn)
 {
+    S2N_ASYNC_PKEY_GUARD(conn);
+
     if (conn->secure.cipher_suite->key_exchange_alg->flags & S2N_KEY_EXCHANGE_DH) {
         return s2n_dhe_client_key_recv(conn);
     } else {
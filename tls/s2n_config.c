@@ -20,6 +20,8 @@
 #include "crypto/s2n_fips.h"
 
 #include "tls/s2n_cipher_preferences.h"
+#include "tls/s2n_key_pool.h"
+#include "tls/s2n_key_server.h"
 #include "utils/s2n_safety.h"
 
 #if defined(__APPLE__) && defined(__MACH__)
@@ -106,6 +108,9 @@ static int s2n_config_init(struct s2n_config *config)
     config->data_for_verify_host = NULL;
     config->client_hello_cb = NULL;
     config->client_hello_cb_ctx = NULL;
+    config->async_pkey_cb = NULL;
+    config->key_server = NULL;
+    config->key_pool = NULL;
     config->cache_store = NULL;
     config->cache_store_data = NULL;
     config->cache_retrieve = NULL;
@@ -141,6 +146,10 @@ static int s2n_config_cleanup(struct s2n_config *config)
 
     GUARD(s2n_config_free_cert_chain_and_key(config));
     GUARD(s2n_config_free_dhparams(config));
+    GUARD(s2n_key_server_free(config->key_server));
+    config->key_server = NULL;
+    GUARD(s2n_key_pool_free(config->key_pool));
+    config->key_pool = NULL;
     GUARD(s2n_free(&config->application_protocols));
 
     return 0;
@@ -302,7 +311,7 @@ int s2n_config_set_protocol_preferences(struct s2n_config *config, const char *c
         return 0;
     }
 
-    GUARD(s2n_stuffer_growable_alloc(&protocol_stuffer, 256));
+    GUARD(s2n_stuffer_growable_alloc_class(&protocol_stuffer, 256, S2N_MEM_PUBLIC));
     for (int i = 0; i < protocol_count; i++) {
         size_t length = strlen(protocols[i]);
         uint8_t protocol[255];
@@ -402,7 +411,7 @@ int s2n_config_set_verification_ca_location(struct s2n_config *config, const cha
 int s2n_config_add_cert_chain_from_stuffer(struct s2n_config *config, struct s2n_stuffer *chain_in_stuffer)
 {
     struct s2n_stuffer cert_out_stuffer;
-    GUARD(s2n_stuffer_growable_alloc(&cert_out_stuffer, 2048));
+    GUARD(s2n_stuffer_growable_alloc_class(&cert_out_stuffer, 2048, S2N_MEM_PUBLIC));
 
     struct s2n_cert **insert = &config->cert_and_key_pairs->cert_chain.head;
     uint32_t chain_size = 0;
@@ -420,7 +429,7 @@ int s2n_config_add_cert_chain_from_stuffer(struct s2n_config *config, struct s2n
         GUARD(s2n_alloc(&mem, sizeof(struct s2n_cert)));
         new_node = (struct s2n_cert *)(void *)mem.data;
 
-        GUARD(s2n_alloc(&new_node->raw, s2n_stuffer_data_available(&cert_out_stuffer)));
+        GUARD(s2n_alloc_class(&new_node->raw, s2n_stuffer_data_available(&cert_out_stuffer), S2N_MEM_PUBLIC));
         GUARD(s2n_stuffer_read(&cert_out_stuffer, &new_node->raw));
 
         /* Additional 3 bytes for the length field in the protocol */
@@ -509,6 +518,71 @@ int s2n_config_add_cert_chain_and_key(struct s2n_config *config, const char *cer
     return 0;
 }
 
+int s2n_config_add_cert_chain_and_key_server(struct s2n_config *config, const char *cert_chain_pem, const char *key_server_path)
+{
+    struct s2n_blob mem;
+
+    notnull_check(config);
+
+    /* Allocate the memory for the chain and key struct. The private key stays empty, the key server holds it. */
+    GUARD(s2n_alloc(&mem, sizeof(struct s2n_cert_chain_and_key)));
+    config->cert_and_key_pairs = (struct s2n_cert_chain_and_key *)(void *)mem.data;
+    config->cert_and_key_pairs->cert_chain.head = NULL;
+
+    memset(&config->cert_and_key_pairs->ocsp_status, 0, sizeof(config->cert_and_key_pairs->ocsp_status));
+    memset(&config->cert_and_key_pairs->sct_list, 0, sizeof(config->cert_and_key_pairs->sct_list));
+    GUARD(s2n_pkey_zero_init(&config->cert_and_key_pairs->private_key));
+
+    GUARD(s2n_config_add_cert_chain(config, cert_chain_pem));
+
+    GUARD(s2n_key_server_free(config->key_server));
+    config->key_server = NULL;
+    GUARD(s2n_key_server_new(&config->key_server, key_server_path));
+
+    return 0;
+}
+
+int s2n_config_get_key_server_fd(struct s2n_config *config, int *fd)
+{
+    notnull_check(config);
+    notnull_check(fd);
+    S2N_ERROR_IF(config->key_server == NULL, S2N_ERR_NO_KEY_SERVER);
+
+    *fd = config->key_server->fd;
+
+    return 0;
+}
+
+int s2n_config_key_server_service(struct s2n_config *config)
+{
+    notnull_check(config);
+    S2N_ERROR_IF(config->key_server == NULL, S2N_ERR_NO_KEY_SERVER);
+
+    GUARD(s2n_key_server_service(config->key_server));
+
+    return 0;
+}
+
+int s2n_config_set_ephemeral_key_pool(struct s2n_config *config, uint32_t size, uint32_t threads)
+{
+    notnull_check(config);
+
+    /* The old pool's threads are stopped first, and a size of 0 leaves none */
+    GUARD(s2n_key_pool_free(config->key_pool));
+    config->key_pool = NULL;
+
+    if (size == 0) {
+        return 0;
+    }
+
+    GUARD(s2n_key_pool_new(&config->key_pool, size, threads));
+    if (config->dhparams) {
+        GUARD(s2n_key_pool_set_dhparams(config->key_pool, config->dhparams));
+    }
+
+    return 0;
+}
+
 int s2n_config_add_dhparams(struct s2n_config *config, const char *dhparams_pem)
 {
     struct s2n_stuffer dhparams_in_stuffer, dhparams_out_stuffer;
@@ -520,7 +594,7 @@ int s2n_config_add_dhparams(struct s2n_config *config, const char *dhparams_pem)
     config->dhparams = (struct s2n_dh_params *)(void *)mem.data;
 
     GUARD(s2n_stuffer_alloc_ro_from_string(&dhparams_in_stuffer, dhparams_pem));
-    GUARD(s2n_stuffer_growable_alloc(&dhparams_out_stuffer, strlen(dhparams_pem)));
+    GUARD(s2n_stuffer_growable_alloc_class(&dhparams_out_stuffer, strlen(dhparams_pem), S2N_MEM_PUBLIC));
 
     /* Convert pem to asn1 and asn1 to the private key */
     GUARD(s2n_stuffer_dhparams_from_pem(&dhparams_in_stuffer, &dhparams_out_stuffer));
@@ -535,6 +609,10 @@ int s2n_config_add_dhparams(struct s2n_config *config, const char *dhparams_pem)
 
     GUARD(s2n_free(&dhparams_blob));
 
+    if (config->key_pool) {
+        GUARD(s2n_key_pool_set_dhparams(config->key_pool, config->dhparams));
+    }
+
     return 0;
 }
 
@@ -601,7 +679,7 @@ int s2n_config_set_extension_data(struct s2n_config *config, s2n_tls_extension_t
                 GUARD(s2n_free(&config->cert_and_key_pairs->sct_list));
 
                 if (data && length) {
-                    GUARD(s2n_alloc(&config->cert_and_key_pairs->sct_list, length));
+                    GUARD(s2n_alloc_class(&config->cert_and_key_pairs->sct_list, length, S2N_MEM_PUBLIC));
                     memcpy_check(config->cert_and_key_pairs->sct_list.data, data, length);
                 }
             } break;
@@ -610,7 +688,7 @@ int s2n_config_set_extension_data(struct s2n_config *config, s2n_tls_extension_t
                 GUARD(s2n_free(&config->cert_and_key_pairs->ocsp_status));
 
                 if (data && length) {
-                    GUARD(s2n_alloc(&config->cert_and_key_pairs->ocsp_status, length));
+                    GUARD(s2n_alloc_class(&config->cert_and_key_pairs->ocsp_status, length, S2N_MEM_PUBLIC));
                     memcpy_check(config->cert_and_key_pairs->ocsp_status.data, data, length);
                 }
             } break;
@@ -629,6 +707,15 @@ int s2n_config_set_client_hello_cb(struct s2n_config *config, s2n_client_hello_f
     return 0;
 }
 
+int s2n_config_set_async_pkey_callback(struct s2n_config *config, s2n_async_pkey_fn fn)
+{
+    notnull_check(config);
+
+    config->async_pkey_cb = fn;
+
+    return 0;
+}
+
 int s2n_config_send_max_fragment_length(struct s2n_config *config, s2n_max_frag_len mfl_code)
 {
     notnull_check(config);
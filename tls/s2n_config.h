@@ -24,6 +24,8 @@
 #include "tls/s2n_x509_validator.h"
 
 struct s2n_cipher_preferences;
+struct s2n_key_server;
+struct s2n_key_pool;
 
 struct s2n_config {
     struct s2n_dh_params *dhparams;
@@ -40,6 +42,15 @@ struct s2n_config {
     s2n_client_hello_fn *client_hello_cb;
     void *client_hello_cb_ctx;
 
+    /* If set, private key operations are handed to the application instead of being done inline */
+    s2n_async_pkey_fn async_pkey_cb;
+
+    /* In keyless mode, where private key operations are sent instead of cert_and_key_pairs->private_key */
+    struct s2n_key_server *key_server;
+
+    /* If set, ECDHE handshakes take ephemeral keys generated ahead of time from here */
+    struct s2n_key_pool *key_pool;
+
     /* If caching is being used, these must all be set */
     int (*cache_store) (void *data, uint64_t ttl_in_seconds, const void *key, uint64_t key_size, const void *value, uint64_t value_size);
     void *cache_store_data;
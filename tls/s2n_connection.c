@@ -14,6 +14,7 @@
  */
 
 #include <unistd.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,17 +31,18 @@
 #include "tls/s2n_tls_parameters.h"
 #include "tls/s2n_cipher_suites.h"
 #include "tls/s2n_connection.h"
+#include "tls/s2n_connection_buffers.h"
 #include "tls/s2n_connection_evp_digests.h"
 #include "tls/s2n_handshake.h"
 #include "tls/s2n_record.h"
 #include "tls/s2n_alerts.h"
+#include "tls/s2n_async_pkey.h"
 #include "tls/s2n_tls.h"
 #include "tls/s2n_prf.h"
 
 #include "crypto/s2n_certificate.h"
 #include "crypto/s2n_cipher.h"
 
-#include "utils/s2n_compiler.h"
 #include "utils/s2n_random.h"
 #include "utils/s2n_safety.h"
 #include "utils/s2n_socket.h"
@@ -48,39 +50,46 @@
 #include "utils/s2n_blob.h"
 #include "utils/s2n_mem.h"
 
+static int s2n_connection_new_handshake_hashes(struct s2n_connection *conn)
+{
+    /* Allocate memory for the hash states that only live as long as the handshake */
+    GUARD(s2n_hash_new(&conn->handshake.hashes->md5));
+    GUARD(s2n_hash_new(&conn->handshake.hashes->sha1));
+    GUARD(s2n_hash_new(&conn->handshake.hashes->sha224));
+    GUARD(s2n_hash_new(&conn->handshake.hashes->sha256));
+    GUARD(s2n_hash_new(&conn->handshake.hashes->sha384));
+    GUARD(s2n_hash_new(&conn->handshake.hashes->sha512));
+    GUARD(s2n_hash_new(&conn->handshake.hashes->md5_sha1));
+    GUARD(s2n_hash_new(&conn->handshake.hashes->prf_md5_hash_copy));
+    GUARD(s2n_hash_new(&conn->handshake.hashes->prf_sha1_hash_copy));
+    GUARD(s2n_hash_new(&conn->handshake.hashes->prf_tls12_hash_copy));
+    GUARD(s2n_hash_new(&conn->prf_space->ssl3.md5));
+    GUARD(s2n_hash_new(&conn->prf_space->ssl3.sha1));
+
+    return 0;
+}
+
 static int s2n_connection_new_hashes(struct s2n_connection *conn)
 {
     /* Allocate long-term memory for the Connection's hash states */
-    GUARD(s2n_hash_new(&conn->handshake.md5));
-    GUARD(s2n_hash_new(&conn->handshake.sha1));
-    GUARD(s2n_hash_new(&conn->handshake.sha224));
-    GUARD(s2n_hash_new(&conn->handshake.sha256));
-    GUARD(s2n_hash_new(&conn->handshake.sha384));
-    GUARD(s2n_hash_new(&conn->handshake.sha512));
-    GUARD(s2n_hash_new(&conn->handshake.md5_sha1));
-    GUARD(s2n_hash_new(&conn->handshake.prf_md5_hash_copy));
-    GUARD(s2n_hash_new(&conn->handshake.prf_sha1_hash_copy));
-    GUARD(s2n_hash_new(&conn->handshake.prf_tls12_hash_copy));
-    GUARD(s2n_hash_new(&conn->prf_space.ssl3.md5));
-    GUARD(s2n_hash_new(&conn->prf_space.ssl3.sha1));
     GUARD(s2n_hash_new(&conn->initial.signature_hash));
     GUARD(s2n_hash_new(&conn->secure.signature_hash));
 
     return 0;
 }
 
-static int s2n_connection_init_hashes(struct s2n_connection *conn)
+static int s2n_connection_init_handshake_hashes(struct s2n_connection *conn)
 {
-    /* Initialize all of the Connection's hash states */
+    /* Initialize the hash states that only live as long as the handshake */
 
     if (s2n_hash_is_available(S2N_HASH_MD5)) {
         /* Only initialize hashes that use MD5 if available. */
-        GUARD(s2n_hash_init(&conn->prf_space.ssl3.md5, S2N_HASH_MD5));
+        GUARD(s2n_hash_init(&conn->prf_space->ssl3.md5, S2N_HASH_MD5));
     }
 
     if (s2n_hash_is_available(S2N_HASH_MD5_SHA1)) {
         /* Only initialize hashes that use MD5_SHA1 if available. */
-        GUARD(s2n_hash_init(&conn->handshake.md5_sha1, S2N_HASH_MD5_SHA1));
+        GUARD(s2n_hash_init(&conn->handshake.hashes->md5_sha1, S2N_HASH_MD5_SHA1));
     }
 
     /* Allow MD5 for hash states that are used by the PRF. This is required
@@ -88,20 +97,27 @@ static int s2n_connection_init_hashes(struct s2n_connection *conn)
      * NIST Special Publication 800-52 Revision 1.
      */
     if (s2n_is_in_fips_mode()) {
-        GUARD(s2n_hash_allow_md5_for_fips(&conn->handshake.md5));
-        GUARD(s2n_hash_allow_md5_for_fips(&conn->handshake.prf_md5_hash_copy));
-    }
-    GUARD(s2n_hash_init(&conn->handshake.md5, S2N_HASH_MD5));
-    GUARD(s2n_hash_init(&conn->handshake.prf_md5_hash_copy, S2N_HASH_MD5));
-
-    GUARD(s2n_hash_init(&conn->handshake.sha1, S2N_HASH_SHA1));
-    GUARD(s2n_hash_init(&conn->handshake.sha224, S2N_HASH_SHA224));
-    GUARD(s2n_hash_init(&conn->handshake.sha256, S2N_HASH_SHA256));
-    GUARD(s2n_hash_init(&conn->handshake.sha384, S2N_HASH_SHA384));
-    GUARD(s2n_hash_init(&conn->handshake.sha512, S2N_HASH_SHA512));
-    GUARD(s2n_hash_init(&conn->handshake.prf_tls12_hash_copy, S2N_HASH_NONE));
-    GUARD(s2n_hash_init(&conn->handshake.prf_sha1_hash_copy, S2N_HASH_SHA1));
-    GUARD(s2n_hash_init(&conn->prf_space.ssl3.sha1, S2N_HASH_SHA1));
+        GUARD(s2n_hash_allow_md5_for_fips(&conn->handshake.hashes->md5));
+        GUARD(s2n_hash_allow_md5_for_fips(&conn->handshake.hashes->prf_md5_hash_copy));
+    }
+    GUARD(s2n_hash_init(&conn->handshake.hashes->md5, S2N_HASH_MD5));
+    GUARD(s2n_hash_init(&conn->handshake.hashes->prf_md5_hash_copy, S2N_HASH_MD5));
+
+    GUARD(s2n_hash_init(&conn->handshake.hashes->sha1, S2N_HASH_SHA1));
+    GUARD(s2n_hash_init(&conn->handshake.hashes->sha224, S2N_HASH_SHA224));
+    GUARD(s2n_hash_init(&conn->handshake.hashes->sha256, S2N_HASH_SHA256));
+    GUARD(s2n_hash_init(&conn->handshake.hashes->sha384, S2N_HASH_SHA384));
+    GUARD(s2n_hash_init(&conn->handshake.hashes->sha512, S2N_HASH_SHA512));
+    GUARD(s2n_hash_init(&conn->handshake.hashes->prf_tls12_hash_copy, S2N_HASH_NONE));
+    GUARD(s2n_hash_init(&conn->handshake.hashes->prf_sha1_hash_copy, S2N_HASH_SHA1));
+    GUARD(s2n_hash_init(&conn->prf_space->ssl3.sha1, S2N_HASH_SHA1));
+
+    return 0;
+}
+
+static int s2n_connection_init_hashes(struct s2n_connection *conn)
+{
+    /* Initialize all of the Connection's long-term hash states */
     GUARD(s2n_hash_init(&conn->initial.signature_hash, S2N_HASH_NONE));
     GUARD(s2n_hash_init(&conn->secure.signature_hash, S2N_HASH_NONE));
 
@@ -134,6 +150,26 @@ static int s2n_connection_init_hmacs(struct s2n_connection *conn)
     return 0;
 }
 
+static int s2n_connection_alloc_handshake_state(struct s2n_connection *conn)
+{
+    if (conn->handshake.hashes != NULL) {
+        return 0;
+    }
+
+    GUARD(s2n_alloc(&conn->handshake.hashes_mem, sizeof(struct s2n_handshake_hashes)));
+    GUARD(s2n_blob_zero(&conn->handshake.hashes_mem));
+    conn->handshake.hashes = (struct s2n_handshake_hashes *)(void *)conn->handshake.hashes_mem.data;
+
+    GUARD(s2n_alloc(&conn->prf_space_mem, sizeof(struct s2n_prf_working_space)));
+    GUARD(s2n_blob_zero(&conn->prf_space_mem));
+    conn->prf_space = (struct s2n_prf_working_space *)(void *)conn->prf_space_mem.data;
+
+    GUARD(s2n_prf_new(conn));
+    GUARD(s2n_connection_new_handshake_hashes(conn));
+
+    return 0;
+}
+
 struct s2n_connection *s2n_connection_new(s2n_mode mode)
 {
     struct s2n_blob blob;
@@ -193,7 +229,7 @@ struct s2n_connection *s2n_connection_new(s2n_mode mode)
     blob.size = S2N_ALERT_LENGTH;
 
     GUARD_PTR(s2n_stuffer_init(&conn->writer_alert_out, &blob));
-    GUARD_PTR(s2n_stuffer_alloc(&conn->out, S2N_LARGE_RECORD_LENGTH));
+    GUARD_PTR(s2n_stuffer_alloc_class(&conn->out, S2N_LARGE_RECORD_LENGTH, S2N_MEM_PLAINTEXT));
 
     /* Allocate long term key memory */
     GUARD_PTR(s2n_session_key_alloc(&conn->secure.client_key));
@@ -201,9 +237,9 @@ struct s2n_connection *s2n_connection_new(s2n_mode mode)
     GUARD_PTR(s2n_session_key_alloc(&conn->initial.client_key));
     GUARD_PTR(s2n_session_key_alloc(&conn->initial.server_key));
 
-    /* Allocate long term hash and HMAC memory */
-    GUARD_PTR(s2n_prf_new(conn));
-
+    /* Allocate long term hash and HMAC memory. The handshake's hash and PRF
+     * memory is allocated by _wipe, the same way as for a reused connection.
+     */
     GUARD_PTR(s2n_connection_new_hashes(conn));
     GUARD_PTR(s2n_connection_init_hashes(conn));
 
@@ -217,9 +253,9 @@ struct s2n_connection *s2n_connection_new(s2n_mode mode)
     blob.size = S2N_TLS_RECORD_HEADER_LENGTH;
 
     GUARD_PTR(s2n_stuffer_init(&conn->header_in, &blob));
-    GUARD_PTR(s2n_stuffer_growable_alloc(&conn->in, 0));
-    GUARD_PTR(s2n_stuffer_growable_alloc(&conn->handshake.io, 0));
-    GUARD_PTR(s2n_stuffer_growable_alloc(&conn->client_hello.raw_message, 0));
+    GUARD_PTR(s2n_stuffer_growable_alloc_class(&conn->in, 0, S2N_MEM_PLAINTEXT));
+    GUARD_PTR(s2n_stuffer_growable_alloc_class(&conn->handshake.io, 0, S2N_MEM_PLAINTEXT));
+    GUARD_PTR(s2n_stuffer_growable_alloc_class(&conn->client_hello.raw_message, 0, S2N_MEM_PUBLIC));
     GUARD_PTR(s2n_connection_wipe(conn));
     GUARD_PTR(s2n_timer_start(conn->config, &conn->write_timer));
 
@@ -236,10 +272,55 @@ static int s2n_connection_free_keys(struct s2n_connection *conn)
     return 0;
 }
 
+/* Members that _wipe resets in place rather than zeroing, because they own
+ * allocations that the next connection can use as they are. Listed in the
+ * order they're laid out in struct s2n_connection.
+ */
+#define S2N_CONNECTION_PRESERVED( member ) { offsetof(struct s2n_connection, member), sizeof(((struct s2n_connection *) 0)->member) }
+
+static const struct {
+    size_t offset;
+    size_t size;
+} s2n_connection_preserved[] = {
+    S2N_CONNECTION_PRESERVED(header_in),
+    S2N_CONNECTION_PRESERVED(in),
+    S2N_CONNECTION_PRESERVED(buffer_in),
+    S2N_CONNECTION_PRESERVED(alert_in),
+    S2N_CONNECTION_PRESERVED(reader_alert_out),
+    S2N_CONNECTION_PRESERVED(out),
+    S2N_CONNECTION_PRESERVED(writer_alert_out),
+    S2N_CONNECTION_PRESERVED(handshake.io),
+    S2N_CONNECTION_PRESERVED(handshake.hashes),
+    S2N_CONNECTION_PRESERVED(handshake.hashes_mem),
+    S2N_CONNECTION_PRESERVED(prf_space),
+    S2N_CONNECTION_PRESERVED(prf_space_mem),
+    S2N_CONNECTION_PRESERVED(initial.client_key),
+    S2N_CONNECTION_PRESERVED(initial.server_key),
+    S2N_CONNECTION_PRESERVED(initial.client_record_mac),
+    S2N_CONNECTION_PRESERVED(initial.server_record_mac),
+    S2N_CONNECTION_PRESERVED(initial.record_mac_copy_workspace),
+    S2N_CONNECTION_PRESERVED(initial.signature_hash),
+    S2N_CONNECTION_PRESERVED(secure.client_key),
+    S2N_CONNECTION_PRESERVED(secure.server_key),
+    S2N_CONNECTION_PRESERVED(secure.client_record_mac),
+    S2N_CONNECTION_PRESERVED(secure.server_record_mac),
+    S2N_CONNECTION_PRESERVED(secure.record_mac_copy_workspace),
+    S2N_CONNECTION_PRESERVED(secure.signature_hash),
+    S2N_CONNECTION_PRESERVED(client_hello.raw_message),
+};
+
 static int s2n_connection_zero(struct s2n_connection *conn, int mode, struct s2n_config *config)
 {
-    /* Zero the whole connection structure */
-    memset_check(conn, 0, sizeof(struct s2n_connection));
+    /* Zero the connection structure, apart from the preserved members */
+    uint8_t *base = (uint8_t *) conn;
+    size_t zeroed = 0;
+    const int num_preserved = sizeof(s2n_connection_preserved) / sizeof(s2n_connection_preserved[0]);
+    for (int i = 0; i < num_preserved; i++) {
+        S2N_ERROR_IF(s2n_connection_preserved[i].offset < zeroed, S2N_ERR_SAFETY);
+        memset_check(base + zeroed, 0, s2n_connection_preserved[i].offset - zeroed);
+        zeroed = s2n_connection_preserved[i].offset + s2n_connection_preserved[i].size;
+    }
+    memset_check(base + zeroed, 0, sizeof(struct s2n_connection) - zeroed);
 
     conn->send = NULL;
     conn->recv = NULL;
@@ -291,21 +372,28 @@ static int s2n_connection_wipe_keys(struct s2n_connection *conn)
     return 0;
 }
 
+static int s2n_connection_reset_handshake_hashes(struct s2n_connection *conn)
+{
+    /* Reset the hash states that only live as long as the handshake */
+    GUARD(s2n_hash_reset(&conn->handshake.hashes->md5));
+    GUARD(s2n_hash_reset(&conn->handshake.hashes->sha1));
+    GUARD(s2n_hash_reset(&conn->handshake.hashes->sha224));
+    GUARD(s2n_hash_reset(&conn->handshake.hashes->sha256));
+    GUARD(s2n_hash_reset(&conn->handshake.hashes->sha384));
+    GUARD(s2n_hash_reset(&conn->handshake.hashes->sha512));
+    GUARD(s2n_hash_reset(&conn->handshake.hashes->md5_sha1));
+    GUARD(s2n_hash_reset(&conn->handshake.hashes->prf_md5_hash_copy));
+    GUARD(s2n_hash_reset(&conn->handshake.hashes->prf_sha1_hash_copy));
+    GUARD(s2n_hash_reset(&conn->handshake.hashes->prf_tls12_hash_copy));
+    GUARD(s2n_hash_reset(&conn->prf_space->ssl3.md5));
+    GUARD(s2n_hash_reset(&conn->prf_space->ssl3.sha1));
+
+    return 0;
+}
+
 static int s2n_connection_reset_hashes(struct s2n_connection *conn)
 {
-    /* Reset all of the Connection's hash states */
-    GUARD(s2n_hash_reset(&conn->handshake.md5));
-    GUARD(s2n_hash_reset(&conn->handshake.sha1));
-    GUARD(s2n_hash_reset(&conn->handshake.sha224));
-    GUARD(s2n_hash_reset(&conn->handshake.sha256));
-    GUARD(s2n_hash_reset(&conn->handshake.sha384));
-    GUARD(s2n_hash_reset(&conn->handshake.sha512));
-    GUARD(s2n_hash_reset(&conn->handshake.md5_sha1));
-    GUARD(s2n_hash_reset(&conn->handshake.prf_md5_hash_copy));
-    GUARD(s2n_hash_reset(&conn->handshake.prf_sha1_hash_copy));
-    GUARD(s2n_hash_reset(&conn->handshake.prf_tls12_hash_copy));
-    GUARD(s2n_hash_reset(&conn->prf_space.ssl3.md5));
-    GUARD(s2n_hash_reset(&conn->prf_space.ssl3.sha1));
+    /* Reset all of the Connection's long-term hash states */
     GUARD(s2n_hash_reset(&conn->initial.signature_hash));
     GUARD(s2n_hash_reset(&conn->secure.signature_hash));
 
@@ -325,6 +413,53 @@ static int s2n_connection_reset_hmacs(struct s2n_connection *conn)
     return 0;
 }
 
+/* Return a hash state kept by _wipe to its initial state, unless nothing
+ * has been hashed since it was last initialized.
+ */
+static int s2n_connection_wipe_hash(struct s2n_hash_state *state)
+{
+    if (state->alg == S2N_HASH_NONE && state->is_ready_for_input && state->currently_in_hash == 0) {
+        return 0;
+    }
+
+    struct s2n_hash_evp_digest evp_digest = state->digest.high_level;
+    memset_check(state, 0, sizeof(struct s2n_hash_state));
+    state->digest.high_level = evp_digest;
+    GUARD(s2n_hash_init(state, S2N_HASH_NONE));
+
+    return 0;
+}
+
+/* As above, for an HMAC state: one that was never keyed holds nothing to wipe */
+static int s2n_connection_wipe_hmac(struct s2n_hmac_state *state)
+{
+    if (state->alg == S2N_HMAC_NONE && state->currently_in_hash_block == 0) {
+        return 0;
+    }
+
+    struct s2n_hmac_evp_backup evp_backup;
+    GUARD(s2n_hmac_save_evp_hash_state(&evp_backup, state));
+    memset_check(state, 0, sizeof(struct s2n_hmac_state));
+    GUARD(s2n_hmac_restore_evp_hash_state(&evp_backup, state));
+    GUARD(s2n_hmac_init(state, S2N_HMAC_NONE, NULL, 0));
+
+    return 0;
+}
+
+static int s2n_connection_wipe_digests(struct s2n_connection *conn)
+{
+    GUARD(s2n_connection_wipe_hash(&conn->initial.signature_hash));
+    GUARD(s2n_connection_wipe_hash(&conn->secure.signature_hash));
+    GUARD(s2n_connection_wipe_hmac(&conn->initial.client_record_mac));
+    GUARD(s2n_connection_wipe_hmac(&conn->initial.server_record_mac));
+    GUARD(s2n_connection_wipe_hmac(&conn->initial.record_mac_copy_workspace));
+    GUARD(s2n_connection_wipe_hmac(&conn->secure.client_record_mac));
+    GUARD(s2n_connection_wipe_hmac(&conn->secure.server_record_mac));
+    GUARD(s2n_connection_wipe_hmac(&conn->secure.record_mac_copy_workspace));
+
+    return 0;
+}
+
 static int s2n_connection_free_io_contexts(struct s2n_connection *conn)
 {
     /* Free the I/O context if it was allocated by s2n. Don't touch user-controlled contexts. */
@@ -368,27 +503,61 @@ static int s2n_connection_wipe_io(struct s2n_connection *conn)
     return 0;
 }
 
+static int s2n_connection_free_handshake_hashes(struct s2n_connection *conn)
+{
+    /* Free the hash states that only live as long as the handshake */
+    GUARD(s2n_hash_free(&conn->handshake.hashes->md5));
+    GUARD(s2n_hash_free(&conn->handshake.hashes->sha1));
+    GUARD(s2n_hash_free(&conn->handshake.hashes->sha224));
+    GUARD(s2n_hash_free(&conn->handshake.hashes->sha256));
+    GUARD(s2n_hash_free(&conn->handshake.hashes->sha384));
+    GUARD(s2n_hash_free(&conn->handshake.hashes->sha512));
+    GUARD(s2n_hash_free(&conn->handshake.hashes->md5_sha1));
+    GUARD(s2n_hash_free(&conn->handshake.hashes->prf_md5_hash_copy));
+    GUARD(s2n_hash_free(&conn->handshake.hashes->prf_sha1_hash_copy));
+    GUARD(s2n_hash_free(&conn->handshake.hashes->prf_tls12_hash_copy));
+    GUARD(s2n_hash_free(&conn->prf_space->ssl3.md5));
+    GUARD(s2n_hash_free(&conn->prf_space->ssl3.sha1));
+
+    return 0;
+}
+
 static int s2n_connection_free_hashes(struct s2n_connection *conn)
 {
-    /* Free all of the Connection's hash states */
-    GUARD(s2n_hash_free(&conn->handshake.md5));
-    GUARD(s2n_hash_free(&conn->handshake.sha1));
-    GUARD(s2n_hash_free(&conn->handshake.sha224));
-    GUARD(s2n_hash_free(&conn->handshake.sha256));
-    GUARD(s2n_hash_free(&conn->handshake.sha384));
-    GUARD(s2n_hash_free(&conn->handshake.sha512));
-    GUARD(s2n_hash_free(&conn->handshake.md5_sha1));
-    GUARD(s2n_hash_free(&conn->handshake.prf_md5_hash_copy));
-    GUARD(s2n_hash_free(&conn->handshake.prf_sha1_hash_copy));
-    GUARD(s2n_hash_free(&conn->handshake.prf_tls12_hash_copy));
-    GUARD(s2n_hash_free(&conn->prf_space.ssl3.md5));
-    GUARD(s2n_hash_free(&conn->prf_space.ssl3.sha1));
+    /* Free all of the Connection's long-term hash states */
     GUARD(s2n_hash_free(&conn->initial.signature_hash));
     GUARD(s2n_hash_free(&conn->secure.signature_hash));
 
     return 0;
 }
 
+int s2n_connection_free_handshake_state(struct s2n_connection *conn)
+{
+    if (conn->handshake.hashes == NULL) {
+        return 0;
+    }
+
+    GUARD(s2n_prf_free(conn));
+    GUARD(s2n_connection_reset_handshake_hashes(conn));
+    GUARD(s2n_connection_free_handshake_hashes(conn));
+
+    /* The PRF working space has held the master secret, so zero it before handing it back */
+    GUARD(s2n_blob_zero(&conn->prf_space_mem));
+    GUARD(s2n_free(&conn->prf_space_mem));
+    conn->prf_space = NULL;
+
+    GUARD(s2n_free(&conn->handshake.hashes_mem));
+    conn->handshake.hashes = NULL;
+
+    /* The ephemeral keys have done their job once the premaster secret is
+     * agreed. The negotiated curve stays, for s2n_connection_get_curve().
+     */
+    GUARD(s2n_dh_params_free(&conn->secure.server_dh_params));
+    GUARD(s2n_ecc_params_free(&conn->secure.server_ecc_params));
+
+    return 0;
+}
+
 static int s2n_connection_free_hmacs(struct s2n_connection *conn)
 {
     /* Free all of the Connection's HMAC states */
@@ -408,20 +577,21 @@ static uint8_t s2n_default_verify_host(const char *host_name, size_t len, void *
      * outlined in RFC6125 6.4. */
 
     struct s2n_connection *conn = data;
+    const char *server_name = s2n_get_server_name(conn);
 
-    if (conn->server_name[0] == '\0') {
+    if (server_name == NULL) {
         return 0;
     }
 
     /* complete match */
-    if (strlen(conn->server_name) == len &&
-            strncasecmp(conn->server_name, host_name, len) == 0) {
+    if (strlen(server_name) == len &&
+            strncasecmp(server_name, host_name, len) == 0) {
         return 1;
     }
 
     /* match 1 level of wildcard */
     if (len > 2 && host_name[0] == '*' && host_name[1] == '.') {
-        const char *suffix = strchr(conn->server_name, '.');
+        const char *suffix = strchr(server_name, '.');
 
         if (suffix == NULL) {
             return 0;
@@ -440,10 +610,12 @@ int s2n_connection_free(struct s2n_connection *conn)
 {
     struct s2n_blob blob = {0};
 
+    GUARD(s2n_async_pkey_abandon(conn));
+
     GUARD(s2n_connection_wipe_keys(conn));
     GUARD(s2n_connection_free_keys(conn));
 
-    GUARD(s2n_prf_free(conn));
+    GUARD(s2n_connection_free_handshake_state(conn));
 
     GUARD(s2n_connection_reset_hashes(conn));
     GUARD(s2n_connection_free_hashes(conn));
@@ -453,9 +625,13 @@ int s2n_connection_free(struct s2n_connection *conn)
 
     GUARD(s2n_connection_free_io_contexts(conn));
     
+    GUARD(s2n_free(&conn->server_name));
+    GUARD(s2n_free(&conn->application_protocol));
     GUARD(s2n_free(&conn->status_response));
+    GUARD(s2n_free(&conn->ct_response));
     GUARD(s2n_stuffer_free(&conn->in));
     GUARD(s2n_stuffer_free(&conn->out));
+    GUARD(s2n_stuffer_free(&conn->buffer_in));
     GUARD(s2n_stuffer_free(&conn->handshake.io));
     s2n_x509_validator_wipe(&conn->x509_validator);
     GUARD(s2n_client_hello_free(&conn->client_hello));
@@ -520,31 +696,28 @@ void *s2n_connection_get_ctx(struct s2n_connection *conn)
 
 int s2n_connection_wipe(struct s2n_connection *conn)
 {
-    /* First make a copy of everything we'd like to save, which isn't very much. */
+    /* Take back any buffers that were handed to the pool, so they're reused below */
+    GUARD(s2n_connection_acquire_buffers(conn));
+
+    /* Let go of a private key operation the handshake was waiting on */
+    GUARD(s2n_async_pkey_abandon(conn));
+
+    /* A completed handshake releases its hashes and PRF space. Fresh ones
+     * only need initializing; ones that a handshake has used need a reset.
+     */
+    int handshake_state_used = conn->handshake.hashes != NULL;
+    GUARD(s2n_connection_alloc_handshake_state(conn));
+
+    /* The connection is zeroed below, apart from the members listed in
+     * s2n_connection_preserved. Those keep their allocations, and are wiped
+     * and reset in place here instead.
+     */
     int mode = conn->mode;
     struct s2n_config *config = conn->config;
-    struct s2n_stuffer alert_in;
-    struct s2n_stuffer reader_alert_out;
-    struct s2n_stuffer writer_alert_out;
-    struct s2n_stuffer handshake_io;
-    struct s2n_stuffer client_hello_raw_message;
-    struct s2n_stuffer header_in;
-    struct s2n_stuffer in;
-    struct s2n_stuffer out;
-    /* Session keys will be wiped. Preserve structs to avoid reallocation */
-    struct s2n_session_key initial_client_key;
-    struct s2n_session_key initial_server_key;
-    struct s2n_session_key secure_client_key;
-    struct s2n_session_key secure_server_key;
-    /* Parts of the PRF working space, hash states, and hmac states  will be wiped. Preserve structs to avoid reallocation */
-    struct s2n_connection_prf_handles prf_handles;
-    struct s2n_connection_hash_handles hash_handles;
-    struct s2n_connection_hmac_handles hmac_handles;
 
     /* Wipe all of the sensitive stuff */
     GUARD(s2n_connection_wipe_keys(conn));
-    GUARD(s2n_connection_reset_hashes(conn));
-    GUARD(s2n_connection_reset_hmacs(conn));
+    GUARD(s2n_connection_wipe_digests(conn));
     GUARD(s2n_stuffer_wipe(&conn->alert_in));
     GUARD(s2n_stuffer_wipe(&conn->reader_alert_out));
     GUARD(s2n_stuffer_wipe(&conn->writer_alert_out));
@@ -553,74 +726,44 @@ int s2n_connection_wipe(struct s2n_connection *conn)
     GUARD(s2n_stuffer_wipe(&conn->header_in));
     GUARD(s2n_stuffer_wipe(&conn->in));
     GUARD(s2n_stuffer_wipe(&conn->out));
+    GUARD(s2n_stuffer_wipe(&conn->buffer_in));
+
+    if (handshake_state_used) {
+        /* The handshake hashes and PRF space live outside of the connection.
+         * Zero them, keeping only the digest handles to avoid reallocation.
+         */
+        struct s2n_connection_prf_handles prf_handles;
+        struct s2n_connection_hash_handles hash_handles;
+
+        GUARD(s2n_connection_reset_handshake_hashes(conn));
+        GUARD(s2n_connection_save_prf_state(&prf_handles, conn));
+        GUARD(s2n_connection_save_hash_state(&hash_handles, conn));
+        memset_check(conn->handshake.hashes, 0, sizeof(struct s2n_handshake_hashes));
+        memset_check(conn->prf_space, 0, sizeof(struct s2n_prf_working_space));
+        GUARD(s2n_connection_restore_prf_state(conn, &prf_handles));
+        GUARD(s2n_connection_restore_hash_state(conn, &hash_handles));
+    }
 
     /* Wipe the I/O-related info and restore the original socket if necessary */
     GUARD(s2n_connection_wipe_io(conn));
 
+    GUARD(s2n_free(&conn->server_name));
+    GUARD(s2n_free(&conn->application_protocol));
     GUARD(s2n_free(&conn->status_response));
+    GUARD(s2n_free(&conn->ct_response));
 
     /* Allocate or resize to their original sizes */
     GUARD(s2n_stuffer_resize(&conn->in, S2N_LARGE_FRAGMENT_LENGTH));
 
-    /* Allocate memory for handling handshakes */
-    GUARD(s2n_stuffer_resize(&conn->handshake.io, S2N_LARGE_RECORD_LENGTH));
-
-    /* Resize raw message buffer to max length */
-    GUARD(s2n_stuffer_resize(&conn->client_hello.raw_message, S2N_LARGE_RECORD_LENGTH));
-
-    /* Remove context associated with connection */
-    conn->context = NULL;
-    conn->verify_host_fn_overridden = 0;
-    conn->verify_host_fn = NULL;
-    conn->data_for_verify_host = NULL;
-
-    /* Clone the stuffers */
-    /* ignore gcc 4.7 address warnings because dest is allocated on the stack */
-    /* pragma gcc diagnostic was added in gcc 4.6 */
-#if S2N_GCC_VERSION_AT_LEAST(4,6,0)
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Waddress"
-#endif
-    memcpy_check(&alert_in, &conn->alert_in, sizeof(struct s2n_stuffer));
-    memcpy_check(&reader_alert_out, &conn->reader_alert_out, sizeof(struct s2n_stuffer));
-    memcpy_check(&writer_alert_out, &conn->writer_alert_out, sizeof(struct s2n_stuffer));
-    memcpy_check(&handshake_io, &conn->handshake.io, sizeof(struct s2n_stuffer));
-    memcpy_check(&client_hello_raw_message, &conn->client_hello.raw_message, sizeof(struct s2n_stuffer));
-    memcpy_check(&header_in, &conn->header_in, sizeof(struct s2n_stuffer));
-    memcpy_check(&in, &conn->in, sizeof(struct s2n_stuffer));
-    memcpy_check(&out, &conn->out, sizeof(struct s2n_stuffer));
-    memcpy_check(&initial_client_key, &conn->initial.client_key, sizeof(struct s2n_session_key));
-    memcpy_check(&initial_server_key, &conn->initial.server_key, sizeof(struct s2n_session_key));
-    memcpy_check(&secure_client_key, &conn->secure.client_key, sizeof(struct s2n_session_key));
-    memcpy_check(&secure_server_key, &conn->secure.server_key, sizeof(struct s2n_session_key));
-    GUARD(s2n_connection_save_prf_state(&prf_handles, conn));
-    GUARD(s2n_connection_save_hash_state(&hash_handles, conn));
-    GUARD(s2n_connection_save_hmac_state(&hmac_handles, conn));
-#if S2N_GCC_VERSION_AT_LEAST(4,6,0)
-#pragma GCC diagnostic pop
-#endif
+    /* Memory for handling handshakes, and for the raw ClientHello. A
+     * completed handshake gave these back to the pool, so take them from there.
+     */
+    GUARD(s2n_connection_buffer_acquire(&conn->handshake.io, S2N_LARGE_RECORD_LENGTH));
+    GUARD(s2n_connection_buffer_acquire(&conn->client_hello.raw_message, S2N_LARGE_RECORD_LENGTH));
 
     GUARD(s2n_connection_zero(conn, mode, config));
 
-    memcpy_check(&conn->alert_in, &alert_in, sizeof(struct s2n_stuffer));
-    memcpy_check(&conn->reader_alert_out, &reader_alert_out, sizeof(struct s2n_stuffer));
-    memcpy_check(&conn->writer_alert_out, &writer_alert_out, sizeof(struct s2n_stuffer));
-    memcpy_check(&conn->handshake.io, &handshake_io, sizeof(struct s2n_stuffer));
-    memcpy_check(&conn->client_hello.raw_message, &client_hello_raw_message, sizeof(struct s2n_stuffer));
-    memcpy_check(&conn->header_in, &header_in, sizeof(struct s2n_stuffer));
-    memcpy_check(&conn->in, &in, sizeof(struct s2n_stuffer));
-    memcpy_check(&conn->out, &out, sizeof(struct s2n_stuffer));
-    memcpy_check(&conn->initial.client_key, &initial_client_key, sizeof(struct s2n_session_key));
-    memcpy_check(&conn->initial.server_key, &initial_server_key, sizeof(struct s2n_session_key));
-    memcpy_check(&conn->secure.client_key, &secure_client_key, sizeof(struct s2n_session_key));
-    memcpy_check(&conn->secure.server_key, &secure_server_key, sizeof(struct s2n_session_key));
-    GUARD(s2n_connection_restore_prf_state(conn, &prf_handles));
-    GUARD(s2n_connection_restore_hash_state(conn, &hash_handles));
-    GUARD(s2n_connection_restore_hmac_state(conn, &hmac_handles));
-
-    /* Re-initialize hash and hmac states */
-    GUARD(s2n_connection_init_hashes(conn));
-    GUARD(s2n_connection_init_hmacs(conn));
+    GUARD(s2n_connection_init_handshake_hashes(conn));
 
     /* Require all handshakes hashes. This set can be reduced as the handshake progresses. */
     GUARD(s2n_handshake_require_all_hashes(&conn->handshake));
@@ -836,34 +979,60 @@ int s2n_connection_get_alert(struct s2n_connection *conn)
     return alert_code;
 }
 
+/* Names are rarely set, so they're kept out of the connection and only allocated when they are */
+static int s2n_connection_store_name(struct s2n_blob *name, const uint8_t *data, uint32_t len)
+{
+    if (name->data == NULL) {
+        GUARD(s2n_alloc_class(name, len + 1, S2N_MEM_PUBLIC));
+    } else {
+        GUARD(s2n_realloc(name, len + 1));
+    }
+
+    memcpy_check(name->data, data, len);
+    name->data[len] = '\0';
+
+    return 0;
+}
+
+int s2n_connection_store_server_name(struct s2n_connection *conn, const uint8_t *server_name, uint32_t len)
+{
+    S2N_ERROR_IF(len > S2N_MAX_SERVER_NAME - 1, S2N_ERR_SERVER_NAME_TOO_LONG);
+
+    return s2n_connection_store_name(&conn->server_name, server_name, len);
+}
+
+int s2n_connection_store_application_protocol(struct s2n_connection *conn, const uint8_t *protocol, uint32_t len)
+{
+    S2N_ERROR_IF(len > 255, S2N_ERR_APPLICATION_PROTOCOL_TOO_LONG);
+
+    return s2n_connection_store_name(&conn->application_protocol, protocol, len);
+}
+
 int s2n_set_server_name(struct s2n_connection *conn, const char *server_name)
 {
     S2N_ERROR_IF(conn->mode != S2N_CLIENT, S2N_ERR_CLIENT_MODE);
 
-    int len = strlen(server_name);
-    S2N_ERROR_IF(len > 255, S2N_ERR_SERVER_NAME_TOO_LONG);
-
-    memcpy_check(conn->server_name, server_name, len);
+    GUARD(s2n_connection_store_server_name(conn, (const uint8_t *) server_name, strlen(server_name)));
 
     return 0;
 }
 
 const char *s2n_get_server_name(struct s2n_connection *conn)
 {
-    if (strlen(conn->server_name) == 0) {
+    if (conn->server_name.data == NULL || conn->server_name.data[0] == '\0') {
         return NULL;
     }
 
-    return conn->server_name;
+    return (const char *) conn->server_name.data;
 }
 
 const char *s2n_get_application_protocol(struct s2n_connection *conn)
 {
-    if (strlen(conn->application_protocol) == 0) {
+    if (conn->application_protocol.data == NULL || conn->application_protocol.data[0] == '\0') {
         return NULL;
     }
 
-    return conn->application_protocol;
+    return (const char *) conn->application_protocol.data;
 }
 
 int s2n_connection_set_blinding(struct s2n_connection *conn, s2n_blinding blinding)
@@ -893,7 +1062,7 @@ uint64_t s2n_connection_get_delay(struct s2n_connection * conn)
 
 int s2n_connection_kill(struct s2n_connection *conn)
 {
-    conn->closed = 1;
+    s2n_connection_set_closed(conn);
 
     /* Delay between 10 and 30 seconds in nanoseconds */
     int64_t min = TEN_S, max = 3 * TEN_S;
@@ -945,6 +1114,73 @@ int s2n_connection_prefer_low_latency(struct s2n_connection *conn)
     return 0;
 }
 
+int s2n_connection_set_dynamic_record_threshold(struct s2n_connection *conn, uint32_t resize_threshold, uint16_t timeout_threshold)
+{
+    notnull_check(conn);
+    S2N_ERROR_IF(resize_threshold > S2N_TLS_MAX_RESIZE_THRESHOLD, S2N_ERR_INVALID_DYNAMIC_THRESHOLD);
+
+    conn->dynamic_record_resize_threshold = resize_threshold;
+    conn->dynamic_record_timeout_threshold = timeout_threshold;
+    conn->active_application_bytes_consumed = 0;
+
+    /* Once the threshold has been crossed, go straight to the largest records.
+     * Turning it off leaves whichever record size was chosen before alone.
+     */
+    if (resize_threshold) {
+        GUARD(s2n_connection_prefer_throughput(conn));
+    }
+
+    return 0;
+}
+
+int s2n_connection_set_send_buffer_size(struct s2n_connection *conn, uint32_t size)
+{
+    notnull_check(conn);
+
+    /* The send buffer always has to be able to hold at least one full record */
+    S2N_ERROR_IF(size < S2N_LARGE_RECORD_LENGTH, S2N_ERR_INVALID_SEND_BUFFER_SIZE);
+
+    GUARD(s2n_connection_acquire_buffers(conn));
+
+    /* Don't throw away records that haven't been flushed yet */
+    S2N_ERROR_IF(s2n_stuffer_data_available(&conn->out), S2N_ERR_INVALID_SEND_BUFFER_SIZE);
+
+    if (size == conn->out.blob.size) {
+        return 0;
+    }
+
+    GUARD(s2n_stuffer_free(&conn->out));
+    GUARD(s2n_stuffer_alloc_class(&conn->out, size, S2N_MEM_PLAINTEXT));
+
+    return 0;
+}
+
+int s2n_connection_set_read_ahead(struct s2n_connection *conn, uint32_t size)
+{
+    notnull_check(conn);
+
+    GUARD(s2n_connection_acquire_buffers(conn));
+
+    /* Don't throw away ciphertext that hasn't been processed yet */
+    S2N_ERROR_IF(s2n_stuffer_data_available(&conn->buffer_in), S2N_ERR_READ_AHEAD_PENDING);
+
+    if (size == conn->buffer_in.blob.size) {
+        return 0;
+    }
+
+    GUARD(s2n_stuffer_free(&conn->buffer_in));
+    if (size) {
+        GUARD(s2n_stuffer_alloc_class(&conn->buffer_in, size, S2N_MEM_PUBLIC));
+    }
+
+    return 0;
+}
+
+uint32_t s2n_connection_get_buffered_bytes_in(struct s2n_connection *conn)
+{
+    return s2n_stuffer_data_available(&conn->buffer_in);
+}
+
 int s2n_connection_set_verify_host_callback(struct s2n_connection *conn, s2n_verify_host_fn verify_host_fn, void *data) {
     notnull_check(conn);
 
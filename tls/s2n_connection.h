@@ -40,20 +40,38 @@
 
 #define is_handshake_complete(conn) (APPLICATION_DATA == s2n_conn_get_current_message_type(conn))
 
+/* Fields owned by different threads are kept at least this far apart. The
+ * gap doesn't rely on the connection being cache line aligned, which it isn't
+ * when memory isn't locked.
+ */
+#define S2N_CACHE_LINE_SIZE 64
+#define S2N_CACHE_LINE_GAP( name ) uint8_t name[S2N_CACHE_LINE_SIZE]
+
+/* closing and closed can be set by the reader and the writer thread at once */
+#define s2n_connection_is_closing(conn)     __atomic_load_n(&(conn)->closing, __ATOMIC_ACQUIRE)
+#define s2n_connection_is_closed(conn)      __atomic_load_n(&(conn)->closed, __ATOMIC_ACQUIRE)
+#define s2n_connection_set_closing(conn)    __atomic_store_n(&(conn)->closing, 1, __ATOMIC_RELEASE)
+#define s2n_connection_set_closed(conn)     __atomic_store_n(&(conn)->closed, 1, __ATOMIC_RELEASE)
+
+/* struct s2n_connection is laid out so that the fields s2n_send and s2n_recv
+ * touch for every record come first and share as few cache lines as
+ * possible, with the reader's and the writer's fields apart from each other.
+ * The handshake state follows, then the crypto parameters, and the
+ * data that is only looked at during the handshake or by the application
+ * comes last. s2n_connection_layout_test keeps it that way.
+ */
 struct s2n_connection {
+    /* ---- Record path, shared by the reader and the writer ---- */
+
     /* The configuration (cert, key .. etc ) */
     struct s2n_config *config;
 
-    /* The user defined context associated with connection */
-    void *context;
-
-    /* The send and receive callbacks don't have to be the same (e.g. two pipes) */
-    s2n_send_fn *send;
-    s2n_recv_fn *recv;
+    /* Which set is the client/server actually using? */
+    struct s2n_crypto_parameters *client;
+    struct s2n_crypto_parameters *server;
 
-    /* The context passed to the I/O callbacks */
-    void *send_io_context;
-    void *recv_io_context;
+    /* Is this connection a client or a server connection */
+    s2n_mode mode;
 
     /* Has the user set their own I/O callbacks or is this connection using the
      * default socket-based I/O set by s2n */
@@ -62,57 +80,52 @@ struct s2n_connection {
     /* Is this connection using CORK/SO_RCVLOWAT optimizations? Only valid when the connection is using
      * managed_io
      */
-    unsigned int corked_io:1;
-
-    /* Is this connection a client or a server connection */
-    s2n_mode mode;
-
-    /* Does s2n handle the blinding, or does the application */
-    s2n_blinding blinding;
-
-    /* A timer to measure the time between record writes */
-    struct s2n_timer write_timer;
+    uint8_t corked_io;
 
-    /* When fatal errors occurs, s2n imposes a pause before
-     * the connection is closed. If non-zero, this value tracks
-     * how many nanoseconds to pause - which will be relative to
-     * the write_timer value. */
-    uint64_t delay;
+    /* The version we are currently speaking */
+    uint8_t actual_protocol_version;
 
-    /* The session id */
-    uint8_t session_id[S2N_TLS_SESSION_ID_MAX_LEN];
-    uint8_t session_id_len;
+    /* While the connection is idle, s2n_connection_release_buffers hands the
+     * I/O buffers over to a shared pool. These are the sizes they're given
+     * back at when the connection is next used.
+     */
+    uint8_t buffers_released;
 
-    /* The version advertised by the client, by the
-     * server, and the actual version we are currently
-     * speaking. */
-    uint8_t client_hello_version;
-    uint8_t client_protocol_version;
-    uint8_t server_protocol_version;
-    uint8_t actual_protocol_version;
-    uint8_t actual_protocol_version_established;
+    /* Is the connection open or closed ? Both the reader and
+     * the writer threads may declare a connection closed, so
+     * these are only accessed through the atomic
+     * s2n_connection_is_closing() family below.
+     *
+     * A connection can be gracefully closed or hard-closed.
+     * When gracefully closed the reader or the writer mark
+     * the connection as closing, and then the writer will
+     * send an alert message before closing the connection
+     * and marking it as closed.
+     *
+     * A hard-close goes straight to closed with no alert
+     * message being sent.
+     */
+    sig_atomic_t closing;
+    sig_atomic_t closed;
 
-    /* Our crypto parameters */
-    struct s2n_crypto_parameters initial;
-    struct s2n_crypto_parameters secure;
+    /* The s2n reader and writer can be separate duplex I/O threads. The
+     * state each of them owns is kept at least a cache line apart, so that
+     * they don't keep invalidating each other's cache lines.
+     */
+    S2N_CACHE_LINE_GAP(reader_gap);
 
-    /* Which set is the client/server actually using? */
-    struct s2n_crypto_parameters *client;
-    struct s2n_crypto_parameters *server;
+    /* ---- Record path, reader ---- */
 
-    /* The PRF needs some storage elements to work with */
-    struct s2n_prf_working_space prf_space;
+    /* The send and receive callbacks don't have to be the same (e.g. two pipes) */
+    s2n_recv_fn *recv;
 
-    /* Whether to use client_cert_auth_type stored in s2n_config or in this s2n_connection.
-     *
-     * By default the s2n_connection will defer to s2n_config->client_cert_auth_type on whether or not to use Client Auth.
-     * But users can override Client Auth at the connection level using s2n_connection_set_client_auth_type() without mutating
-     * s2n_config since s2n_config can be shared between multiple s2n_connections. */
-    uint8_t client_cert_auth_type_overridden;
+    /* The context passed to the I/O callbacks */
+    void *recv_io_context;
 
-    /* Whether or not the s2n_connection should require the Client to authenticate itself to the server. Only used if
-     * client_cert_auth_type_overridden is non-zero. */
-    s2n_cert_auth_type client_cert_auth_type;
+    /* Has record protection been handed over to the kernel (kTLS)? Once it
+     * has, application data in that direction is plain socket I/O.
+     */
+    uint8_t ktls_recv_enabled;
 
     /* Our workhorse stuffers, used for buffering the plaintext
      * and encrypted data in both directions.
@@ -120,14 +133,17 @@ struct s2n_connection {
     uint8_t header_in_data[S2N_TLS_RECORD_HEADER_LENGTH];
     struct s2n_stuffer header_in;
     struct s2n_stuffer in;
-    struct s2n_stuffer out;
     enum { ENCRYPTED, PLAINTEXT } in_status;
 
-    /* How much of the current user buffer have we already
-     * encrypted and sent or have pending for the wire but have
-     * not acknowledged to the user.
+    /* An error from a record that came after data s2n_recv already returned */
+    int recv_deferred_errno;
+
+    /* When read-ahead is enabled, as much ciphertext as the peer has sent
+     * (up to the size of this buffer) is read in a single call, and records
+     * are parsed out of it without going back to the socket. Unallocated
+     * (zero sized) when read-ahead is disabled.
      */
-    ssize_t current_user_data_consumed;
+    struct s2n_stuffer buffer_in;
 
     /* An alert may be fragmented across multiple records,
      * this stuffer is used to re-assemble.
@@ -144,15 +160,26 @@ struct s2n_connection {
      * can be separate duplex I/O threads.
      */
     uint8_t reader_alert_out_data[S2N_ALERT_LENGTH];
-    uint8_t writer_alert_out_data[S2N_ALERT_LENGTH];
     struct s2n_stuffer reader_alert_out;
-    struct s2n_stuffer writer_alert_out;
+
+    /* Keep some accounting on each connection */
+    uint64_t wire_bytes_in;
+
+    S2N_CACHE_LINE_GAP(writer_gap);
+
+    /* ---- Record path, writer ---- */
+
+    s2n_send_fn *send;
+    void *send_io_context;
+    uint8_t ktls_send_enabled;
 
     /* Determines if we're currently sending or receiving in s2n_shutdown */
-    unsigned int close_notify_queued:1;
+    uint8_t close_notify_queued;
 
-    /* Our handshake state machine */
-    struct s2n_handshake handshake;
+    struct s2n_stuffer out;
+
+    uint8_t writer_alert_out_data[S2N_ALERT_LENGTH];
+    struct s2n_stuffer writer_alert_out;
 
     /* Maximum outgoing fragment size for this connection. Does not limit
      * incoming record size.
@@ -166,38 +193,100 @@ struct s2n_connection {
      */
     uint16_t max_outgoing_fragment_length;
 
+    /* How much of the current user buffer have we already
+     * encrypted and sent or have pending for the wire but have
+     * not acknowledged to the user.
+     */
+    ssize_t current_user_data_consumed;
+
+    /* Dynamic record sizing. While fewer than dynamic_record_resize_threshold
+     * bytes of application data have been sent, records are kept small enough
+     * to fit in a single TCP segment. The count starts again after the
+     * connection has been idle for dynamic_record_timeout_threshold seconds,
+     * as measured by the write_timer. A zero resize threshold disables it.
+     */
+    uint32_t dynamic_record_resize_threshold;
+    uint16_t dynamic_record_timeout_threshold;
+    uint64_t active_application_bytes_consumed;
+
+    uint64_t wire_bytes_out;
+
+    /* A timer to measure the time between record writes */
+    struct s2n_timer write_timer;
+
+    /* When fatal errors occurs, s2n imposes a pause before
+     * the connection is closed. If non-zero, this value tracks
+     * how many nanoseconds to pause - which will be relative to
+     * the write_timer value. */
+    uint64_t delay;
+
+    S2N_CACHE_LINE_GAP(handshake_gap);
+
+    /* ---- Handshake ---- */
+
+    /* Our handshake state machine */
+    struct s2n_handshake handshake;
+
+    /* The PRF needs some storage elements to work with. Like the handshake
+     * hashes, this is released once the handshake completes. */
+    struct s2n_prf_working_space *prf_space;
+    struct s2n_blob prf_space_mem;
+
+    /* The version advertised by the client, by the
+     * server, and whether the actual version has been
+     * established. */
+    uint8_t client_hello_version;
+    uint8_t client_protocol_version;
+    uint8_t server_protocol_version;
+    uint8_t actual_protocol_version_established;
+
     /* Negotiated TLS extension Maximum Fragment Length code */
     uint8_t mfl_code;
 
-    /* Keep some accounting on each connection */
-    uint64_t wire_bytes_in;
-    uint64_t wire_bytes_out;
+    /* Does s2n handle the blinding, or does the application */
+    s2n_blinding blinding;
 
-    /* Is the connection open or closed ? We use C's only
-     * atomic type as both the reader and the writer threads
-     * may declare a connection closed.
-     *
-     * A connection can be gracefully closed or hard-closed.
-     * When gracefully closed the reader or the writer mark
-     * the connection as closing, and then the writer will
-     * send an alert message before closing the connection
-     * and marking it as closed.
+    /* The session id */
+    uint8_t session_id[S2N_TLS_SESSION_ID_MAX_LEN];
+    uint8_t session_id_len;
+
+    /* ---- Crypto parameters, reached through client and server above ---- */
+
+    struct s2n_crypto_parameters initial;
+    struct s2n_crypto_parameters secure;
+
+    /* ---- Cold: only used during the handshake or by the application ---- */
+
+    /* The user defined context associated with connection */
+    void *context;
+
+    /* Whether to use client_cert_auth_type stored in s2n_config or in this s2n_connection.
      *
-     * A hard-close goes straight to closed with no alert
-     * message being sent.
-     */
-    sig_atomic_t closing;
-    sig_atomic_t closed;
+     * By default the s2n_connection will defer to s2n_config->client_cert_auth_type on whether or not to use Client Auth.
+     * But users can override Client Auth at the connection level using s2n_connection_set_client_auth_type() without mutating
+     * s2n_config since s2n_config can be shared between multiple s2n_connections. */
+    uint8_t client_cert_auth_type_overridden;
+
+    /* Whether or not the s2n_connection should require the Client to authenticate itself to the server. Only used if
+     * client_cert_auth_type_overridden is non-zero. */
+    s2n_cert_auth_type client_cert_auth_type;
 
-    /* TLS extension data */
-    char server_name[256];
+    /* Sizes the released I/O buffers are given back at */
+    uint32_t released_in_size;
+    uint32_t released_out_size;
+    uint32_t released_buffer_in_size;
+    uint32_t released_handshake_io_size;
 
-    /* The application protocol decided upon during the client hello.
+    /* TLS extension data. Allocated when first set, and NUL terminated.
+     *
+     * The application protocol decided upon during the client hello.
      * If ALPN is being used, then:
      * In server mode, this will be set by the time client_hello_cb is invoked.
      * In client mode, this will be set after is_handshake_complete(connection) is true.
      */
-    char application_protocol[256];
+    struct s2n_blob server_name;
+    struct s2n_blob application_protocol;
+
     /* s2n does not support renegotiation.
      * RFC5746 Section 4.3 suggests servers implement a minimal version of the
      * renegotiation_info extension even if renegotiation is not supported.
@@ -238,4 +327,7 @@ int s2n_connection_recv_stuffer(struct s2n_stuffer *stuffer, struct s2n_connecti
 
 extern int s2n_connection_set_client_auth_type(struct s2n_connection *conn, s2n_cert_auth_type cert_auth_type);
 extern int s2n_connection_get_client_auth_type(struct s2n_connection *conn, s2n_cert_auth_type *client_cert_auth_type);
+extern int s2n_connection_free_handshake_state(struct s2n_connection *conn);
+extern int s2n_connection_store_server_name(struct s2n_connection *conn, const uint8_t *server_name, uint32_t len);
+extern int s2n_connection_store_application_protocol(struct s2n_connection *conn, const uint8_t *protocol, uint32_t len);
 extern int s2n_connection_get_client_cert_chain(struct s2n_connection *conn, uint8_t **der_cert_chain_out, uint32_t *cert_chain_len);
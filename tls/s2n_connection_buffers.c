@@ -0,0 +1,206 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include <s2n.h>
+
+#include "error/s2n_errno.h"
+
+#include "stuffer/s2n_stuffer.h"
+
+#include "tls/s2n_connection.h"
+#include "tls/s2n_connection_buffers.h"
+
+#include "utils/s2n_blob.h"
+#include "utils/s2n_mem.h"
+#include "utils/s2n_safety.h"
+
+/* Buffers released by idle connections, kept allocated and locked so that
+ * the next connection to wake up doesn't go back to the allocator.
+ */
+static struct s2n_blob buffer_pool[S2N_CONNECTION_BUFFER_POOL_SIZE];
+static uint32_t buffer_pool_count;
+static pthread_mutex_t buffer_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Pooled buffers are matched on the size they were released at first, and
+ * then on capacity, so that one which was shrunk in place (like the
+ * ClientHello) can still serve a full sized request. A big read-ahead
+ * buffer isn't handed out for a small one.
+ */
+static int s2n_buffer_pool_get(struct s2n_blob *b, uint32_t size)
+{
+    pthread_mutex_lock(&buffer_pool_lock);
+    int fit = -1;
+    for (int i = buffer_pool_count - 1; i >= 0; i--) {
+        struct s2n_blob *pooled = &buffer_pool[i];
+        if (pooled->mem_class != b->mem_class || pooled->allocated < size || pooled->allocated / 2 > size) {
+            continue;
+        }
+        if (pooled->size == size) {
+            fit = i;
+            break;
+        }
+        if (fit < 0) {
+            fit = i;
+        }
+    }
+
+    if (fit >= 0) {
+        *b = buffer_pool[fit];
+        buffer_pool[fit] = buffer_pool[--buffer_pool_count];
+        pthread_mutex_unlock(&buffer_pool_lock);
+
+        b->size = size;
+        return 0;
+    }
+    pthread_mutex_unlock(&buffer_pool_lock);
+
+    GUARD(s2n_alloc_class(b, size, b->mem_class));
+
+    return 0;
+}
+
+static int s2n_buffer_pool_put(struct s2n_blob *b)
+{
+    /* The stuffer was only wiped up to its write cursor */
+    struct s2n_blob whole = *b;
+    whole.size = b->allocated;
+    GUARD(s2n_blob_zero(&whole));
+
+    pthread_mutex_lock(&buffer_pool_lock);
+    if (buffer_pool_count < S2N_CONNECTION_BUFFER_POOL_SIZE) {
+        buffer_pool[buffer_pool_count++] = *b;
+        pthread_mutex_unlock(&buffer_pool_lock);
+
+        b->data = NULL;
+        b->size = 0;
+        b->allocated = 0;
+        b->mlocked = 0;
+        b->slab = 0;
+        return 0;
+    }
+    pthread_mutex_unlock(&buffer_pool_lock);
+
+    GUARD(s2n_free(b));
+
+    return 0;
+}
+
+int s2n_connection_buffers_cleanup(void)
+{
+    pthread_mutex_lock(&buffer_pool_lock);
+    while (buffer_pool_count) {
+        if (s2n_free(&buffer_pool[--buffer_pool_count]) < 0) {
+            pthread_mutex_unlock(&buffer_pool_lock);
+            return -1;
+        }
+    }
+    pthread_mutex_unlock(&buffer_pool_lock);
+
+    return 0;
+}
+
+int s2n_connection_buffer_release(struct s2n_stuffer *stuffer)
+{
+    GUARD(s2n_stuffer_wipe(stuffer));
+
+    if (stuffer->blob.data) {
+        GUARD(s2n_buffer_pool_put(&stuffer->blob));
+    }
+
+    return 0;
+}
+
+int s2n_connection_buffer_acquire(struct s2n_stuffer *stuffer, uint32_t size)
+{
+    /* Keep what the stuffer already holds if it's big enough */
+    if (stuffer->blob.data && stuffer->blob.allocated >= size) {
+        GUARD(s2n_stuffer_resize(stuffer, size));
+        return 0;
+    }
+
+    GUARD(s2n_stuffer_wipe(stuffer));
+    GUARD(s2n_free(&stuffer->blob));
+    GUARD(s2n_buffer_pool_get(&stuffer->blob, size));
+
+    return 0;
+}
+
+static int s2n_connection_release_stuffer(struct s2n_stuffer *stuffer, uint32_t *released_size)
+{
+    *released_size = stuffer->blob.size;
+    GUARD(s2n_connection_buffer_release(stuffer));
+
+    return 0;
+}
+
+static int s2n_connection_acquire_stuffer(struct s2n_stuffer *stuffer, uint32_t *released_size)
+{
+    if (*released_size) {
+        GUARD(s2n_connection_buffer_acquire(stuffer, *released_size));
+        *released_size = 0;
+    }
+
+    return 0;
+}
+
+int s2n_connection_release_buffers(struct s2n_connection *conn)
+{
+    notnull_check(conn);
+
+    if (conn->buffers_released) {
+        return 0;
+    }
+
+    /* Buffers can only be let go of between records */
+    S2N_ERROR_IF(s2n_stuffer_data_available(&conn->header_in) || conn->in.write_cursor || s2n_stuffer_data_available(&conn->buffer_in)
+                 || s2n_stuffer_data_available(&conn->out) || s2n_stuffer_data_available(&conn->handshake.io), S2N_ERR_CONNECTION_BUFFERS_IN_USE);
+
+    GUARD(s2n_stuffer_wipe(&conn->header_in));
+    GUARD(s2n_connection_release_stuffer(&conn->in, &conn->released_in_size));
+    GUARD(s2n_connection_release_stuffer(&conn->out, &conn->released_out_size));
+    GUARD(s2n_connection_release_stuffer(&conn->buffer_in, &conn->released_buffer_in_size));
+    GUARD(s2n_connection_release_stuffer(&conn->handshake.io, &conn->released_handshake_io_size));
+
+    /* The ClientHello is kept for s2n_connection_get_client_hello, and is
+     * already sized to fit once it's been received. Before then, it's an
+     * empty buffer that will be resized when the ClientHello arrives.
+     */
+    if (conn->client_hello.raw_message.write_cursor == 0) {
+        GUARD(s2n_connection_buffer_release(&conn->client_hello.raw_message));
+    }
+
+    conn->buffers_released = 1;
+
+    return 0;
+}
+
+int s2n_connection_acquire_buffers(struct s2n_connection *conn)
+{
+    if (!conn->buffers_released) {
+        return 0;
+    }
+
+    GUARD(s2n_connection_acquire_stuffer(&conn->in, &conn->released_in_size));
+    GUARD(s2n_connection_acquire_stuffer(&conn->out, &conn->released_out_size));
+    GUARD(s2n_connection_acquire_stuffer(&conn->buffer_in, &conn->released_buffer_in_size));
+    GUARD(s2n_connection_acquire_stuffer(&conn->handshake.io, &conn->released_handshake_io_size));
+
+    conn->buffers_released = 0;
+
+    return 0;
+}
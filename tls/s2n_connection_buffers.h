@@ -0,0 +1,28 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+
+#include "tls/s2n_connection.h"
+
+/* How many released I/O buffers are kept around for other connections */
+#define S2N_CONNECTION_BUFFER_POOL_SIZE 64
+
+/* Hand a growable stuffer's memory to the pool, or size it from the pool */
+extern int s2n_connection_buffer_release(struct s2n_stuffer *stuffer);
+extern int s2n_connection_buffer_acquire(struct s2n_stuffer *stuffer, uint32_t size);
+
+extern int s2n_connection_acquire_buffers(struct s2n_connection *conn);
+extern int s2n_connection_buffers_cleanup(void);
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <s2n.h>
+
+#include "error/s2n_errno.h"
+
+#include "tls/s2n_config.h"
+#include "tls/s2n_connection.h"
+#include "tls/s2n_connection_pool.h"
+
+#include "crypto/s2n_fips.h"
+
+#include "utils/s2n_safety.h"
+#include "utils/s2n_blob.h"
+#include "utils/s2n_mem.h"
+
+struct s2n_connection_pool *s2n_connection_pool_new(s2n_mode mode, uint32_t capacity)
+{
+    struct s2n_blob blob;
+    struct s2n_connection_pool *pool;
+
+    if (capacity == 0 || capacity > S2N_CONNECTION_POOL_MAX_CAPACITY) {
+        S2N_ERROR_PTR(S2N_ERR_INVALID_CONNECTION_POOL_SIZE);
+    }
+
+    GUARD_PTR(s2n_alloc(&blob, sizeof(struct s2n_connection_pool)));
+    GUARD_PTR(s2n_blob_zero(&blob));
+    pool = (struct s2n_connection_pool *)(void *)blob.data;
+    pool->mode = mode;
+
+    if (s2n_alloc(&blob, capacity * sizeof(struct s2n_connection *)) < 0) {
+        s2n_connection_pool_free(pool);
+        return NULL;
+    }
+    pool->connections = (struct s2n_connection **)(void *)blob.data;
+    pool->capacity = capacity;
+
+    /* Warm the pool up front, so that the first connections are hits too */
+    while (pool->count < pool->capacity) {
+        struct s2n_connection *conn = s2n_connection_new(mode);
+        if (conn == NULL) {
+            s2n_connection_pool_free(pool);
+            return NULL;
+        }
+        pool->connections[pool->count++] = conn;
+    }
+
+    return pool;
+}
+
+int s2n_connection_pool_free(struct s2n_connection_pool *pool)
+{
+    notnull_check(pool);
+
+    while (pool->count) {
+        GUARD(s2n_connection_free(pool->connections[--pool->count]));
+    }
+
+    struct s2n_blob blob = {.data = (uint8_t *) pool->connections,.size = pool->capacity * sizeof(struct s2n_connection *) };
+    if (pool->connections) {
+        GUARD(s2n_free(&blob));
+    }
+
+    blob.data = (uint8_t *) pool;
+    blob.size = sizeof(struct s2n_connection_pool);
+    GUARD(s2n_free(&blob));
+
+    return 0;
+}
+
+struct s2n_connection *s2n_connection_pool_get(struct s2n_connection_pool *pool)
+{
+    if (pool == NULL) {
+        S2N_ERROR_PTR(S2N_ERR_NULL);
+    }
+
+    if (pool->count) {
+        pool->hits++;
+        return pool->connections[--pool->count];
+    }
+
+    pool->misses++;
+    return s2n_connection_new(pool->mode);
+}
+
+int s2n_connection_pool_put(struct s2n_connection_pool *pool, struct s2n_connection *conn)
+{
+    notnull_check(pool);
+    notnull_check(conn);
+
+    S2N_ERROR_IF(conn->mode != pool->mode, S2N_ERR_CONNECTION_POOL_MODE);
+
+    /* The pool is full, so this one goes */
+    if (pool->count == pool->capacity) {
+        return s2n_connection_free(conn);
+    }
+
+    GUARD(s2n_connection_wipe(conn));
+
+    /* The application may free its config while the connection sits in the
+     * pool, so go back to the default, as s2n_connection_new would.
+     */
+    if (s2n_is_in_fips_mode()) {
+        GUARD(s2n_connection_set_config(conn, s2n_fetch_default_fips_config()));
+    } else {
+        GUARD(s2n_connection_set_config(conn, s2n_fetch_default_config()));
+    }
+
+    pool->connections[pool->count++] = conn;
+
+    return 0;
+}
+
+uint32_t s2n_connection_pool_get_available(struct s2n_connection_pool *pool)
+{
+    return pool->count;
+}
+
+uint64_t s2n_connection_pool_get_hits(struct s2n_connection_pool *pool)
+{
+    return pool->hits;
+}
+
+uint64_t s2n_connection_pool_get_misses(struct s2n_connection_pool *pool)
+{
+    return pool->misses;
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <s2n.h>
+
+#include "tls/s2n_connection.h"
+
+/* Enough for any one thread, and small enough that the array of them can't overflow */
+#define S2N_CONNECTION_POOL_MAX_CAPACITY    65536
+
+/* Wiped connections, ready to be handed out again. The pool isn't locked:
+ * each thread that accepts connections is expected to have its own.
+ */
+struct s2n_connection_pool {
+    s2n_mode mode;
+    uint32_t capacity;
+    uint32_t count;
+    struct s2n_connection **connections;
+
+    uint64_t hits;
+    uint64_t misses;
+};
@@ -54,7 +54,23 @@
 /* RFC 5246 7.4.1.2 */
 #define S2N_TLS_SESSION_ID_MAX_LEN     32
 
+struct s2n_record_protection;
+
 struct s2n_crypto_parameters {
+    /* Used for every record, so kept together at the front */
+    struct s2n_cipher_suite *cipher_suite;
+    /* Specialized record protection for the negotiated cipher, if any */
+    const struct s2n_record_protection *record_protection;
+    struct s2n_session_key client_key;
+    struct s2n_session_key server_key;
+    uint8_t client_sequence_number[S2N_TLS_SEQUENCE_NUM_LEN];
+    uint8_t server_sequence_number[S2N_TLS_SEQUENCE_NUM_LEN];
+    uint8_t client_implicit_iv[S2N_TLS_MAX_IV_LEN];
+    uint8_t server_implicit_iv[S2N_TLS_MAX_IV_LEN];
+    struct s2n_hmac_state client_record_mac;
+    struct s2n_hmac_state server_record_mac;
+    struct s2n_hmac_state record_mac_copy_workspace;
+
     struct s2n_pkey server_public_key;
     struct s2n_pkey client_public_key;
     struct s2n_dh_params server_dh_params;
@@ -67,21 +83,10 @@ struct s2n_crypto_parameters {
     s2n_hash_algorithm client_cert_hash_algorithm;
     s2n_signature_algorithm client_cert_sig_alg;
 
-    struct s2n_cipher_suite *cipher_suite;
-    struct s2n_session_key client_key;
-    struct s2n_session_key server_key;
-
     uint8_t rsa_premaster_secret[S2N_TLS_SECRET_LEN];
     uint8_t master_secret[S2N_TLS_SECRET_LEN];
     uint8_t client_random[S2N_TLS_RANDOM_DATA_LEN];
     uint8_t server_random[S2N_TLS_RANDOM_DATA_LEN];
-    uint8_t client_implicit_iv[S2N_TLS_MAX_IV_LEN];
-    uint8_t server_implicit_iv[S2N_TLS_MAX_IV_LEN];
 
     struct s2n_hash_state signature_hash;
-    struct s2n_hmac_state client_record_mac;
-    struct s2n_hmac_state server_record_mac;
-    struct s2n_hmac_state record_mac_copy_workspace;
-    uint8_t client_sequence_number[S2N_TLS_SEQUENCE_NUM_LEN];
-    uint8_t server_sequence_number[S2N_TLS_SEQUENCE_NUM_LEN];
 };
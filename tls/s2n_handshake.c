@@ -27,9 +27,7 @@
 
 int s2n_handshake_write_header(struct s2n_connection *conn, uint8_t message_type)
 {
-    S2N_ERROR_IF(s2n_stuffer_data_available(&conn->handshake.io), S2N_ERR_HANDSHAKE_STATE);
-
-    /* Write the message header */
+    /* Write the message header, after any messages of the flight already queued */
     GUARD(s2n_stuffer_write_uint8(&conn->handshake.io, message_type));
 
     /* Leave the length blank for now */
@@ -39,15 +37,17 @@ int s2n_handshake_write_header(struct s2n_connection *conn, uint8_t message_type
     return 0;
 }
 
-int s2n_handshake_finish_header(struct s2n_connection *conn)
+int s2n_handshake_finish_header(struct s2n_connection *conn, uint32_t message_start)
 {
-    uint16_t length = s2n_stuffer_data_available(&conn->handshake.io);
+    S2N_ERROR_IF(message_start > conn->handshake.io.write_cursor, S2N_ERR_SIZE_MISMATCH);
+
+    uint32_t length = conn->handshake.io.write_cursor - message_start;
     S2N_ERROR_IF(length < TLS_HANDSHAKE_HEADER_LENGTH, S2N_ERR_SIZE_MISMATCH);
 
-    uint16_t payload = length - TLS_HANDSHAKE_HEADER_LENGTH;
+    uint32_t payload = length - TLS_HANDSHAKE_HEADER_LENGTH;
 
     /* Write the message header */
-    GUARD(s2n_stuffer_rewrite(&conn->handshake.io));
+    conn->handshake.io.write_cursor = message_start;
     GUARD(s2n_stuffer_skip_write(&conn->handshake.io, 1));
     GUARD(s2n_stuffer_write_uint24(&conn->handshake.io, payload));
     GUARD(s2n_stuffer_skip_write(&conn->handshake.io, payload));
@@ -70,25 +70,25 @@ int s2n_handshake_get_hash_state(struct s2n_connection *conn, s2n_hash_algorithm
 {
     switch (hash_alg) {
     case S2N_HASH_MD5:
-        *hash_state = conn->handshake.md5;
+        *hash_state = conn->handshake.hashes->md5;
         break;
     case S2N_HASH_SHA1:
-        *hash_state = conn->handshake.sha1;
+        *hash_state = conn->handshake.hashes->sha1;
         break;
     case S2N_HASH_SHA224:
-        *hash_state = conn->handshake.sha224;
+        *hash_state = conn->handshake.hashes->sha224;
         break;
     case S2N_HASH_SHA256:
-        *hash_state = conn->handshake.sha256;
+        *hash_state = conn->handshake.hashes->sha256;
         break;
     case S2N_HASH_SHA384:
-        *hash_state = conn->handshake.sha384;
+        *hash_state = conn->handshake.hashes->sha384;
         break;
     case S2N_HASH_SHA512:
-        *hash_state = conn->handshake.sha512;
+        *hash_state = conn->handshake.hashes->sha512;
         break;
     case S2N_HASH_MD5_SHA1:
-        *hash_state = conn->handshake.md5_sha1;
+        *hash_state = conn->handshake.hashes->md5_sha1;
         break;
     default:
         S2N_ERROR(S2N_ERR_HASH_INVALID_ALGORITHM);
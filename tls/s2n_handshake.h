@@ -18,6 +18,7 @@
 #include <stdint.h>
 #include <s2n.h>
 
+#include "tls/s2n_async_pkey.h"
 #include "tls/s2n_crypto.h"
 
 #include "stuffer/s2n_stuffer.h"
@@ -44,9 +45,10 @@ typedef enum {
     APPLICATION_DATA
 } message_type_t;
 
-struct s2n_handshake {
-    struct s2n_stuffer io;
-
+/* Transcript hashes are only needed until the handshake completes, so they are
+ * allocated separately from the connection and released once it does.
+ */
+struct s2n_handshake_hashes {
     struct s2n_hash_state md5;
     struct s2n_hash_state sha1;
     struct s2n_hash_state sha224;
@@ -60,6 +62,29 @@ struct s2n_handshake {
     struct s2n_hash_state prf_sha1_hash_copy;
     /*Used for TLS 1.2 PRF */
     struct s2n_hash_state prf_tls12_hash_copy;
+};
+
+struct s2n_handshake {
+    struct s2n_stuffer io;
+
+    /* The messages of a flight are queued in io, and only cut into records
+     * once the record type changes or the peer is to speak next. Set while
+     * that is under way, so that a call after EWOULDBLOCK carries on with
+     * the records instead of writing the current message again.
+     */
+    uint8_t cutting_records;
+
+    /* Where the message being written starts in io */
+    uint32_t message_start;
+
+    /* A private key operation handed to the application, which the handshake
+     * waits on before going any further
+     */
+    struct s2n_async_pkey_op *async_op;
+    s2n_async_state async_state;
+
+    struct s2n_handshake_hashes *hashes;
+    struct s2n_blob hashes_mem;
 
     /* Hash algorithms required for this handshake. The set of required hashes can be reduced as session parameters are
      * negotiated, i.e. cipher suite and protocol version.
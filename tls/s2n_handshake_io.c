@@ -24,6 +24,7 @@
 
 #include "tls/s2n_cipher_suites.h"
 #include "tls/s2n_connection.h"
+#include "tls/s2n_connection_buffers.h"
 #include "tls/s2n_record.h"
 #include "tls/s2n_resume.h"
 #include "tls/s2n_alerts.h"
@@ -238,9 +239,11 @@ static message_type_t handshakes[128][16] = {
 
 #define ACTIVE_MESSAGE( conn ) handshakes[ (conn)->handshake.handshake_type ][ (conn)->handshake.message_number ]
 #define PREVIOUS_MESSAGE( conn ) handshakes[ (conn)->handshake.handshake_type ][ (conn)->handshake.message_number - 1 ]
+#define NEXT_MESSAGE( conn ) handshakes[ (conn)->handshake.handshake_type ][ (conn)->handshake.message_number + 1 ]
 
 #define ACTIVE_STATE( conn ) state_machine[ ACTIVE_MESSAGE( (conn) ) ]
 #define PREVIOUS_STATE( conn ) state_machine[ PREVIOUS_MESSAGE( (conn) ) ]
+#define NEXT_STATE( conn ) state_machine[ NEXT_MESSAGE( (conn) ) ]
 
 /* Used in our test cases */
 message_type_t s2n_conn_get_current_message_type(struct s2n_connection *conn)
@@ -354,11 +357,11 @@ static int s2n_conn_update_handshake_hashes(struct s2n_connection *conn, struct
          * PRF, which is required to comply with the TLS 1.0 and 1.1 RFCs and is approved
          * as per NIST Special Publication 800-52 Revision 1.
          */
-        GUARD(s2n_hash_update(&conn->handshake.md5, data->data, data->size));
+        GUARD(s2n_hash_update(&conn->handshake.hashes->md5, data->data, data->size));
     }
 
     if (s2n_handshake_is_hash_required(&conn->handshake, S2N_HASH_SHA1)) {
-        GUARD(s2n_hash_update(&conn->handshake.sha1, data->data, data->size));
+        GUARD(s2n_hash_update(&conn->handshake.hashes->sha1, data->data, data->size));
     }
 
     const uint8_t md5_sha1_required = (s2n_handshake_is_hash_required(&conn->handshake, S2N_HASH_MD5) &&
@@ -366,52 +369,36 @@ static int s2n_conn_update_handshake_hashes(struct s2n_connection *conn, struct
 
     if (md5_sha1_required && s2n_hash_is_available(S2N_HASH_MD5_SHA1)) {
         /* The MD5_SHA1 hash cannot be initialized when FIPS mode is set. */
-        GUARD(s2n_hash_update(&conn->handshake.md5_sha1, data->data, data->size));
+        GUARD(s2n_hash_update(&conn->handshake.hashes->md5_sha1, data->data, data->size));
     }
 
     if (s2n_handshake_is_hash_required(&conn->handshake, S2N_HASH_SHA224)) {
-        GUARD(s2n_hash_update(&conn->handshake.sha224, data->data, data->size));
+        GUARD(s2n_hash_update(&conn->handshake.hashes->sha224, data->data, data->size));
     }
 
     if (s2n_handshake_is_hash_required(&conn->handshake, S2N_HASH_SHA256)) {
-        GUARD(s2n_hash_update(&conn->handshake.sha256, data->data, data->size));
+        GUARD(s2n_hash_update(&conn->handshake.hashes->sha256, data->data, data->size));
     }
 
     if (s2n_handshake_is_hash_required(&conn->handshake, S2N_HASH_SHA384)) {
-        GUARD(s2n_hash_update(&conn->handshake.sha384, data->data, data->size));
+        GUARD(s2n_hash_update(&conn->handshake.hashes->sha384, data->data, data->size));
     }
 
     if (s2n_handshake_is_hash_required(&conn->handshake, S2N_HASH_SHA512)) {
-        GUARD(s2n_hash_update(&conn->handshake.sha512, data->data, data->size));
+        GUARD(s2n_hash_update(&conn->handshake.hashes->sha512, data->data, data->size));
     }
 
     return 0;
 }
 
-/* Writing is relatively straight forward, simply write each message out as a record,
- * we may fragment a message across multiple records, but we never coalesce multiple
- * messages into single records. 
- * Precondition: secure outbound I/O has already been flushed
+/* Cut the messages queued in handshake.io into records in conn->out. Records
+ * are only sent once there's no room left for the next one; otherwise they
+ * wait for the rest of the flight, and go out together before we next read.
  */
-static int handshake_write_io(struct s2n_connection *conn)
+static int s2n_handshake_write_records(struct s2n_connection *conn, uint8_t record_type)
 {
-    uint8_t record_type = ACTIVE_STATE(conn).record_type;
     s2n_blocked_status blocked = S2N_NOT_BLOCKED;
 
-    /* Populate handshake.io with header/payload for the current state, once.
-     * Check wiped instead of s2n_stuffer_data_available to differentiate between the initial call
-     * to handshake_write_io and a repeated call after an EWOULDBLOCK.
-     */
-    if (conn->handshake.io.wiped == 1) {
-        if (record_type == TLS_HANDSHAKE) {
-            GUARD(s2n_handshake_write_header(conn, ACTIVE_STATE(conn).message_type));
-        }
-        GUARD(ACTIVE_STATE(conn).handler[conn->mode] (conn));
-        if (record_type == TLS_HANDSHAKE) {
-            GUARD(s2n_handshake_finish_header(conn));
-        }
-    }
-
     /* Write the handshake data to records in fragment sized chunks */
     struct s2n_blob out;
     while (s2n_stuffer_data_available(&conn->handshake.io) > 0) {
@@ -419,24 +406,75 @@ static int handshake_write_io(struct s2n_connection *conn)
         GUARD((max_payload_size = s2n_record_max_write_payload_size(conn)));
         out.size = MIN(s2n_stuffer_data_available(&conn->handshake.io), max_payload_size);
 
+        /* A record is never bigger than the largest one, less the payload it doesn't carry */
+        int max_record_size;
+        GUARD((max_record_size = s2n_record_max_write_size(conn)));
+        if (s2n_stuffer_space_remaining(&conn->out) < max_record_size - (max_payload_size - out.size)) {
+            /* We could block here. Assume the caller will come back to finish the records. */
+            GUARD(s2n_flush(conn, &blocked));
+        }
+
         out.data = s2n_stuffer_raw_read(&conn->handshake.io, out.size);
         notnull_check(out.data);
 
         /* Make the actual record */
         GUARD(s2n_record_write(conn, record_type, &out));
+    }
 
-        /* MD5 and SHA sum the handshake data too */
+    return 0;
+}
+
+/* Writing is relatively straight forward: each message is appended to
+ * handshake.io, behind the messages of the same flight that came before it.
+ * Consecutive messages of the same record type are coalesced into records,
+ * which we may fragment, and the whole flight is sent with as few writes as
+ * conn->out allows.
+ */
+static int handshake_write_io(struct s2n_connection *conn)
+{
+    uint8_t record_type = ACTIVE_STATE(conn).record_type;
+
+    /* Populate handshake.io with header/payload for the current state, once */
+    if (!conn->handshake.cutting_records) {
+        /* A handler that waited on the application already has its header written */
+        if (conn->handshake.async_state != S2N_ASYNC_COMPLETE) {
+            conn->handshake.message_start = conn->handshake.io.write_cursor;
+
+            if (record_type == TLS_HANDSHAKE) {
+                GUARD(s2n_handshake_write_header(conn, ACTIVE_STATE(conn).message_type));
+            }
+        }
+        uint32_t message_start = conn->handshake.message_start;
+
+        GUARD(ACTIVE_STATE(conn).handler[conn->mode] (conn));
         if (record_type == TLS_HANDSHAKE) {
-            GUARD(s2n_conn_update_handshake_hashes(conn, &out));
+            GUARD(s2n_handshake_finish_header(conn, message_start));
+
+            /* MD5 and SHA sum the handshake data too. This happens as each
+             * message is written, as later messages of the flight (e.g.
+             * CertificateVerify and Finished) sign or MAC the hashes so far.
+             */
+            struct s2n_blob message;
+            message.data = conn->handshake.io.blob.data + message_start;
+            message.size = conn->handshake.io.write_cursor - message_start;
+            notnull_check(message.data);
+            GUARD(s2n_conn_update_handshake_hashes(conn, &message));
+        }
+
+        /* Keep queueing while the next message is ours, and goes in the same kind of record */
+        if (NEXT_STATE(conn).writer == ACTIVE_STATE(conn).writer && NEXT_STATE(conn).record_type == record_type) {
+            GUARD(s2n_advance_message(conn));
+            return 0;
         }
 
-        /* Actually send the record. We could block here. Assume the caller will call flush before coming back. */
-        GUARD(s2n_flush(conn, &blocked));
+        conn->handshake.cutting_records = 1;
     }
 
-    /* We're done sending the last record, reset everything */
-    GUARD(s2n_stuffer_wipe(&conn->out));
+    GUARD(s2n_handshake_write_records(conn, record_type));
+
+    /* We're done with the queued messages, reset everything */
     GUARD(s2n_stuffer_wipe(&conn->handshake.io));
+    conn->handshake.cutting_records = 0;
 
     /* Advance the state machine */
     GUARD(s2n_advance_message(conn));
@@ -535,6 +573,68 @@ static int s2n_handshake_handle_sslv2(struct s2n_connection *conn)
     return 0;
 }
 
+/* Call the handler for the handshake message in handshake.io. A handler
+ * that is waiting on the application leaves the message where it is, to be
+ * called again once the application is done.
+ */
+static int s2n_handshake_handle_message(struct s2n_connection *conn)
+{
+    int r = ACTIVE_STATE(conn).handler[conn->mode] (conn);
+    if (r < 0 && s2n_errno == S2N_ERR_ASYNC_BLOCKED) {
+        return -1;
+    }
+
+    /* Don't update handshake hashes until after the handler has executed since some handlers need to read the
+     * hash values before they are updated. */
+    GUARD(s2n_handshake_conn_update_hashes(conn));
+
+    GUARD(s2n_stuffer_wipe(&conn->handshake.io));
+
+    if (r < 0) {
+        GUARD(s2n_connection_kill(conn));
+
+        return r;
+    }
+
+    /* Advance the state machine */
+    GUARD(s2n_advance_message(conn));
+
+    return 0;
+}
+
+/* Handle each of the handshake messages left in the record */
+static int s2n_handshake_read_messages(struct s2n_connection *conn)
+{
+    while (s2n_stuffer_data_available(&conn->in)) {
+        int r;
+        uint8_t handshake_message_type;
+        GUARD((r = read_full_handshake_message(conn, &handshake_message_type)));
+
+        /* Do we need more data? */
+        if (r == 1) {
+            /* Break out of this inner loop, but since we're not changing the state, the
+             * outer loop in s2n_handshake_io() will read another record. 
+             */
+            GUARD(s2n_stuffer_wipe(&conn->header_in));
+            GUARD(s2n_stuffer_wipe(&conn->in));
+            conn->in_status = ENCRYPTED;
+            return 0;
+        }
+
+        S2N_ERROR_IF(handshake_message_type != ACTIVE_STATE(conn).message_type, S2N_ERR_BAD_MESSAGE);
+
+        /* Call the relevant handler */
+        GUARD(s2n_handshake_handle_message(conn));
+    }
+
+    /* We're done with the record, wipe it */
+    GUARD(s2n_stuffer_wipe(&conn->header_in));
+    GUARD(s2n_stuffer_wipe(&conn->in));
+    conn->in_status = ENCRYPTED;
+
+    return 0;
+}
+
 /* Reading is a little more complicated than writing as the TLS RFCs allow content
  * types to be interleaved at the record layer. We may get an alert message
  * during the handshake phase, or messages of types that we don't support (e.g.
@@ -547,6 +647,12 @@ static int handshake_read_io(struct s2n_connection *conn)
     uint8_t record_type;
     int isSSLv2;
 
+    /* Pick up where we left off in the record once the application is done */
+    if (conn->handshake.async_state == S2N_ASYNC_COMPLETE) {
+        GUARD(s2n_handshake_handle_message(conn));
+        return s2n_handshake_read_messages(conn);
+    }
+
     GUARD(s2n_read_full_record(conn, &record_type, &isSSLv2));
 
     if (isSSLv2) {
@@ -588,49 +694,32 @@ static int handshake_read_io(struct s2n_connection *conn)
     }
 
     /* Record is a handshake message */
-    while (s2n_stuffer_data_available(&conn->in)) {
-        int r;
-        uint8_t handshake_message_type;
-        GUARD((r = read_full_handshake_message(conn, &handshake_message_type)));
-
-        /* Do we need more data? */
-        if (r == 1) {
-            /* Break out of this inner loop, but since we're not changing the state, the
-             * outer loop in s2n_handshake_io() will read another record. 
-             */
-            GUARD(s2n_stuffer_wipe(&conn->header_in));
-            GUARD(s2n_stuffer_wipe(&conn->in));
-            conn->in_status = ENCRYPTED;
-            return 0;
-        }
-
-        S2N_ERROR_IF(handshake_message_type != ACTIVE_STATE(conn).message_type, S2N_ERR_BAD_MESSAGE);
-
-        /* Call the relevant handler */
-        r = ACTIVE_STATE(conn).handler[conn->mode] (conn);
-
-        /* Don't update handshake hashes until after the handler has executed since some handlers need to read the
-         * hash values before they are updated. */
-        GUARD(s2n_handshake_conn_update_hashes(conn));
+    return s2n_handshake_read_messages(conn);
+}
 
-        GUARD(s2n_stuffer_wipe(&conn->handshake.io));
+static int s2n_handshake_write_failed(struct s2n_connection *conn, s2n_blocked_status *blocked)
+{
+    /* Come back once the socket can take more */
+    if (s2n_errno == S2N_ERR_BLOCKED) {
+        return -1;
+    }
 
-        if (r < 0) {
-            GUARD(s2n_connection_kill(conn));
+    /* Come back once the application is done with the private key */
+    if (s2n_errno == S2N_ERR_ASYNC_BLOCKED) {
+        *blocked = S2N_BLOCKED_ON_APPLICATION;
+        return -1;
+    }
 
-            return r;
-        }
+    /* Non-retryable write error. The peer might have sent an alert. Try and read it. */
+    const int write_s2n_errno = s2n_errno;
 
-        /* Advance the state machine */
-        GUARD(s2n_advance_message(conn));
+    if (handshake_read_io(conn) < 0 && s2n_errno == S2N_ERR_ALERT) {
+        /* handshake_read_io has set s2n_errno */
+        return -1;
     }
 
-    /* We're done with the record, wipe it */
-    GUARD(s2n_stuffer_wipe(&conn->header_in));
-    GUARD(s2n_stuffer_wipe(&conn->in));
-    conn->in_status = ENCRYPTED;
-
-    return 0;
+    /* Let the write error take precedence if we didn't read an alert. */
+    S2N_ERROR(write_s2n_errno);
 }
 
 int s2n_negotiate(struct s2n_connection *conn, s2n_blocked_status * blocked)
@@ -640,27 +729,37 @@ int s2n_negotiate(struct s2n_connection *conn, s2n_blocked_status * blocked)
         this = 'C';
     }
 
+    GUARD(s2n_connection_acquire_buffers(conn));
+
+    /* A private key operation has been handed to the application or the key
+     * server, and the handshake can't go on until it has been applied.
+     */
+    if (conn->handshake.async_state == S2N_ASYNC_INVOKED) {
+        *blocked = S2N_BLOCKED_ON_APPLICATION;
+        GUARD(s2n_async_pkey_poll(conn));
+        S2N_ERROR_IF(conn->handshake.async_state == S2N_ASYNC_INVOKED, S2N_ERR_ASYNC_BLOCKED);
+    }
+    S2N_ERROR_IF(conn->handshake.async_state == S2N_ASYNC_FAILED, S2N_ERR_ASYNC_FAILED);
+
     while (ACTIVE_STATE(conn).writer != 'B') {
-        /* Flush any pending I/O or alert messages */
-        GUARD(s2n_flush(conn, blocked));
+        /* Flush our flight, and any pending alert messages, before we read */
+        if (ACTIVE_STATE(conn).writer != this && s2n_flush(conn, blocked) < 0) {
+            return s2n_handshake_write_failed(conn, blocked);
+        }
 
         if (ACTIVE_STATE(conn).writer == this) {
             *blocked = S2N_BLOCKED_ON_WRITE;
-            if (handshake_write_io(conn) < 0 && s2n_errno != S2N_ERR_BLOCKED) {
-                /* Non-retryable write error. The peer might have sent an alert. Try and read it. */
-                const int write_s2n_errno = s2n_errno;
-
-                if (handshake_read_io(conn) < 0 && s2n_errno == S2N_ERR_ALERT) {
-                    /* handshake_read_io has set s2n_errno */
-                    return -1;
-                } else {
-                    /* Let the write error take precedence if we didn't read an alert. */
-                    S2N_ERROR(write_s2n_errno);
-                }
+            if (handshake_write_io(conn) < 0) {
+                return s2n_handshake_write_failed(conn, blocked);
             }
         } else {
             *blocked = S2N_BLOCKED_ON_READ;
             if (handshake_read_io(conn) < 0) {
+                if (s2n_errno == S2N_ERR_ASYNC_BLOCKED) {
+                    *blocked = S2N_BLOCKED_ON_APPLICATION;
+                    return -1;
+                }
+
                 if (s2n_errno != S2N_ERR_BLOCKED && s2n_allowed_to_cache_connection(conn) && conn->session_id_len) {
                     conn->config->cache_delete(conn->config->cache_delete_data, conn->session_id, conn->session_id_len);
                 }
@@ -668,11 +767,21 @@ int s2n_negotiate(struct s2n_connection *conn, s2n_blocked_status * blocked)
                 return -1;
             }
         }
+    }
+
+    /* If the handshake has just ended, send our last flight and free up memory */
+    if (conn->handshake.hashes) {
+        GUARD(s2n_flush(conn, blocked));
 
-        /* If the handshake has just ended, free up memory */
-        if (ACTIVE_STATE(conn).writer == 'B') {
-            GUARD(s2n_stuffer_resize(&conn->handshake.io, 0));
+        GUARD(s2n_connection_buffer_release(&conn->handshake.io));
+        GUARD(s2n_connection_free_handshake_state(conn));
+        /* Servers keep the ClientHello for s2n_connection_get_client_hello(); clients never use the buffer */
+        if (conn->mode == S2N_SERVER) {
+            GUARD(s2n_client_hello_shrink(&conn->client_hello));
+        } else {
+            GUARD(s2n_connection_buffer_release(&conn->client_hello.raw_message));
         }
+        s2n_x509_validator_wipe(&conn->x509_validator);
     }
 
     *blocked = S2N_NOT_BLOCKED;
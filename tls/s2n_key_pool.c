@@ -0,0 +1,338 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <sys/param.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "error/s2n_errno.h"
+
+#include "crypto/s2n_dhe.h"
+#include "crypto/s2n_ecc.h"
+
+#include "tls/s2n_key_pool.h"
+
+#include "utils/s2n_mem.h"
+#include "utils/s2n_random.h"
+#include "utils/s2n_safety.h"
+
+/* A DH key is generated in the copy of the parameters it's given */
+static void *s2n_key_pool_generate(int kind, struct s2n_dh_params *dh_params)
+{
+    if (kind == S2N_KEY_POOL_DH) {
+        if (s2n_dh_generate_ephemeral_key(dh_params) < 0) {
+            s2n_dh_params_free(dh_params);
+            return NULL;
+        }
+
+        return dh_params->dh;
+    }
+
+    struct s2n_ecc_params ecc_params = { .negotiated_curve = &s2n_ecc_supported_curves[kind], .ec_key = NULL };
+
+    if (s2n_ecc_generate_ephemeral_key(&ecc_params) < 0) {
+        return NULL;
+    }
+
+    return ecc_params.ec_key;
+}
+
+static int s2n_key_pool_free_key(int kind, void *key)
+{
+    if (kind == S2N_KEY_POOL_DH) {
+        struct s2n_dh_params dh_params = { .dh = key };
+        GUARD(s2n_dh_params_free(&dh_params));
+        return 0;
+    }
+
+    struct s2n_ecc_params ecc_params = { .negotiated_curve = &s2n_ecc_supported_curves[kind], .ec_key = key };
+
+    GUARD(s2n_ecc_params_free(&ecc_params));
+
+    return 0;
+}
+
+/* The kind of key furthest from full, or -1 if they're all full */
+static int s2n_key_pool_neediest(struct s2n_key_pool *pool)
+{
+    int neediest = -1;
+    uint32_t least = pool->size;
+
+    for (int i = 0; i < S2N_KEY_POOL_KINDS; i++) {
+        if (i == S2N_KEY_POOL_DH && pool->dhparams.dh == NULL) {
+            continue;
+        }
+
+        uint32_t have = pool->count[i] + pool->generating[i];
+        if (have < least) {
+            least = have;
+            neediest = i;
+        }
+    }
+
+    return neediest;
+}
+
+/* Wait before trying to make a key again after failing to, doubling the wait
+ * each time up to a limit. Called with the lock held, and returns early if
+ * the pool is shutting down.
+ */
+static void s2n_key_pool_backoff(struct s2n_key_pool *pool, long *backoff_ms)
+{
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += *backoff_ms / 1000;
+    until.tv_nsec += (*backoff_ms % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+
+    int r = 0;
+    while (!pool->shutdown && r == 0) {
+        r = pthread_cond_timedwait(&pool->wanted, &pool->lock, &until);
+    }
+
+    *backoff_ms = MIN(*backoff_ms * 2, S2N_KEY_POOL_MAX_BACKOFF_MS);
+}
+
+static void *s2n_key_pool_worker(void *arg)
+{
+    struct s2n_key_pool *pool = arg;
+    long backoff_ms = S2N_KEY_POOL_MIN_BACKOFF_MS;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->shutdown) {
+        int kind = s2n_key_pool_neediest(pool);
+        if (kind < 0) {
+            pthread_cond_wait(&pool->wanted, &pool->lock);
+            continue;
+        }
+
+        /* Generate without the lock, so that handshakes can take keys
+         * meanwhile. The DH parameters may be replaced then, so they're
+         * copied first.
+         */
+        pool->generating[kind]++;
+        uint32_t dh_generation = pool->dh_generation;
+        struct s2n_dh_params dh_params = { .dh = NULL };
+        int ready = kind != S2N_KEY_POOL_DH || s2n_dh_params_copy(&pool->dhparams, &dh_params) == 0;
+        pthread_mutex_unlock(&pool->lock);
+        void *key = ready ? s2n_key_pool_generate(kind, &dh_params) : NULL;
+        pthread_mutex_lock(&pool->lock);
+        pool->generating[kind]--;
+
+        /* Whatever stopped the key being made may well pass, so try again later */
+        if (key == NULL) {
+            s2n_key_pool_backoff(pool, &backoff_ms);
+            continue;
+        }
+        backoff_ms = S2N_KEY_POOL_MIN_BACKOFF_MS;
+
+        if (pool->shutdown || (kind == S2N_KEY_POOL_DH && dh_generation != pool->dh_generation)) {
+            s2n_key_pool_free_key(kind, key);
+            continue;
+        }
+
+        pool->keys[kind][pool->count[kind]++] = key;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    /* The thread's random state goes with it */
+    s2n_rand_cleanup_thread();
+
+    return NULL;
+}
+
+static int s2n_key_pool_stop(struct s2n_key_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->wanted);
+    pthread_mutex_unlock(&pool->lock);
+
+    while (pool->num_threads) {
+        pthread_join(pool->threads[--pool->num_threads], NULL);
+    }
+
+    return 0;
+}
+
+int s2n_key_pool_new(struct s2n_key_pool **pool, uint32_t size, uint32_t threads)
+{
+    S2N_ERROR_IF(size == 0 || size > S2N_KEY_POOL_MAX_SIZE, S2N_ERR_KEY_POOL_SIZE);
+    S2N_ERROR_IF(threads == 0 || threads > S2N_KEY_POOL_MAX_THREADS, S2N_ERR_KEY_POOL_SIZE);
+
+    /* The key slots follow the pool in the same allocation */
+    struct s2n_blob mem = {0};
+    GUARD(s2n_alloc(&mem, sizeof(struct s2n_key_pool) + S2N_KEY_POOL_KINDS * size * sizeof(void *)));
+    GUARD(s2n_blob_zero(&mem));
+
+    struct s2n_key_pool *p = (struct s2n_key_pool *)(void *)mem.data;
+    for (int i = 0; i < S2N_KEY_POOL_KINDS; i++) {
+        p->keys[i] = (void **)(void *)(p + 1) + i * size;
+    }
+    p->size = size;
+    p->pid = getpid();
+    p->mem = mem;
+
+    if (pthread_mutex_init(&p->lock, NULL) != 0) {
+        GUARD(s2n_free(&mem));
+        S2N_ERROR(S2N_ERR_KEY_POOL_THREAD);
+    }
+    if (pthread_cond_init(&p->wanted, NULL) != 0) {
+        pthread_mutex_destroy(&p->lock);
+        GUARD(s2n_free(&mem));
+        S2N_ERROR(S2N_ERR_KEY_POOL_THREAD);
+    }
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&p->threads[i], NULL, s2n_key_pool_worker, p) != 0) {
+            GUARD(s2n_key_pool_free(p));
+            S2N_ERROR(S2N_ERR_KEY_POOL_THREAD);
+        }
+        p->num_threads++;
+    }
+
+    *pool = p;
+
+    return 0;
+}
+
+int s2n_key_pool_free(struct s2n_key_pool *pool)
+{
+    if (pool == NULL) {
+        return 0;
+    }
+
+    /* A forked child has none of the threads, and the lock may have been
+     * held by one of them when the process forked, so only the memory is
+     * released.
+     */
+    if (pool->pid != getpid()) {
+        for (int i = 0; i < S2N_KEY_POOL_KINDS; i++) {
+            while (pool->count[i]) {
+                GUARD(s2n_key_pool_free_key(i, pool->keys[i][--pool->count[i]]));
+            }
+        }
+        GUARD(s2n_dh_params_free(&pool->dhparams));
+
+        struct s2n_blob mem = pool->mem;
+        GUARD(s2n_free(&mem));
+
+        return 0;
+    }
+
+    GUARD(s2n_key_pool_stop(pool));
+
+    for (int i = 0; i < S2N_KEY_POOL_KINDS; i++) {
+        while (pool->count[i]) {
+            GUARD(s2n_key_pool_free_key(i, pool->keys[i][--pool->count[i]]));
+        }
+    }
+
+    GUARD(s2n_dh_params_free(&pool->dhparams));
+    pthread_cond_destroy(&pool->wanted);
+    pthread_mutex_destroy(&pool->lock);
+
+    /* Copied out, since s2n_free writes to the blob after releasing it */
+    struct s2n_blob mem = pool->mem;
+    GUARD(s2n_free(&mem));
+
+    return 0;
+}
+
+/* Start generating DH keys over a copy of dhparams, or stop if it's NULL,
+ * dropping any over the old parameters.
+ */
+int s2n_key_pool_set_dhparams(struct s2n_key_pool *pool, struct s2n_dh_params *dhparams)
+{
+    notnull_check(pool);
+
+    struct s2n_dh_params copy = { .dh = NULL };
+    if (dhparams) {
+        GUARD(s2n_dh_params_copy(dhparams, &copy));
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    struct s2n_dh_params old = pool->dhparams;
+    pool->dhparams = copy;
+    pool->dh_generation++;
+    while (pool->count[S2N_KEY_POOL_DH]) {
+        s2n_key_pool_free_key(S2N_KEY_POOL_DH, pool->keys[S2N_KEY_POOL_DH][--pool->count[S2N_KEY_POOL_DH]]);
+    }
+    pthread_cond_broadcast(&pool->wanted);
+    pthread_mutex_unlock(&pool->lock);
+
+    GUARD(s2n_dh_params_free(&old));
+
+    return 0;
+}
+
+static int s2n_key_pool_take(struct s2n_key_pool *pool, int kind, void **key)
+{
+    *key = NULL;
+
+    /* A forked child would otherwise hand out the same keys as its parent */
+    if (pool->pid != getpid()) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->count[kind]) {
+        *key = pool->keys[kind][--pool->count[kind]];
+        pool->keys[kind][pool->count[kind]] = NULL;
+        pthread_cond_signal(&pool->wanted);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+/* Give the connection a key for its negotiated curve if there's one ready.
+ * Otherwise ec_key is left NULL, for the caller to generate one inline.
+ */
+int s2n_key_pool_take_ecc_key(struct s2n_key_pool *pool, struct s2n_ecc_params *ecc_params)
+{
+    notnull_check(pool);
+    notnull_check(ecc_params->negotiated_curve);
+
+    for (int i = 0; i < S2N_KEY_POOL_DH; i++) {
+        if (ecc_params->negotiated_curve == &s2n_ecc_supported_curves[i]) {
+            void *key;
+            GUARD(s2n_key_pool_take(pool, i, &key));
+            ecc_params->ec_key = key;
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+/* Give the connection a DH key over the config's parameters if there's one
+ * ready. Otherwise dh is left NULL, for the caller to generate one inline.
+ */
+int s2n_key_pool_take_dh_key(struct s2n_key_pool *pool, struct s2n_dh_params *dh_params)
+{
+    notnull_check(pool);
+
+    void *key;
+    GUARD(s2n_key_pool_take(pool, S2N_KEY_POOL_DH, &key));
+    dh_params->dh = key;
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "crypto/s2n_dhe.h"
+#include "crypto/s2n_ecc.h"
+
+#include "utils/s2n_blob.h"
+
+#define S2N_KEY_POOL_MAX_SIZE       1024
+#define S2N_KEY_POOL_MAX_THREADS    16
+
+/* How long a thread waits to try again after failing to make a key */
+#define S2N_KEY_POOL_MIN_BACKOFF_MS 10
+#define S2N_KEY_POOL_MAX_BACKOFF_MS 1000
+
+/* One kind of key for each supported curve, then DH keys over the config's parameters */
+#define S2N_KEY_POOL_DH             (sizeof(s2n_ecc_supported_curves) / sizeof(s2n_ecc_supported_curves[0]))
+#define S2N_KEY_POOL_KINDS          (S2N_KEY_POOL_DH + 1)
+
+/* Ephemeral keys generated by background threads ahead of the handshakes
+ * that need them. Each key is handed out once, and is owned by the
+ * connection that takes it from then on.
+ */
+struct s2n_key_pool {
+    pthread_mutex_t lock;
+
+    /* Signalled when a key is taken, or the pool is shutting down */
+    pthread_cond_t wanted;
+
+    /* size keys of each kind at most, count ready and generating on their way */
+    void **keys[S2N_KEY_POOL_KINDS];
+    uint32_t count[S2N_KEY_POOL_KINDS];
+    uint32_t generating[S2N_KEY_POOL_KINDS];
+    uint32_t size;
+
+    /* The pool's own copy of the config's DH parameters, if it has any. The
+     * generation changes with them, so that keys over old ones are dropped.
+     */
+    struct s2n_dh_params dhparams;
+    uint32_t dh_generation;
+
+    pthread_t threads[S2N_KEY_POOL_MAX_THREADS];
+    uint32_t num_threads;
+
+    /* Keys are only handed out in the process that generated them */
+    pid_t pid;
+
+    unsigned shutdown:1;
+
+    /* The allocation this pool and its key slots live in */
+    struct s2n_blob mem;
+};
+
+extern int s2n_key_pool_new(struct s2n_key_pool **pool, uint32_t size, uint32_t threads);
+extern int s2n_key_pool_free(struct s2n_key_pool *pool);
+extern int s2n_key_pool_set_dhparams(struct s2n_key_pool *pool, struct s2n_dh_params *dhparams);
+extern int s2n_key_pool_take_ecc_key(struct s2n_key_pool *pool, struct s2n_ecc_params *ecc_params);
+extern int s2n_key_pool_take_dh_key(struct s2n_key_pool *pool, struct s2n_dh_params *dh_params);
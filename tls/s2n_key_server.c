@@ -0,0 +1,354 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <s2n.h>
+
+#include "error/s2n_errno.h"
+
+#include "crypto/s2n_hash.h"
+
+#include "stuffer/s2n_stuffer.h"
+
+#include "tls/s2n_async_pkey.h"
+#include "tls/s2n_key_server.h"
+#include "tls/s2n_tls_digest_preferences.h"
+#include "tls/s2n_tls_parameters.h"
+
+#include "utils/s2n_mem.h"
+#include "utils/s2n_safety.h"
+
+/* How much we ask the socket for at a time */
+#define S2N_KEY_SERVER_READ_SIZE    4096
+
+static int s2n_key_server_connect(struct s2n_key_server *key_server)
+{
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, key_server->path, strlen(key_server->path) + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    S2N_ERROR_IF(fd < 0, S2N_ERR_KEY_SERVER);
+
+    /* Requests and responses are never waited on, the handshake blocks on the application instead */
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+        || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0
+        || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+        close(fd);
+        S2N_ERROR(S2N_ERR_KEY_SERVER);
+    }
+
+    key_server->fd = fd;
+    key_server->pid = getpid();
+
+    return 0;
+}
+
+/* An operation that has been answered, or never will be, belongs to its
+ * connection again. One whose connection has gone away is freed here.
+ */
+static int s2n_key_server_finish(struct s2n_async_pkey_op *op)
+{
+    op->performed = 1;
+
+    if (op->conn == NULL) {
+        GUARD(s2n_async_pkey_op_free(op));
+    }
+
+    return 0;
+}
+
+/* The channel is broken. Everything in flight fails, and the next request reconnects. */
+static int s2n_key_server_disconnect(struct s2n_key_server *key_server)
+{
+    if (key_server->fd >= 0) {
+        close(key_server->fd);
+        key_server->fd = -1;
+    }
+
+    GUARD(s2n_stuffer_rewrite(&key_server->out));
+    GUARD(s2n_stuffer_rewrite(&key_server->in));
+
+    while (key_server->in_flight) {
+        struct s2n_async_pkey_op *op = key_server->in_flight;
+        key_server->in_flight = op->next;
+
+        op->result = -1;
+        GUARD(s2n_key_server_finish(op));
+    }
+
+    return 0;
+}
+
+static int s2n_key_server_handle_response(struct s2n_key_server *key_server, uint32_t id, uint8_t status, struct s2n_blob *data)
+{
+    struct s2n_async_pkey_op **link = &key_server->in_flight;
+    while (*link && (*link)->id != id) {
+        link = &(*link)->next;
+    }
+    S2N_ERROR_IF(*link == NULL, S2N_ERR_KEY_SERVER_RESPONSE);
+
+    struct s2n_async_pkey_op *op = *link;
+    *link = op->next;
+
+    op->result = -1;
+    if (status == S2N_KEY_SERVER_STATUS_OK) {
+        if (op->type == S2N_ASYNC_SIGN && data->size > 0 && s2n_alloc_class(&op->output, data->size, S2N_MEM_PUBLIC) == 0) {
+            memcpy_check(op->output.data, data->data, data->size);
+            op->result = 0;
+        } else if (op->type == S2N_ASYNC_DECRYPT && data->size == op->output.size) {
+            /* Otherwise the random pre-master secret stays, as it would for any failed decrypt */
+            memcpy_check(op->output.data, data->data, data->size);
+            op->result = 0;
+        }
+    }
+
+    GUARD(s2n_key_server_finish(op));
+
+    return 0;
+}
+
+static int s2n_key_server_read_responses(struct s2n_key_server *key_server)
+{
+    struct s2n_stuffer *in = &key_server->in;
+
+    while (s2n_stuffer_data_available(in) >= S2N_KEY_SERVER_RESPONSE_HEADER_LENGTH) {
+        uint32_t id;
+        uint8_t status;
+        uint16_t length;
+        GUARD(s2n_stuffer_read_uint32(in, &id));
+        GUARD(s2n_stuffer_read_uint8(in, &status));
+        GUARD(s2n_stuffer_read_uint16(in, &length));
+
+        /* Wait for the rest of the response */
+        if (s2n_stuffer_data_available(in) < length) {
+            GUARD(s2n_stuffer_rewind_read(in, S2N_KEY_SERVER_RESPONSE_HEADER_LENGTH));
+            break;
+        }
+
+        struct s2n_blob data;
+        data.size = length;
+        data.data = s2n_stuffer_raw_read(in, length);
+        notnull_check(data.data);
+
+        GUARD(s2n_key_server_handle_response(key_server, id, status, &data));
+    }
+
+    /* Keep whatever partial response is left at the front of the buffer */
+    uint32_t partial = s2n_stuffer_data_available(in);
+    if (partial) {
+        memmove(in->blob.data, in->blob.data + in->read_cursor, partial);
+    }
+    in->read_cursor = 0;
+    in->write_cursor = partial;
+
+    return 0;
+}
+
+/* Responses on a socket shared with another process could go to either one */
+static int s2n_key_server_check_fork(struct s2n_key_server *key_server)
+{
+    if (key_server->fd >= 0 && key_server->pid != getpid()) {
+        GUARD(s2n_key_server_disconnect(key_server));
+    }
+
+    return 0;
+}
+
+static int s2n_key_server_service_locked(struct s2n_key_server *key_server)
+{
+    GUARD(s2n_key_server_check_fork(key_server));
+
+    if (key_server->fd < 0) {
+        if (s2n_stuffer_data_available(&key_server->out) == 0) {
+            return 0;
+        }
+        if (s2n_key_server_connect(key_server) < 0) {
+            GUARD(s2n_key_server_disconnect(key_server));
+            S2N_ERROR(S2N_ERR_KEY_SERVER);
+        }
+    }
+
+    /* Everything queued since the last time goes out in as few writes as the socket allows */
+    while (s2n_stuffer_data_available(&key_server->out)) {
+        if (s2n_stuffer_send_to_fd(&key_server->out, key_server->fd, s2n_stuffer_data_available(&key_server->out)) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            GUARD(s2n_key_server_disconnect(key_server));
+            S2N_ERROR(S2N_ERR_KEY_SERVER);
+        }
+    }
+    if (s2n_stuffer_data_available(&key_server->out) == 0) {
+        GUARD(s2n_stuffer_rewrite(&key_server->out));
+    }
+
+    /* Take whatever responses have arrived */
+    while (key_server->in_flight) {
+        int r = s2n_stuffer_recv_from_fd(&key_server->in, key_server->fd, S2N_KEY_SERVER_READ_SIZE);
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (r <= 0 || s2n_key_server_read_responses(key_server) < 0) {
+            GUARD(s2n_key_server_disconnect(key_server));
+            S2N_ERROR(S2N_ERR_KEY_SERVER);
+        }
+    }
+
+    return 0;
+}
+
+static int s2n_key_server_submit_locked(struct s2n_key_server *key_server, struct s2n_async_pkey_op *op)
+{
+    struct s2n_stuffer *out = &key_server->out;
+    uint8_t hash = TLS_HASH_ALGORITHM_NONE;
+
+    GUARD(s2n_key_server_check_fork(key_server));
+
+    if (op->type == S2N_ASYNC_SIGN && op->digest.alg != S2N_HASH_MD5_SHA1) {
+        hash = s2n_hash_alg_to_tls[op->digest.alg];
+    }
+
+    op->id = key_server->next_id++;
+
+    GUARD(s2n_stuffer_write_uint32(out, op->id));
+    GUARD(s2n_stuffer_write_uint8(out, op->type == S2N_ASYNC_SIGN ? S2N_KEY_SERVER_OP_SIGN : S2N_KEY_SERVER_OP_DECRYPT));
+    GUARD(s2n_stuffer_write_uint8(out, hash));
+    GUARD(s2n_stuffer_write_uint16(out, op->input.size));
+    GUARD(s2n_stuffer_write(out, &op->input));
+
+    op->next = key_server->in_flight;
+    key_server->in_flight = op;
+
+    return 0;
+}
+
+int s2n_key_server_new(struct s2n_key_server **key_server, const char *path)
+{
+    notnull_check(path);
+    S2N_ERROR_IF(strlen(path) == 0 || strlen(path) > S2N_KEY_SERVER_MAX_PATH_LENGTH, S2N_ERR_KEY_SERVER_PATH);
+
+    struct s2n_blob mem = {0};
+    GUARD(s2n_alloc_class(&mem, sizeof(struct s2n_key_server), S2N_MEM_PUBLIC));
+    GUARD(s2n_blob_zero(&mem));
+
+    struct s2n_key_server *ks = (struct s2n_key_server *)(void *)mem.data;
+    ks->mem = mem;
+    memcpy(ks->path, path, strlen(path) + 1);
+    ks->fd = -1;
+
+    if (pthread_mutex_init(&ks->lock, NULL) != 0) {
+        GUARD(s2n_free(&mem));
+        S2N_ERROR(S2N_ERR_KEY_SERVER);
+    }
+
+    if (s2n_stuffer_growable_alloc_class(&ks->out, 0, S2N_MEM_PUBLIC) < 0
+        || s2n_stuffer_growable_alloc_class(&ks->in, 0, S2N_MEM_PUBLIC) < 0
+        || s2n_key_server_connect(ks) < 0) {
+        GUARD(s2n_key_server_free(ks));
+        S2N_ERROR(S2N_ERR_KEY_SERVER);
+    }
+
+    *key_server = ks;
+
+    return 0;
+}
+
+int s2n_key_server_free(struct s2n_key_server *key_server)
+{
+    if (key_server == NULL) {
+        return 0;
+    }
+
+    /* Whatever is still in flight belongs to connections that are gone, or soon will be */
+    while (key_server->in_flight) {
+        struct s2n_async_pkey_op *op = key_server->in_flight;
+        key_server->in_flight = op->next;
+
+        op->result = -1;
+        op->performed = 1;
+        op->conn = NULL;
+        GUARD(s2n_async_pkey_op_free(op));
+    }
+
+    if (key_server->fd >= 0) {
+        close(key_server->fd);
+    }
+    GUARD(s2n_stuffer_free(&key_server->out));
+    GUARD(s2n_stuffer_free(&key_server->in));
+    pthread_mutex_destroy(&key_server->lock);
+
+    /* Copied out, since s2n_free writes to the blob after releasing it */
+    struct s2n_blob mem = key_server->mem;
+    GUARD(s2n_free(&mem));
+
+    return 0;
+}
+
+/* Queue a request. It is written the next time the channel is serviced, along
+ * with any other requests queued by then.
+ */
+int s2n_key_server_submit(struct s2n_key_server *key_server, struct s2n_async_pkey_op *op)
+{
+    S2N_ERROR_IF(pthread_mutex_lock(&key_server->lock) != 0, S2N_ERR_KEY_SERVER);
+    int rc = s2n_key_server_submit_locked(key_server, op);
+    pthread_mutex_unlock(&key_server->lock);
+
+    return rc;
+}
+
+int s2n_key_server_service(struct s2n_key_server *key_server)
+{
+    S2N_ERROR_IF(pthread_mutex_lock(&key_server->lock) != 0, S2N_ERR_KEY_SERVER);
+    int rc = s2n_key_server_service_locked(key_server);
+    pthread_mutex_unlock(&key_server->lock);
+
+    return rc;
+}
+
+int s2n_key_server_op_done(struct s2n_key_server *key_server, struct s2n_async_pkey_op *op, uint8_t *done)
+{
+    S2N_ERROR_IF(pthread_mutex_lock(&key_server->lock) != 0, S2N_ERR_KEY_SERVER);
+    *done = op->performed;
+    pthread_mutex_unlock(&key_server->lock);
+
+    return 0;
+}
+
+/* The connection is going away. An operation that's still in flight is
+ * freed when its response arrives, one that isn't is freed now.
+ */
+int s2n_key_server_abandon(struct s2n_key_server *key_server, struct s2n_async_pkey_op *op)
+{
+    S2N_ERROR_IF(pthread_mutex_lock(&key_server->lock) != 0, S2N_ERR_KEY_SERVER);
+    int performed = op->performed;
+    op->conn = NULL;
+    pthread_mutex_unlock(&key_server->lock);
+
+    if (performed) {
+        GUARD(s2n_async_pkey_op_free(op));
+    }
+
+    return 0;
+}
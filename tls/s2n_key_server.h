@@ -0,0 +1,81 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "stuffer/s2n_stuffer.h"
+
+#include "tls/s2n_async_pkey.h"
+
+/* In keyless mode the private key lives in a separate key server, which s2n
+ * reaches over a Unix stream socket. Requests from every connection using
+ * the config are pipelined over the one socket and matched to their
+ * responses by ID, so responses may come back in any order. All integers
+ * are in network order.
+ *
+ * Request:   uint32 id, uint8 op, uint8 hash, uint16 length, data
+ * Response:  uint32 id, uint8 status, uint16 length, data
+ *
+ * A sign request carries the digest to sign with RSA PKCS#1 v1.5, and hash
+ * is the TLS HashAlgorithm of the digest. TLS_HASH_ALGORITHM_NONE stands for
+ * the MD5 and SHA1 digests concatenated, as used before TLS1.2. A decrypt
+ * request carries the RSA PKCS#1 v1.5 encrypted pre-master secret, and hash
+ * is TLS_HASH_ALGORITHM_NONE.
+ */
+#define S2N_KEY_SERVER_OP_SIGN                  1
+#define S2N_KEY_SERVER_OP_DECRYPT               2
+
+#define S2N_KEY_SERVER_STATUS_OK                0
+#define S2N_KEY_SERVER_STATUS_FAILED            1
+
+#define S2N_KEY_SERVER_REQUEST_HEADER_LENGTH    8
+#define S2N_KEY_SERVER_RESPONSE_HEADER_LENGTH   7
+
+#define S2N_KEY_SERVER_MAX_PATH_LENGTH          107
+
+struct s2n_key_server {
+    char path[S2N_KEY_SERVER_MAX_PATH_LENGTH + 1];
+
+    /* -1 until connected, and again after the connection is lost */
+    int fd;
+
+    /* The process that opened fd. A forked child opens its own. */
+    pid_t pid;
+
+    /* Connections on different threads share the channel */
+    pthread_mutex_t lock;
+
+    /* Requests waiting to be written, and partly read responses */
+    struct s2n_stuffer out;
+    struct s2n_stuffer in;
+
+    /* Operations that have been sent but not answered */
+    struct s2n_async_pkey_op *in_flight;
+    uint32_t next_id;
+
+    /* The allocation this key server lives in */
+    struct s2n_blob mem;
+};
+
+extern int s2n_key_server_new(struct s2n_key_server **key_server, const char *path);
+extern int s2n_key_server_free(struct s2n_key_server *key_server);
+extern int s2n_key_server_submit(struct s2n_key_server *key_server, struct s2n_async_pkey_op *op);
+extern int s2n_key_server_service(struct s2n_key_server *key_server);
+extern int s2n_key_server_op_done(struct s2n_key_server *key_server, struct s2n_async_pkey_op *op, uint8_t *done);
+extern int s2n_key_server_abandon(struct s2n_key_server *key_server, struct s2n_async_pkey_op *op);
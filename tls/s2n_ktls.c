@@ -0,0 +1,379 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <linux/tls.h>
+#endif
+
+#include <s2n.h>
+
+#include "error/s2n_errno.h"
+
+#include "tls/s2n_cipher_suites.h"
+#include "tls/s2n_connection.h"
+#include "tls/s2n_ktls.h"
+#include "tls/s2n_prf.h"
+#include "tls/s2n_tls_parameters.h"
+
+#include "crypto/s2n_cipher.h"
+
+#include "utils/s2n_socket.h"
+#include "utils/s2n_safety.h"
+#include "utils/s2n_blob.h"
+
+#if defined(TLS_TX) && defined(TLS_RX) && defined(TLS_SET_RECORD_TYPE) && defined(SOL_TLS) && defined(TCP_ULP)
+#define S2N_KTLS_SUPPORTED 1
+#endif
+
+/* Linux's IOV_MAX, which isn't visible in strict C99 mode */
+#define S2N_KTLS_MAX_IOVECS 1024
+
+/* Fill in both directions' crypto info, deriving the keys into key_block.
+ * The caller wipes key_block however this returns.
+ */
+static int s2n_ktls_crypto_info_from_key_block(struct s2n_connection *conn, struct s2n_blob *out,
+                                               struct s2n_ktls_crypto_info *client, struct s2n_ktls_crypto_info *server)
+{
+    const struct s2n_cipher *cipher = conn->secure.cipher_suite->record_alg->cipher;
+    S2N_ERROR_IF(cipher != &s2n_aes128_gcm && cipher != &s2n_aes256_gcm, S2N_ERR_KTLS_UNSUPPORTED);
+
+    uint8_t mac_size;
+    GUARD(s2n_hmac_digest_size(conn->secure.cipher_suite->record_alg->hmac_alg, &mac_size));
+
+    /* The raw keys aren't kept once they've been loaded into the ciphers, so
+     * derive the key block again from the master secret. The connection's PRF
+     * working space went away with the handshake, so lend it one for this.
+     */
+    struct s2n_stuffer key_material;
+    struct s2n_prf_working_space prf_space;
+    struct s2n_blob prf_space_blob = {.data = (uint8_t *) &prf_space,.size = sizeof(prf_space) };
+    GUARD(s2n_blob_zero(&prf_space_blob));
+
+    uint8_t lent_prf_space = 0;
+    if (conn->prf_space == NULL) {
+        conn->prf_space = &prf_space;
+        lent_prf_space = 1;
+        if (s2n_prf_new(conn) < 0) {
+            conn->prf_space = NULL;
+            return -1;
+        }
+    }
+
+    int key_block_rc = s2n_prf_key_block(conn, out);
+
+    if (lent_prf_space) {
+        int prf_free_rc = s2n_prf_free(conn);
+        GUARD(s2n_blob_zero(&prf_space_blob));
+        conn->prf_space = NULL;
+        GUARD(prf_free_rc);
+    }
+    GUARD(key_block_rc);
+    GUARD(s2n_stuffer_init(&key_material, out));
+    GUARD(s2n_stuffer_write(&key_material, out));
+
+    GUARD(s2n_stuffer_skip_read(&key_material, 2 * mac_size));
+    GUARD(s2n_stuffer_read_bytes(&key_material, client->key, cipher->key_material_size));
+    GUARD(s2n_stuffer_read_bytes(&key_material, server->key, cipher->key_material_size));
+    client->key_size = cipher->key_material_size;
+    server->key_size = cipher->key_material_size;
+
+    memcpy_check(client->salt, conn->secure.client_implicit_iv, S2N_TLS_GCM_FIXED_IV_LEN);
+    memcpy_check(server->salt, conn->secure.server_implicit_iv, S2N_TLS_GCM_FIXED_IV_LEN);
+
+    /* s2n uses the sequence number as the explicit part of the nonce, which is
+     * what the kernel carries on with from here.
+     */
+    memcpy_check(client->iv, conn->secure.client_sequence_number, S2N_TLS_SEQUENCE_NUM_LEN);
+    memcpy_check(client->rec_seq, conn->secure.client_sequence_number, S2N_TLS_SEQUENCE_NUM_LEN);
+    memcpy_check(server->iv, conn->secure.server_sequence_number, S2N_TLS_SEQUENCE_NUM_LEN);
+    memcpy_check(server->rec_seq, conn->secure.server_sequence_number, S2N_TLS_SEQUENCE_NUM_LEN);
+
+    return 0;
+}
+
+int s2n_ktls_crypto_info(struct s2n_connection *conn, struct s2n_ktls_crypto_info *client, struct s2n_ktls_crypto_info *server)
+{
+    uint8_t key_block[S2N_MAX_KEY_BLOCK_LEN];
+    struct s2n_blob out = {.data = key_block,.size = sizeof(key_block) };
+
+    int r = s2n_ktls_crypto_info_from_key_block(conn, &out, client, server);
+    GUARD(s2n_blob_zero(&out));
+
+    /* Don't leave half of the keys behind on failure either */
+    if (r < 0) {
+        memset_check(client, 0, sizeof(*client));
+        memset_check(server, 0, sizeof(*server));
+    }
+
+    return r;
+}
+
+#if defined(S2N_KTLS_SUPPORTED)
+
+static int s2n_ktls_fd(void *io_context)
+{
+    /* The read and write socket contexts both start with the fd */
+    return ((struct s2n_socket_write_io_context *) io_context)->fd;
+}
+
+static int s2n_ktls_set_crypto_info(int fd, int direction, struct s2n_ktls_crypto_info *info)
+{
+    if (setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) < 0 && errno != EEXIST) {
+        S2N_ERROR(S2N_ERR_KTLS_UNSUPPORTED);
+    }
+
+    int r = -1;
+    if (info->key_size == 16) {
+        struct tls12_crypto_info_aes_gcm_128 crypto_info;
+        memset(&crypto_info, 0, sizeof(crypto_info));
+        crypto_info.info.version = TLS_1_2_VERSION;
+        crypto_info.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        memcpy(crypto_info.key, info->key, sizeof(crypto_info.key));
+        memcpy(crypto_info.salt, info->salt, sizeof(crypto_info.salt));
+        memcpy(crypto_info.iv, info->iv, sizeof(crypto_info.iv));
+        memcpy(crypto_info.rec_seq, info->rec_seq, sizeof(crypto_info.rec_seq));
+        r = setsockopt(fd, SOL_TLS, direction, &crypto_info, sizeof(crypto_info));
+        memset(&crypto_info, 0, sizeof(crypto_info));
+#if defined(TLS_CIPHER_AES_GCM_256)
+    } else if (info->key_size == 32) {
+        struct tls12_crypto_info_aes_gcm_256 crypto_info;
+        memset(&crypto_info, 0, sizeof(crypto_info));
+        crypto_info.info.version = TLS_1_2_VERSION;
+        crypto_info.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        memcpy(crypto_info.key, info->key, sizeof(crypto_info.key));
+        memcpy(crypto_info.salt, info->salt, sizeof(crypto_info.salt));
+        memcpy(crypto_info.iv, info->iv, sizeof(crypto_info.iv));
+        memcpy(crypto_info.rec_seq, info->rec_seq, sizeof(crypto_info.rec_seq));
+        r = setsockopt(fd, SOL_TLS, direction, &crypto_info, sizeof(crypto_info));
+        memset(&crypto_info, 0, sizeof(crypto_info));
+#endif
+    }
+
+    S2N_ERROR_IF(r < 0, S2N_ERR_KTLS_UNSUPPORTED);
+
+    return 0;
+}
+
+static int s2n_ktls_enable(struct s2n_connection *conn, struct s2n_ktls_crypto_info *client, struct s2n_ktls_crypto_info *server)
+{
+    struct s2n_ktls_crypto_info *tx = server;
+    struct s2n_ktls_crypto_info *rx = client;
+    if (conn->mode == S2N_CLIENT) {
+        tx = client;
+        rx = server;
+    }
+
+    /* The kernel has no way to give a direction back once it has it, so if
+     * the receive direction fails after this, sending stays offloaded and
+     * the connection carries on half in the kernel, as documented.
+     */
+    if (!conn->ktls_send_enabled) {
+        GUARD(s2n_ktls_set_crypto_info(s2n_ktls_fd(conn->send_io_context), TLS_TX, tx));
+        conn->ktls_send_enabled = 1;
+    }
+
+    if (!conn->ktls_recv_enabled) {
+        GUARD(s2n_ktls_set_crypto_info(s2n_ktls_fd(conn->recv_io_context), TLS_RX, rx));
+        conn->ktls_recv_enabled = 1;
+    }
+
+    return 0;
+}
+
+int s2n_connection_enable_ktls(struct s2n_connection *conn)
+{
+    notnull_check(conn);
+
+    if (conn->ktls_send_enabled && conn->ktls_recv_enabled) {
+        return 0;
+    }
+
+    S2N_ERROR_IF(s2n_connection_is_closing(conn) || s2n_connection_is_closed(conn), S2N_ERR_CLOSED);
+
+    /* Everything up to here was protected by s2n. The kernel takes over at a
+     * record boundary, with nothing left buffered in either direction.
+     */
+    S2N_ERROR_IF(!is_handshake_complete(conn), S2N_ERR_KTLS_STATE);
+    S2N_ERROR_IF(s2n_stuffer_data_available(&conn->out), S2N_ERR_KTLS_STATE);
+    S2N_ERROR_IF(s2n_stuffer_data_available(&conn->header_in) || s2n_stuffer_data_available(&conn->in), S2N_ERR_KTLS_STATE);
+    S2N_ERROR_IF(s2n_stuffer_data_available(&conn->buffer_in), S2N_ERR_KTLS_STATE);
+
+    S2N_ERROR_IF(conn->actual_protocol_version != S2N_TLS12, S2N_ERR_KTLS_UNSUPPORTED);
+    S2N_ERROR_IF(conn->send != s2n_socket_write || conn->recv != s2n_socket_read, S2N_ERR_KTLS_UNSUPPORTED);
+
+    struct s2n_ktls_crypto_info client;
+    struct s2n_ktls_crypto_info server;
+    GUARD(s2n_ktls_crypto_info(conn, &client, &server));
+
+    int r = s2n_ktls_enable(conn, &client, &server);
+
+    memset_check(&client, 0, sizeof(client));
+    memset_check(&server, 0, sizeof(server));
+
+    return r;
+}
+
+ssize_t s2n_ktls_sendv(struct s2n_connection *conn, const struct iovec *bufs, int count)
+{
+    ssize_t w = writev(s2n_ktls_fd(conn->send_io_context), bufs, MIN(count, S2N_KTLS_MAX_IOVECS));
+    if (w < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            S2N_ERROR(S2N_ERR_BLOCKED);
+        }
+        S2N_ERROR(S2N_ERR_IO);
+    }
+    conn->wire_bytes_out += w;
+
+    return w;
+}
+
+ssize_t s2n_ktls_sendfile(struct s2n_connection *conn, int fd, off_t offset, size_t count)
+{
+    /* The file contents go from the page cache to the socket without ever
+     * being copied to user space.
+     */
+    ssize_t w = sendfile(s2n_ktls_fd(conn->send_io_context), fd, &offset, count);
+    if (w < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            S2N_ERROR(S2N_ERR_BLOCKED);
+        }
+        S2N_ERROR(S2N_ERR_IO);
+    }
+    S2N_ERROR_IF(w == 0 && count, S2N_ERR_SENDFILE_EOF);
+    conn->wire_bytes_out += w;
+
+    return w;
+}
+
+int s2n_ktls_send_control(struct s2n_connection *conn, uint8_t record_type, struct s2n_blob *in)
+{
+    char control[CMSG_SPACE(sizeof(record_type))];
+    struct iovec iov = {.iov_base = in->data,.iov_len = in->size };
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    /* The kernel frames the payload as a record of this type */
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_TLS;
+    cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(record_type));
+    memcpy(CMSG_DATA(cmsg), &record_type, sizeof(record_type));
+
+    ssize_t w = sendmsg(s2n_ktls_fd(conn->send_io_context), &msg, 0);
+    if (w < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            S2N_ERROR(S2N_ERR_BLOCKED);
+        }
+        S2N_ERROR(S2N_ERR_IO);
+    }
+    S2N_ERROR_IF(w != in->size, S2N_ERR_IO);
+    conn->wire_bytes_out += w;
+
+    return 0;
+}
+
+ssize_t s2n_ktls_recv(struct s2n_connection *conn, uint8_t *buf, uint32_t size, uint8_t *record_type)
+{
+    char control[CMSG_SPACE(sizeof(*record_type))];
+    struct iovec iov = {.iov_base = buf,.iov_len = size };
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t r = recvmsg(s2n_ktls_fd(conn->recv_io_context), &msg, 0);
+    if (r == 0) {
+        s2n_connection_set_closed(conn);
+        S2N_ERROR(S2N_ERR_CLOSED);
+    } else if (r < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            S2N_ERROR(S2N_ERR_BLOCKED);
+        }
+        if (errno == EBADMSG) {
+            S2N_ERROR(S2N_ERR_DECRYPT);
+        }
+        S2N_ERROR(S2N_ERR_IO);
+    }
+    conn->wire_bytes_in += r;
+
+    /* Records other than application data are flagged with their type */
+    *record_type = TLS_APPLICATION_DATA;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_TLS && cmsg->cmsg_type == TLS_GET_RECORD_TYPE) {
+        *record_type = *CMSG_DATA(cmsg);
+    }
+
+    return r;
+}
+
+#else
+
+int s2n_connection_enable_ktls(struct s2n_connection *conn)
+{
+    S2N_ERROR(S2N_ERR_KTLS_UNSUPPORTED);
+}
+
+ssize_t s2n_ktls_sendv(struct s2n_connection *conn, const struct iovec *bufs, int count)
+{
+    S2N_ERROR(S2N_ERR_KTLS_UNSUPPORTED);
+}
+
+ssize_t s2n_ktls_sendfile(struct s2n_connection *conn, int fd, off_t offset, size_t count)
+{
+    S2N_ERROR(S2N_ERR_KTLS_UNSUPPORTED);
+}
+
+int s2n_ktls_send_control(struct s2n_connection *conn, uint8_t record_type, struct s2n_blob *in)
+{
+    S2N_ERROR(S2N_ERR_KTLS_UNSUPPORTED);
+}
+
+ssize_t s2n_ktls_recv(struct s2n_connection *conn, uint8_t *buf, uint32_t size, uint8_t *record_type)
+{
+    S2N_ERROR(S2N_ERR_KTLS_UNSUPPORTED);
+}
+
+#endif
+
+int s2n_connection_is_ktls_send_enabled(struct s2n_connection *conn)
+{
+    notnull_check(conn);
+
+    return conn->ktls_send_enabled;
+}
+
+int s2n_connection_is_ktls_recv_enabled(struct s2n_connection *conn)
+{
+    notnull_check(conn);
+
+    return conn->ktls_recv_enabled;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "tls/s2n_connection.h"
+#include "tls/s2n_crypto.h"
+
+#define S2N_KTLS_MAX_KEY_LEN    32
+
+/* The parameters the kernel needs to take over one direction of a connection */
+struct s2n_ktls_crypto_info {
+    uint8_t key[S2N_KTLS_MAX_KEY_LEN];
+    uint8_t key_size;
+    uint8_t salt[S2N_TLS_GCM_FIXED_IV_LEN];
+    uint8_t iv[S2N_TLS_GCM_EXPLICIT_IV_LEN];
+    uint8_t rec_seq[S2N_TLS_SEQUENCE_NUM_LEN];
+};
+
+extern int s2n_ktls_crypto_info(struct s2n_connection *conn, struct s2n_ktls_crypto_info *client, struct s2n_ktls_crypto_info *server);
+extern ssize_t s2n_ktls_sendv(struct s2n_connection *conn, const struct iovec *bufs, int count);
+extern ssize_t s2n_ktls_sendfile(struct s2n_connection *conn, int fd, off_t offset, size_t count);
+extern int s2n_ktls_send_control(struct s2n_connection *conn, uint8_t record_type, struct s2n_blob *in);
+extern ssize_t s2n_ktls_recv(struct s2n_connection *conn, uint8_t *buf, uint32_t size, uint8_t *record_type);
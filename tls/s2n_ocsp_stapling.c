@@ -44,7 +44,7 @@ int s2n_server_status_recv(struct s2n_connection *conn)
     notnull_check(status.data);
 
     if (type == S2N_STATUS_REQUEST_OCSP) {
-        GUARD(s2n_alloc(&conn->status_response, status.size));
+        GUARD(s2n_alloc_class(&conn->status_response, status.size, S2N_MEM_PUBLIC));
         memcpy_check(conn->status_response.data, status.data, status.size);
         conn->status_response.size = status.size;
 
@@ -23,6 +23,7 @@
 #include "tls/s2n_cipher_suites.h"
 #include "tls/s2n_connection.h"
 #include "tls/s2n_prf.h"
+#include "tls/s2n_record.h"
 
 #include "stuffer/s2n_stuffer.h"
 
@@ -310,9 +311,9 @@ int s2n_prf_new(struct s2n_connection *conn)
     /* Set p_hash_hmac_impl on initial prf creation. 
      * When in FIPS mode, the EVP API's must be used for the p_hash HMAC.
      */
-    conn->prf_space.tls.p_hash_hmac_impl = s2n_is_in_fips_mode() ? &s2n_evp_hmac : &s2n_hmac;
+    conn->prf_space->tls.p_hash_hmac_impl = s2n_is_in_fips_mode() ? &s2n_evp_hmac : &s2n_hmac;
 
-    return conn->prf_space.tls.p_hash_hmac_impl->new(&conn->prf_space);
+    return conn->prf_space->tls.p_hash_hmac_impl->new(conn->prf_space);
 }
 
 int s2n_prf_free(struct s2n_connection *conn)
@@ -320,15 +321,15 @@ int s2n_prf_free(struct s2n_connection *conn)
     /* Ensure that p_hash_hmac_impl is set, as it may have been reset for prf_space on s2n_connection_wipe. 
      * When in FIPS mode, the EVP API's must be used for the p_hash HMAC.
      */
-    conn->prf_space.tls.p_hash_hmac_impl = s2n_is_in_fips_mode() ? &s2n_evp_hmac : &s2n_hmac;
+    conn->prf_space->tls.p_hash_hmac_impl = s2n_is_in_fips_mode() ? &s2n_evp_hmac : &s2n_hmac;
 
-    return conn->prf_space.tls.p_hash_hmac_impl->free(&conn->prf_space);
+    return conn->prf_space->tls.p_hash_hmac_impl->free(conn->prf_space);
 }
 
 static int s2n_prf(struct s2n_connection *conn, struct s2n_blob *secret, struct s2n_blob *label, struct s2n_blob *seed_a, struct s2n_blob *seed_b, struct s2n_blob *out)
 {
     if (conn->actual_protocol_version == S2N_SSLv3) {
-        return s2n_sslv3_prf(&conn->prf_space, secret, seed_a, seed_b, out);
+        return s2n_sslv3_prf(conn->prf_space, secret, seed_a, seed_b, out);
     }
 
     /* We zero the out blob because p_hash works by XOR'ing with the existing
@@ -342,17 +343,17 @@ static int s2n_prf(struct s2n_connection *conn, struct s2n_blob *secret, struct
     /* Ensure that p_hash_hmac_impl is set, as it may have been reset for prf_space on s2n_connection_wipe. 
      * When in FIPS mode, the EVP API's must be used for the p_hash HMAC.
      */
-    conn->prf_space.tls.p_hash_hmac_impl = s2n_is_in_fips_mode() ? &s2n_evp_hmac : &s2n_hmac;
+    conn->prf_space->tls.p_hash_hmac_impl = s2n_is_in_fips_mode() ? &s2n_evp_hmac : &s2n_hmac;
 
     if (conn->actual_protocol_version == S2N_TLS12) {
-        return s2n_p_hash(&conn->prf_space, conn->secure.cipher_suite->tls12_prf_alg, secret, label, seed_a, seed_b, out);
+        return s2n_p_hash(conn->prf_space, conn->secure.cipher_suite->tls12_prf_alg, secret, label, seed_a, seed_b, out);
     }
 
     struct s2n_blob half_secret = {.data = secret->data,.size = (secret->size + 1) / 2 };
 
-    GUARD(s2n_p_hash(&conn->prf_space, S2N_HMAC_MD5, &half_secret, label, seed_a, seed_b, out));
+    GUARD(s2n_p_hash(conn->prf_space, S2N_HMAC_MD5, &half_secret, label, seed_a, seed_b, out));
     half_secret.data += secret->size - half_secret.size;
-    GUARD(s2n_p_hash(&conn->prf_space, S2N_HMAC_SHA1, &half_secret, label, seed_a, seed_b, out));
+    GUARD(s2n_p_hash(conn->prf_space, S2N_HMAC_SHA1, &half_secret, label, seed_a, seed_b, out));
 
     return 0;
 }
@@ -420,9 +421,9 @@ static int s2n_sslv3_client_finished(struct s2n_connection *conn)
     uint8_t prefix[4] = { 0x43, 0x4c, 0x4e, 0x54 };
 
     lte_check(MD5_DIGEST_LENGTH + SHA_DIGEST_LENGTH, sizeof(conn->handshake.client_finished));
-    GUARD(s2n_hash_copy(&conn->handshake.prf_md5_hash_copy, &conn->handshake.md5));
-    GUARD(s2n_hash_copy(&conn->handshake.prf_sha1_hash_copy, &conn->handshake.sha1));
-    return s2n_sslv3_finished(conn, prefix, &conn->handshake.prf_md5_hash_copy, &conn->handshake.prf_sha1_hash_copy, conn->handshake.client_finished);
+    GUARD(s2n_hash_copy(&conn->handshake.hashes->prf_md5_hash_copy, &conn->handshake.hashes->md5));
+    GUARD(s2n_hash_copy(&conn->handshake.hashes->prf_sha1_hash_copy, &conn->handshake.hashes->sha1));
+    return s2n_sslv3_finished(conn, prefix, &conn->handshake.hashes->prf_md5_hash_copy, &conn->handshake.hashes->prf_sha1_hash_copy, conn->handshake.client_finished);
 }
 
 static int s2n_sslv3_server_finished(struct s2n_connection *conn)
@@ -430,9 +431,9 @@ static int s2n_sslv3_server_finished(struct s2n_connection *conn)
     uint8_t prefix[4] = { 0x53, 0x52, 0x56, 0x52 };
 
     lte_check(MD5_DIGEST_LENGTH + SHA_DIGEST_LENGTH, sizeof(conn->handshake.server_finished));
-    GUARD(s2n_hash_copy(&conn->handshake.prf_md5_hash_copy, &conn->handshake.md5));
-    GUARD(s2n_hash_copy(&conn->handshake.prf_sha1_hash_copy, &conn->handshake.sha1));
-    return s2n_sslv3_finished(conn, prefix, &conn->handshake.prf_md5_hash_copy, &conn->handshake.prf_sha1_hash_copy, conn->handshake.server_finished);
+    GUARD(s2n_hash_copy(&conn->handshake.hashes->prf_md5_hash_copy, &conn->handshake.hashes->md5));
+    GUARD(s2n_hash_copy(&conn->handshake.hashes->prf_sha1_hash_copy, &conn->handshake.hashes->sha1));
+    return s2n_sslv3_finished(conn, prefix, &conn->handshake.hashes->prf_md5_hash_copy, &conn->handshake.hashes->prf_sha1_hash_copy, conn->handshake.server_finished);
 }
 
 int s2n_prf_client_finished(struct s2n_connection *conn)
@@ -458,13 +459,13 @@ int s2n_prf_client_finished(struct s2n_connection *conn)
     if (conn->actual_protocol_version == S2N_TLS12) {
         switch (conn->secure.cipher_suite->tls12_prf_alg) {
         case S2N_HMAC_SHA256:
-            GUARD(s2n_hash_copy(&conn->handshake.prf_tls12_hash_copy, &conn->handshake.sha256));
-            GUARD(s2n_hash_digest(&conn->handshake.prf_tls12_hash_copy, sha_digest, SHA256_DIGEST_LENGTH));
+            GUARD(s2n_hash_copy(&conn->handshake.hashes->prf_tls12_hash_copy, &conn->handshake.hashes->sha256));
+            GUARD(s2n_hash_digest(&conn->handshake.hashes->prf_tls12_hash_copy, sha_digest, SHA256_DIGEST_LENGTH));
             sha.size = SHA256_DIGEST_LENGTH;
             break;
         case S2N_HMAC_SHA384:
-            GUARD(s2n_hash_copy(&conn->handshake.prf_tls12_hash_copy, &conn->handshake.sha384));
-            GUARD(s2n_hash_digest(&conn->handshake.prf_tls12_hash_copy, sha_digest, SHA384_DIGEST_LENGTH));
+            GUARD(s2n_hash_copy(&conn->handshake.hashes->prf_tls12_hash_copy, &conn->handshake.hashes->sha384));
+            GUARD(s2n_hash_digest(&conn->handshake.hashes->prf_tls12_hash_copy, sha_digest, SHA384_DIGEST_LENGTH));
             sha.size = SHA384_DIGEST_LENGTH;
             break;
         default:
@@ -475,11 +476,11 @@ int s2n_prf_client_finished(struct s2n_connection *conn)
         return s2n_prf(conn, &master_secret, &label, &sha, NULL, &client_finished);
     }
 
-    GUARD(s2n_hash_copy(&conn->handshake.prf_md5_hash_copy, &conn->handshake.md5));
-    GUARD(s2n_hash_copy(&conn->handshake.prf_sha1_hash_copy, &conn->handshake.sha1));
+    GUARD(s2n_hash_copy(&conn->handshake.hashes->prf_md5_hash_copy, &conn->handshake.hashes->md5));
+    GUARD(s2n_hash_copy(&conn->handshake.hashes->prf_sha1_hash_copy, &conn->handshake.hashes->sha1));
 
-    GUARD(s2n_hash_digest(&conn->handshake.prf_md5_hash_copy, md5_digest, MD5_DIGEST_LENGTH));
-    GUARD(s2n_hash_digest(&conn->handshake.prf_sha1_hash_copy, sha_digest, SHA_DIGEST_LENGTH));
+    GUARD(s2n_hash_digest(&conn->handshake.hashes->prf_md5_hash_copy, md5_digest, MD5_DIGEST_LENGTH));
+    GUARD(s2n_hash_digest(&conn->handshake.hashes->prf_sha1_hash_copy, sha_digest, SHA_DIGEST_LENGTH));
     md5.data = md5_digest;
     md5.size = MD5_DIGEST_LENGTH;
     sha.data = sha_digest;
@@ -511,13 +512,13 @@ int s2n_prf_server_finished(struct s2n_connection *conn)
     if (conn->actual_protocol_version == S2N_TLS12) {
         switch (conn->secure.cipher_suite->tls12_prf_alg) {
         case S2N_HMAC_SHA256:
-            GUARD(s2n_hash_copy(&conn->handshake.prf_tls12_hash_copy, &conn->handshake.sha256));
-            GUARD(s2n_hash_digest(&conn->handshake.prf_tls12_hash_copy, sha_digest, SHA256_DIGEST_LENGTH));
+            GUARD(s2n_hash_copy(&conn->handshake.hashes->prf_tls12_hash_copy, &conn->handshake.hashes->sha256));
+            GUARD(s2n_hash_digest(&conn->handshake.hashes->prf_tls12_hash_copy, sha_digest, SHA256_DIGEST_LENGTH));
             sha.size = SHA256_DIGEST_LENGTH;
             break;
         case S2N_HMAC_SHA384:
-            GUARD(s2n_hash_copy(&conn->handshake.prf_tls12_hash_copy, &conn->handshake.sha384));
-            GUARD(s2n_hash_digest(&conn->handshake.prf_tls12_hash_copy, sha_digest, SHA384_DIGEST_LENGTH));
+            GUARD(s2n_hash_copy(&conn->handshake.hashes->prf_tls12_hash_copy, &conn->handshake.hashes->sha384));
+            GUARD(s2n_hash_digest(&conn->handshake.hashes->prf_tls12_hash_copy, sha_digest, SHA384_DIGEST_LENGTH));
             sha.size = SHA384_DIGEST_LENGTH;
             break;
         default:
@@ -528,11 +529,11 @@ int s2n_prf_server_finished(struct s2n_connection *conn)
         return s2n_prf(conn, &master_secret, &label, &sha, NULL, &server_finished);
     }
 
-    GUARD(s2n_hash_copy(&conn->handshake.prf_md5_hash_copy, &conn->handshake.md5));
-    GUARD(s2n_hash_copy(&conn->handshake.prf_sha1_hash_copy, &conn->handshake.sha1));
+    GUARD(s2n_hash_copy(&conn->handshake.hashes->prf_md5_hash_copy, &conn->handshake.hashes->md5));
+    GUARD(s2n_hash_copy(&conn->handshake.hashes->prf_sha1_hash_copy, &conn->handshake.hashes->sha1));
 
-    GUARD(s2n_hash_digest(&conn->handshake.prf_md5_hash_copy, md5_digest, MD5_DIGEST_LENGTH));
-    GUARD(s2n_hash_digest(&conn->handshake.prf_sha1_hash_copy, sha_digest, SHA_DIGEST_LENGTH));
+    GUARD(s2n_hash_digest(&conn->handshake.hashes->prf_md5_hash_copy, md5_digest, MD5_DIGEST_LENGTH));
+    GUARD(s2n_hash_digest(&conn->handshake.hashes->prf_sha1_hash_copy, sha_digest, SHA_DIGEST_LENGTH));
     md5.data = md5_digest;
     md5.size = MD5_DIGEST_LENGTH;
     sha.data = sha_digest;
@@ -573,22 +574,29 @@ static int s2n_prf_make_server_key(struct s2n_connection *conn, struct s2n_stuff
     return 0;
 }
 
-int s2n_prf_key_expansion(struct s2n_connection *conn)
+int s2n_prf_key_block(struct s2n_connection *conn, struct s2n_blob *out)
 {
     struct s2n_blob client_random = {.data = conn->secure.client_random,.size = sizeof(conn->secure.client_random) };
     struct s2n_blob server_random = {.data = conn->secure.server_random,.size = sizeof(conn->secure.server_random) };
     struct s2n_blob master_secret = {.data = conn->secure.master_secret,.size = sizeof(conn->secure.master_secret) };
-    struct s2n_blob label, out;
+    struct s2n_blob label;
     uint8_t key_expansion_label[] = "key expansion";
-    uint8_t key_block[S2N_MAX_KEY_BLOCK_LEN];
 
     label.data = key_expansion_label;
     label.size = sizeof(key_expansion_label) - 1;
-    out.data = key_block;
-    out.size = sizeof(key_block);
+
+    GUARD(s2n_prf(conn, &master_secret, &label, &server_random, &client_random, out));
+
+    return 0;
+}
+
+int s2n_prf_key_expansion(struct s2n_connection *conn)
+{
+    uint8_t key_block[S2N_MAX_KEY_BLOCK_LEN];
+    struct s2n_blob out = {.data = key_block,.size = sizeof(key_block) };
 
     struct s2n_stuffer key_material;
-    GUARD(s2n_prf(conn, &master_secret, &label, &server_random, &client_random, &out));
+    GUARD(s2n_prf_key_block(conn, &out));
     GUARD(s2n_stuffer_init(&key_material, &out));
     GUARD(s2n_stuffer_write(&key_material, &out));
 
@@ -641,6 +649,9 @@ int s2n_prf_key_expansion(struct s2n_connection *conn)
         GUARD(conn->secure.cipher_suite->record_alg->cipher->io.comp.set_mac_write_key(&conn->secure.client_key, client_mac_write_key, mac_size));
     }
 
+    /* Pick the record protection routines for the negotiated cipher */
+    GUARD(s2n_record_bind_protection(conn));
+
     /* TLS >= 1.1 has no implicit IVs for non AEAD ciphers */
     if (conn->actual_protocol_version > S2N_TLS10 && conn->secure.cipher_suite->record_alg->cipher->type != S2N_AEAD) {
         return 0;
@@ -16,12 +16,39 @@
 #pragma once
 
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #include "s2n_connection.h"
 
+/* Record protection specialized for a single cipher. These replace the
+ * generic record routines for the ciphers where the per-record overhead of
+ * the generic code is significant next to the cost of the cipher itself.
+ */
+struct s2n_record_protection {
+    uint8_t explicit_iv_size;
+    uint8_t overhead;
+    int (*nonce) (const uint8_t *implicit_iv, const uint8_t *per_record, uint8_t *nonce);
+    int (*write) (struct s2n_connection *conn, struct s2n_crypto_parameters *params, uint8_t content_type,
+                  const struct iovec *in, int in_count, size_t offs, uint16_t data_bytes_to_take);
+    int (*parse) (struct s2n_connection *conn, struct s2n_crypto_parameters *params);
+    int (*parse_into) (struct s2n_connection *conn, struct s2n_crypto_parameters *params, uint8_t *out, uint32_t out_size);
+};
+
+extern const struct s2n_record_protection s2n_record_aes_gcm_protection;
+extern const struct s2n_record_protection s2n_record_chacha20_poly1305_protection;
+
+extern int s2n_record_bind_protection(struct s2n_connection *conn);
+
 extern int s2n_record_max_write_payload_size(struct s2n_connection *conn);
+extern int s2n_record_min_write_payload_size(struct s2n_connection *conn);
+extern int s2n_record_max_write_size(struct s2n_connection *conn);
 extern int s2n_record_write(struct s2n_connection *conn, uint8_t content_type, struct s2n_blob *in);
+extern int s2n_record_writev(struct s2n_connection *conn, uint8_t content_type, const struct iovec *in, int in_count, size_t offs, size_t to_write);
+extern int s2n_record_write_fd(struct s2n_connection *conn, uint8_t content_type, int fd, off_t offset, size_t to_write);
 extern int s2n_record_parse(struct s2n_connection *conn);
+extern int s2n_record_can_parse_into(struct s2n_connection *conn, uint32_t out_size);
+extern int s2n_record_parse_into(struct s2n_connection *conn, uint8_t *out, uint32_t out_size);
 extern int s2n_record_header_parse(struct s2n_connection *conn, uint8_t * content_type, uint16_t * fragment_length);
 extern int s2n_sslv2_record_header_parse(struct s2n_connection *conn, uint8_t * record_type, uint8_t * client_protocol_version, uint16_t * fragment_length);
 extern int s2n_verify_cbc(struct s2n_connection *conn, struct s2n_hmac_state *hmac, struct s2n_blob *decrypted);
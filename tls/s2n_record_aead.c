@@ -0,0 +1,311 @@
+/*
+ * Copyright 2017 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/uio.h>
+
+#include "error/s2n_errno.h"
+
+#include "tls/s2n_cipher_suites.h"
+#include "tls/s2n_connection.h"
+#include "tls/s2n_crypto.h"
+#include "tls/s2n_record.h"
+
+#include "stuffer/s2n_stuffer.h"
+
+#include "crypto/s2n_cipher.h"
+
+#include "utils/s2n_safety.h"
+#include "utils/s2n_blob.h"
+
+/* Record protection for the AEAD ciphers, without the per-record branching,
+ * stuffer bookkeeping and byte-at-a-time sequence number arithmetic of the
+ * generic record code. The sequence number is kept in the connection in wire
+ * order, and handled as a native 64-bit counter while a record is built.
+ */
+
+static inline uint64_t s2n_load_be64(const uint8_t *in)
+{
+    return ((uint64_t) in[0] << 56) | ((uint64_t) in[1] << 48) | ((uint64_t) in[2] << 40) | ((uint64_t) in[3] << 32)
+         | ((uint64_t) in[4] << 24) | ((uint64_t) in[5] << 16) | ((uint64_t) in[6] << 8) | (uint64_t) in[7];
+}
+
+static inline void s2n_store_be64(uint8_t *out, uint64_t value)
+{
+    for (int i = 7; i >= 0; i--) {
+        out[i] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+/* RFC 5246 6.2.3.3: additional_data = seq_num + type + version + length */
+static inline void s2n_aead_record_aad(uint8_t *aad, uint64_t seq, uint8_t content_type, uint8_t protocol_version, uint16_t length)
+{
+    s2n_store_be64(aad, seq);
+    aad[8] = content_type;
+    aad[9] = protocol_version / 10;
+    aad[10] = protocol_version % 10;
+    aad[11] = length >> 8;
+    aad[12] = length & 0xff;
+}
+
+/* Partially explicit nonce: the implicit salt followed by the explicit part
+ * carried in the record. See RFC 5288 Section 3.
+ */
+static int s2n_aes_gcm_nonce(const uint8_t *implicit_iv, const uint8_t *explicit_iv, uint8_t *nonce)
+{
+    memcpy(nonce, implicit_iv, S2N_TLS_GCM_FIXED_IV_LEN);
+    memcpy(nonce + S2N_TLS_GCM_FIXED_IV_LEN, explicit_iv, S2N_TLS_GCM_EXPLICIT_IV_LEN);
+
+    return S2N_TLS_GCM_IV_LEN;
+}
+
+/* Fully implicit nonce: the sequence number XORed into the implicit IV. See
+ * RFC 7905 Section 2.
+ */
+static int s2n_chacha20_poly1305_nonce(const uint8_t *implicit_iv, const uint8_t *sequence_number, uint8_t *nonce)
+{
+    memcpy(nonce, implicit_iv, S2N_TLS_CHACHA20_POLY1305_IV_LEN);
+    for (int i = 0; i < S2N_TLS_SEQUENCE_NUM_LEN; i++) {
+        nonce[S2N_TLS_CHACHA20_POLY1305_IV_LEN - S2N_TLS_SEQUENCE_NUM_LEN + i] ^= sequence_number[i];
+    }
+
+    return S2N_TLS_CHACHA20_POLY1305_IV_LEN;
+}
+
+static int s2n_record_aead_write(struct s2n_connection *conn, struct s2n_crypto_parameters *params, uint8_t content_type,
+                                 const struct iovec *in, int in_count, size_t offs, uint16_t data_bytes_to_take)
+{
+    const struct s2n_record_protection *protection = params->record_protection;
+    const struct s2n_cipher *cipher = params->cipher_suite->record_alg->cipher;
+
+    uint8_t *sequence_number = params->server_sequence_number;
+    struct s2n_session_key *session_key = &params->server_key;
+    uint8_t *implicit_iv = params->server_implicit_iv;
+    if (conn->mode == S2N_CLIENT) {
+        sequence_number = params->client_sequence_number;
+        session_key = &params->client_key;
+        implicit_iv = params->client_implicit_iv;
+    }
+
+    /* RFC 5246 6.1: sequence numbers can't wrap */
+    uint64_t seq = s2n_load_be64(sequence_number);
+    S2N_ERROR_IF(seq == UINT64_MAX, S2N_ERR_RECORD_LIMIT);
+
+    /* Claim the whole record up front: header | explicit IV | payload | tag */
+    uint16_t fragment_length = protection->overhead + data_bytes_to_take;
+    uint8_t *record = s2n_stuffer_raw_write(&conn->out, S2N_TLS_RECORD_HEADER_LENGTH + fragment_length);
+    notnull_check(record);
+
+    record[0] = content_type;
+    record[1] = conn->actual_protocol_version / 10;
+    record[2] = conn->actual_protocol_version % 10;
+    record[3] = fragment_length >> 8;
+    record[4] = fragment_length & 0xff;
+
+    uint8_t *explicit_iv = record + S2N_TLS_RECORD_HEADER_LENGTH;
+    uint8_t *payload = explicit_iv + protection->explicit_iv_size;
+
+    /* s2n uses the sequence number as the explicit part of the nonce */
+    if (protection->explicit_iv_size) {
+        memcpy(explicit_iv, sequence_number, S2N_TLS_SEQUENCE_NUM_LEN);
+    }
+
+    /* Gather the plaintext, unless it's already been put in place */
+    if (in) {
+        uint8_t *p = payload;
+        uint16_t data_bytes_left = data_bytes_to_take;
+        for (int i = 0; i < in_count && data_bytes_left; i++) {
+            if (offs >= in[i].iov_len) {
+                offs -= in[i].iov_len;
+                continue;
+            }
+
+            uint16_t n = MIN(in[i].iov_len - offs, data_bytes_left);
+            memcpy(p, (uint8_t *) in[i].iov_base + offs, n);
+            offs = 0;
+
+            p += n;
+            data_bytes_left -= n;
+        }
+    }
+
+    uint8_t nonce[S2N_TLS_MAX_IV_LEN];
+    uint8_t aad[S2N_TLS12_AAD_LEN];
+    struct s2n_blob iv = {.data = nonce,.size = protection->nonce(implicit_iv, sequence_number, nonce) };
+    struct s2n_blob ad = {.data = aad,.size = sizeof(aad) };
+    struct s2n_blob en = {.data = payload,.size = data_bytes_to_take + cipher->io.aead.tag_size };
+    s2n_aead_record_aad(aad, seq, content_type, conn->actual_protocol_version, data_bytes_to_take);
+
+    GUARD(cipher->io.aead.encrypt(session_key, &iv, &ad, &en, &en));
+
+    s2n_store_be64(sequence_number, seq + 1);
+
+    conn->wire_bytes_out += S2N_TLS_RECORD_HEADER_LENGTH + fragment_length;
+    return data_bytes_to_take;
+}
+
+/* Check the header of the record in conn->in, and work out where the
+ * ciphertext is. Nothing is consumed from conn->in.
+ */
+static int s2n_record_aead_open_header(struct s2n_connection *conn, const struct s2n_record_protection *protection,
+                                       uint8_t *content_type, uint16_t *payload_length)
+{
+    uint16_t fragment_length;
+    GUARD(s2n_record_header_parse(conn, content_type, &fragment_length));
+
+    /* There has to be room for the explicit IV and the tag */
+    S2N_ERROR_IF(fragment_length < protection->overhead || s2n_stuffer_data_available(&conn->in) < fragment_length, S2N_ERR_BAD_MESSAGE);
+    *payload_length = fragment_length - protection->overhead;
+
+    return 0;
+}
+
+/* Decrypt and authenticate the record in conn->in into out, which may be
+ * the ciphertext itself.
+ */
+static int s2n_record_aead_open(struct s2n_connection *conn, struct s2n_crypto_parameters *params, uint8_t content_type,
+                                uint16_t payload_length, uint8_t *out)
+{
+    const struct s2n_record_protection *protection = params->record_protection;
+    const struct s2n_cipher *cipher = params->cipher_suite->record_alg->cipher;
+
+    uint8_t *sequence_number = params->client_sequence_number;
+    struct s2n_session_key *session_key = &params->client_key;
+    uint8_t *implicit_iv = params->client_implicit_iv;
+    if (conn->mode == S2N_CLIENT) {
+        sequence_number = params->server_sequence_number;
+        session_key = &params->server_key;
+        implicit_iv = params->server_implicit_iv;
+    }
+
+    uint64_t seq = s2n_load_be64(sequence_number);
+    S2N_ERROR_IF(seq == UINT64_MAX, S2N_ERR_RECORD_LIMIT);
+
+    uint8_t *explicit_iv = conn->in.blob.data + conn->in.read_cursor;
+    uint8_t *ciphertext = explicit_iv + protection->explicit_iv_size;
+
+    uint8_t nonce[S2N_TLS_MAX_IV_LEN];
+    uint8_t aad[S2N_TLS12_AAD_LEN];
+    struct s2n_blob iv = {.data = nonce,.size = protection->nonce(implicit_iv, protection->explicit_iv_size ? explicit_iv : sequence_number, nonce) };
+    struct s2n_blob ad = {.data = aad,.size = sizeof(aad) };
+    struct s2n_blob en = {.data = ciphertext,.size = payload_length + cipher->io.aead.tag_size };
+    struct s2n_blob pt = {.data = out,.size = out == ciphertext ? en.size : payload_length };
+    s2n_aead_record_aad(aad, seq, content_type, conn->actual_protocol_version, payload_length);
+
+    GUARD(cipher->io.aead.decrypt(session_key, &iv, &ad, &en, &pt));
+
+    s2n_store_be64(sequence_number, seq + 1);
+
+    return 0;
+}
+
+static int s2n_record_aead_parse(struct s2n_connection *conn, struct s2n_crypto_parameters *params)
+{
+    const struct s2n_record_protection *protection = params->record_protection;
+    const struct s2n_cipher *cipher = params->cipher_suite->record_alg->cipher;
+
+    uint8_t content_type;
+    uint16_t payload_length;
+    GUARD(s2n_record_aead_open_header(conn, protection, &content_type, &payload_length));
+
+    uint8_t *header = s2n_stuffer_raw_read(&conn->header_in, S2N_TLS_RECORD_HEADER_LENGTH);
+    notnull_check(header);
+
+    /* Decrypt in place */
+    uint8_t *ciphertext = conn->in.blob.data + conn->in.read_cursor + protection->explicit_iv_size;
+    GUARD(s2n_record_aead_open(conn, params, content_type, payload_length, ciphertext));
+
+    /* Leave the payload length in the header, as the generic code does */
+    header[3] = payload_length >> 8;
+    header[4] = payload_length & 0xff;
+    GUARD(s2n_stuffer_reread(&conn->header_in));
+
+    /* The payload is all that's left to read; wipe the tag */
+    GUARD(s2n_stuffer_skip_read(&conn->in, protection->explicit_iv_size));
+    GUARD(s2n_stuffer_wipe_n(&conn->in, cipher->io.aead.tag_size));
+    conn->in_status = PLAINTEXT;
+
+    return 0;
+}
+
+static int s2n_record_aead_parse_into(struct s2n_connection *conn, struct s2n_crypto_parameters *params, uint8_t *out, uint32_t out_size)
+{
+    const struct s2n_record_protection *protection = params->record_protection;
+
+    uint8_t content_type;
+    uint16_t payload_length;
+    GUARD(s2n_record_aead_open_header(conn, protection, &content_type, &payload_length));
+    S2N_ERROR_IF(payload_length > out_size, S2N_ERR_SIZE_MISMATCH);
+
+    /* The plaintext never touches conn->in, so there's nothing to wipe
+     * there. The caller's buffer may hold unauthenticated plaintext if
+     * decryption fails though, so clear it in that case.
+     */
+    if (s2n_record_aead_open(conn, params, content_type, payload_length, out) < 0) {
+        memset(out, 0, payload_length);
+        return -1;
+    }
+
+    /* Done with the ciphertext */
+    GUARD(s2n_stuffer_wipe(&conn->header_in));
+    GUARD(s2n_stuffer_rewrite(&conn->in));
+
+    return payload_length;
+}
+
+const struct s2n_record_protection s2n_record_aes_gcm_protection = {
+    .explicit_iv_size = S2N_TLS_GCM_EXPLICIT_IV_LEN,
+    .overhead = S2N_TLS_GCM_EXPLICIT_IV_LEN + S2N_TLS_GCM_TAG_LEN,
+    .nonce = s2n_aes_gcm_nonce,
+    .write = s2n_record_aead_write,
+    .parse = s2n_record_aead_parse,
+    .parse_into = s2n_record_aead_parse_into,
+};
+
+const struct s2n_record_protection s2n_record_chacha20_poly1305_protection = {
+    .explicit_iv_size = S2N_TLS_CHACHA20_POLY1305_EXPLICIT_IV_LEN,
+    .overhead = S2N_TLS_CHACHA20_POLY1305_EXPLICIT_IV_LEN + S2N_TLS_CHACHA20_POLY1305_TAG_LEN,
+    .nonce = s2n_chacha20_poly1305_nonce,
+    .write = s2n_record_aead_write,
+    .parse = s2n_record_aead_parse,
+    .parse_into = s2n_record_aead_parse_into,
+};
+
+int s2n_record_bind_protection(struct s2n_connection *conn)
+{
+    const struct s2n_record_algorithm *record_alg = conn->secure.cipher_suite->record_alg;
+
+    conn->secure.record_protection = NULL;
+
+    /* AEAD records are only ever TLS1.2 */
+    if (record_alg->cipher->type != S2N_AEAD || conn->actual_protocol_version != S2N_TLS12) {
+        return 0;
+    }
+
+    if (record_alg->flags & S2N_TLS12_AES_GCM_AEAD_NONCE) {
+        eq_check(record_alg->cipher->io.aead.record_iv_size, S2N_TLS_GCM_EXPLICIT_IV_LEN);
+        eq_check(record_alg->cipher->io.aead.tag_size, S2N_TLS_GCM_TAG_LEN);
+        conn->secure.record_protection = &s2n_record_aes_gcm_protection;
+    } else if (record_alg->flags & S2N_TLS12_CHACHA_POLY_AEAD_NONCE) {
+        eq_check(record_alg->cipher->io.aead.record_iv_size, S2N_TLS_CHACHA20_POLY1305_EXPLICIT_IV_LEN);
+        eq_check(record_alg->cipher->io.aead.tag_size, S2N_TLS_CHACHA20_POLY1305_TAG_LEN);
+        conn->secure.record_protection = &s2n_record_chacha20_poly1305_protection;
+    }
+
+    return 0;
+}
@@ -92,6 +92,45 @@ int s2n_record_header_parse(struct s2n_connection *conn, uint8_t * content_type,
     return 0;
 }
 
+/* Can the record in conn->in be decrypted straight into a buffer of
+ * out_size bytes, without going through conn->in?
+ */
+int s2n_record_can_parse_into(struct s2n_connection *conn, uint32_t out_size)
+{
+    struct s2n_crypto_parameters *active = conn->client;
+
+    if (conn->mode == S2N_CLIENT) {
+        active = conn->server;
+    }
+
+    if (active->record_protection == NULL || active->record_protection->parse_into == NULL) {
+        return 0;
+    }
+
+    uint8_t *header = conn->header_in.blob.data;
+    uint16_t fragment_length = (header[3] << 8) | header[4];
+
+    return fragment_length >= active->record_protection->overhead
+        && fragment_length - active->record_protection->overhead <= out_size;
+}
+
+/* Decrypt the record in conn->in into out, leaving conn->in empty. Returns
+ * the number of plaintext bytes.
+ */
+int s2n_record_parse_into(struct s2n_connection *conn, uint8_t *out, uint32_t out_size)
+{
+    struct s2n_crypto_parameters *active = conn->client;
+
+    if (conn->mode == S2N_CLIENT) {
+        active = conn->server;
+    }
+
+    notnull_check(active->record_protection);
+    notnull_check(active->record_protection->parse_into);
+
+    return active->record_protection->parse_into(conn, active, out, out_size);
+}
+
 int s2n_record_parse(struct s2n_connection *conn)
 {
     struct s2n_blob iv;
@@ -117,6 +156,16 @@ int s2n_record_parse(struct s2n_connection *conn)
         implicit_iv = conn->server->server_implicit_iv;
     }
 
+    struct s2n_crypto_parameters *active = conn->client;
+
+    if (conn->mode == S2N_CLIENT) {
+        active = conn->server;
+    }
+
+    if (active->record_protection) {
+        return active->record_protection->parse(conn, active);
+    }
+
     GUARD(s2n_record_header_parse(conn, &content_type, &fragment_length));
 
     /* Add the header to the HMAC */
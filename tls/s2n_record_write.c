@@ -15,6 +15,9 @@
 
 #include <stdint.h>
 #include <sys/param.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include "error/s2n_errno.h"
 
@@ -62,9 +65,8 @@ static uint16_t overhead(struct s2n_connection *conn)
     return extra;
 }
 
-int s2n_record_max_write_payload_size(struct s2n_connection *conn)
+static int s2n_record_write_payload_size(struct s2n_connection *conn, uint16_t max_fragment_size)
 {
-    uint16_t max_fragment_size = conn->max_outgoing_fragment_length;
     struct s2n_crypto_parameters *active = conn->server;
 
     if (conn->mode == S2N_CLIENT) {
@@ -85,7 +87,51 @@ int s2n_record_max_write_payload_size(struct s2n_connection *conn)
     return max_fragment_size - overhead(conn);
 }
 
-int s2n_record_write(struct s2n_connection *conn, uint8_t content_type, struct s2n_blob *in)
+int s2n_record_max_write_payload_size(struct s2n_connection *conn)
+{
+    return s2n_record_write_payload_size(conn, conn->max_outgoing_fragment_length);
+}
+
+int s2n_record_min_write_payload_size(struct s2n_connection *conn)
+{
+    /* Small enough for the whole record to fit in a single TCP segment */
+    return s2n_record_write_payload_size(conn, MIN(S2N_SMALL_FRAGMENT_LENGTH, conn->max_outgoing_fragment_length));
+}
+
+int s2n_record_max_write_size(struct s2n_connection *conn)
+{
+    /* The header, plus the fragment, plus up to one block of padding that
+     * composite ciphers may add on top of the fragment length.
+     */
+    return S2N_TLS_RECORD_HEADER_LENGTH + conn->max_outgoing_fragment_length + S2N_TLS_MAX_IV_LEN;
+}
+
+/* How many bytes of explicit IV sit between the record header and the plaintext? */
+static uint16_t s2n_record_explicit_iv_size(struct s2n_connection *conn)
+{
+    struct s2n_crypto_parameters *active = conn->server;
+
+    if (conn->mode == S2N_CLIENT) {
+        active = conn->client;
+    }
+
+    switch (active->cipher_suite->record_alg->cipher->type) {
+        case S2N_AEAD:
+            return active->cipher_suite->record_alg->cipher->io.aead.record_iv_size;
+        case S2N_CBC:
+            return conn->actual_protocol_version > S2N_TLS10 ? active->cipher_suite->record_alg->cipher->io.cbc.block_size : 0;
+        case S2N_COMPOSITE:
+            return conn->actual_protocol_version > S2N_TLS10 ? active->cipher_suite->record_alg->cipher->io.comp.block_size : 0;
+        default:
+            return 0;
+    }
+}
+
+/* Write and encrypt a record of data_bytes_to_take bytes, taken from the
+ * iovecs past offs. If in is NULL, the plaintext has already been put where
+ * it belongs in conn->out and is encrypted in place.
+ */
+static int s2n_record_write_fragment(struct s2n_connection *conn, uint8_t content_type, const struct iovec *in, int in_count, size_t offs, uint16_t data_bytes_to_take)
 {
     struct s2n_blob out, iv, aad;
     uint8_t padding = 0;
@@ -94,6 +140,16 @@ int s2n_record_write(struct s2n_connection *conn, uint8_t content_type, struct s
     uint8_t aad_gen[S2N_TLS_MAX_AAD_LEN] = { 0 };
     uint8_t aad_iv[S2N_TLS_MAX_IV_LEN] = { 0 };
 
+    struct s2n_crypto_parameters *active = conn->server;
+
+    if (conn->mode == S2N_CLIENT) {
+        active = conn->client;
+    }
+
+    if (active->record_protection) {
+        return active->record_protection->write(conn, active, content_type, in, in_count, offs, data_bytes_to_take);
+    }
+
     uint8_t *sequence_number = conn->server->server_sequence_number;
     struct s2n_hmac_state *mac = &conn->server->server_record_mac;
     struct s2n_session_key *session_key = &conn->server->server_key;
@@ -108,16 +164,14 @@ int s2n_record_write(struct s2n_connection *conn, uint8_t content_type, struct s
         implicit_iv = conn->client->client_implicit_iv;
     }
 
-    S2N_ERROR_IF(s2n_stuffer_data_available(&conn->out), S2N_ERR_BAD_MESSAGE);
+    /* Records are appended to conn->out, so that several of them can be
+     * flushed with a single write. Remember where this one starts.
+     */
+    uint32_t record_start = conn->out.write_cursor;
 
     uint8_t mac_digest_size;
     GUARD(s2n_hmac_digest_size(mac->alg, &mac_digest_size));
 
-    /* Before we do anything, we need to figure out what the length of the
-     * fragment is going to be.
-     */
-    uint16_t data_bytes_to_take = MIN(in->size, s2n_record_max_write_payload_size(conn));
-
     uint16_t extra = overhead(conn);
 
     /* If we have padding to worry about, figure that out too */
@@ -142,12 +196,13 @@ int s2n_record_write(struct s2n_connection *conn, uint8_t content_type, struct s
     /* First write a header that has the payload length, this is for the MAC */
     GUARD(s2n_stuffer_write_uint16(&conn->out, data_bytes_to_take));
 
+    uint8_t *header = conn->out.blob.data + record_start;
     if (conn->actual_protocol_version > S2N_SSLv3) {
-        GUARD(s2n_hmac_update(mac, conn->out.blob.data, S2N_TLS_RECORD_HEADER_LENGTH));
+        GUARD(s2n_hmac_update(mac, header, S2N_TLS_RECORD_HEADER_LENGTH));
     } else {
         /* SSLv3 doesn't include the protocol version in the MAC */
-        GUARD(s2n_hmac_update(mac, conn->out.blob.data, 1));
-        GUARD(s2n_hmac_update(mac, conn->out.blob.data + 3, 2));
+        GUARD(s2n_hmac_update(mac, header, 1));
+        GUARD(s2n_hmac_update(mac, header + 3, 2));
     }
 
     /* Compute non-payload parts of the MAC(seq num, type, proto vers, fragment length) for composite ciphers.
@@ -220,11 +275,33 @@ int s2n_record_write(struct s2n_connection *conn, uint8_t content_type, struct s
     struct s2n_blob seq = {.data = sequence_number,.size = S2N_TLS_SEQUENCE_NUM_LEN };
     GUARD(s2n_increment_sequence_number(&seq));
 
-    /* Write the plaintext data */
-    out.data = in->data;
-    out.size = data_bytes_to_take;
-    GUARD(s2n_stuffer_write(&conn->out, &out));
-    GUARD(s2n_hmac_update(mac, out.data, out.size));
+    /* Plaintext that's already in place only needs to be MACed */
+    if (in == NULL) {
+        eq_check(conn->out.write_cursor, record_start + S2N_TLS_RECORD_HEADER_LENGTH + s2n_record_explicit_iv_size(conn));
+
+        out.data = s2n_stuffer_raw_write(&conn->out, data_bytes_to_take);
+        notnull_check(out.data);
+        GUARD(s2n_hmac_update(mac, out.data, data_bytes_to_take));
+    }
+
+    /* Write the plaintext data, which may be spread across several buffers.
+     * Skip over the buffers (or parts of them) that have already been sent.
+     */
+    uint16_t data_bytes_left = in ? data_bytes_to_take : 0;
+    for (int i = 0; i < in_count && data_bytes_left; i++) {
+        if (offs >= in[i].iov_len) {
+            offs -= in[i].iov_len;
+            continue;
+        }
+
+        out.data = (uint8_t *) in[i].iov_base + offs;
+        out.size = MIN(in[i].iov_len - offs, data_bytes_left);
+        offs = 0;
+
+        GUARD(s2n_stuffer_write(&conn->out, &out));
+        GUARD(s2n_hmac_update(mac, out.data, out.size));
+        data_bytes_left -= out.size;
+    }
 
     /* Write the digest */
     uint8_t *digest = s2n_stuffer_raw_write(&conn->out, mac_digest_size);
@@ -242,8 +319,8 @@ int s2n_record_write(struct s2n_connection *conn, uint8_t content_type, struct s
         }
     }
 
-    /* Rewind to rewrite/encrypt the packet */
-    GUARD(s2n_stuffer_rewrite(&conn->out));
+    /* Rewind to the start of this record to rewrite/encrypt the packet */
+    conn->out.write_cursor = record_start;
 
     /* Skip the header */
     GUARD(s2n_stuffer_skip_write(&conn->out, S2N_TLS_RECORD_HEADER_LENGTH));
@@ -310,3 +387,55 @@ int s2n_record_write(struct s2n_connection *conn, uint8_t content_type, struct s
     conn->wire_bytes_out += actual_fragment_length + S2N_TLS_RECORD_HEADER_LENGTH;
     return data_bytes_to_take;
 }
+
+int s2n_record_writev(struct s2n_connection *conn, uint8_t content_type, const struct iovec *in, int in_count, size_t offs, size_t to_write)
+{
+    /* Before we do anything, we need to figure out what the length of the
+     * fragment is going to be.
+     */
+    uint16_t data_bytes_to_take = MIN(to_write, s2n_record_max_write_payload_size(conn));
+
+    /* Make sure the buffers actually hold that much data past the offset,
+     * looking no further than the buffers this record will take from.
+     */
+    S2N_ERROR_IF(offs > SIZE_MAX - data_bytes_to_take, S2N_ERR_SIZE_MISMATCH);
+    size_t data_bytes_available = 0;
+    for (int i = 0; i < in_count && data_bytes_available < offs + data_bytes_to_take; i++) {
+        data_bytes_available += in[i].iov_len;
+    }
+    S2N_ERROR_IF(data_bytes_available < offs + data_bytes_to_take, S2N_ERR_SIZE_MISMATCH);
+
+    return s2n_record_write_fragment(conn, content_type, in, in_count, offs, data_bytes_to_take);
+}
+
+int s2n_record_write_fd(struct s2n_connection *conn, uint8_t content_type, int fd, off_t offset, size_t to_write)
+{
+    uint16_t data_bytes_to_take = MIN(to_write, s2n_record_max_write_payload_size(conn));
+
+    /* Read the file straight into the spot the plaintext will take up in the
+     * record, so that it's encrypted in place. Nothing is committed to the
+     * stuffer until the whole fragment has been read.
+     */
+    uint32_t plaintext_start = S2N_TLS_RECORD_HEADER_LENGTH + s2n_record_explicit_iv_size(conn);
+    S2N_ERROR_IF(s2n_stuffer_space_remaining(&conn->out) < s2n_record_max_write_size(conn), S2N_ERR_STUFFER_IS_FULL);
+    uint8_t *plaintext = conn->out.blob.data + conn->out.write_cursor + plaintext_start;
+
+    uint16_t bytes_read = 0;
+    while (bytes_read < data_bytes_to_take) {
+        ssize_t r = pread(fd, plaintext + bytes_read, data_bytes_to_take - bytes_read, offset + bytes_read);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        S2N_ERROR_IF(r < 0, S2N_ERR_IO);
+        S2N_ERROR_IF(r == 0, S2N_ERR_SENDFILE_EOF);
+        bytes_read += r;
+    }
+
+    return s2n_record_write_fragment(conn, content_type, NULL, 0, 0, data_bytes_to_take);
+}
+
+int s2n_record_write(struct s2n_connection *conn, uint8_t content_type, struct s2n_blob *in)
+{
+    struct iovec iov = {.iov_base = in->data, .iov_len = in->size };
+    return s2n_record_writev(conn, content_type, &iov, 1, 0, in->size);
+}
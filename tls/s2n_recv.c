@@ -25,7 +25,9 @@
 #include "error/s2n_errno.h"
 
 #include "tls/s2n_connection.h"
+#include "tls/s2n_connection_buffers.h"
 #include "tls/s2n_handshake.h"
+#include "tls/s2n_ktls.h"
 #include "tls/s2n_record.h"
 #include "tls/s2n_resume.h"
 #include "tls/s2n_alerts.h"
@@ -37,30 +39,52 @@
 #include "utils/s2n_safety.h"
 #include "utils/s2n_blob.h"
 
-int s2n_read_full_record(struct s2n_connection *conn, uint8_t * record_type, int *isSSLv2)
+/* Top up the read-ahead buffer with as much as the peer has sent, in a single call */
+static int s2n_read_ahead_fill(struct s2n_connection *conn, uint32_t needed)
 {
-    int r;
+    GUARD(s2n_stuffer_rewrite(&conn->buffer_in));
 
-    *isSSLv2 = 0;
+    if (s2n_connection_is_managed_corked(conn)) {
+        GUARD(s2n_socket_set_read_size(conn, needed));
+    }
 
-    /* If the record has already been decrypted, then leave it alone */
-    if (conn->in_status == PLAINTEXT) {
-        /* Only application data packets count as plaintext */
-        *record_type = TLS_APPLICATION_DATA;
-        return 0;
+    int r = s2n_connection_recv_stuffer(&conn->buffer_in, conn, conn->buffer_in.blob.size);
+    if (r == 0) {
+        s2n_connection_set_closed(conn);
+        S2N_ERROR(S2N_ERR_CLOSED);
+    } else if (r < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            S2N_ERROR(S2N_ERR_BLOCKED);
+        }
+        S2N_ERROR(S2N_ERR_IO);
     }
+    conn->wire_bytes_in += r;
 
-    /* Read the record until we at least have a header */
-    while (s2n_stuffer_data_available(&conn->header_in) < S2N_TLS_RECORD_HEADER_LENGTH) {
-        int remaining = S2N_TLS_RECORD_HEADER_LENGTH - s2n_stuffer_data_available(&conn->header_in);
+    return 0;
+}
+
+/* Read until the stuffer holds length bytes of the current record */
+static int s2n_read_in_bytes(struct s2n_connection *conn, struct s2n_stuffer *output, uint32_t length)
+{
+    while (s2n_stuffer_data_available(output) < length) {
+        uint32_t remaining = length - s2n_stuffer_data_available(output);
+
+        if (conn->buffer_in.blob.size) {
+            if (s2n_stuffer_data_available(&conn->buffer_in) == 0) {
+                GUARD(s2n_read_ahead_fill(conn, remaining));
+            }
+
+            GUARD(s2n_stuffer_copy(&conn->buffer_in, output, MIN(remaining, s2n_stuffer_data_available(&conn->buffer_in))));
+            continue;
+        }
 
         if (s2n_connection_is_managed_corked(conn)) {
             GUARD(s2n_socket_set_read_size(conn, remaining));
         }
-        r = s2n_connection_recv_stuffer(&conn->header_in, conn, remaining);
 
+        int r = s2n_connection_recv_stuffer(output, conn, remaining);
         if (r == 0) {
-            conn->closed = 1;
+            s2n_connection_set_closed(conn);
             S2N_ERROR(S2N_ERR_CLOSED);
         } else if (r < 0) {
             if (errno == EWOULDBLOCK || errno == EAGAIN) {
@@ -70,6 +94,90 @@ int s2n_read_full_record(struct s2n_connection *conn, uint8_t * record_type, int
         }
         conn->wire_bytes_in += r;
     }
+
+    return 0;
+}
+
+/* Does the read-ahead buffer already hold a whole record? */
+static int s2n_read_ahead_has_record(struct s2n_connection *conn)
+{
+    uint32_t available = s2n_stuffer_data_available(&conn->buffer_in);
+    if (available < S2N_TLS_RECORD_HEADER_LENGTH) {
+        return 0;
+    }
+
+    uint8_t *header = conn->buffer_in.blob.data + conn->buffer_in.read_cursor;
+    uint16_t fragment_length = (header[3] << 8) | header[4];
+
+    return available >= S2N_TLS_RECORD_HEADER_LENGTH + fragment_length;
+}
+
+/* Alerts received through the kernel are handled the same way as decrypted ones */
+static int s2n_ktls_process_alert(struct s2n_connection *conn, uint8_t *data, uint32_t size)
+{
+    struct s2n_blob alert = {.data = data,.size = size };
+    GUARD(s2n_stuffer_write(&conn->in, &alert));
+
+    int r = s2n_process_alert_fragment(conn);
+    GUARD(s2n_stuffer_wipe(&conn->in));
+
+    return r;
+}
+
+static ssize_t s2n_recv_ktls(struct s2n_connection *conn, uint8_t *buf, ssize_t size, s2n_blocked_status * blocked)
+{
+    *blocked = S2N_BLOCKED_ON_READ;
+
+    while (size && !s2n_connection_is_closed(conn)) {
+        uint8_t record_type;
+        ssize_t r = s2n_ktls_recv(conn, buf, size, &record_type);
+        if (r < 0) {
+            if (s2n_errno == S2N_ERR_CLOSED) {
+                *blocked = S2N_NOT_BLOCKED;
+                GUARD(s2n_connection_wipe(conn));
+                return 0;
+            }
+            return -1;
+        }
+
+        if (record_type == TLS_APPLICATION_DATA) {
+            *blocked = S2N_NOT_BLOCKED;
+            return r;
+        }
+
+        /* Anything else landed in the caller's buffer, so don't leave it there */
+        int rc = 0;
+        if (record_type == TLS_ALERT) {
+            rc = s2n_ktls_process_alert(conn, buf, r);
+        }
+        memset_check(buf, 0, r);
+        GUARD(rc);
+    }
+
+    *blocked = S2N_NOT_BLOCKED;
+    return 0;
+}
+
+/* Read a whole record, and decrypt it. Application data that fits in direct
+ * is decrypted straight into it, if the cipher allows, and *direct_bytes
+ * says how much of it there was; otherwise *direct_bytes is -1 and the
+ * plaintext is left in conn->in.
+ */
+static int s2n_read_record(struct s2n_connection *conn, uint8_t * record_type, int *isSSLv2, uint8_t * direct, uint32_t direct_size, int *direct_bytes)
+{
+    *isSSLv2 = 0;
+    *direct_bytes = -1;
+
+    /* If the record has already been decrypted, then leave it alone */
+    if (conn->in_status == PLAINTEXT) {
+        /* Only application data packets count as plaintext */
+        *record_type = TLS_APPLICATION_DATA;
+        return 0;
+    }
+
+    /* Read the record until we at least have a header */
+    GUARD(s2n_read_in_bytes(conn, &conn->header_in, S2N_TLS_RECORD_HEADER_LENGTH));
+
     uint16_t fragment_length;
 
     /* If the first bit is set then this is an SSLv2 record */
@@ -89,28 +197,22 @@ int s2n_read_full_record(struct s2n_connection *conn, uint8_t * record_type, int
     }
 
     /* Read enough to have the whole record */
-    while (s2n_stuffer_data_available(&conn->in) < fragment_length) {
-        int remaining = fragment_length - s2n_stuffer_data_available(&conn->in);
+    GUARD(s2n_read_in_bytes(conn, &conn->in, fragment_length));
 
-        if (s2n_connection_is_managed_corked(conn)) {
-            GUARD(s2n_socket_set_read_size(conn, remaining));
-        }
+    if (*isSSLv2) {
+        return 0;
+    }
 
-        r = s2n_connection_recv_stuffer(&conn->in, conn, remaining);
+    /* Decrypt application data straight into the caller's buffer, skipping
+     * the copy out of conn->in and the wipe that follows it.
+     */
+    if (direct && *record_type == TLS_APPLICATION_DATA && s2n_record_can_parse_into(conn, direct_size)) {
+        if ((*direct_bytes = s2n_record_parse_into(conn, direct, direct_size)) < 0) {
+            GUARD(s2n_connection_kill(conn));
 
-        if (r == 0) {
-            conn->closed = 1;
-            S2N_ERROR(S2N_ERR_CLOSED);
-        } else if (r < 0) {
-            if (errno == EWOULDBLOCK || errno == EAGAIN) {
-                S2N_ERROR(S2N_ERR_BLOCKED);
-            }
-            S2N_ERROR(S2N_ERR_IO);
+            return -1;
         }
-        conn->wire_bytes_in += r;
-    }
 
-    if (*isSSLv2) {
         return 0;
     }
 
@@ -124,22 +226,83 @@ int s2n_read_full_record(struct s2n_connection *conn, uint8_t * record_type, int
     return 0;
 }
 
+int s2n_read_full_record(struct s2n_connection *conn, uint8_t * record_type, int *isSSLv2)
+{
+    int direct_bytes;
+
+    return s2n_read_record(conn, record_type, isSSLv2, NULL, 0, &direct_bytes);
+}
+
+/* Records that aren't application data are dealt with and dropped */
+static int s2n_recv_discard_record(struct s2n_connection *conn, uint8_t record_type, s2n_blocked_status * blocked)
+{
+    if (record_type == TLS_ALERT) {
+        GUARD(s2n_process_alert_fragment(conn));
+        GUARD(s2n_flush(conn, blocked));
+    }
+
+    GUARD(s2n_stuffer_wipe(&conn->header_in));
+    GUARD(s2n_stuffer_wipe(&conn->in));
+    conn->in_status = ENCRYPTED;
+
+    return 0;
+}
+
+/* A session that failed part way through shouldn't be resumed */
+static void s2n_recv_uncache_on_error(struct s2n_connection *conn)
+{
+    if (s2n_errno != S2N_ERR_BLOCKED && s2n_allowed_to_cache_connection(conn) && conn->session_id_len) {
+        conn->config->cache_delete(conn->config->cache_delete_data, conn->session_id, conn->session_id_len);
+    }
+}
+
+/* Once some data has been read, an error in a later record doesn't lose it:
+ * the data is returned, and the error is kept for the next call to report.
+ */
+static ssize_t s2n_recv_error(struct s2n_connection *conn, ssize_t bytes_read, s2n_blocked_status * blocked)
+{
+    if (s2n_errno == S2N_ERR_BLOCKED && bytes_read) {
+        s2n_errno = S2N_ERR_OK;
+        return bytes_read;
+    }
+
+    s2n_recv_uncache_on_error(conn);
+
+    if (bytes_read && s2n_errno != S2N_ERR_BLOCKED) {
+        conn->recv_deferred_errno = s2n_errno;
+        s2n_errno = S2N_ERR_OK;
+        *blocked = S2N_NOT_BLOCKED;
+        return bytes_read;
+    }
+
+    return -1;
+}
+
 ssize_t s2n_recv(struct s2n_connection * conn, void *buf, ssize_t size, s2n_blocked_status * blocked)
 {
     ssize_t bytes_read = 0;
     struct s2n_blob out = {.data = (uint8_t *) buf };
 
-    if (conn->closed) {
+    S2N_ERROR_IF(conn->recv_deferred_errno, conn->recv_deferred_errno);
+
+    if (s2n_connection_is_closed(conn)) {
         GUARD(s2n_connection_wipe(conn));
         return 0;
     }
 
+    if (conn->ktls_recv_enabled) {
+        return s2n_recv_ktls(conn, buf, size, blocked);
+    }
+
+    GUARD(s2n_connection_acquire_buffers(conn));
+
     *blocked = S2N_BLOCKED_ON_READ;
 
-    while (size && !conn->closed) {
+    while (size && !s2n_connection_is_closed(conn)) {
         int isSSLv2 = 0;
         uint8_t record_type;
-        int r = s2n_read_full_record(conn, &record_type, &isSSLv2);
+        int direct_bytes;
+        int r = s2n_read_record(conn, &record_type, &isSSLv2, out.data, size, &direct_bytes);
         if (r < 0) {
             if (s2n_errno == S2N_ERR_CLOSED) {
                 *blocked = S2N_NOT_BLOCKED;
@@ -151,51 +314,41 @@ ssize_t s2n_recv(struct s2n_connection * conn, void *buf, ssize_t size, s2n_bloc
                 }
             }
 
-            /* Don't propagate the error if we already read some bytes */
-            if (s2n_errno == S2N_ERR_BLOCKED && bytes_read) {
-                s2n_errno = S2N_ERR_OK;
-                return bytes_read;
-            }
-
-            /* If we get here, it's an error condition */
-            if (s2n_errno != S2N_ERR_BLOCKED && s2n_allowed_to_cache_connection(conn) && conn->session_id_len) {
-                conn->config->cache_delete(conn->config->cache_delete_data, conn->session_id, conn->session_id_len);
-            }
-
-            return -1;
+            return s2n_recv_error(conn, bytes_read, blocked);
         }
 
         S2N_ERROR_IF(isSSLv2, S2N_ERR_BAD_MESSAGE);
 
         if (record_type != TLS_APPLICATION_DATA) {
-            if (record_type == TLS_ALERT) {
-                GUARD(s2n_process_alert_fragment(conn));
-                GUARD(s2n_flush(conn, blocked));
+            if (s2n_recv_discard_record(conn, record_type, blocked) < 0) {
+                return s2n_recv_error(conn, bytes_read, blocked);
             }
-
-            GUARD(s2n_stuffer_wipe(&conn->header_in));
-            GUARD(s2n_stuffer_wipe(&conn->in));
-            conn->in_status = ENCRYPTED;
             continue;
         }
 
-        out.size = MIN(size, s2n_stuffer_data_available(&conn->in));
-
-        GUARD(s2n_stuffer_erase_and_read(&conn->in, &out));
+        if (direct_bytes >= 0) {
+            /* Already decrypted into place, and ready for more encrypted data */
+            out.size = direct_bytes;
+        } else {
+            out.size = MIN(size, s2n_stuffer_data_available(&conn->in));
+            GUARD(s2n_stuffer_erase_and_read(&conn->in, &out));
+        }
         bytes_read += out.size;
 
         out.data += out.size;
         size -= out.size;
 
         /* Are we ready for more encrypted data? */
-        if (s2n_stuffer_data_available(&conn->in) == 0) {
+        if (direct_bytes < 0 && s2n_stuffer_data_available(&conn->in) == 0) {
             GUARD(s2n_stuffer_wipe(&conn->header_in));
             GUARD(s2n_stuffer_wipe(&conn->in));
             conn->in_status = ENCRYPTED;
         }
 
-        /* If we've read some data, return it */
-        if (bytes_read) {
+        /* If we've read some data, return it. Keep going while whole records
+         * are already buffered, as those don't need another trip to the socket.
+         */
+        if (bytes_read && !(size && s2n_read_ahead_has_record(conn))) {
             break;
         }
     }
@@ -207,12 +360,115 @@ ssize_t s2n_recv(struct s2n_connection * conn, void *buf, ssize_t size, s2n_bloc
     return bytes_read;
 }
 
+uint32_t s2n_peek(struct s2n_connection *conn)
+{
+    if (conn->in_status != PLAINTEXT) {
+        return 0;
+    }
+
+    return s2n_stuffer_data_available(&conn->in);
+}
+
+int s2n_recv_borrow(struct s2n_connection *conn, const uint8_t **data, size_t *len, s2n_blocked_status * blocked)
+{
+    notnull_check(conn);
+    notnull_check(data);
+    notnull_check(len);
+
+    *data = NULL;
+    *len = 0;
+
+    S2N_ERROR_IF(conn->recv_deferred_errno, conn->recv_deferred_errno);
+
+    if (s2n_connection_is_closed(conn)) {
+        *blocked = S2N_NOT_BLOCKED;
+        GUARD(s2n_connection_wipe(conn));
+        return 0;
+    }
+
+    /* The kernel decrypts straight into the caller's buffer */
+    S2N_ERROR_IF(conn->ktls_recv_enabled, S2N_ERR_RECV_BORROW_KTLS);
+
+    GUARD(s2n_connection_acquire_buffers(conn));
+
+    *blocked = S2N_BLOCKED_ON_READ;
+
+    while (!s2n_connection_is_closed(conn)) {
+        int isSSLv2 = 0;
+        uint8_t record_type;
+        if (s2n_read_full_record(conn, &record_type, &isSSLv2) < 0) {
+            if (s2n_errno == S2N_ERR_CLOSED) {
+                *blocked = S2N_NOT_BLOCKED;
+                GUARD(s2n_connection_wipe(conn));
+                return 0;
+            }
+
+            s2n_recv_uncache_on_error(conn);
+
+            return -1;
+        }
+
+        S2N_ERROR_IF(isSSLv2, S2N_ERR_BAD_MESSAGE);
+
+        if (record_type != TLS_APPLICATION_DATA) {
+            GUARD(s2n_recv_discard_record(conn, record_type, blocked));
+            continue;
+        }
+
+        /* Skip over empty records */
+        if (s2n_stuffer_data_available(&conn->in) == 0) {
+            GUARD(s2n_recv_discard_record(conn, record_type, blocked));
+            continue;
+        }
+
+        /* Lend out the plaintext where it is */
+        *data = conn->in.blob.data + conn->in.read_cursor;
+        *len = s2n_stuffer_data_available(&conn->in);
+        break;
+    }
+
+    *blocked = S2N_NOT_BLOCKED;
+    return 0;
+}
+
+int s2n_recv_release(struct s2n_connection *conn, size_t consumed)
+{
+    notnull_check(conn);
+
+    uint32_t borrowed = conn->in_status == PLAINTEXT ? s2n_stuffer_data_available(&conn->in) : 0;
+    S2N_ERROR_IF(consumed > borrowed, S2N_ERR_RECV_RELEASE_SIZE);
+
+    GUARD(s2n_stuffer_skip_read(&conn->in, consumed));
+
+    /* Wipe the record once all of it has been consumed */
+    if (conn->in_status == PLAINTEXT && s2n_stuffer_data_available(&conn->in) == 0) {
+        GUARD(s2n_stuffer_wipe(&conn->header_in));
+        GUARD(s2n_stuffer_wipe(&conn->in));
+        conn->in_status = ENCRYPTED;
+    }
+
+    return 0;
+}
+
 int s2n_recv_close_notify(struct s2n_connection *conn, s2n_blocked_status * blocked)
 {
     uint8_t record_type;
     int isSSLv2;
     *blocked = S2N_BLOCKED_ON_READ;
 
+    if (conn->ktls_recv_enabled) {
+        uint8_t alert[S2N_ALERT_LENGTH];
+        ssize_t r;
+        GUARD((r = s2n_ktls_recv(conn, alert, sizeof(alert), &record_type)));
+        S2N_ERROR_IF(record_type != TLS_ALERT, S2N_ERR_SHUTDOWN_RECORD_TYPE);
+
+        /* Only succeeds for an incoming close_notify alert */
+        GUARD(s2n_ktls_process_alert(conn, alert, r));
+
+        *blocked = S2N_NOT_BLOCKED;
+        return 0;
+    }
+
     GUARD(s2n_read_full_record(conn, &record_type, &isSSLv2));
 
     S2N_ERROR_IF(isSSLv2, S2N_ERR_BAD_MESSAGE);
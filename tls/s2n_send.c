@@ -14,14 +14,18 @@
  */
 
 #include <sys/param.h>
+#include <sys/uio.h>
 #include <errno.h>
+#include <limits.h>
 #include <s2n.h>
 
 #include "error/s2n_errno.h"
 
 #include "tls/s2n_cipher_suites.h"
 #include "tls/s2n_connection.h"
+#include "tls/s2n_connection_buffers.h"
 #include "tls/s2n_handshake.h"
+#include "tls/s2n_ktls.h"
 #include "tls/s2n_record.h"
 
 #include "stuffer/s2n_stuffer.h"
@@ -30,6 +34,9 @@
 
 #include "utils/s2n_safety.h"
 #include "utils/s2n_blob.h"
+#include "utils/s2n_timer.h"
+
+#define ONE_S  INT64_C(1000000000)
 
 int s2n_flush(struct s2n_connection *conn, s2n_blocked_status * blocked)
 {
@@ -37,6 +44,8 @@ int s2n_flush(struct s2n_connection *conn, s2n_blocked_status * blocked)
 
     *blocked = S2N_BLOCKED_ON_WRITE;
 
+    GUARD(s2n_connection_acquire_buffers(conn));
+
     /* Write any data that's already pending */
   WRITE:
     while (s2n_stuffer_data_available(&conn->out)) {
@@ -50,8 +59,8 @@ int s2n_flush(struct s2n_connection *conn, s2n_blocked_status * blocked)
         conn->wire_bytes_out += w;
     }
 
-    if (conn->closing) {
-        conn->closed = 1;
+    if (s2n_connection_is_closing(conn)) {
+        s2n_connection_set_closed(conn);
         /* Delay wiping for close_notify. s2n_shutdown() needs to wait for peer's close_notify */
         if (!conn->close_notify_queued) {
             GUARD(s2n_connection_wipe(conn));
@@ -64,9 +73,13 @@ int s2n_flush(struct s2n_connection *conn, s2n_blocked_status * blocked)
         struct s2n_blob alert;
         alert.data = conn->reader_alert_out.blob.data;
         alert.size = 2;
-        GUARD(s2n_record_write(conn, TLS_ALERT, &alert));
+        if (conn->ktls_send_enabled) {
+            GUARD(s2n_ktls_send_control(conn, TLS_ALERT, &alert));
+        } else {
+            GUARD(s2n_record_write(conn, TLS_ALERT, &alert));
+        }
         GUARD(s2n_stuffer_rewrite(&conn->reader_alert_out));
-        conn->closing = 1;
+        s2n_connection_set_closing(conn);
 
         /* Actually write it ... */
         goto WRITE;
@@ -77,9 +90,13 @@ int s2n_flush(struct s2n_connection *conn, s2n_blocked_status * blocked)
         struct s2n_blob alert;
         alert.data = conn->writer_alert_out.blob.data;
         alert.size = 2;
-        GUARD(s2n_record_write(conn, TLS_ALERT, &alert));
+        if (conn->ktls_send_enabled) {
+            GUARD(s2n_ktls_send_control(conn, TLS_ALERT, &alert));
+        } else {
+            GUARD(s2n_record_write(conn, TLS_ALERT, &alert));
+        }
         GUARD(s2n_stuffer_rewrite(&conn->writer_alert_out));
-        conn->closing = 1;
+        s2n_connection_set_closing(conn);
 
         /* Actually write it ... */
         goto WRITE;
@@ -90,16 +107,53 @@ int s2n_flush(struct s2n_connection *conn, s2n_blocked_status * blocked)
     return 0;
 }
 
-ssize_t s2n_send(struct s2n_connection * conn, const void *buf, ssize_t size, s2n_blocked_status * blocked)
+/* Where the application data comes from: either the caller's buffers, or
+ * a range of a file when bufs is NULL.
+ */
+struct s2n_send_source {
+    const struct iovec *bufs;
+    int count;
+    int fd;
+    off_t offset;
+};
+
+/* Move a position in the caller's buffers past the buffers it skips over
+ * entirely, so each record starts copying from the buffer it needs.
+ */
+static void s2n_send_skip_bufs(const struct iovec **bufs, int *count, size_t *offs)
+{
+    while (*count && *offs >= (*bufs)->iov_len) {
+        *offs -= (*bufs)->iov_len;
+        (*bufs)++;
+        (*count)--;
+    }
+}
+
+static ssize_t s2n_send_from_source(struct s2n_connection * conn, const struct s2n_send_source * src, ssize_t size, s2n_blocked_status * blocked)
 {
     ssize_t user_data_sent;
     int max_payload_size;
 
-    S2N_ERROR_IF(conn->closed, S2N_ERR_CLOSED);
+    S2N_ERROR_IF(s2n_connection_is_closed(conn), S2N_ERR_CLOSED);
 
     /* Flush any pending I/O */
     GUARD(s2n_flush(conn, blocked));
 
+    /* The kernel does the record protection, so just hand it the data */
+    if (conn->ktls_send_enabled) {
+        ssize_t w;
+
+        /* A full socket fails with S2N_ERR_BLOCKED */
+        *blocked = S2N_BLOCKED_ON_WRITE;
+        if (src->bufs) {
+            GUARD((w = s2n_ktls_sendv(conn, src->bufs, src->count)));
+        } else {
+            GUARD((w = s2n_ktls_sendfile(conn, src->fd, src->offset, size)));
+        }
+        *blocked = (w < size) ? S2N_BLOCKED_ON_WRITE : S2N_NOT_BLOCKED;
+        return w;
+    }
+
     /* Acknowledge consumed and flushed user data as sent */
     user_data_sent = conn->current_user_data_consumed;
 
@@ -107,6 +161,20 @@ ssize_t s2n_send(struct s2n_connection * conn, const void *buf, ssize_t size, s2
 
     GUARD((max_payload_size = s2n_record_max_write_payload_size(conn)));
 
+    /* With dynamic record sizing, a burst of data that follows an idle period
+     * starts out with small records again.
+     */
+    int min_payload_size = max_payload_size;
+    if (conn->dynamic_record_resize_threshold) {
+        uint64_t elapsed;
+        GUARD(s2n_timer_reset(conn->config, &conn->write_timer, &elapsed));
+        if (elapsed > (uint64_t) conn->dynamic_record_timeout_threshold * ONE_S) {
+            conn->active_application_bytes_consumed = 0;
+        }
+
+        GUARD((min_payload_size = s2n_record_min_write_payload_size(conn)));
+    }
+
     /* TLS 1.0 and SSLv3 are vulnerable to the so-called Beast attack. Work
      * around this by splitting messages into one byte records, and then
      * the remainder can follow as usual.
@@ -121,25 +189,57 @@ ssize_t s2n_send(struct s2n_connection * conn, const void *buf, ssize_t size, s2
     /* Defensive check against an invalid retry */
     S2N_ERROR_IF(conn->current_user_data_consumed > size, S2N_ERR_SEND_SIZE);
 
+    /* Only connections with an enlarged send buffer batch several records into
+     * a single write. The default buffer holds exactly one record per flush.
+     */
+    int batch_records = conn->out.blob.size > S2N_LARGE_RECORD_LENGTH;
+    int max_record_size;
+    GUARD((max_record_size = s2n_record_max_write_size(conn)));
+
+    /* Where the next record's data starts in the caller's buffers. It's
+     * carried from record to record rather than found again from the first
+     * buffer each time.
+     */
+    const struct iovec *bufs = src->bufs;
+    int count = src->count;
+    size_t offs = conn->current_user_data_consumed;
+    s2n_send_skip_bufs(&bufs, &count, &offs);
+
     /* Now write the data we were asked to send this round */
     while (size - conn->current_user_data_consumed) {
-        struct s2n_blob in = {.data = ((uint8_t *)(uintptr_t) buf) + conn->current_user_data_consumed };
-        in.size = MIN(size - conn->current_user_data_consumed, max_payload_size);
-
-        /* Don't split messages in server mode for interoperability with naive clients.
-         * Some clients may have expectations based on the amount of content in the first record.
-         */
-        if (conn->actual_protocol_version < S2N_TLS11 && writer->cipher_suite->record_alg->cipher->type == S2N_CBC && conn->mode != S2N_SERVER) {
-            if (in.size > 1 && cbcHackUsed == 0) {
-                in.size = 1;
-                cbcHackUsed = 1;
+        GUARD(s2n_stuffer_rewrite(&conn->out));
+
+        do {
+            int payload_size = max_payload_size;
+            if (conn->active_application_bytes_consumed < conn->dynamic_record_resize_threshold) {
+                payload_size = min_payload_size;
             }
-        }
 
-        /* Write and encrypt the record */
-        GUARD(s2n_stuffer_rewrite(&conn->out));
-        GUARD(s2n_record_write(conn, TLS_APPLICATION_DATA, &in));
-        conn->current_user_data_consumed += in.size;
+            ssize_t to_write = MIN(size - conn->current_user_data_consumed, payload_size);
+
+            /* Don't split messages in server mode for interoperability with naive clients.
+             * Some clients may have expectations based on the amount of content in the first record.
+             */
+            if (conn->actual_protocol_version < S2N_TLS11 && writer->cipher_suite->record_alg->cipher->type == S2N_CBC && conn->mode != S2N_SERVER) {
+                if (to_write > 1 && cbcHackUsed == 0) {
+                    to_write = 1;
+                    cbcHackUsed = 1;
+                }
+            }
+
+            /* Write and encrypt the record, filling it from as many buffers as it takes */
+            int written;
+            if (src->bufs) {
+                GUARD((written = s2n_record_writev(conn, TLS_APPLICATION_DATA, bufs, count, offs, to_write)));
+                offs += written;
+                s2n_send_skip_bufs(&bufs, &count, &offs);
+            } else {
+                GUARD((written = s2n_record_write_fd(conn, TLS_APPLICATION_DATA, src->fd, src->offset + conn->current_user_data_consumed, to_write)));
+            }
+            conn->current_user_data_consumed += written;
+            conn->active_application_bytes_consumed += written;
+        } while (batch_records && (size - conn->current_user_data_consumed)
+                 && s2n_stuffer_space_remaining(&conn->out) >= max_record_size);
 
         /* Send it */
         if (s2n_flush(conn, blocked) < 0) {
@@ -165,3 +265,48 @@ ssize_t s2n_send(struct s2n_connection * conn, const void *buf, ssize_t size, s2
 
     return size;
 }
+
+ssize_t s2n_sendv(struct s2n_connection * conn, const struct iovec * bufs, int count, s2n_blocked_status * blocked)
+{
+    struct s2n_send_source src = {.bufs = bufs,.count = count };
+    ssize_t size = 0;
+
+    notnull_check(conn);
+    S2N_ERROR_IF(count < 0, S2N_ERR_SEND_SIZE);
+
+    /* A source with no buffers would otherwise be taken for a file. There's
+     * no data to write, but, as with a zero length s2n_send, anything
+     * already pending is flushed.
+     */
+    if (count == 0) {
+        S2N_ERROR_IF(s2n_connection_is_closed(conn), S2N_ERR_CLOSED);
+        GUARD(s2n_flush(conn, blocked));
+        return 0;
+    }
+    notnull_check(bufs);
+
+    for (int i = 0; i < count; i++) {
+        S2N_ERROR_IF(bufs[i].iov_len > SSIZE_MAX - size, S2N_ERR_SEND_SIZE);
+        size += bufs[i].iov_len;
+    }
+
+    return s2n_send_from_source(conn, &src, size, blocked);
+}
+
+ssize_t s2n_sendfile(struct s2n_connection * conn, int fd, off_t offset, size_t count, s2n_blocked_status * blocked)
+{
+    struct s2n_send_source src = {.bufs = NULL,.fd = fd,.offset = offset };
+
+    S2N_ERROR_IF(count > SSIZE_MAX, S2N_ERR_SEND_SIZE);
+    S2N_ERROR_IF(offset < 0, S2N_ERR_SEND_SIZE);
+
+    return s2n_send_from_source(conn, &src, count, blocked);
+}
+
+ssize_t s2n_send(struct s2n_connection * conn, const void *buf, ssize_t size, s2n_blocked_status * blocked)
+{
+    S2N_ERROR_IF(size < 0, S2N_ERR_SEND_SIZE);
+
+    struct iovec iov = {.iov_base = (void *)(uintptr_t) buf, .iov_len = size };
+    return s2n_sendv(conn, &iov, 1, blocked);
+}
@@ -37,7 +37,8 @@ int s2n_server_extensions_send(struct s2n_connection *conn, struct s2n_stuffer *
 {
     uint16_t total_size = 0;
 
-    uint8_t application_protocol_len = strlen(conn->application_protocol);
+    const char *application_protocol = s2n_get_application_protocol(conn);
+    uint8_t application_protocol_len = application_protocol ? strlen(application_protocol) : 0;
 
     if (application_protocol_len) {
         total_size += 7 + application_protocol_len;
@@ -96,7 +97,7 @@ int s2n_server_extensions_send(struct s2n_connection *conn, struct s2n_stuffer *
         GUARD(s2n_stuffer_write_uint16(out, application_protocol_len + 3));
         GUARD(s2n_stuffer_write_uint16(out, application_protocol_len + 1));
         GUARD(s2n_stuffer_write_uint8(out, application_protocol_len));
-        GUARD(s2n_stuffer_write_bytes(out, (uint8_t *) conn->application_protocol, application_protocol_len));
+        GUARD(s2n_stuffer_write_bytes(out, (const uint8_t *) application_protocol, application_protocol_len));
     }
 
     /* Write OCSP extension */
@@ -179,8 +180,7 @@ int s2n_recv_server_alpn(struct s2n_connection *conn, struct s2n_stuffer *extens
     notnull_check(protocol);
 
     /* copy the first protocol name */
-    memcpy_check(conn->application_protocol, protocol, protocol_len);
-    conn->application_protocol[protocol_len] = '\0';
+    GUARD(s2n_connection_store_application_protocol(conn, protocol, protocol_len));
 
     return 0;
 }
@@ -17,9 +17,11 @@
 
 #include "error/s2n_errno.h"
 
+#include "tls/s2n_async_pkey.h"
 #include "tls/s2n_tls_digest_preferences.h"
 #include "tls/s2n_cipher_suites.h"
 #include "tls/s2n_connection.h"
+#include "tls/s2n_key_pool.h"
 
 #include "stuffer/s2n_stuffer.h"
 
@@ -178,6 +180,8 @@ static int s2n_dhe_server_key_recv(struct s2n_connection *conn)
 
 int s2n_server_key_send(struct s2n_connection *conn)
 {
+    S2N_ASYNC_PKEY_GUARD(conn);
+
     if (conn->secure.cipher_suite->key_exchange_alg->flags & S2N_KEY_EXCHANGE_ECC) {
         GUARD(s2n_ecdhe_server_key_send(conn));
     } else {
@@ -187,71 +191,75 @@ int s2n_server_key_send(struct s2n_connection *conn)
     return 0;
 }
 
+static int s2n_server_key_send_write_signature(struct s2n_connection *conn, struct s2n_blob *signature)
+{
+    struct s2n_stuffer *out = &conn->handshake.io;
+
+    GUARD(s2n_stuffer_write_uint16(out, signature->size));
+    GUARD(s2n_stuffer_write(out, signature));
+
+    return 0;
+}
+
 static int s2n_ecdhe_server_key_send(struct s2n_connection *conn)
 {
-    struct s2n_blob signature;
     struct s2n_stuffer *out = &conn->handshake.io;
     struct s2n_blob ecdhparams;
 
-    /* Generate an ephemeral key and  */
-    GUARD(s2n_ecc_generate_ephemeral_key(&conn->secure.server_ecc_params));
+    /* Take an ephemeral key generated ahead of time, or generate one now */
+    if (conn->config->key_pool) {
+        GUARD(s2n_key_pool_take_ecc_key(conn->config->key_pool, &conn->secure.server_ecc_params));
+    }
+    if (conn->secure.server_ecc_params.ec_key == NULL) {
+        GUARD(s2n_ecc_generate_ephemeral_key(&conn->secure.server_ecc_params));
+    }
 
     /* Write it out and calculate the hash */
     GUARD(s2n_ecc_write_ecc_params(&conn->secure.server_ecc_params, out, &ecdhparams));
 
-    if (conn->actual_protocol_version == S2N_TLS12) {
-        GUARD(s2n_stuffer_write_uint8(out, s2n_hash_alg_to_tls[ conn->secure.conn_hash_alg ]));
-        GUARD(s2n_stuffer_write_uint8(out, TLS_SIGNATURE_ALGORITHM_RSA));
-    }
-
-    /* Add the random data to the hash */
+    /* Add the random data to the hash, before any more writes to out can move ecdhparams */
     GUARD(s2n_hash_init(&conn->secure.signature_hash, conn->secure.conn_hash_alg));
     GUARD(s2n_hash_update(&conn->secure.signature_hash, conn->secure.client_random, S2N_TLS_RANDOM_DATA_LEN));
     GUARD(s2n_hash_update(&conn->secure.signature_hash, conn->secure.server_random, S2N_TLS_RANDOM_DATA_LEN));
     GUARD(s2n_hash_update(&conn->secure.signature_hash, ecdhparams.data, ecdhparams.size));
 
-    signature.size = s2n_rsa_private_encrypted_size(&conn->config->cert_and_key_pairs->private_key.key.rsa_key);
-    GUARD(s2n_stuffer_write_uint16(out, signature.size));
-
-    signature.data = s2n_stuffer_raw_write(out, signature.size);
-    notnull_check(signature.data);
-
-    S2N_ERROR_IF(s2n_pkey_sign(&conn->config->cert_and_key_pairs->private_key, &conn->secure.signature_hash, &signature) < 0, S2N_ERR_DH_FAILED_SIGNING);
+    if (conn->actual_protocol_version == S2N_TLS12) {
+        GUARD(s2n_stuffer_write_uint8(out, s2n_hash_alg_to_tls[ conn->secure.conn_hash_alg ]));
+        GUARD(s2n_stuffer_write_uint8(out, TLS_SIGNATURE_ALGORITHM_RSA));
+    }
 
-    return 0;
+    return s2n_async_pkey_sign(conn, &conn->secure.signature_hash, s2n_server_key_send_write_signature);
 }
 
 static int s2n_dhe_server_key_send(struct s2n_connection *conn)
 {
-    struct s2n_blob serverDHparams, signature;
+    struct s2n_blob serverDHparams;
     struct s2n_stuffer *out = &conn->handshake.io;
 
-    /* Duplicate the DH key from the config */
-    GUARD(s2n_dh_params_copy(conn->config->dhparams, &conn->secure.server_dh_params));
-
-    /* Generate an ephemeral key */
-    GUARD(s2n_dh_generate_ephemeral_key(&conn->secure.server_dh_params));
+    /* Take an ephemeral key generated ahead of time, or duplicate the DH
+     * parameters from the config and generate one now
+     */
+    if (conn->config->key_pool) {
+        GUARD(s2n_key_pool_take_dh_key(conn->config->key_pool, &conn->secure.server_dh_params));
+    }
+    if (conn->secure.server_dh_params.dh == NULL) {
+        GUARD(s2n_dh_params_copy(conn->config->dhparams, &conn->secure.server_dh_params));
+        GUARD(s2n_dh_generate_ephemeral_key(&conn->secure.server_dh_params));
+    }
 
     /* Write it out */
     GUARD(s2n_dh_params_to_p_g_Ys(&conn->secure.server_dh_params, out, &serverDHparams));
 
-    if (conn->actual_protocol_version == S2N_TLS12) {
-        GUARD(s2n_stuffer_write_uint8(out, s2n_hash_alg_to_tls[ conn->secure.conn_hash_alg ]));
-        GUARD(s2n_stuffer_write_uint8(out, TLS_SIGNATURE_ALGORITHM_RSA));
-    }
-
+    /* Hash it while serverDHparams still points into out */
     GUARD(s2n_hash_init(&conn->secure.signature_hash, conn->secure.conn_hash_alg));
     GUARD(s2n_hash_update(&conn->secure.signature_hash, conn->secure.client_random, S2N_TLS_RANDOM_DATA_LEN));
     GUARD(s2n_hash_update(&conn->secure.signature_hash, conn->secure.server_random, S2N_TLS_RANDOM_DATA_LEN));
     GUARD(s2n_hash_update(&conn->secure.signature_hash, serverDHparams.data, serverDHparams.size));
 
-    signature.size = s2n_rsa_private_encrypted_size(&conn->config->cert_and_key_pairs->private_key.key.rsa_key);
-    GUARD(s2n_stuffer_write_uint16(out, signature.size));
-
-    signature.data = s2n_stuffer_raw_write(out, signature.size);
-    notnull_check(signature.data);
-
-    S2N_ERROR_IF(s2n_pkey_sign(&conn->config->cert_and_key_pairs->private_key, &conn->secure.signature_hash, &signature) < 0, S2N_ERR_DH_FAILED_SIGNING);
+    if (conn->actual_protocol_version == S2N_TLS12) {
+        GUARD(s2n_stuffer_write_uint8(out, s2n_hash_alg_to_tls[ conn->secure.conn_hash_alg ]));
+        GUARD(s2n_stuffer_write_uint8(out, TLS_SIGNATURE_ALGORITHM_RSA));
+    }
 
-    return 0;
+    return s2n_async_pkey_sign(conn, &conn->secure.signature_hash, s2n_server_key_send_write_signature);
 }
@@ -53,7 +53,7 @@ extern int s2n_client_finished_recv(struct s2n_connection *conn);
 extern int s2n_server_finished_send(struct s2n_connection *conn);
 extern int s2n_server_finished_recv(struct s2n_connection *conn);
 extern int s2n_handshake_write_header(struct s2n_connection *conn, uint8_t message_type);
-extern int s2n_handshake_finish_header(struct s2n_connection *conn);
+extern int s2n_handshake_finish_header(struct s2n_connection *conn, uint32_t message_start);
 extern int s2n_handshake_parse_header(struct s2n_connection *conn, uint8_t * message_type, uint32_t * length);
 extern int s2n_read_full_record(struct s2n_connection *conn, uint8_t * record_type, int *isSSLv2);
 extern int s2n_recv_close_notify(struct s2n_connection *conn, s2n_blocked_status * blocked);
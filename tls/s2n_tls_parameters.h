@@ -70,6 +70,7 @@
 #define TLS_SIGNATURE_ALGORITHM_DSA         2
 #define TLS_SIGNATURE_ALGORITHM_ECDSA       3
 
+#define TLS_HASH_ALGORITHM_NONE             0
 #define TLS_HASH_ALGORITHM_MD5              1
 #define TLS_HASH_ALGORITHM_SHA1             2
 #define TLS_HASH_ALGORITHM_SHA224           3
@@ -130,6 +131,9 @@
 #define S2N_LARGE_RECORD_LENGTH S2N_TLS_MAXIMUM_RECORD_LENGTH
 #define S2N_LARGE_FRAGMENT_LENGTH S2N_TLS_MAXIMUM_FRAGMENT_LENGTH
 
+/* Dynamic record sizing can keep records small for at most the first 8MB of a burst */
+#define S2N_TLS_MAX_RESIZE_THRESHOLD (1024 * 1024 * 8)
+
 /* Put a 64k cap on the size of any handshake message */
 #define S2N_MAXIMUM_HANDSHAKE_MESSAGE_LENGTH (64 * 1024)
 
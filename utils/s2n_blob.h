@@ -22,6 +22,10 @@ struct s2n_blob {
     uint32_t size;
     uint32_t allocated;
     unsigned int mlocked:1;
+    /* Carved out of a shared arena by s2n_slab_alloc */
+    unsigned int slab:1;
+    /* An s2n_mem_class, kept across reallocations */
+    unsigned int mem_class:2;
 };
 
 extern int s2n_blob_init(struct s2n_blob *b, uint8_t * data, uint32_t size);
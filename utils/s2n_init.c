@@ -15,6 +15,7 @@
 #include "crypto/s2n_fips.h"
 
 #include "tls/s2n_cipher_suites.h"
+#include "tls/s2n_connection_buffers.h"
 
 #include "utils/s2n_mem.h"
 #include "utils/s2n_random.h"
@@ -34,8 +35,10 @@ int s2n_cleanup(void)
 {
     GUARD(s2n_cipher_suites_cleanup());
     GUARD(s2n_rand_cleanup());
-    GUARD(s2n_mem_cleanup());
+    /* The static configs and pooled buffers hold memory that has to go back before the allocator is cleaned up */
     s2n_wipe_static_configs();
+    GUARD(s2n_connection_buffers_cleanup());
+    GUARD(s2n_mem_cleanup());
 
     return 0;
 }
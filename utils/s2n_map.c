@@ -72,7 +72,7 @@ static int s2n_map_embiggen(struct s2n_map *map, uint32_t capacity)
 
     S2N_ERROR_IF(map->immutable, S2N_ERR_MAP_IMMUTABLE);
 
-    GUARD(s2n_alloc(&mem, (capacity * sizeof(struct s2n_map_entry))));
+    GUARD(s2n_alloc_class(&mem, (capacity * sizeof(struct s2n_map_entry)), S2N_MEM_PUBLIC));
     GUARD(s2n_blob_zero(&mem));
 
     tmp.capacity = capacity;
@@ -90,9 +90,8 @@ static int s2n_map_embiggen(struct s2n_map *map, uint32_t capacity)
     }
 
     /* Free the old memory */
-    mem.data = (void *) map->table;
-    mem.size = map->capacity * sizeof(struct s2n_map_entry);
-    GUARD(s2n_free(&mem));
+    struct s2n_blob old = {.data = (void *) map->table,.size = map->capacity * sizeof(struct s2n_map_entry) };
+    GUARD(s2n_free(&old));
 
     /* Clone the temporary map */
     map->capacity = tmp.capacity;
@@ -189,7 +188,7 @@ int s2n_map_lookup(struct s2n_map *map, struct s2n_blob *key, struct s2n_blob *v
 
 int s2n_map_free(struct s2n_map *map)
 {
-    struct s2n_blob mem;
+    struct s2n_blob mem = {0};
 
     /* Free the keys and values */
     for (int i = 0; i < map->capacity; i++) {
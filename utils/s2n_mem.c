@@ -18,38 +18,180 @@
 #include <stdlib.h>
 #include <sys/mman.h>
 
+#include <s2n.h>
+
 #include "error/s2n_errno.h"
 
 #include "utils/s2n_blob.h"
 #include "utils/s2n_mem.h"
+#include "utils/s2n_slab.h"
 #include "utils/s2n_safety.h"
 
 static long page_size = 4096;
 static int use_mlock = 1;
+static s2n_mlock_policy mlock_policy = S2N_MLOCK_ALL;
+static int initialized = 0;
+
+/* s2n_cleanup is called by every thread that used s2n, but only the one
+ * that called s2n_init tears the allocator down.
+ */
+static __thread int initialized_by_this_thread = 0;
+static struct s2n_mem_stats mem_stats;
+
+#define S2N_MEM_STATS_ADD( field, n ) __atomic_fetch_add(&mem_stats.field, (n), __ATOMIC_RELAXED)
+
+static int s2n_mem_init_impl(void)
+{
+    return 0;
+}
+
+static int s2n_mem_cleanup_impl(void)
+{
+    return 0;
+}
+
+static int s2n_mem_malloc_impl(void **ptr, uint32_t requested, uint32_t *allocated)
+{
+    if (use_mlock && requested % page_size == 0) {
+        /* s2n asks for whole pages exactly when it needs page aligned memory to lock or madvise */
+        S2N_ERROR_IF(posix_memalign(ptr, page_size, requested), S2N_ERR_ALLOC);
+    } else {
+        *ptr = malloc(requested);
+        S2N_ERROR_IF(*ptr == NULL, S2N_ERR_ALLOC);
+    }
+
+    *allocated = requested;
+    return 0;
+}
+
+static int s2n_mem_free_impl(void *ptr, uint32_t size)
+{
+    free(ptr);
+    return 0;
+}
+
+static s2n_mem_init_callback s2n_mem_init_cb = s2n_mem_init_impl;
+static s2n_mem_cleanup_callback s2n_mem_cleanup_cb = s2n_mem_cleanup_impl;
+static s2n_mem_malloc_callback s2n_mem_malloc_cb = s2n_mem_malloc_impl;
+static s2n_mem_free_callback s2n_mem_free_cb = s2n_mem_free_impl;
+
+int s2n_mem_set_callbacks(s2n_mem_init_callback mem_init_callback, s2n_mem_cleanup_callback mem_cleanup_callback,
+                          s2n_mem_malloc_callback mem_malloc_callback, s2n_mem_free_callback mem_free_callback)
+{
+    S2N_ERROR_IF(initialized, S2N_ERR_INITIALIZED);
+    notnull_check(mem_init_callback);
+    notnull_check(mem_cleanup_callback);
+    notnull_check(mem_malloc_callback);
+    notnull_check(mem_free_callback);
+
+    s2n_mem_init_cb = mem_init_callback;
+    s2n_mem_cleanup_cb = mem_cleanup_callback;
+    s2n_mem_malloc_cb = mem_malloc_callback;
+    s2n_mem_free_cb = mem_free_callback;
+
+    return 0;
+}
+
+int s2n_mem_set_mlock_policy(s2n_mlock_policy policy)
+{
+    S2N_ERROR_IF(initialized, S2N_ERR_INITIALIZED);
+    S2N_ERROR_IF(policy != S2N_MLOCK_ALL && policy != S2N_MLOCK_SECRETS_ONLY && policy != S2N_MLOCK_NONE, S2N_ERR_INVALID_MLOCK_POLICY);
+
+    mlock_policy = policy;
+
+    return 0;
+}
 
 int s2n_mem_init(void)
 {
     GUARD(page_size = sysconf(_SC_PAGESIZE));
-    if (getenv("S2N_DONT_MLOCK")) {
+    if (getenv("S2N_DONT_MLOCK") || mlock_policy == S2N_MLOCK_NONE) {
         use_mlock = 0;
     }
 
+    GUARD(s2n_mem_init_cb());
+    initialized = 1;
+    initialized_by_this_thread = 1;
+
     return 0;
 }
 
 int s2n_mem_cleanup(void)
 {
+    GUARD(s2n_slab_cleanup());
+
+    /* Other threads may still be allocating through the callbacks */
+    if (!initialized_by_this_thread) {
+        return 0;
+    }
+
+    GUARD(s2n_mem_cleanup_cb());
+
     page_size = 4096;
     use_mlock = 1;
+    initialized = 0;
+    initialized_by_this_thread = 0;
+    return 0;
+}
+
+int s2n_mem_malloc_raw(void **ptr, uint32_t requested, uint32_t *allocated)
+{
+    *ptr = NULL;
+    GUARD(s2n_mem_malloc_cb(ptr, requested, allocated));
+    S2N_ERROR_IF(*ptr == NULL || *allocated < requested, S2N_ERR_ALLOC);
+
     return 0;
 }
 
+/* mlock, munlock and madvise work on whole pages, so memory that will be
+ * locked or kept out of core dumps must not share a page with anything else.
+ */
+int s2n_mem_malloc_pages(void **ptr, uint32_t requested, uint32_t *allocated)
+{
+    GUARD(s2n_mem_malloc_raw(ptr, requested, allocated));
+
+    if ((uintptr_t) *ptr % page_size) {
+        s2n_mem_free_cb(*ptr, *allocated);
+        *ptr = NULL;
+        S2N_ERROR(S2N_ERR_UNALIGNED_ALLOCATION);
+    }
+
+    return 0;
+}
+
+int s2n_mem_free_raw(void *ptr, uint32_t size)
+{
+    return s2n_mem_free_cb(ptr, size);
+}
+
+static int s2n_mem_class_locked(s2n_mem_class mem_class)
+{
+    if (!use_mlock) {
+        return 0;
+    }
+
+    return mlock_policy == S2N_MLOCK_ALL || mem_class == S2N_MEM_SECRET;
+}
+
+/* Plaintext stays out of core dumps even when it isn't locked */
+static int s2n_mem_class_dontdump(s2n_mem_class mem_class)
+{
+    return s2n_mem_class_locked(mem_class) || (use_mlock && mem_class == S2N_MEM_PLAINTEXT);
+}
+
 int s2n_alloc(struct s2n_blob *b, uint32_t size)
+{
+    return s2n_alloc_class(b, size, S2N_MEM_SECRET);
+}
+
+int s2n_alloc_class(struct s2n_blob *b, uint32_t size, s2n_mem_class mem_class)
 {
     b->data = NULL;
     b->size = 0;
     b->allocated = 0;
     b->mlocked = 0;
+    b->slab = 0;
+    b->mem_class = mem_class;
     GUARD(s2n_realloc(b, size));
     return 0;
 }
@@ -61,15 +203,49 @@ int s2n_realloc(struct s2n_blob *b, uint32_t size)
     }
 
     /* blob already has space for the request */
-    if (size < b->allocated) {
+    if (size <= b->allocated) {
         b->size = size;
         return 0;
     }
 
-    void *data;
-    if (!use_mlock) {
-        data = realloc(b->data, size);
-        S2N_ERROR_IF(!data, S2N_ERR_ALLOC);
+    int lock = s2n_mem_class_locked(b->mem_class);
+    int dontdump = s2n_mem_class_dontdump(b->mem_class);
+
+    /* Small blobs share arenas that are locked once, rather than locking a page each */
+    if (lock && size <= S2N_SLAB_MAX_SIZE) {
+        struct s2n_blob slab = {0};
+        GUARD(s2n_slab_alloc(&slab, size));
+
+        if (b->size) {
+            memcpy_check(slab.data, b->data, b->size);
+            S2N_MEM_STATS_ADD(reallocs, 1);
+            S2N_MEM_STATS_ADD(realloc_bytes_copied, b->size);
+            GUARD(s2n_free(b));
+        } else {
+            S2N_MEM_STATS_ADD(allocs, 1);
+        }
+
+        slab.mem_class = b->mem_class;
+        *b = slab;
+        return 0;
+    }
+
+    /* With nothing to lock or keep out of core dumps, and libc's allocator
+     * behind the callbacks, the blob can grow in place.
+     */
+    if (!dontdump && s2n_mem_malloc_cb == s2n_mem_malloc_impl) {
+        void *data = realloc(b->data, size);
+        S2N_ERROR_IF(data == NULL, S2N_ERR_ALLOC);
+
+        /* The old pointer can't be looked at once realloc() has returned, so
+         * the copy it may have made is always counted.
+         */
+        if (b->size) {
+            S2N_MEM_STATS_ADD(reallocs, 1);
+            S2N_MEM_STATS_ADD(realloc_bytes_copied, b->size);
+        } else {
+            S2N_MEM_STATS_ADD(allocs, 1);
+        }
 
         b->data = data;
         b->size = size;
@@ -77,18 +253,36 @@ int s2n_realloc(struct s2n_blob *b, uint32_t size)
         return 0;
     }
 
-    /* Page aligned allocation required for mlock */
-    uint32_t allocate = page_size * (((size - 1) / page_size) + 1);
-    S2N_ERROR_IF(posix_memalign(&data, page_size, allocate), S2N_ERR_ALLOC);
+    /* Whole pages are required for mlock and madvise */
+    uint32_t request = size;
+    if (dontdump) {
+        request = page_size * (((size - 1) / page_size) + 1);
+    }
+
+    void *data;
+    uint32_t allocated;
+    if (dontdump) {
+        GUARD(s2n_mem_malloc_pages(&data, request, &allocated));
+    } else {
+        GUARD(s2n_mem_malloc_raw(&data, request, &allocated));
+    }
 
     if (b->size) {
         memcpy_check(data, b->data, b->size);
+        S2N_MEM_STATS_ADD(reallocs, 1);
+        S2N_MEM_STATS_ADD(realloc_bytes_copied, b->size);
         GUARD(s2n_free(b));
+    } else {
+        S2N_MEM_STATS_ADD(allocs, 1);
     }
 
     b->data = data;
     b->size = size;
-    b->allocated = allocate;
+    b->allocated = allocated;
+
+    if (!dontdump) {
+        return 0;
+    }
 
 #ifdef MADV_DONTDUMP
     if (madvise(b->data, size, MADV_DONTDUMP) < 0) {
@@ -97,6 +291,10 @@ int s2n_realloc(struct s2n_blob *b, uint32_t size)
     }
 #endif
 
+    if (!lock) {
+        return 0;
+    }
+
     if (mlock(b->data, size) < 0) {
         GUARD(s2n_free(b));
         S2N_ERROR(S2N_ERR_MLOCK);
@@ -108,18 +306,37 @@ int s2n_realloc(struct s2n_blob *b, uint32_t size)
 
 int s2n_free(struct s2n_blob *b)
 {
+    if (b->data == NULL) {
+        b->size = 0;
+        b->allocated = 0;
+        b->mlocked = 0;
+        b->slab = 0;
+        return 0;
+    }
+
+    S2N_MEM_STATS_ADD(frees, 1);
+
+    /* A blob rebuilt from a bare pointer has nothing allocated, and doesn't
+     * know whether it came from a slab. Only a small one could have, so only
+     * those need looking up.
+     */
+    if (b->slab || (b->allocated == 0 && b->size <= S2N_SLAB_MAX_SIZE && s2n_slab_owns(b->data))) {
+        return s2n_slab_free(b);
+    }
+
     int munlock_rc = 0;
     if (b->mlocked) {
         munlock_rc = munlock(b->data, b->size);
     }
 
-    free(b->data);
+    int free_rc = s2n_mem_free_cb(b->data, b->size);
     b->data = NULL;
     b->size = 0;
     b->allocated = 0;
 
     S2N_ERROR_IF(munlock_rc < 0, S2N_ERR_MUNLOCK);
     b->mlocked = 0;
+    GUARD(free_rc);
 
     return 0;
 }
@@ -135,3 +352,15 @@ int s2n_dup(struct s2n_blob *from, struct s2n_blob *to)
 
     return 0;
 }
+
+int s2n_mem_get_stats(struct s2n_mem_stats *stats)
+{
+    notnull_check(stats);
+
+    stats->allocs = __atomic_load_n(&mem_stats.allocs, __ATOMIC_RELAXED);
+    stats->reallocs = __atomic_load_n(&mem_stats.reallocs, __ATOMIC_RELAXED);
+    stats->realloc_bytes_copied = __atomic_load_n(&mem_stats.realloc_bytes_copied, __ATOMIC_RELAXED);
+    stats->frees = __atomic_load_n(&mem_stats.frees, __ATOMIC_RELAXED);
+
+    return 0;
+}
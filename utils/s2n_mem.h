@@ -19,9 +19,36 @@
 
 #include <stdint.h>
 
+#include <s2n.h>
+
+/* How sensitive the contents of a blob are. Secrets are always locked when
+ * locking is on, while plaintext and public data are only locked under
+ * S2N_MLOCK_ALL. Plaintext is still kept out of core dumps when it isn't.
+ */
+typedef enum {
+    S2N_MEM_SECRET = 0,
+    S2N_MEM_PLAINTEXT,
+    S2N_MEM_PUBLIC,
+} s2n_mem_class;
+
+struct s2n_mem_stats {
+    /* Blobs given memory for the first time */
+    uint64_t allocs;
+    /* Blobs moved to a larger allocation, and the bytes copied doing so */
+    uint64_t reallocs;
+    uint64_t realloc_bytes_copied;
+    /* Allocations handed back, including the old memory of moved blobs */
+    uint64_t frees;
+};
+
 int s2n_mem_init(void);
 int s2n_mem_cleanup(void);
+int s2n_mem_malloc_raw(void **ptr, uint32_t requested, uint32_t *allocated);
+int s2n_mem_malloc_pages(void **ptr, uint32_t requested, uint32_t *allocated);
+int s2n_mem_free_raw(void *ptr, uint32_t size);
 int s2n_alloc(struct s2n_blob *b, uint32_t size);
+int s2n_alloc_class(struct s2n_blob *b, uint32_t size, s2n_mem_class mem_class);
 int s2n_realloc(struct s2n_blob *b, uint32_t size);
 int s2n_free(struct s2n_blob *b);
 int s2n_dup(struct s2n_blob *from, struct s2n_blob *to);
+int s2n_mem_get_stats(struct s2n_mem_stats *stats);
@@ -287,6 +287,22 @@ int s2n_rand_cleanup(void)
     return 0;
 }
 
+/* Wipe the calling thread's DRBGs. They are instantiated again if the thread
+ * asks for more random data.
+ */
+int s2n_rand_cleanup_thread(void)
+{
+    if (per_thread_private_drbg.ctx) {
+        GUARD(s2n_drbg_wipe(&per_thread_private_drbg));
+    }
+    if (per_thread_public_drbg.ctx) {
+        GUARD(s2n_drbg_wipe(&per_thread_public_drbg));
+    }
+    zero_if_forked = 0;
+
+    return 0;
+}
+
 int s2n_cpu_supports_rdrand()
 {
 #if ((defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || S2N_GCC_VERSION_AT_LEAST(4,3,0)))
@@ -0,0 +1,396 @@
+/*
+ * Copyright 2014 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+
+#include "error/s2n_errno.h"
+
+#include "utils/s2n_blob.h"
+#include "utils/s2n_mem.h"
+#include "utils/s2n_slab.h"
+#include "utils/s2n_safety.h"
+
+/* Every arena is S2N_SLAB_ARENA_SIZE bytes of page aligned memory from the
+ * allocator callbacks, and serves a single size class. The arena header lives
+ * in the first slab(s) of the arena.
+ *
+ * Each size class has its own lock, free list and arenas, so threads only
+ * contend when they allocate or free slabs of the same size.
+ *
+ * Blobs from s2n_slab_alloc are marked as slabs, and their allocated size
+ * names their class. Some objects are still freed through a blob rebuilt
+ * from a bare pointer, which doesn't say, so the arena owning a pointer, if
+ * any, can also be found in each class's sorted array of arena addresses.
+ */
+struct s2n_slab_arena {
+    struct s2n_slab_arena *next;
+    uint32_t class_index;
+    uint32_t in_use;
+};
+
+struct s2n_slab_free_slab {
+    struct s2n_slab_free_slab *next;
+};
+
+struct s2n_slab_class {
+    uint32_t size;
+    pthread_mutex_t lock;
+    struct s2n_slab_arena *arenas;
+    struct s2n_slab_free_slab *free_list;
+    struct s2n_slab_arena **arena_index;
+    uint32_t arena_index_capacity;
+    struct s2n_slab_stats stats;
+};
+
+static struct s2n_slab_class slab_classes[] = {
+    { .size = 32, .lock = PTHREAD_MUTEX_INITIALIZER },
+    { .size = 64, .lock = PTHREAD_MUTEX_INITIALIZER },
+    { .size = 128, .lock = PTHREAD_MUTEX_INITIALIZER },
+    { .size = 256, .lock = PTHREAD_MUTEX_INITIALIZER },
+    { .size = 512, .lock = PTHREAD_MUTEX_INITIALIZER },
+    { .size = 1024, .lock = PTHREAD_MUTEX_INITIALIZER },
+    { .size = S2N_SLAB_MAX_SIZE, .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+
+#define S2N_SLAB_CLASS_COUNT (sizeof(slab_classes) / sizeof(slab_classes[0]))
+
+static uint32_t s2n_slab_class_index(uint32_t size)
+{
+    uint32_t i = 0;
+    while (slab_classes[i].size < size) {
+        i++;
+    }
+    return i;
+}
+
+static uint32_t s2n_slab_header_size(struct s2n_slab_class *class)
+{
+    /* Round the header up to a whole number of slabs */
+    return class->size * (((sizeof(struct s2n_slab_arena) - 1) / class->size) + 1);
+}
+
+/* Returns the position of arena in the class's arena_index, or where it
+ * would be inserted. Must be called with the class's lock held.
+ */
+static uint32_t s2n_slab_index_search(struct s2n_slab_class *class, struct s2n_slab_arena *arena)
+{
+    uint32_t low = 0;
+    uint32_t high = class->stats.arenas;
+
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if ((uintptr_t) class->arena_index[mid] < (uintptr_t) arena) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/* Returns the arena of this class that data was carved out of, or NULL.
+ * Must be called with the class's lock held.
+ */
+static struct s2n_slab_arena *s2n_slab_arena_of(struct s2n_slab_class *class, void *data)
+{
+    uint32_t i = s2n_slab_index_search(class, (struct s2n_slab_arena *) data);
+
+    if (i < class->stats.arenas && class->arena_index[i] == data) {
+        return class->arena_index[i];
+    }
+    if (i == 0) {
+        return NULL;
+    }
+
+    struct s2n_slab_arena *arena = class->arena_index[i - 1];
+    if ((uintptr_t) data < (uintptr_t) arena + S2N_SLAB_ARENA_SIZE) {
+        return arena;
+    }
+
+    return NULL;
+}
+
+/* Find the class whose arenas data was carved out of, trying the class
+ * its allocated size names first. Returns with that class's lock held, or
+ * NULL with no lock held.
+ */
+static struct s2n_slab_class *s2n_slab_lock_owner(void *data, uint32_t allocated, struct s2n_slab_arena **arena)
+{
+    uint32_t first = s2n_slab_class_index(MIN(allocated, S2N_SLAB_MAX_SIZE));
+
+    for (uint32_t n = 0; n < S2N_SLAB_CLASS_COUNT; n++) {
+        struct s2n_slab_class *class = &slab_classes[(first + n) % S2N_SLAB_CLASS_COUNT];
+
+        pthread_mutex_lock(&class->lock);
+        if ((*arena = s2n_slab_arena_of(class, data)) != NULL) {
+            return class;
+        }
+        pthread_mutex_unlock(&class->lock);
+    }
+
+    return NULL;
+}
+
+/* Must be called with the class's lock held */
+static int s2n_slab_index_add(struct s2n_slab_class *class, struct s2n_slab_arena *arena)
+{
+    if (class->stats.arenas == class->arena_index_capacity) {
+        uint32_t capacity = class->arena_index_capacity ? class->arena_index_capacity * 2 : 16;
+        void *index;
+        uint32_t allocated;
+        GUARD(s2n_mem_malloc_raw(&index, capacity * sizeof(struct s2n_slab_arena *), &allocated));
+
+        if (class->arena_index) {
+            memcpy(index, class->arena_index, class->stats.arenas * sizeof(struct s2n_slab_arena *));
+            s2n_mem_free_raw(class->arena_index, class->arena_index_capacity * sizeof(struct s2n_slab_arena *));
+        }
+
+        class->arena_index = index;
+        class->arena_index_capacity = capacity;
+    }
+
+    uint32_t i = s2n_slab_index_search(class, arena);
+    memmove(&class->arena_index[i + 1], &class->arena_index[i], (class->stats.arenas - i) * sizeof(struct s2n_slab_arena *));
+    class->arena_index[i] = arena;
+
+    return 0;
+}
+
+/* Must be called with the class's lock held */
+static void s2n_slab_index_remove(struct s2n_slab_class *class, struct s2n_slab_arena *arena)
+{
+    uint32_t i = s2n_slab_index_search(class, arena);
+    memmove(&class->arena_index[i], &class->arena_index[i + 1], (class->stats.arenas - i - 1) * sizeof(struct s2n_slab_arena *));
+}
+
+/* Must be called with the class's lock held */
+static int s2n_slab_arena_new(uint32_t class_index)
+{
+    struct s2n_slab_class *class = &slab_classes[class_index];
+    void *data;
+    uint32_t allocated;
+
+    GUARD(s2n_mem_malloc_pages(&data, S2N_SLAB_ARENA_SIZE, &allocated));
+
+#ifdef MADV_DONTDUMP
+    if (madvise(data, S2N_SLAB_ARENA_SIZE, MADV_DONTDUMP) < 0) {
+        s2n_mem_free_raw(data, S2N_SLAB_ARENA_SIZE);
+        S2N_ERROR(S2N_ERR_MADVISE);
+    }
+#endif
+
+    if (mlock(data, S2N_SLAB_ARENA_SIZE) < 0) {
+        s2n_mem_free_raw(data, S2N_SLAB_ARENA_SIZE);
+        S2N_ERROR(S2N_ERR_MLOCK);
+    }
+
+    struct s2n_slab_arena *arena = data;
+    if (s2n_slab_index_add(class, arena) < 0) {
+        munlock(data, S2N_SLAB_ARENA_SIZE);
+        s2n_mem_free_raw(data, S2N_SLAB_ARENA_SIZE);
+        return -1;
+    }
+
+    arena->class_index = class_index;
+    arena->in_use = 0;
+    arena->next = class->arenas;
+    class->arenas = arena;
+
+    /* Push the slabs in reverse so that they're handed out in address order */
+    uint8_t *first = (uint8_t *) data + s2n_slab_header_size(class);
+    uint8_t *slab = (uint8_t *) data + S2N_SLAB_ARENA_SIZE - class->size;
+    for (; slab >= first; slab -= class->size) {
+        struct s2n_slab_free_slab *free_slab = (struct s2n_slab_free_slab *) slab;
+        free_slab->next = class->free_list;
+        class->free_list = free_slab;
+    }
+
+    class->stats.arenas++;
+    class->stats.arena_bytes += S2N_SLAB_ARENA_SIZE;
+
+    return 0;
+}
+
+/* Must be called with the class's lock held */
+static int s2n_slab_arena_free(struct s2n_slab_class *class, struct s2n_slab_arena *arena)
+{
+    s2n_slab_index_remove(class, arena);
+
+    int munlock_rc = munlock(arena, S2N_SLAB_ARENA_SIZE);
+    int free_rc = s2n_mem_free_raw(arena, S2N_SLAB_ARENA_SIZE);
+
+    class->stats.arenas--;
+    class->stats.arena_bytes -= S2N_SLAB_ARENA_SIZE;
+
+    S2N_ERROR_IF(munlock_rc < 0, S2N_ERR_MUNLOCK);
+    GUARD(free_rc);
+
+    return 0;
+}
+
+int s2n_slab_alloc(struct s2n_blob *b, uint32_t size)
+{
+    S2N_ERROR_IF(size == 0 || size > S2N_SLAB_MAX_SIZE, S2N_ERR_SAFETY);
+
+    uint32_t class_index = s2n_slab_class_index(size);
+    struct s2n_slab_class *class = &slab_classes[class_index];
+
+    pthread_mutex_lock(&class->lock);
+
+    if (class->free_list == NULL && s2n_slab_arena_new(class_index) < 0) {
+        pthread_mutex_unlock(&class->lock);
+        return -1;
+    }
+
+    struct s2n_slab_free_slab *slab = class->free_list;
+    class->free_list = slab->next;
+    s2n_slab_arena_of(class, slab)->in_use++;
+
+    class->stats.slabs_in_use++;
+    class->stats.slab_allocs++;
+
+    pthread_mutex_unlock(&class->lock);
+
+    /* Don't leak the free list pointer to the caller */
+    slab->next = NULL;
+
+    b->data = (uint8_t *) slab;
+    b->size = size;
+    b->allocated = class->size;
+    b->mlocked = 1;
+    b->slab = 1;
+
+    return 0;
+}
+
+int s2n_slab_owns(void *data)
+{
+    struct s2n_slab_arena *arena;
+
+    if (data == NULL) {
+        return 0;
+    }
+
+    struct s2n_slab_class *class = s2n_slab_lock_owner(data, 0, &arena);
+    if (class == NULL) {
+        return 0;
+    }
+    pthread_mutex_unlock(&class->lock);
+
+    return 1;
+}
+
+int s2n_slab_free(struct s2n_blob *b)
+{
+    struct s2n_slab_free_slab *slab = (struct s2n_slab_free_slab *) b->data;
+    struct s2n_slab_arena *arena;
+
+    struct s2n_slab_class *class = s2n_slab_lock_owner(b->data, b->allocated, &arena);
+    S2N_ERROR_IF(class == NULL, S2N_ERR_SAFETY);
+
+    /* Slabs stay mapped and get handed out again, so never keep old contents around */
+    memset(slab, 0, class->size);
+
+    slab->next = class->free_list;
+    class->free_list = slab;
+    arena->in_use--;
+
+    class->stats.slabs_in_use--;
+    class->stats.slab_frees++;
+
+    pthread_mutex_unlock(&class->lock);
+
+    b->data = NULL;
+    b->size = 0;
+    b->allocated = 0;
+    b->mlocked = 0;
+    b->slab = 0;
+
+    return 0;
+}
+
+int s2n_slab_cleanup(void)
+{
+    int rc = 0;
+
+    /* Arenas that still have slabs handed out are left alone; those slabs
+     * can still be freed later and their arenas released on the next cleanup.
+     */
+    for (uint32_t i = 0; i < S2N_SLAB_CLASS_COUNT; i++) {
+        struct s2n_slab_class *class = &slab_classes[i];
+
+        pthread_mutex_lock(&class->lock);
+
+        struct s2n_slab_free_slab **free_slab = &class->free_list;
+        while (*free_slab) {
+            if (s2n_slab_arena_of(class, *free_slab)->in_use == 0) {
+                *free_slab = (*free_slab)->next;
+            } else {
+                free_slab = &(*free_slab)->next;
+            }
+        }
+
+        struct s2n_slab_arena **arena = &class->arenas;
+        while (*arena) {
+            struct s2n_slab_arena *current = *arena;
+            if (current->in_use == 0) {
+                *arena = current->next;
+                if (s2n_slab_arena_free(class, current) < 0) {
+                    rc = -1;
+                }
+            } else {
+                arena = &current->next;
+            }
+        }
+
+        /* The index came from the allocator callbacks too, so it goes back with the last arena */
+        if (class->stats.arenas == 0 && class->arena_index) {
+            if (s2n_mem_free_raw(class->arena_index, class->arena_index_capacity * sizeof(struct s2n_slab_arena *)) < 0) {
+                rc = -1;
+            }
+            class->arena_index = NULL;
+            class->arena_index_capacity = 0;
+        }
+
+        pthread_mutex_unlock(&class->lock);
+    }
+
+    return rc;
+}
+
+int s2n_slab_get_stats(struct s2n_slab_stats *stats)
+{
+    notnull_check(stats);
+
+    memset_check(stats, 0, sizeof(*stats));
+    for (uint32_t i = 0; i < S2N_SLAB_CLASS_COUNT; i++) {
+        struct s2n_slab_class *class = &slab_classes[i];
+
+        pthread_mutex_lock(&class->lock);
+        stats->arenas += class->stats.arenas;
+        stats->arena_bytes += class->stats.arena_bytes;
+        stats->slabs_in_use += class->stats.slabs_in_use;
+        stats->slab_allocs += class->stats.slab_allocs;
+        stats->slab_frees += class->stats.slab_frees;
+        pthread_mutex_unlock(&class->lock);
+    }
+
+    return 0;
+}
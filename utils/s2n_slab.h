@@ -0,0 +1,43 @@
+/*
+ * Copyright 2014 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+
+#include "utils/s2n_blob.h"
+
+#include <stdint.h>
+
+/* Blobs up to this size are carved out of shared, already-locked arenas
+ * instead of getting a locked page of their own.
+ */
+#define S2N_SLAB_MAX_SIZE   2048
+#define S2N_SLAB_ARENA_SIZE (64 * 1024)
+
+struct s2n_slab_stats {
+    /* Arenas currently mapped, and the locked memory they hold */
+    uint32_t arenas;
+    uint64_t arena_bytes;
+    /* Slabs currently handed out */
+    uint64_t slabs_in_use;
+    /* Running totals */
+    uint64_t slab_allocs;
+    uint64_t slab_frees;
+};
+
+extern int s2n_slab_alloc(struct s2n_blob *b, uint32_t size);
+extern int s2n_slab_owns(void *data);
+extern int s2n_slab_free(struct s2n_blob *b);
+extern int s2n_slab_cleanup(void);
+extern int s2n_slab_get_stats(struct s2n_slab_stats *stats);